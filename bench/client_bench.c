@@ -0,0 +1,184 @@
+// file : client_bench.c
+// date : 2026-10-19
+// desc : cost of a client call with small params through pf_call and
+//        through pf_call_prepared, against a local server run in a child
+//        process. Each case makes -n calls, -r times, and prints the
+//        median wall time and client cpu time per call as one JSON line:
+//        the cpu time is where the request encoding shows.
+//
+//        usage: client_bench [-t tcp|unix] [-n calls] [-r reps]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "jsonrpc_server.h"
+#include "jsonrpc_client.h"
+
+#define BENCH_PORT 18933
+
+static bool     sg_b_unix = true;
+static int      sg_i_calls = 20000;
+static int      sg_i_reps = 5;
+static char     sg_psz_unix[64];
+
+static jsonrpc_prepared_t *sg_p_prep;
+
+static uint64_t clock_ns( clockid_t id )
+{
+    struct timespec ts;
+    clock_gettime( id, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void echo( struct json_object *p_params, struct json_object *p_response )
+{
+    json_object_object_add( p_response, "result", json_object_get( p_params ) );
+}
+
+static void serve( void )
+{
+    static jsonrpc_server_t server;
+    jsonrpc_server_init( &server );
+    int i_ret = sg_b_unix ?
+        jsonrpc_server_addListener( &server, AF_UNIX, sg_psz_unix ) :
+        jsonrpc_server_addListener( &server, AF_INET, "127.0.0.1",
+                                    BENCH_PORT );
+    if ( i_ret < 0 )
+        exit( 1 );
+    server.pf_register_function( &server, "echo", echo );
+    server.pf_serve( &server );
+    server.pf_exit( &server );
+}
+
+// [ i, "small", true ]
+static struct json_object *small_params( int i )
+{
+    struct json_object *p_params = json_object_new_array();
+    json_object_array_add( p_params, json_object_new_int( i ) );
+    json_object_array_add( p_params, json_object_new_string( "small" ) );
+    json_object_array_add( p_params, json_object_new_boolean( 1 ) );
+    return p_params;
+}
+
+// failed calls
+static int run( jsonrpc_client_t *p_client, bool b_prepared )
+{
+    int i_errors = 0;
+    for ( int i = 0; i < sg_i_calls; i++ )
+    {
+        struct json_object *p_res = b_prepared ?
+            p_client->pf_call_prepared( p_client, sg_p_prep,
+                                        small_params( i ) ) :
+            p_client->pf_call( p_client, "echo", small_params( i ) );
+        if ( !json_object_object_get( p_res, "result" ) )
+            i_errors++;
+        json_object_put( p_res );
+    }
+    return i_errors;
+}
+
+static int cmp_double( const void *a, const void *b )
+{
+    double f_a = *(const double*)a, f_b = *(const double*)b;
+    return f_a < f_b ? -1 : f_a > f_b;
+}
+
+static int usage( const char *psz_name )
+{
+    fprintf( stderr, "usage: %s [-t tcp|unix] [-n calls] [-r reps]\n",
+             psz_name );
+    return 1;
+}
+
+int main( int argc, char **argv )
+{
+    int i_opt;
+    while ( ( i_opt = getopt( argc, argv, "t:n:r:" ) ) != -1 )
+    {
+        switch ( i_opt )
+        {
+        case 't': sg_b_unix = strcmp( optarg, "tcp" ) != 0; break;
+        case 'n': sg_i_calls = atoi( optarg ); break;
+        case 'r': sg_i_reps = atoi( optarg ); break;
+        default:
+            return usage( argv[0] );
+        }
+    }
+    if ( sg_i_calls < 1 || sg_i_reps < 1 )
+        return usage( argv[0] );
+    snprintf( sg_psz_unix, sizeof(sg_psz_unix), "/tmp/client_bench.%d",
+              (int)getpid() );
+
+    pid_t pid = fork();
+    if ( pid == 0 )
+    {
+        serve();
+        return 0;
+    }
+
+    jsonrpc_client_t client;
+    int i_ret = -1;
+    for ( int i = 0; i < 50 && i_ret < 0; i++ )
+    {
+        usleep( 20000 );
+        i_ret = sg_b_unix ?
+            jsonrpc_client_init( &client, AF_UNIX, sg_psz_unix ) :
+            jsonrpc_client_init( &client, AF_INET, "127.0.0.1", BENCH_PORT );
+    }
+    sg_p_prep = jsonrpc_client_Prepare( "echo" );
+    if ( i_ret < 0 || !sg_p_prep )
+    {
+        kill( pid, SIGINT );
+        return 1;
+    }
+
+    // the reps of both cases take turns, a drift of the machine hits both
+    double *pf_wall = malloc( 2 * sg_i_reps * sizeof(double) );
+    double *pf_cpu = malloc( 2 * sg_i_reps * sizeof(double) );
+    int pi_errors[2] = { 0, 0 };
+    run( &client, false );
+    run( &client, true );
+    for ( int r = 0; r < sg_i_reps; r++ )
+        for ( int k = 0; k < 2; k++ )
+        {
+            uint64_t i_wall = clock_ns( CLOCK_MONOTONIC );
+            uint64_t i_cpu = clock_ns( CLOCK_THREAD_CPUTIME_ID );
+            pi_errors[k] += run( &client, k == 1 );
+            pf_cpu[k * sg_i_reps + r] =
+                (double)( clock_ns( CLOCK_THREAD_CPUTIME_ID ) - i_cpu ) /
+                sg_i_calls;
+            pf_wall[k * sg_i_reps + r] =
+                (double)( clock_ns( CLOCK_MONOTONIC ) - i_wall ) /
+                sg_i_calls;
+        }
+
+    const char *ppsz_name[] = { "call_small", "call_prepared_small" };
+    for ( int k = 0; k < 2; k++ )
+    {
+        double *pf_w = pf_wall + k * sg_i_reps;
+        double *pf_c = pf_cpu + k * sg_i_reps;
+        qsort( pf_w, sg_i_reps, sizeof(double), cmp_double );
+        qsort( pf_c, sg_i_reps, sizeof(double), cmp_double );
+        printf( "{ \"name\": \"%s\", \"transport\": \"%s\", \"calls\": %d, "
+                "\"reps\": %d, \"ns_per_call\": %.0f, "
+                "\"cpu_ns_per_call\": %.0f, \"errors\": %d }\n",
+                ppsz_name[k], sg_b_unix ? "unix" : "tcp", sg_i_calls,
+                sg_i_reps, pf_w[ sg_i_reps / 2 ], pf_c[ sg_i_reps / 2 ],
+                pi_errors[k] );
+    }
+    free( pf_wall );
+    free( pf_cpu );
+
+    jsonrpc_client_Unprepare( sg_p_prep );
+    client.pf_exit( &client );
+    kill( pid, SIGINT );
+    waitpid( pid, NULL, 0 );
+    unlink( sg_psz_unix );
+    return 0;
+}
@@ -0,0 +1,713 @@
+// file : jsonrpc_bench.c
+// date : 2026-10-19
+// desc : load generator against a local server, run in a child process.
+//        Closed loop: i_conns clients each wait for a response before the
+//        next call. Open loop: calls are due at a fixed total rate spread
+//        over the connections and their latency counts from when they were
+//        due, so a stalled server is not hidden by clients waiting on it.
+//        Transports: tcp, unix, ws (websocket server) and notify (one
+//        publisher calling a handler that notifies i_conns subscribers, the
+//        latency is from publish to delivery). The result is one JSON
+//        object on stdout.
+//
+//        usage: jsonrpc_bench [-t tcp|unix|ws|notify] [-m closed|open]
+//                             [-c conns] [-r calls/s] [-d seconds]
+//                             [-s payload bytes] [-u handler us]
+//                             [-b epoll|uring]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "jsonrpc_server.h"
+#include "jsonrpc_utils.h"
+
+#define BENCH_PORT      18932
+#define BENCH_SERVICE   "bench"
+#define RING_SIZE       65536           // open loop calls in flight per conn
+#define RECV_TIMEOUT    2               // s, then the missing ones are lost
+
+enum { T_TCP, T_UNIX, T_WS, T_NOTIFY };
+enum { FRAME_ZERO, FRAME_WS, FRAME_NOTIFY };
+
+static const char *sg_ppsz_transport[] = { "tcp", "unix", "ws", "notify" };
+
+static int      sg_i_transport = T_TCP;
+static bool     sg_b_open = false;
+static int      sg_i_conns = 16;
+static double   sg_f_rate = 10000;
+static double   sg_f_duration = 5;
+static int      sg_i_payload = 64;
+static int      sg_i_handler_us = 0;
+static int      sg_i_backend = JSONRPC_BACKEND_EPOLL;
+static char     sg_psz_unix[64];
+
+static jsonrpc_server_t *sg_p_server;
+
+/*
+ * server, in the child process
+ */
+static void spin( void )
+{
+    if ( sg_i_handler_us <= 0 )
+        return;
+    uint64_t i_end = jsonrpc_mdate() + sg_i_handler_us;
+    while ( jsonrpc_mdate() < i_end )
+        ;
+}
+
+static void work( struct json_object *p_params, struct json_object *p_response )
+{
+    spin();
+    json_object_object_add( p_response, "result", json_object_get( p_params ) );
+}
+
+// params: [ "<due time, us>", "<payload>" ], notified as { "t": .., "data": .. }
+static void publish( struct json_object *p_params,
+                     struct json_object *p_response )
+{
+    spin();
+    struct json_object *p_notify = json_object_new_object();
+    json_object_object_add( p_notify, "t",
+        json_object_get( json_object_array_get_idx( p_params, 0 ) ) );
+    json_object_object_add( p_notify, "data",
+        json_object_get( json_object_array_get_idx( p_params, 1 ) ) );
+    sg_p_server->pf_notify_dispatch( sg_p_server, BENCH_SERVICE, p_notify );
+    json_object_put( p_notify );
+    json_object_object_add( p_response, "result", json_object_new_int( 0 ) );
+}
+
+static void serve( void )
+{
+    static jsonrpc_server_t server;
+    static ws_jsonrpc_server_t ws_server;
+    jsonrpc_server_t *p_server = &server;
+    if ( sg_i_transport == T_WS )
+    {
+        ws_jsonrpc_server_init( &ws_server );
+        p_server = (jsonrpc_server_t *)&ws_server;
+    }
+    else
+        jsonrpc_server_init( p_server );
+    sg_p_server = p_server;
+    p_server->i_backend = sg_i_backend;
+
+    int i_ret;
+    if ( sg_i_transport == T_UNIX )
+        i_ret = jsonrpc_server_addListener( p_server, AF_UNIX, sg_psz_unix );
+    else
+        i_ret = jsonrpc_server_addListener( p_server, AF_INET, "127.0.0.1",
+                                            BENCH_PORT );
+    if ( i_ret < 0 )
+        exit( 1 );
+    const char *ppsz_service[] = { BENCH_SERVICE };
+    p_server->pf_register_notify_services( p_server, ppsz_service, 1 );
+    p_server->pf_register_function( p_server, "work", work );
+    p_server->pf_register_function( p_server, "publish", publish );
+    p_server->pf_serve( p_server );
+    p_server->pf_exit( p_server );
+}
+
+/*
+ * clients
+ */
+typedef struct reader_t
+{
+    int      fd;
+    int      i_frame;                       // FRAME_*
+    uint8_t *p_buf;
+    size_t   i_buf;
+    size_t   i_pos;
+    size_t   i_max;
+} reader_t;
+
+// bytes of the complete message at p_data, 0 if not complete yet
+static size_t frame_len( int i_frame, const uint8_t *p_data, size_t i_data )
+{
+    if ( i_frame == FRAME_ZERO )
+    {
+        const uint8_t *p_end = memchr( p_data, '\0', i_data );
+        return p_end ? p_end - p_data + 1 : 0;
+    }
+    if ( i_frame == FRAME_NOTIFY )
+    {
+        uint32_t i_len;
+        if ( i_data < 5 )
+            return 0;
+        memcpy( &i_len, p_data + 1, 4 );
+        i_len = ntohl( i_len );
+        return i_data >= 5 + i_len ? 5 + i_len : 0;
+    }
+    // server frames are not masked
+    if ( i_data < 2 )
+        return 0;
+    uint64_t i_len = p_data[1] & 0x7f;
+    size_t i_header = 2;
+    if ( i_len == 126 )
+    {
+        if ( i_data < 4 )
+            return 0;
+        i_len = ( p_data[2] << 8 ) | p_data[3];
+        i_header = 4;
+    }
+    else if ( i_len == 127 )
+    {
+        if ( i_data < 10 )
+            return 0;
+        i_len = 0;
+        for ( int i = 0; i < 8; i++ )
+            i_len = ( i_len << 8 ) | p_data[2 + i];
+        i_header = 10;
+    }
+    return i_data >= i_header + i_len ? i_header + i_len : 0;
+}
+
+// next message, -1 on timeout or close
+static int read_msg( reader_t *p_reader, const uint8_t **pp_msg,
+                     size_t *pi_msg )
+{
+    while ( true )
+    {
+        size_t i_len = frame_len( p_reader->i_frame,
+                                  p_reader->p_buf + p_reader->i_pos,
+                                  p_reader->i_buf - p_reader->i_pos );
+        if ( i_len > 0 )
+        {
+            *pp_msg = p_reader->p_buf + p_reader->i_pos;
+            *pi_msg = i_len;
+            p_reader->i_pos += i_len;
+            return 0;
+        }
+        if ( p_reader->i_pos > 0 )
+        {
+            memmove( p_reader->p_buf, p_reader->p_buf + p_reader->i_pos,
+                     p_reader->i_buf - p_reader->i_pos );
+            p_reader->i_buf -= p_reader->i_pos;
+            p_reader->i_pos = 0;
+        }
+        if ( p_reader->i_max - p_reader->i_buf < 65536 )
+        {
+            p_reader->i_max = p_reader->i_max * 2 + 65536;
+            p_reader->p_buf = realloc( p_reader->p_buf, p_reader->i_max );
+            if ( !p_reader->p_buf )
+                abort();
+        }
+        ssize_t i_read = recv( p_reader->fd, p_reader->p_buf + p_reader->i_buf,
+                               p_reader->i_max - p_reader->i_buf, 0 );
+        if ( i_read <= 0 )
+        {
+            if ( i_read < 0 && errno == EINTR )
+                continue;
+            return -1;
+        }
+        p_reader->i_buf += i_read;
+    }
+}
+
+static bool response_failed( const uint8_t *p_msg, size_t i_msg )
+{
+    // the error member comes right after the id and version
+    char head[96];
+    size_t i_head = i_msg < sizeof(head) - 1 ? i_msg : sizeof(head) - 1;
+    memcpy( head, p_msg, i_head );
+    head[i_head] = '\0';
+    for ( size_t i = 0; i < i_head; i++ )
+        if ( !head[i] )
+            head[i] = ' ';
+    return strstr( head, "\"error\"" ) != NULL;
+}
+
+static int send_all( int fd, const void *p_data, size_t i_data )
+{
+    const uint8_t *p = p_data;
+    while ( i_data > 0 )
+    {
+        ssize_t i_ret = send( fd, p, i_data, MSG_NOSIGNAL );
+        if ( i_ret < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+        p += i_ret;
+        i_data -= i_ret;
+    }
+    return 0;
+}
+
+static int bench_connect( reader_t *p_reader, bool b_subscribe )
+{
+    int fd;
+    for ( int i = 0; i < 200; i++ )
+    {
+        if ( sg_i_transport == T_UNIX )
+        {
+            struct sockaddr_un addr;
+            memset( &addr, 0, sizeof(addr) );
+            addr.sun_family = AF_UNIX;
+            strcpy( addr.sun_path, sg_psz_unix );
+            fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+            if ( connect( fd, (struct sockaddr*)&addr, sizeof(addr) ) == 0 )
+                break;
+        }
+        else
+        {
+            struct sockaddr_in addr;
+            memset( &addr, 0, sizeof(addr) );
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons( BENCH_PORT );
+            addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+            fd = socket( AF_INET, SOCK_STREAM, 0 );
+            if ( connect( fd, (struct sockaddr*)&addr, sizeof(addr) ) == 0 )
+            {
+                int i_one = 1;
+                setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &i_one,
+                            sizeof(i_one) );
+                break;
+            }
+        }
+        close( fd );
+        fd = -1;
+        usleep( 10000 );
+    }
+    if ( fd < 0 )
+        return -1;
+    struct timeval tv = { RECV_TIMEOUT, 0 };
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+
+    memset( p_reader, 0, sizeof(*p_reader) );
+    p_reader->fd = fd;
+    const char *psz_end;
+    if ( sg_i_transport == T_WS )
+    {
+        static const char psz_get[] =
+            "GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Protocol: json\r\nSec-WebSocket-Version: 13\r\n\r\n";
+        send_all( fd, psz_get, strlen( psz_get ) );
+        psz_end = "\r\n\r\n";
+    }
+    else
+    {
+        static const char psz_rpc[] = "{ \"protocol\": \"rpc\" }";
+        static const char psz_notify[] =
+            "{ \"protocol\": \"notify\", \"notifyServiceNames\": [ \""
+            BENCH_SERVICE "\" ] }";
+        if ( b_subscribe )
+            send_all( fd, psz_notify, sizeof(psz_notify) );
+        else
+            send_all( fd, psz_rpc, sizeof(psz_rpc) );
+        psz_end = "\r\n";
+    }
+    // the handshake answer is all there is before the first call
+    char buf[1024];
+    size_t i_buf = 0;
+    while ( i_buf < sizeof(buf) - 1 )
+    {
+        ssize_t i_read = recv( fd, buf + i_buf, sizeof(buf) - 1 - i_buf, 0 );
+        if ( i_read <= 0 )
+            break;
+        i_buf += i_read;
+        buf[i_buf] = '\0';
+        if ( strstr( buf, psz_end ) )
+        {
+            p_reader->i_frame = sg_i_transport == T_WS ? FRAME_WS :
+                                b_subscribe ? FRAME_NOTIFY : FRAME_ZERO;
+            return 0;
+        }
+    }
+    fprintf( stderr, "handshake failed\n" );
+    close( fd );
+    return -1;
+}
+
+// the call as sent, ws frames masked with a fixed key
+static uint8_t *make_call( const char *psz_method, size_t *pi_call )
+{
+    char *psz_payload = malloc( sg_i_payload + 1 );
+    memset( psz_payload, 'x', sg_i_payload );
+    psz_payload[sg_i_payload] = '\0';
+    size_t i_json = sg_i_payload + 128;
+    char *psz_json = malloc( i_json );
+    // the due time goes over the zeroes of a publish call
+    if ( sg_i_transport == T_NOTIFY )
+        snprintf( psz_json, i_json, "{ \"jsonrpc\": \"2.0\", \"method\": "
+                  "\"%s\", \"params\": [ \"%020d\", \"%s\" ], \"id\": 1 }",
+                  psz_method, 0, psz_payload );
+    else
+        snprintf( psz_json, i_json, "{ \"jsonrpc\": \"2.0\", \"method\": "
+                  "\"%s\", \"params\": [ \"%s\" ], \"id\": 1 }",
+                  psz_method, psz_payload );
+    free( psz_payload );
+    size_t i_len = strlen( psz_json );
+    if ( sg_i_transport != T_WS )
+    {
+        *pi_call = i_len + 1;
+        return (uint8_t*)psz_json;
+    }
+
+    uint8_t *p_frame = malloc( i_len + 14 );
+    size_t i_header = 2;
+    p_frame[0] = 0x81;
+    if ( i_len < 126 )
+        p_frame[1] = 0x80 | i_len;
+    else if ( i_len < 65536 )
+    {
+        p_frame[1] = 0x80 | 126;
+        p_frame[2] = i_len >> 8;
+        p_frame[3] = i_len & 0xff;
+        i_header = 4;
+    }
+    else
+    {
+        p_frame[1] = 0x80 | 127;
+        for ( int i = 0; i < 8; i++ )
+            p_frame[2 + i] = ( (uint64_t)i_len >> ( 56 - 8 * i ) ) & 0xff;
+        i_header = 10;
+    }
+    static const uint8_t p_mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    memcpy( p_frame + i_header, p_mask, 4 );
+    for ( size_t i = 0; i < i_len; i++ )
+        p_frame[i_header + 4 + i] = psz_json[i] ^ p_mask[i & 3];
+    free( psz_json );
+    *pi_call = i_header + 4 + i_len;
+    return p_frame;
+}
+
+static void stamp( uint8_t *p_call, size_t i_call, uint64_t i_due )
+{
+    // the 20 digits after "params": [ "
+    uint8_t *p = memmem( p_call, i_call, "[ \"", 3 );
+    char digits[21];
+    snprintf( digits, sizeof(digits), "%020llu", (unsigned long long)i_due );
+    memcpy( p + 3, digits, 20 );
+}
+
+typedef struct samples_t
+{
+    uint64_t *p_lat;                        // us
+    size_t    i_lat;
+    size_t    i_max;
+    uint64_t  i_errors;
+} samples_t;
+
+static void sample_add( samples_t *p_samples, uint64_t i_lat )
+{
+    if ( p_samples->i_lat == p_samples->i_max )
+    {
+        p_samples->i_max = p_samples->i_max * 2 + 4096;
+        p_samples->p_lat = realloc( p_samples->p_lat,
+                                    p_samples->i_max * sizeof(uint64_t) );
+        if ( !p_samples->p_lat )
+            abort();
+    }
+    p_samples->p_lat[ p_samples->i_lat++ ] = i_lat;
+}
+
+typedef struct conn_t
+{
+    reader_t  reader;
+    uint8_t  *p_call;
+    size_t    i_call;
+    uint64_t  i_start;
+    uint64_t  i_end;
+    uint64_t  i_interval;                   // us between due times, open
+    uint64_t  i_offset;                     // first due time after i_start
+    // open loop: due times of the calls in flight, answered in order
+    uint64_t *p_ring;
+    volatile uint64_t i_head;
+    volatile uint64_t i_tail;
+    volatile bool b_sent;
+    samples_t samples;                      // of its calls, or deliveries
+} conn_t;
+
+static void sleep_until( uint64_t i_date )
+{
+    uint64_t i_now = jsonrpc_mdate();
+    if ( i_date > i_now + 50 )
+        usleep( i_date - i_now - 50 );
+    while ( jsonrpc_mdate() < i_date )
+        ;
+}
+
+static void *closed_loop( void *p_arg )
+{
+    conn_t *p_conn = p_arg;
+    const uint8_t *p_msg;
+    size_t i_msg;
+    while ( jsonrpc_mdate() < p_conn->i_end )
+    {
+        uint64_t i_sent = jsonrpc_mdate();
+        if ( sg_i_transport == T_NOTIFY )
+            stamp( p_conn->p_call, p_conn->i_call, i_sent );
+        if ( send_all( p_conn->reader.fd, p_conn->p_call, p_conn->i_call ) ||
+             read_msg( &p_conn->reader, &p_msg, &i_msg ) )
+        {
+            p_conn->samples.i_errors++;
+            break;
+        }
+        if ( response_failed( p_msg, i_msg ) )
+            p_conn->samples.i_errors++;
+        // a publisher's deliveries are timed by the subscribers
+        else if ( sg_i_transport != T_NOTIFY )
+            sample_add( &p_conn->samples, jsonrpc_mdate() - i_sent );
+    }
+    return NULL;
+}
+
+static void *open_sender( void *p_arg )
+{
+    conn_t *p_conn = p_arg;
+    for ( uint64_t i_due = p_conn->i_start + p_conn->i_offset;
+          i_due < p_conn->i_end; i_due += p_conn->i_interval )
+    {
+        while ( p_conn->i_tail - p_conn->i_head == RING_SIZE )
+            usleep( 100 );
+        sleep_until( i_due );
+        if ( sg_i_transport == T_NOTIFY )
+            stamp( p_conn->p_call, p_conn->i_call, i_due );
+        p_conn->p_ring[ p_conn->i_tail % RING_SIZE ] = i_due;
+        __atomic_store_n( &p_conn->i_tail, p_conn->i_tail + 1,
+                          __ATOMIC_RELEASE );
+        if ( send_all( p_conn->reader.fd, p_conn->p_call, p_conn->i_call ) )
+            break;
+    }
+    __atomic_store_n( &p_conn->b_sent, true, __ATOMIC_RELEASE );
+    return NULL;
+}
+
+static void *open_receiver( void *p_arg )
+{
+    conn_t *p_conn = p_arg;
+    const uint8_t *p_msg;
+    size_t i_msg;
+    while ( true )
+    {
+        // a response always has its due time pushed before the call is
+        // sent, b_sent is read first so no last call is missed
+        bool b_sent = __atomic_load_n( &p_conn->b_sent, __ATOMIC_ACQUIRE );
+        if ( p_conn->i_head == __atomic_load_n( &p_conn->i_tail,
+                                                __ATOMIC_ACQUIRE ) )
+        {
+            if ( b_sent )
+                break;
+            struct pollfd pfd = { p_conn->reader.fd, POLLIN, 0 };
+            poll( &pfd, 1, 10 );
+            continue;
+        }
+        if ( read_msg( &p_conn->reader, &p_msg, &i_msg ) )
+            break;
+        uint64_t i_due = p_conn->p_ring[ p_conn->i_head % RING_SIZE ];
+        p_conn->i_head++;
+        if ( response_failed( p_msg, i_msg ) )
+            p_conn->samples.i_errors++;
+        else if ( sg_i_transport != T_NOTIFY )
+            sample_add( &p_conn->samples, jsonrpc_mdate() - i_due );
+    }
+    // the rest never came back
+    p_conn->samples.i_errors += p_conn->i_tail - p_conn->i_head;
+    return NULL;
+}
+
+// a subscriber times each notification from its "t" (due or sent time)
+static void *subscriber( void *p_arg )
+{
+    conn_t *p_conn = p_arg;
+    const uint8_t *p_msg;
+    size_t i_msg;
+    while ( read_msg( &p_conn->reader, &p_msg, &i_msg ) == 0 )
+    {
+        const uint8_t *p_t = memmem( p_msg, i_msg, "\"t\"", 3 );
+        const uint8_t *p_digits = p_t ? memchr( p_t + 3, '"',
+                                                i_msg - ( p_t + 3 - p_msg ) )
+                                      : NULL;
+        if ( !p_digits )
+        {
+            p_conn->samples.i_errors++;
+            continue;
+        }
+        uint64_t i_t = strtoull( (const char*)p_digits + 1, NULL, 10 );
+        sample_add( &p_conn->samples, jsonrpc_mdate() - i_t );
+    }
+    return NULL;
+}
+
+static int cmp_u64( const void *a, const void *b )
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile( const samples_t *p_all, double f_q )
+{
+    if ( p_all->i_lat == 0 )
+        return 0;
+    size_t i = (size_t)( f_q * p_all->i_lat );
+    return p_all->p_lat[ i < p_all->i_lat ? i : p_all->i_lat - 1 ];
+}
+
+static int usage( const char *psz_name )
+{
+    fprintf( stderr, "usage: %s [-t tcp|unix|ws|notify] [-m closed|open] "
+             "[-c conns] [-r calls/s] [-d seconds] [-s payload bytes] "
+             "[-u handler us] [-b epoll|uring]\n", psz_name );
+    return 1;
+}
+
+int main( int argc, char **argv )
+{
+    int i_opt;
+    while ( ( i_opt = getopt( argc, argv, "t:m:c:r:d:s:u:b:" ) ) != -1 )
+    {
+        switch ( i_opt )
+        {
+        case 't':
+            sg_i_transport = -1;
+            for ( int i = 0; i < 4; i++ )
+                if ( !strcmp( optarg, sg_ppsz_transport[i] ) )
+                    sg_i_transport = i;
+            if ( sg_i_transport < 0 )
+                return usage( argv[0] );
+            break;
+        case 'm':
+            sg_b_open = !strcmp( optarg, "open" );
+            break;
+        case 'c': sg_i_conns = atoi( optarg ); break;
+        case 'r': sg_f_rate = atof( optarg ); break;
+        case 'd': sg_f_duration = atof( optarg ); break;
+        case 's': sg_i_payload = atoi( optarg ); break;
+        case 'u': sg_i_handler_us = atoi( optarg ); break;
+        case 'b':
+            sg_i_backend = !strcmp( optarg, "uring" ) ? JSONRPC_BACKEND_URING
+                                                      : JSONRPC_BACKEND_EPOLL;
+            break;
+        default:
+            return usage( argv[0] );
+        }
+    }
+    if ( sg_i_conns < 1 || sg_f_rate <= 0 || sg_f_duration <= 0 ||
+         sg_i_payload < 0 )
+        return usage( argv[0] );
+    snprintf( sg_psz_unix, sizeof(sg_psz_unix), "/tmp/jsonrpc_bench.%d",
+              (int)getpid() );
+
+    pid_t pid = fork();
+    if ( pid == 0 )
+    {
+        serve();
+        return 0;
+    }
+
+    // notify: i_conns subscribers and one publisher, else i_conns callers
+    bool b_notify = sg_i_transport == T_NOTIFY;
+    int i_subs = b_notify ? sg_i_conns : 0;
+    int i_callers = b_notify ? 1 : sg_i_conns;
+    conn_t *p_conns = calloc( i_subs + i_callers, sizeof(conn_t) );
+    for ( int i = 0; i < i_subs + i_callers; i++ )
+    {
+        conn_t *p_conn = &p_conns[i];
+        if ( bench_connect( &p_conn->reader, i < i_subs ) < 0 )
+        {
+            kill( pid, SIGINT );
+            return 1;
+        }
+        if ( i >= i_subs )
+            p_conn->p_call = make_call( b_notify ? "publish" : "work",
+                                        &p_conn->i_call );
+    }
+
+    uint64_t i_start = jsonrpc_mdate() + 10000;
+    uint64_t i_end = i_start + (uint64_t)( sg_f_duration * 1e6 );
+    pthread_t *p_threads = calloc( 2 * ( i_subs + i_callers ),
+                                   sizeof(pthread_t) );
+    int i_threads = 0;
+    for ( int i = 0; i < i_subs; i++ )
+        pthread_create( &p_threads[i_threads++], NULL, subscriber,
+                        &p_conns[i] );
+    for ( int i = i_subs; i < i_subs + i_callers; i++ )
+    {
+        conn_t *p_conn = &p_conns[i];
+        p_conn->i_start = i_start;
+        p_conn->i_end = i_end;
+        if ( !sg_b_open )
+        {
+            pthread_create( &p_threads[i_threads++], NULL, closed_loop,
+                            p_conn );
+            continue;
+        }
+        // the connections take turns
+        p_conn->i_interval = 1e6 * i_callers / sg_f_rate;
+        if ( p_conn->i_interval == 0 )
+            p_conn->i_interval = 1;
+        p_conn->i_offset = p_conn->i_interval * ( i - i_subs ) / i_callers;
+        p_conn->p_ring = malloc( RING_SIZE * sizeof(uint64_t) );
+        pthread_create( &p_threads[i_threads++], NULL, open_sender, p_conn );
+        pthread_create( &p_threads[i_threads++], NULL, open_receiver, p_conn );
+    }
+    for ( int i = i_subs; i < i_threads; i++ )
+        pthread_join( p_threads[i], NULL );
+    uint64_t i_elapsed = jsonrpc_mdate() - i_start;
+    // the last notifications are on their way
+    if ( b_notify )
+    {
+        usleep( 200000 );
+        for ( int i = 0; i < i_subs; i++ )
+            shutdown( p_conns[i].reader.fd, SHUT_RDWR );
+        for ( int i = 0; i < i_subs; i++ )
+            pthread_join( p_threads[i], NULL );
+    }
+    kill( pid, SIGINT );
+    waitpid( pid, NULL, 0 );
+    unlink( sg_psz_unix );
+
+    samples_t all;
+    memset( &all, 0, sizeof(all) );
+    double f_sum = 0;
+    uint64_t i_calls = 0;
+    for ( int i = 0; i < i_subs + i_callers; i++ )
+    {
+        samples_t *p_samples = &p_conns[i].samples;
+        for ( size_t k = 0; k < p_samples->i_lat; k++ )
+        {
+            sample_add( &all, p_samples->p_lat[k] );
+            f_sum += p_samples->p_lat[k];
+        }
+        all.i_errors += p_samples->i_errors;
+        if ( i >= i_subs && !b_notify )
+            i_calls += p_samples->i_lat;
+    }
+    qsort( all.p_lat, all.i_lat, sizeof(uint64_t), cmp_u64 );
+    if ( b_notify )
+        i_calls = all.i_lat;
+
+    printf( "{ \"transport\": \"%s\", \"mode\": \"%s\", \"backend\": \"%s\", "
+            "\"conns\": %d, \"rate\": %.0f, \"duration\": %.3f, "
+            "\"payload\": %d, \"handler_us\": %d, \"completed\": %llu, "
+            "\"errors\": %llu, \"throughput\": %.1f, \"latency_us\": { "
+            "\"mean\": %.1f, \"p50\": %llu, \"p99\": %llu, \"p999\": %llu, "
+            "\"max\": %llu } }\n",
+            sg_ppsz_transport[sg_i_transport], sg_b_open ? "open" : "closed",
+            sg_i_backend == JSONRPC_BACKEND_URING ? "uring" : "epoll",
+            sg_i_conns, sg_b_open ? sg_f_rate : 0, i_elapsed / 1e6,
+            sg_i_payload, sg_i_handler_us, (unsigned long long)i_calls,
+            (unsigned long long)all.i_errors, i_calls * 1e6 / i_elapsed,
+            all.i_lat ? f_sum / all.i_lat : 0,
+            (unsigned long long)percentile( &all, 0.5 ),
+            (unsigned long long)percentile( &all, 0.99 ),
+            (unsigned long long)percentile( &all, 0.999 ),
+            (unsigned long long)( all.i_lat ? all.p_lat[all.i_lat - 1] : 0 ) );
+    return 0;
+}
@@ -0,0 +1,347 @@
+// file : jsonrpc_replay.c
+// date : 2026-10-19
+// desc : plays a capture (see capture.h) back against a running server.
+//        Each call is due at its recorded offset divided by -x (0 sends
+//        them all at once), the calls take turns over -c connections, and
+//        latency counts from when a call was due so a server falling
+//        behind shows in the tail. The result is one JSON object on
+//        stdout.
+//
+//        usage: jsonrpc_replay [-a host:port | -u unix path] [-x speed]
+//                              [-c conns] capture.jsonl
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "jsonrpc_server.h"
+#include "jsonrpc_utils.h"
+
+#define RECV_TIMEOUT 2                      // s, then the rest are lost
+
+typedef struct call_t
+{
+    uint64_t i_offset;                      // us after the first call
+    char    *psz_call;                      // '\0' framed
+    size_t   i_call;
+} call_t;
+
+typedef struct conn_t
+{
+    int       fd;
+    call_t  **pp_calls;                     // its calls, in order
+    int       i_calls;
+    uint64_t  i_start;
+    uint64_t *p_due;                        // when each was due, set
+    // before it is sent so before its response can come
+    uint64_t *p_lat;                        // us, of the answered ones
+    int       i_answered;
+    int       i_errors;
+    uint64_t  i_lag;                        // worst send behind schedule
+} conn_t;
+
+static const char *sg_psz_addr = "127.0.0.1:8080";
+static const char *sg_psz_unix = NULL;
+static double sg_f_speed = 1;
+static int    sg_i_conns = 4;
+static uint64_t sg_i_recorded;              // us from first to last call
+
+static int connect_server( void )
+{
+    int fd;
+    if ( sg_psz_unix )
+    {
+        struct sockaddr_un addr;
+        memset( &addr, 0, sizeof(addr) );
+        addr.sun_family = AF_UNIX;
+        strncpy( addr.sun_path, sg_psz_unix, sizeof(addr.sun_path) - 1 );
+        fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+        if ( connect( fd, (struct sockaddr*)&addr, sizeof(addr) ) < 0 )
+            goto error;
+    }
+    else
+    {
+        char psz_host[64];
+        const char *psz_port = strrchr( sg_psz_addr, ':' );
+        if ( !psz_port || psz_port - sg_psz_addr >= (int)sizeof(psz_host) )
+            return -1;
+        memcpy( psz_host, sg_psz_addr, psz_port - sg_psz_addr );
+        psz_host[psz_port - sg_psz_addr] = '\0';
+        struct sockaddr_in addr;
+        memset( &addr, 0, sizeof(addr) );
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons( atoi( psz_port + 1 ) );
+        if ( inet_pton( AF_INET, psz_host, &addr.sin_addr ) != 1 )
+            return -1;
+        fd = socket( AF_INET, SOCK_STREAM, 0 );
+        if ( connect( fd, (struct sockaddr*)&addr, sizeof(addr) ) < 0 )
+            goto error;
+        int i_one = 1;
+        setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &i_one, sizeof(i_one) );
+    }
+    struct timeval tv = { RECV_TIMEOUT, 0 };
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+
+    static const char psz_rpc[] = "{ \"protocol\": \"rpc\" }";
+    char buf[256];
+    size_t i_buf = 0;
+    if ( send( fd, psz_rpc, sizeof(psz_rpc), MSG_NOSIGNAL ) < 0 )
+        goto error;
+    while ( i_buf < sizeof(buf) - 1 )
+    {
+        ssize_t i_read = recv( fd, buf + i_buf, sizeof(buf) - 1 - i_buf, 0 );
+        if ( i_read <= 0 )
+            goto error;
+        i_buf += i_read;
+        buf[i_buf] = '\0';
+        if ( strstr( buf, "\r\n" ) )
+            return strstr( buf, "OK" ) ? fd : -1;
+    }
+error:
+    fprintf( stderr, "connect failed (%s)\n", strerror( errno ) );
+    close( fd );
+    return -1;
+}
+
+// the calls of psz_file, offsets from the first one scaled by the speed
+static call_t *load( const char *psz_file, int *pi_calls )
+{
+    FILE *p_file = fopen( psz_file, "r" );
+    if ( !p_file )
+    {
+        fprintf( stderr, "cannot open %s\n", psz_file );
+        return NULL;
+    }
+    call_t *p_calls = NULL;
+    int i_calls = 0, i_max = 0;
+    uint64_t i_ts0 = 0;
+    char *psz_line = NULL;
+    size_t i_line = 0;
+    while ( getline( &psz_line, &i_line, p_file ) > 0 )
+    {
+        struct json_object *p_line = json_tokener_parse( psz_line );
+        if ( is_error( p_line ) )
+            continue;
+        struct json_object *p_ts = json_object_object_get( p_line, "ts" );
+        struct json_object *p_method =
+            json_object_object_get( p_line, "method" );
+        struct json_object *p_params =
+            json_object_object_get( p_line, "params" );
+        if ( !p_ts || !p_method || !p_params )
+        {
+            json_object_put( p_line );
+            continue;
+        }
+        if ( i_calls == i_max )
+        {
+            i_max = i_max * 2 + 1024;
+            p_calls = realloc( p_calls, i_max * sizeof(call_t) );
+            if ( !p_calls )
+                abort();
+        }
+        uint64_t i_ts = json_object_get_int64( p_ts );
+        if ( i_calls == 0 )
+            i_ts0 = i_ts;
+        call_t *p_call = &p_calls[i_calls];
+        p_call->i_offset = sg_f_speed > 0 && i_ts > i_ts0 ?
+                           ( i_ts - i_ts0 ) / sg_f_speed : 0;
+        const char *psz_method = json_object_to_json_string( p_method );
+        const char *psz_params = json_object_to_json_string( p_params );
+        size_t i_max_call = strlen( psz_method ) + strlen( psz_params ) + 96;
+        p_call->psz_call = malloc( i_max_call );
+        p_call->i_call = snprintf( p_call->psz_call, i_max_call,
+                                   "{ \"jsonrpc\": \"2.0\", \"method\": %s, "
+                                   "\"params\": %s, \"id\": %d }",
+                                   psz_method, psz_params, i_calls ) + 1;
+        json_object_put( p_line );
+        sg_i_recorded = i_ts > i_ts0 ? i_ts - i_ts0 : 0;
+        i_calls++;
+    }
+    free( psz_line );
+    fclose( p_file );
+    *pi_calls = i_calls;
+    return p_calls;
+}
+
+static void *sender( void *p_arg )
+{
+    conn_t *p_conn = p_arg;
+    for ( int i = 0; i < p_conn->i_calls; i++ )
+    {
+        call_t *p_call = p_conn->pp_calls[i];
+        uint64_t i_due = p_conn->i_start + p_call->i_offset;
+        uint64_t i_now = jsonrpc_mdate();
+        if ( i_due > i_now + 50 )
+            usleep( i_due - i_now - 50 );
+        while ( ( i_now = jsonrpc_mdate() ) < i_due )
+            ;
+        if ( i_now - i_due > p_conn->i_lag )
+            p_conn->i_lag = i_now - i_due;
+        p_conn->p_due[i] = i_due;
+        const char *p = p_call->psz_call;
+        size_t i_left = p_call->i_call;
+        while ( i_left > 0 )
+        {
+            ssize_t i_ret = send( p_conn->fd, p, i_left, MSG_NOSIGNAL );
+            if ( i_ret < 0 && errno == EINTR )
+                continue;
+            if ( i_ret < 0 )
+                return NULL;
+            p += i_ret;
+            i_left -= i_ret;
+        }
+    }
+    return NULL;
+}
+
+// responses come back in order, each one ends with '\0'
+static void *receiver( void *p_arg )
+{
+    conn_t *p_conn = p_arg;
+    size_t i_max = 65536, i_buf = 0;
+    char *p_buf = malloc( i_max );
+    while ( p_conn->i_answered < p_conn->i_calls )
+    {
+        ssize_t i_read = recv( p_conn->fd, p_buf + i_buf, i_max - i_buf, 0 );
+        if ( i_read < 0 && errno == EINTR )
+            continue;
+        if ( i_read <= 0 )
+            break;
+        i_buf += i_read;
+        uint64_t i_now = jsonrpc_mdate();
+        char *p_start = p_buf, *p_end;
+        while ( ( p_end = memchr( p_start, '\0', i_buf - ( p_start - p_buf ) ) ) )
+        {
+            int i = p_conn->i_answered++;
+            if ( memmem( p_start, p_end - p_start < 64 ? p_end - p_start : 64,
+                         "\"error\"", 7 ) )
+                p_conn->i_errors++;
+            else
+                p_conn->p_lat[ i - p_conn->i_errors ] = i_now - p_conn->p_due[i];
+            p_start = p_end + 1;
+        }
+        i_buf -= p_start - p_buf;
+        memmove( p_buf, p_start, i_buf );
+        if ( i_buf == i_max )
+        {
+            i_max *= 2;
+            p_buf = realloc( p_buf, i_max );
+            if ( !p_buf )
+                abort();
+        }
+    }
+    free( p_buf );
+    return NULL;
+}
+
+static int cmp_u64( const void *a, const void *b )
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int usage( const char *psz_name )
+{
+    fprintf( stderr, "usage: %s [-a host:port | -u unix path] [-x speed] "
+             "[-c conns] capture.jsonl\n", psz_name );
+    return 1;
+}
+
+int main( int argc, char **argv )
+{
+    int i_opt;
+    while ( ( i_opt = getopt( argc, argv, "a:u:x:c:" ) ) != -1 )
+    {
+        switch ( i_opt )
+        {
+        case 'a': sg_psz_addr = optarg; break;
+        case 'u': sg_psz_unix = optarg; break;
+        case 'x': sg_f_speed = atof( optarg ); break;
+        case 'c': sg_i_conns = atoi( optarg ); break;
+        default:
+            return usage( argv[0] );
+        }
+    }
+    if ( optind != argc - 1 || sg_i_conns < 1 || sg_f_speed < 0 )
+        return usage( argv[0] );
+
+    int i_calls;
+    call_t *p_calls = load( argv[optind], &i_calls );
+    if ( !p_calls || i_calls == 0 )
+    {
+        fprintf( stderr, "no calls in %s\n", argv[optind] );
+        return 1;
+    }
+
+    conn_t *p_conns = calloc( sg_i_conns, sizeof(conn_t) );
+    for ( int i = 0; i < sg_i_conns; i++ )
+    {
+        conn_t *p_conn = &p_conns[i];
+        if ( ( p_conn->fd = connect_server() ) < 0 )
+            return 1;
+        int i_mine = i_calls / sg_i_conns + ( i < i_calls % sg_i_conns );
+        p_conn->pp_calls = malloc( ( i_mine + 1 ) * sizeof(call_t*) );
+        p_conn->p_due = malloc( ( i_mine + 1 ) * sizeof(uint64_t) );
+        p_conn->p_lat = malloc( ( i_mine + 1 ) * sizeof(uint64_t) );
+    }
+    for ( int k = 0; k < i_calls; k++ )
+    {
+        conn_t *p_conn = &p_conns[ k % sg_i_conns ];
+        p_conn->pp_calls[ p_conn->i_calls++ ] = &p_calls[k];
+    }
+
+    uint64_t i_start = jsonrpc_mdate() + 10000;
+    pthread_t *p_threads = calloc( 2 * sg_i_conns, sizeof(pthread_t) );
+    for ( int i = 0; i < sg_i_conns; i++ )
+    {
+        p_conns[i].i_start = i_start;
+        pthread_create( &p_threads[2 * i], NULL, sender, &p_conns[i] );
+        pthread_create( &p_threads[2 * i + 1], NULL, receiver, &p_conns[i] );
+    }
+    for ( int i = 0; i < 2 * sg_i_conns; i++ )
+        pthread_join( p_threads[i], NULL );
+    uint64_t i_elapsed = jsonrpc_mdate() - i_start;
+
+    uint64_t *p_lat = malloc( i_calls * sizeof(uint64_t) );
+    int i_lat = 0, i_errors = 0, i_lost = 0;
+    uint64_t i_lag = 0;
+    double f_sum = 0;
+    for ( int i = 0; i < sg_i_conns; i++ )
+    {
+        conn_t *p_conn = &p_conns[i];
+        int i_ok = p_conn->i_answered - p_conn->i_errors;
+        for ( int k = 0; k < i_ok; k++ )
+        {
+            p_lat[i_lat++] = p_conn->p_lat[k];
+            f_sum += p_conn->p_lat[k];
+        }
+        i_errors += p_conn->i_errors;
+        i_lost += p_conn->i_calls - p_conn->i_answered;
+        if ( p_conn->i_lag > i_lag )
+            i_lag = p_conn->i_lag;
+        close( p_conn->fd );
+    }
+    qsort( p_lat, i_lat, sizeof(uint64_t), cmp_u64 );
+#define PCT( q ) (unsigned long long)( i_lat ? \
+    p_lat[ (int)( (q) * i_lat ) < i_lat ? (int)( (q) * i_lat ) \
+                                        : i_lat - 1 ] : 0 )
+
+    printf( "{ \"calls\": %d, \"speed\": %g, \"conns\": %d, "
+            "\"recorded_s\": %.3f, \"duration_s\": %.3f, \"completed\": %d, "
+            "\"errors\": %d, \"lost\": %d, \"throughput\": %.1f, "
+            "\"send_lag_us\": %llu, \"latency_us\": { \"mean\": %.1f, "
+            "\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu } }\n",
+            i_calls, sg_f_speed, sg_i_conns, sg_i_recorded / 1e6,
+            i_elapsed / 1e6, i_lat, i_errors, i_lost, i_lat * 1e6 / i_elapsed,
+            (unsigned long long)i_lag, i_lat ? f_sum / i_lat : 0,
+            PCT( 0.5 ), PCT( 0.99 ), PCT( 0.999 ), PCT( 1 ) );
+    return i_lost > 0 || i_errors > 0;
+}
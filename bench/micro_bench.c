@@ -0,0 +1,412 @@
+// file : micro_bench.c
+// date : 2026-10-19
+// desc : cost per call of the hot primitives: framing (json, ws), the
+//        hashmap with string and int keys, blocks, and a canned call
+//        through handle_request. The unmasking of handle_ws_payload is
+//        what ws_handle_request_* costs over handle_request_*. Each case
+//        finds a batch of at least -t ms (or takes -n calls), runs it -r
+//        times and prints the median ns per call as one JSON line. -b
+//        compares with a saved run and exits 1 when a case got slower
+//        than -x percent.
+//
+//        usage: micro_bench [-f filter] [-n calls] [-t ms] [-r reps]
+//                           [-b baseline.jsonl] [-x percent]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "jsonrpc_server.h"
+#include "jsonrpc_utils.h"
+#include "block.h"
+
+#define KEYS 1024
+
+typedef struct bench_case_t
+{
+    const char *psz_name;
+    void      (*pf_run) ( uint64_t i_calls );
+} bench_case_t;
+
+static const char *sg_psz_filter = NULL;
+static uint64_t sg_i_calls = 0;
+static int      sg_i_target_ms = 20;
+static int      sg_i_reps = 7;
+static const char *sg_psz_baseline = NULL;
+static double   sg_f_threshold = 10;
+
+static volatile uint64_t sg_i_sink;
+
+static jsonrpc_server_t sg_server;
+static ws_jsonrpc_server_t sg_ws_server;
+static block_t *sg_p_small;                 // '\0' framed calls
+static block_t *sg_p_big;
+static block_t *sg_p_ws_small;              // the same, masked ws frames
+static block_t *sg_p_ws_big;
+static block_t *sg_p_res;
+
+static hashmap sg_strmap;
+static hashmap sg_intmap;
+static char    sg_ppsz_keys[KEYS][24];
+
+static uint64_t now_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void echo( struct json_object *p_params, struct json_object *p_response )
+{
+    json_object_object_add( p_response, "result", json_object_get( p_params ) );
+}
+
+static block_t *make_call( size_t i_payload )
+{
+    char *psz_payload = malloc( i_payload + 1 );
+    memset( psz_payload, 'x', i_payload );
+    psz_payload[i_payload] = '\0';
+    block_t *p_block = block_Alloc( i_payload + 128 );
+    p_block->i_buffer = snprintf( (char*)p_block->p_buffer, p_block->i_maxlen,
+                                  "{ \"jsonrpc\": \"2.0\", \"method\": "
+                                  "\"echo\", \"params\": [ \"%s\" ], "
+                                  "\"id\": 1 }", psz_payload ) + 1;
+    free( psz_payload );
+    return p_block;
+}
+
+static block_t *make_ws_frame( const block_t *p_call )
+{
+    // the frame carries the json without its '\0'
+    size_t i_len = p_call->i_buffer - 1;
+    block_t *p_frame = block_Alloc( i_len + 14 );
+    uint8_t *p = p_frame->p_buffer;
+    size_t i_header = 2;
+    p[0] = 0x81;
+    if ( i_len < 126 )
+        p[1] = 0x80 | i_len;
+    else
+    {
+        p[1] = 0x80 | 126;
+        p[2] = i_len >> 8;
+        p[3] = i_len & 0xff;
+        i_header = 4;
+    }
+    static const uint8_t p_mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    memcpy( p + i_header, p_mask, 4 );
+    for ( size_t i = 0; i < i_len; i++ )
+        p[i_header + 4 + i] = p_call->p_buffer[i] ^ p_mask[i & 3];
+    p_frame->i_buffer = i_header + 4 + i_len;
+    return p_frame;
+}
+
+/*
+ * cases
+ */
+static void json_complete( block_t *p_block, uint64_t i_calls )
+{
+    size_t i_len;
+    for ( uint64_t i = 0; i < i_calls; i++ )
+        sg_i_sink += json_request_IsComplete( p_block, &i_len ) + i_len;
+}
+static void json_complete_small( uint64_t n ) { json_complete( sg_p_small, n ); }
+static void json_complete_4k( uint64_t n ) { json_complete( sg_p_big, n ); }
+
+static void ws_complete( block_t *p_block, uint64_t i_calls )
+{
+    jsonrpc_server_t *p_ws = (jsonrpc_server_t*)&sg_ws_server;
+    size_t i_len;
+    for ( uint64_t i = 0; i < i_calls; i++ )
+        sg_i_sink += p_ws->pf_request_IsComplete( p_ws, p_block, &i_len ) +
+                     i_len;
+}
+static void ws_complete_small( uint64_t n ) { ws_complete( sg_p_ws_small, n ); }
+static void ws_complete_4k( uint64_t n ) { ws_complete( sg_p_ws_big, n ); }
+
+static hashmap_key_t str_key( uint64_t i )
+{
+    hashmap_key_t key;
+    key.type = 'c';
+    key.u.psz_string = sg_ppsz_keys[ i % KEYS ];
+    return key;
+}
+
+static hashmap_key_t int_key( uint64_t i )
+{
+    hashmap_key_t key;
+    key.type = 'l';
+    key.u.i_int32 = i % KEYS;
+    return key;
+}
+
+// the maps hold all KEYS, a put adds back what the pop took
+static void hashmap_get_str( uint64_t i_calls )
+{
+    for ( uint64_t i = 0; i < i_calls; i++ )
+        sg_i_sink += (uintptr_t)hashmap_get( sg_strmap, str_key( i * 7 ) );
+}
+
+static void hashmap_putpop_str( uint64_t i_calls )
+{
+    for ( uint64_t i = 0; i < i_calls; i++ )
+    {
+        hashmap_key_t key = str_key( i * 7 );
+        void *p_val = hashmap_pop( sg_strmap, key, NULL );
+        hashmap_put( sg_strmap, key, p_val );
+    }
+}
+
+static void hashmap_get_int( uint64_t i_calls )
+{
+    for ( uint64_t i = 0; i < i_calls; i++ )
+        sg_i_sink += (uintptr_t)hashmap_get( sg_intmap, int_key( i * 7 ) );
+}
+
+static void hashmap_putpop_int( uint64_t i_calls )
+{
+    for ( uint64_t i = 0; i < i_calls; i++ )
+    {
+        hashmap_key_t key = int_key( i * 7 );
+        void *p_val = hashmap_pop( sg_intmap, key, NULL );
+        hashmap_put( sg_intmap, key, p_val );
+    }
+}
+
+static void block_alloc_4k( uint64_t i_calls )
+{
+    for ( uint64_t i = 0; i < i_calls; i++ )
+    {
+        block_t *p_block = block_Alloc( 4096 );
+        sg_i_sink += p_block->i_maxlen;
+        block_Release( p_block );
+    }
+}
+
+// a response growing page by page to 64k
+static void block_realloc_64k( uint64_t i_calls )
+{
+    for ( uint64_t i = 0; i < i_calls; i++ )
+    {
+        block_t *p_block = block_Alloc( 4096 );
+        while ( p_block->i_maxlen < 65536 )
+            p_block = block_Realloc( p_block, 4096 );
+        sg_i_sink += p_block->i_maxlen;
+        block_Release( p_block );
+    }
+}
+
+// 64 bytes at a time into a block reused once it reaches 64k
+static void block_append_64( uint64_t i_calls )
+{
+    static uint8_t p_chunk[64];
+    static block_t *p_block;
+    if ( !p_block )
+        p_block = block_Alloc( 65536 + 4096 );
+    for ( uint64_t i = 0; i < i_calls; i++ )
+    {
+        if ( p_block->i_buffer >= 65536 )
+            p_block->i_buffer = 0;
+        p_block = block_Append( p_block, p_chunk, sizeof(p_chunk) );
+    }
+    sg_i_sink += p_block->i_buffer;
+}
+
+static void request( jsonrpc_server_t *p_server, block_t *p_req,
+                     uint64_t i_calls )
+{
+    for ( uint64_t i = 0; i < i_calls; i++ )
+    {
+        sg_p_res->i_buffer = 0;
+        p_server->pf_handle_request( p_server, p_req, sg_p_res );
+        sg_i_sink += sg_p_res->i_buffer;
+    }
+}
+static void request_small( uint64_t n ) { request( &sg_server, sg_p_small, n ); }
+static void request_4k( uint64_t n ) { request( &sg_server, sg_p_big, n ); }
+static void ws_request_small( uint64_t n )
+{
+    request( (jsonrpc_server_t*)&sg_ws_server, sg_p_ws_small, n );
+}
+static void ws_request_4k( uint64_t n )
+{
+    request( (jsonrpc_server_t*)&sg_ws_server, sg_p_ws_big, n );
+}
+
+static const bench_case_t sg_cases[] =
+{
+    { "json_request_IsComplete_small", json_complete_small },
+    { "json_request_IsComplete_4k",    json_complete_4k },
+    { "ws_request_IsComplete_small",   ws_complete_small },
+    { "ws_request_IsComplete_4k",      ws_complete_4k },
+    { "hashmap_get_str",               hashmap_get_str },
+    { "hashmap_putpop_str",            hashmap_putpop_str },
+    { "hashmap_get_int",               hashmap_get_int },
+    { "hashmap_putpop_int",            hashmap_putpop_int },
+    { "block_Alloc_4k",                block_alloc_4k },
+    { "block_Realloc_64k",             block_realloc_64k },
+    { "block_Append_64",               block_append_64 },
+    { "handle_request_small",          request_small },
+    { "handle_request_4k",             request_4k },
+    { "ws_handle_request_small",       ws_request_small },
+    { "ws_handle_request_4k",          ws_request_4k },
+};
+
+static void setup( void )
+{
+    jsonrpc_server_init( &sg_server );
+    sg_server.pf_register_function( &sg_server, "echo", echo );
+    ws_jsonrpc_server_init( &sg_ws_server );
+    jsonrpc_server_t *p_ws = (jsonrpc_server_t*)&sg_ws_server;
+    p_ws->pf_register_function( p_ws, "echo", echo );
+
+    sg_p_small = make_call( 16 );
+    sg_p_big = make_call( 4096 );
+    sg_p_ws_small = make_ws_frame( sg_p_small );
+    sg_p_ws_big = make_ws_frame( sg_p_big );
+    sg_p_res = block_Alloc( 65536 );
+
+    sg_strmap = hashmap_create( 101 );
+    sg_intmap = hashmap_create( 101 );
+    for ( int i = 0; i < KEYS; i++ )
+    {
+        snprintf( sg_ppsz_keys[i], sizeof(sg_ppsz_keys[i]), "method_%d", i );
+        hashmap_put( sg_strmap, str_key( i ), sg_ppsz_keys[i] );
+        hashmap_put( sg_intmap, int_key( i ), sg_ppsz_keys[i] );
+    }
+}
+
+static int cmp_double( const void *a, const void *b )
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// ns per call of the case in a saved run, < 0 when it is not there
+static double baseline_of( struct json_object *p_base, const char *psz_name )
+{
+    if ( !p_base )
+        return -1;
+    struct json_object *p_case = json_object_object_get( p_base, psz_name );
+    struct json_object *p_ns = p_case ?
+        json_object_object_get( p_case, "ns_per_call" ) : NULL;
+    if ( !p_ns )
+        return -1;
+    return json_object_get_double( p_ns );
+}
+
+// the lines of a saved run, by name
+static struct json_object *load_baseline( const char *psz_file )
+{
+    FILE *p_file = fopen( psz_file, "r" );
+    if ( !p_file )
+    {
+        fprintf( stderr, "cannot open %s\n", psz_file );
+        return NULL;
+    }
+    struct json_object *p_base = json_object_new_object();
+    char psz_line[1024];
+    while ( fgets( psz_line, sizeof(psz_line), p_file ) )
+    {
+        struct json_object *p_line = json_tokener_parse( psz_line );
+        struct json_object *p_name = is_error( p_line ) ? NULL :
+            json_object_object_get( p_line, "name" );
+        if ( p_name )
+            json_object_object_add( p_base, json_object_get_string( p_name ),
+                                    p_line );
+        else if ( !is_error( p_line ) )
+            json_object_put( p_line );
+    }
+    fclose( p_file );
+    return p_base;
+}
+
+static int usage( const char *psz_name )
+{
+    fprintf( stderr, "usage: %s [-f filter] [-n calls] [-t ms] [-r reps] "
+             "[-b baseline.jsonl] [-x percent]\n", psz_name );
+    return 2;
+}
+
+int main( int argc, char **argv )
+{
+    int i_opt;
+    while ( ( i_opt = getopt( argc, argv, "f:n:t:r:b:x:" ) ) != -1 )
+    {
+        switch ( i_opt )
+        {
+        case 'f': sg_psz_filter = optarg; break;
+        case 'n': sg_i_calls = strtoull( optarg, NULL, 10 ); break;
+        case 't': sg_i_target_ms = atoi( optarg ); break;
+        case 'r': sg_i_reps = atoi( optarg ); break;
+        case 'b': sg_psz_baseline = optarg; break;
+        case 'x': sg_f_threshold = atof( optarg ); break;
+        default:
+            return usage( argv[0] );
+        }
+    }
+    if ( sg_i_reps < 1 || sg_i_target_ms < 1 )
+        return usage( argv[0] );
+
+    struct json_object *p_base = NULL;
+    if ( sg_psz_baseline && !( p_base = load_baseline( sg_psz_baseline ) ) )
+        return 2;
+    setup();
+
+    int i_ret = 0;
+    double *pf_reps = malloc( sg_i_reps * sizeof(double) );
+    for ( size_t k = 0; k < sizeof(sg_cases) / sizeof(sg_cases[0]); k++ )
+    {
+        const bench_case_t *p_case = &sg_cases[k];
+        if ( sg_psz_filter && !strstr( p_case->psz_name, sg_psz_filter ) )
+            continue;
+
+        // warm the caches, then double the batch up to the target time
+        uint64_t i_calls = sg_i_calls;
+        p_case->pf_run( 1000 );
+        if ( i_calls == 0 )
+        {
+            i_calls = 1000;
+            while ( true )
+            {
+                uint64_t i_start = now_ns();
+                p_case->pf_run( i_calls );
+                if ( now_ns() - i_start >= sg_i_target_ms * 1000000ull )
+                    break;
+                i_calls *= 2;
+            }
+        }
+        for ( int r = 0; r < sg_i_reps; r++ )
+        {
+            uint64_t i_start = now_ns();
+            p_case->pf_run( i_calls );
+            pf_reps[r] = (double)( now_ns() - i_start ) / i_calls;
+        }
+        qsort( pf_reps, sg_i_reps, sizeof(double), cmp_double );
+        double f_median = pf_reps[ sg_i_reps / 2 ];
+
+        printf( "{ \"name\": \"%s\", \"calls\": %llu, \"reps\": %d, "
+                "\"ns_per_call\": %.2f, \"min\": %.2f, \"max\": %.2f",
+                p_case->psz_name, (unsigned long long)i_calls, sg_i_reps,
+                f_median, pf_reps[0], pf_reps[sg_i_reps - 1] );
+        double f_base = baseline_of( p_base, p_case->psz_name );
+        if ( f_base > 0 )
+        {
+            double f_delta = ( f_median - f_base ) * 100 / f_base;
+            printf( ", \"baseline\": %.2f, \"delta_pct\": %.1f",
+                    f_base, f_delta );
+            if ( f_delta > sg_f_threshold )
+            {
+                printf( ", \"regression\": true" );
+                i_ret = 1;
+            }
+        }
+        printf( " }\n" );
+        fflush( stdout );
+    }
+    free( pf_reps );
+    if ( p_base )
+        json_object_put( p_base );
+    return i_ret;
+}
@@ -0,0 +1,169 @@
+// file : nodelay_bench.c
+// date : 2026-10-19
+// desc : latency of small calls with and without TCP_NODELAY, one call at a
+//        time and in bursts of i_depth pipelined calls. Without it, a
+//        response sent while the previous one is not acknowledged waits for
+//        the ack (delayed up to 40 ms on linux). The server sends what a loop
+//        iteration produced for a connection at once, a burst read in one
+//        iteration is answered in one send and does not wait.
+//
+//        usage: nodelay_bench [calls] [depth]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "jsonrpc_server.h"
+#include "jsonrpc_utils.h"
+
+#define BENCH_PORT 18931
+
+static int sg_i_calls = 2000;
+static int sg_i_depth = 8;
+static jsonrpc_sockopt_t sg_opt;
+
+static const char sg_handshake[] = "{ \"protocol\": \"rpc\" }";
+static const char sg_call[] =
+    "{ \"jsonrpc\": \"2.0\", \"method\": \"echo\", \"params\": [ 42 ], "
+    "\"id\": 1 }";
+
+static void echo( struct json_object *p_params, struct json_object *p_response )
+{
+    json_object_object_add( p_response, "result", json_object_get( p_params ) );
+}
+
+static int read_frames( int fd, int i_frames, char c_end )
+{
+    char buf[65536];
+    while ( i_frames > 0 )
+    {
+        int i_read = recv( fd, buf, sizeof(buf), 0 );
+        if ( i_read <= 0 )
+            return -1;
+        for ( int i = 0; i < i_read; i++ )
+            if ( buf[i] == c_end )
+                i_frames--;
+    }
+    return 0;
+}
+
+static int cmp_u64( const void *p_a, const void *p_b )
+{
+    uint64_t a = *(const uint64_t*)p_a, b = *(const uint64_t*)p_b;
+    return a < b ? -1 : a > b;
+}
+
+// i_depth calls written one by one, then wait for every response
+static void measure( int fd, int i_depth, const char *psz_name )
+{
+    int i_rounds = sg_i_calls / i_depth;
+    uint64_t *p_lat = malloc( sizeof(uint64_t) * i_rounds );
+    for ( int i = 0; i < i_rounds; i++ )
+    {
+        uint64_t i_start = jsonrpc_mdate();
+        for ( int j = 0; j < i_depth; j++ )
+            send( fd, sg_call, sizeof(sg_call), 0 );
+        if ( read_frames( fd, i_depth, '\0' ) < 0 )
+        {
+            fprintf( stderr, "connection lost\n" );
+            exit( 1 );
+        }
+        p_lat[i] = jsonrpc_mdate() - i_start;
+    }
+    qsort( p_lat, i_rounds, sizeof(uint64_t), cmp_u64 );
+    uint64_t i_sum = 0;
+    for ( int i = 0; i < i_rounds; i++ )
+        i_sum += p_lat[i];
+    printf( "%-9s depth %2d  avg %8.1f us  p50 %8lu us  p99 %8lu us\n",
+            psz_name, i_depth, (double)i_sum / i_rounds,
+            (unsigned long)p_lat[ i_rounds / 2 ],
+            (unsigned long)p_lat[ i_rounds * 99 / 100 ] );
+    free( p_lat );
+}
+
+static void *client( void *p_arg )
+{
+    const char *psz_name = p_arg;
+    int fd = socket( AF_INET, SOCK_STREAM, 0 );
+    sockopt_Apply( fd, AF_INET, &sg_opt );
+    struct sockaddr_in addr;
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( BENCH_PORT );
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    int i_try = 0;
+    while ( connect( fd, (struct sockaddr*)&addr, sizeof(addr) ) < 0 )
+    {
+        if ( ++i_try == 100 )
+        {
+            fprintf( stderr, "connect failed\n" );
+            exit( 1 );
+        }
+        usleep( 10000 );
+    }
+    send( fd, sg_handshake, sizeof(sg_handshake), 0 );
+    if ( read_frames( fd, 1, '\n' ) < 0 )
+        exit( 1 );
+
+    measure( fd, 1, psz_name );
+    measure( fd, sg_i_depth, psz_name );
+    close( fd );
+    kill( getpid(), SIGINT );
+    return NULL;
+}
+
+static void run( bool b_nodelay, const char *psz_name )
+{
+    memset( &sg_opt, 0, sizeof(sg_opt) );
+    sg_opt.b_nodelay = b_nodelay;
+
+    jsonrpc_server_t server;
+    jsonrpc_server_init( &server );
+    jsonrpc_listen_opt_t opt;
+    memset( &opt, 0, sizeof(opt) );
+    opt.conn = sg_opt;
+    if ( jsonrpc_server_addListenerOpt( &server, &opt, AF_INET, "127.0.0.1",
+                                        BENCH_PORT ) < 0 )
+        exit( 1 );
+    server.pf_register_function( &server, "echo", echo );
+
+    pthread_t thread;
+    pthread_create( &thread, NULL, client, (void*)psz_name );
+    server.pf_serve( &server );
+    pthread_join( thread, NULL );
+    server.pf_exit( &server );
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc > 1 )
+        sg_i_calls = atoi( argv[1] );
+    if ( argc > 2 )
+        sg_i_depth = atoi( argv[2] );
+    if ( sg_i_calls < 100 || sg_i_depth < 1 )
+    {
+        fprintf( stderr, "usage: %s [calls >= 100] [depth]\n", argv[0] );
+        return 1;
+    }
+
+    // one process per run, the abort flag of serve() is global
+    for ( int i = 0; i < 2; i++ )
+    {
+        fflush( stdout );
+        pid_t pid = fork();
+        if ( pid == 0 )
+        {
+            run( i == 1, i == 1 ? "nodelay" : "default" );
+            return 0;
+        }
+        waitpid( pid, NULL, 0 );
+    }
+    return 0;
+}
@@ -0,0 +1,176 @@
+// file : uring_bench.c
+// date : 2026-10-19
+// desc : throughput and syscalls per request of the epoll and io_uring
+//        serve loops. Each backend runs in its own process with an echo
+//        server and i_conns client threads, each keeping i_depth requests
+//        in flight on its connection.
+//
+//        usage: uring_bench [conns] [requests per conn] [depth]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "jsonrpc_server.h"
+#include "jsonrpc_utils.h"
+
+#define BENCH_PORT 18930
+
+static int sg_i_conns = 16;
+static int sg_i_requests = 20000;
+static int sg_i_depth = 1;
+
+static const char sg_handshake[] = "{ \"protocol\": \"rpc\" }";
+static const char sg_call[] =
+    "{ \"jsonrpc\": \"2.0\", \"method\": \"echo\", \"params\": [ 42 ], "
+    "\"id\": 1 }";
+
+static void echo( struct json_object *p_params, struct json_object *p_response )
+{
+    json_object_object_add( p_response, "result", json_object_get( p_params ) );
+}
+
+static int connect_server( void )
+{
+    int fd = socket( AF_INET, SOCK_STREAM, 0 );
+    struct sockaddr_in addr;
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( BENCH_PORT );
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    for ( int i = 0; i < 100; i++ )
+    {
+        if ( connect( fd, (struct sockaddr*)&addr, sizeof(addr) ) == 0 )
+            return fd;
+        usleep( 10000 );
+    }
+    close( fd );
+    return -1;
+}
+
+// read until i_frames '\0' terminated frames (or the handshake line)
+static int read_frames( int fd, int i_frames, char c_end )
+{
+    char buf[65536];
+    while ( i_frames > 0 )
+    {
+        int i_read = recv( fd, buf, sizeof(buf), 0 );
+        if ( i_read <= 0 )
+            return -1;
+        for ( int i = 0; i < i_read; i++ )
+            if ( buf[i] == c_end )
+                i_frames--;
+    }
+    return 0;
+}
+
+static void *client( void *p_arg )
+{
+    int fd = connect_server();
+    if ( fd < 0 )
+    {
+        fprintf( stderr, "connect failed\n" );
+        exit( 1 );
+    }
+    send( fd, sg_handshake, sizeof(sg_handshake), 0 );
+    if ( read_frames( fd, 1, '\n' ) < 0 )
+        exit( 1 );
+
+    // sg_i_depth calls per write, wait for all the responses
+    size_t i_batch = sizeof(sg_call) * sg_i_depth;
+    char *p_batch = malloc( i_batch );
+    for ( int i = 0; i < sg_i_depth; i++ )
+        memcpy( p_batch + i * sizeof(sg_call), sg_call, sizeof(sg_call) );
+    for ( int i = 0; i < sg_i_requests; i += sg_i_depth )
+    {
+        if ( send( fd, p_batch, i_batch, 0 ) != (ssize_t)i_batch ||
+             read_frames( fd, sg_i_depth, '\0' ) < 0 )
+        {
+            fprintf( stderr, "connection lost\n" );
+            exit( 1 );
+        }
+    }
+    free( p_batch );
+    close( fd );
+    return NULL;
+}
+
+static void *load( void *p_arg )
+{
+    pthread_t *p_threads = malloc( sizeof(pthread_t) * sg_i_conns );
+    for ( int i = 0; i < sg_i_conns; i++ )
+        pthread_create( &p_threads[i], NULL, client, NULL );
+    for ( int i = 0; i < sg_i_conns; i++ )
+        pthread_join( p_threads[i], NULL );
+    free( p_threads );
+    kill( getpid(), SIGINT );
+    return NULL;
+}
+
+static void run( int i_backend, const char *psz_name )
+{
+    jsonrpc_server_t server;
+    jsonrpc_server_init( &server );
+    server.i_backend = i_backend;
+    if ( jsonrpc_server_addListener( &server, AF_INET, "127.0.0.1",
+                                     BENCH_PORT ) < 0 )
+        exit( 1 );
+    server.pf_register_function( &server, "echo", echo );
+
+    pthread_t thread;
+    uint64_t i_start = jsonrpc_mdate();
+    pthread_create( &thread, NULL, load, NULL );
+    server.pf_serve( &server );
+    uint64_t i_elapsed = jsonrpc_mdate() - i_start;
+    pthread_join( thread, NULL );
+
+    jsonrpc_server_stats_t *p_stats = &server.stats;
+    double f_requests = p_stats->i_requests ? p_stats->i_requests : 1;
+    printf( "%-6s %10lu req %10.0f req/s %8.3f syscalls/req "
+            "%8.3f loops/req\n", psz_name,
+            (unsigned long)p_stats->i_requests,
+            p_stats->i_requests * 1e6 / i_elapsed,
+            p_stats->i_syscalls / f_requests,
+            p_stats->i_loops / f_requests );
+    server.pf_exit( &server );
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc > 1 )
+        sg_i_conns = atoi( argv[1] );
+    if ( argc > 2 )
+        sg_i_requests = atoi( argv[2] );
+    if ( argc > 3 )
+        sg_i_depth = atoi( argv[3] );
+    if ( sg_i_conns < 1 || sg_i_requests < 1 || sg_i_depth < 1 )
+    {
+        fprintf( stderr, "usage: %s [conns] [requests] [depth]\n", argv[0] );
+        return 1;
+    }
+    printf( "%d conns, %d requests each, %d in flight\n",
+            sg_i_conns, sg_i_requests, sg_i_depth );
+
+    // one process per backend, the abort flag of serve() is global
+    int pi_backend[2] = { JSONRPC_BACKEND_EPOLL, JSONRPC_BACKEND_URING };
+    const char *ppsz_name[2] = { "epoll", "uring" };
+    for ( int i = 0; i < 2; i++ )
+    {
+        fflush( stdout );
+        pid_t pid = fork();
+        if ( pid == 0 )
+        {
+            run( pi_backend[i], ppsz_name[i] );
+            return 0;
+        }
+        waitpid( pid, NULL, 0 );
+    }
+    return 0;
+}
@@ -35,6 +35,32 @@ block_t *block_Realloc( block_t *p_block, size_t i_addsize )
     return p_block;
 }
 
+void block_Shrink( block_t *p_block, size_t i_size )
+{
+    size_t i_max = ceil( i_size * 1.0 / 4096 ) * 4096;
+    if ( p_block->i_maxlen <= i_max || p_block->i_buffer >= i_max )
+        return;
+    uint8_t *p_buffer = realloc( p_block->p_buffer, i_max );
+    if ( !p_buffer )
+        return;
+    p_block->p_buffer = p_buffer;
+    p_block->i_maxlen = i_max;
+}
+
+int block_Reserve( block_t *p_block, size_t i_size )
+{
+    if ( p_block->i_buffer + i_size < p_block->i_maxlen )
+        return 0;
+    size_t i_max = ceil( ( p_block->i_buffer + i_size + 1 ) * 1.0 / 4096 ) *
+                   4096;
+    uint8_t *p_buffer = realloc( p_block->p_buffer, i_max );
+    if ( !p_buffer )
+        return -1;
+    p_block->p_buffer = p_buffer;
+    p_block->i_maxlen = i_max;
+    return 0;
+}
+
 void block_Release( block_t *p_block )
 {
     free( p_block->p_buffer );
@@ -15,6 +15,10 @@ typedef struct block_t block_t;
 
 block_t *block_Alloc( size_t i_size );
 block_t *block_Realloc( block_t *p_block, size_t i_addsize );
+// give back the memory above i_size if the content fits in it
+void     block_Shrink( block_t *p_block, size_t i_size );
+// room for i_size more bytes, -1 leaves p_block as it was
+int      block_Reserve( block_t *p_block, size_t i_size );
 void     block_Release( block_t *p_block );
 block_t *block_Append( block_t *p_block, uint8_t *p_buf, size_t i_buf );
 
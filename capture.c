@@ -0,0 +1,223 @@
+// file : capture.c
+// date : 2026-10-19
+// desc : traffic capture to a JSONL file through a background writer
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <json/json.h>
+#include "capture.h"
+#include "log.h"
+#include "common.h"
+
+#define CAPTURE_FLUSH_MS 100                // the writer wakes up at least
+
+// followed by the request, padded to 8 bytes
+typedef struct capture_entry_t
+{
+    uint64_t i_ts;
+    uint64_t i_latency;
+    uint32_t i_res;
+    uint32_t i_req;
+} capture_entry_t;
+
+struct capture_t
+{
+    FILE    *p_file;
+    int      i_every;
+    uint64_t i_seen;                        // serving thread only
+
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  wait;
+    bool     b_stop;
+    // the serving thread fills p_front, the writer swaps and empties it
+    uint8_t *p_front;
+    size_t   i_front;
+    uint8_t *p_back;
+    uint64_t i_dropped;
+};
+
+#define ENTRY_SIZE( i_req ) \
+    ( ( sizeof(capture_entry_t) + (i_req) + 7 ) & ~(size_t)7 )
+
+static void write_entries( capture_t *p_capture, const uint8_t *p_buf,
+                           size_t i_buf )
+{
+    size_t i_pos = 0;
+    while ( i_pos < i_buf )
+    {
+        const capture_entry_t *p_entry =
+            (const capture_entry_t*)( p_buf + i_pos );
+        const char *psz_req = (const char*)( p_entry + 1 );
+        i_pos += ENTRY_SIZE( p_entry->i_req );
+
+        const char *psz_method = "null";
+        const char *psz_params = "null";
+        struct json_object *p_req = json_tokener_parse( psz_req );
+        if ( !is_error( p_req ) && json_object_is_type( p_req,
+                                                        json_type_object ) )
+        {
+            struct json_object *p_method =
+                json_object_object_get( p_req, "method" );
+            struct json_object *p_params =
+                json_object_object_get( p_req, "params" );
+            if ( p_method )
+                psz_method = json_object_to_json_string( p_method );
+            if ( p_params )
+                psz_params = json_object_to_json_string( p_params );
+        }
+        fprintf( p_capture->p_file, "{\"ts\":%llu,\"method\":%s,"
+                 "\"params\":%s,\"res\":%u,\"us\":%llu}\n",
+                 (unsigned long long)p_entry->i_ts, psz_method, psz_params,
+                 p_entry->i_res, (unsigned long long)p_entry->i_latency );
+        if ( !is_error( p_req ) )
+            json_object_put( p_req );
+    }
+    fflush( p_capture->p_file );
+}
+
+static void *capture_thread( void *p_arg )
+{
+    capture_t *p_capture = p_arg;
+    pthread_mutex_lock( &p_capture->lock );
+    while ( true )
+    {
+        if ( p_capture->i_front == 0 )
+        {
+            if ( p_capture->b_stop )
+                break;
+            struct timespec ts;
+            clock_gettime( CLOCK_REALTIME, &ts );
+            ts.tv_nsec += CAPTURE_FLUSH_MS * 1000000L;
+            if ( ts.tv_nsec >= 1000000000L )
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait( &p_capture->wait, &p_capture->lock, &ts );
+            continue;
+        }
+        uint8_t *p_buf = p_capture->p_front;
+        size_t i_buf = p_capture->i_front;
+        p_capture->p_front = p_capture->p_back;
+        p_capture->i_front = 0;
+        p_capture->p_back = p_buf;
+        pthread_mutex_unlock( &p_capture->lock );
+
+        write_entries( p_capture, p_buf, i_buf );
+
+        pthread_mutex_lock( &p_capture->lock );
+    }
+    pthread_mutex_unlock( &p_capture->lock );
+    return NULL;
+}
+
+capture_t *capture_New( const char *psz_file, int i_every )
+{
+    capture_t *p_capture = calloc( 1, sizeof(capture_t) );
+    if ( !p_capture )
+    {
+        log_Err( "no memory" );
+        return NULL;
+    }
+    p_capture->i_every = i_every > 0 ? i_every : 1;
+    p_capture->p_front = malloc( CAPTURE_QUEUE_BYTES );
+    p_capture->p_back = malloc( CAPTURE_QUEUE_BYTES );
+    if ( !p_capture->p_front || !p_capture->p_back )
+    {
+        log_Err( "no memory" );
+        goto error;
+    }
+    p_capture->p_file = fopen( psz_file, "a" );
+    if ( !p_capture->p_file )
+    {
+        log_Err( "open capture file %s failed (%s)", psz_file,
+                 strerror( errno ) );
+        goto error;
+    }
+    pthread_mutex_init( &p_capture->lock, NULL );
+    pthread_cond_init( &p_capture->wait, NULL );
+    if ( pthread_create( &p_capture->thread, NULL, capture_thread,
+                         p_capture ) )
+    {
+        log_Err( "create capture thread failed" );
+        pthread_mutex_destroy( &p_capture->lock );
+        pthread_cond_destroy( &p_capture->wait );
+        fclose( p_capture->p_file );
+        goto error;
+    }
+    return p_capture;
+
+error:
+    free( p_capture->p_front );
+    free( p_capture->p_back );
+    free( p_capture );
+    return NULL;
+}
+
+void capture_Delete( capture_t *p_capture )
+{
+    if ( !p_capture )
+        return;
+    pthread_mutex_lock( &p_capture->lock );
+    p_capture->b_stop = true;
+    pthread_cond_signal( &p_capture->wait );
+    pthread_mutex_unlock( &p_capture->lock );
+    pthread_join( p_capture->thread, NULL );
+
+    if ( p_capture->i_dropped > 0 )
+        log_Warn( "capture dropped %llu calls",
+                  (unsigned long long)p_capture->i_dropped );
+    fclose( p_capture->p_file );
+    pthread_mutex_destroy( &p_capture->lock );
+    pthread_cond_destroy( &p_capture->wait );
+    free( p_capture->p_front );
+    free( p_capture->p_back );
+    free( p_capture );
+}
+
+bool capture_Sample( capture_t *p_capture )
+{
+    return ++p_capture->i_seen % p_capture->i_every == 0;
+}
+
+void capture_Record( capture_t *p_capture, const uint8_t *p_req,
+                     size_t i_req, uint64_t i_ts, size_t i_res,
+                     uint64_t i_latency )
+{
+    // terminated for the parser, whether p_req counts its '\0' or not
+    size_t i_entry = ENTRY_SIZE( i_req + 1 );
+    pthread_mutex_lock( &p_capture->lock );
+    if ( p_capture->i_front + i_entry > CAPTURE_QUEUE_BYTES )
+    {
+        p_capture->i_dropped++;
+        pthread_mutex_unlock( &p_capture->lock );
+        return;
+    }
+    capture_entry_t *p_entry =
+        (capture_entry_t*)( p_capture->p_front + p_capture->i_front );
+    p_entry->i_ts = i_ts;
+    p_entry->i_latency = i_latency;
+    p_entry->i_res = i_res;
+    p_entry->i_req = i_req + 1;
+    memcpy( p_entry + 1, p_req, i_req );
+    ( (uint8_t*)( p_entry + 1 ) )[i_req] = '\0';
+    p_capture->i_front += i_entry;
+    // otherwise the writer comes every CAPTURE_FLUSH_MS
+    if ( p_capture->i_front > CAPTURE_QUEUE_BYTES / 2 )
+        pthread_cond_signal( &p_capture->wait );
+    pthread_mutex_unlock( &p_capture->lock );
+}
+
+uint64_t capture_Dropped( capture_t *p_capture )
+{
+    pthread_mutex_lock( &p_capture->lock );
+    uint64_t i_dropped = p_capture->i_dropped;
+    pthread_mutex_unlock( &p_capture->lock );
+    return i_dropped;
+}
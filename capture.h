@@ -0,0 +1,37 @@
+// file : capture.h
+// date : 2026-10-19
+// desc : traffic capture, one in i_every calls is appended to a JSONL file
+//        as {"ts":..,"method":..,"params":..,"res":..,"us":..} (wall clock
+//        and handler time in microseconds, response bytes). The serving
+//        thread only copies the raw request into a buffer, a background
+//        thread parses and writes it. Calls are dropped (and counted) when
+//        the writer is CAPTURE_QUEUE_BYTES behind. bench/jsonrpc_replay
+//        plays a capture back.
+//
+
+#ifndef JSONRPC_CAPTURE_H
+#define JSONRPC_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAPTURE_QUEUE_BYTES ( 4 << 20 )     // waiting for the writer
+
+typedef struct capture_t capture_t;
+
+// NULL when psz_file cannot be opened (appended to) or on no memory
+capture_t *capture_New( const char *psz_file, int i_every );
+// writes what is queued, then stops the writer
+void       capture_Delete( capture_t *p_capture );
+
+// whether the next call is recorded
+bool       capture_Sample( capture_t *p_capture );
+// p_req is the request json, i_ts its wall clock start
+void       capture_Record( capture_t *p_capture, const uint8_t *p_req,
+                           size_t i_req, uint64_t i_ts, size_t i_res,
+                           uint64_t i_latency );
+// calls dropped because the writer was behind
+uint64_t   capture_Dropped( capture_t *p_capture );
+
+#endif
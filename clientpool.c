@@ -0,0 +1,374 @@
+// file : clientpool.c
+// date : 2026-10-19
+// desc : pool of rpc connections shared by threads
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "clientpool.h"
+#include "jsonrpc_utils.h"
+#include "log.h"
+#include "common.h"
+
+enum slot_state
+{
+    SLOT_EMPTY = 0,             // no connection, opened when callers wait
+    SLOT_IDLE,                  // may be taken by clientpool_Get
+    SLOT_BUSY,                  // borrowed, or checked by the pool thread
+    SLOT_BROKEN,                // given back with b_error, to be reopened
+};
+
+typedef struct clientpool_slot_t
+{
+    jsonrpc_client_t client;    // first, clientpool_Put casts it back
+    int      i_state;           // enum slot_state, changed atomically
+    bool     b_open;            // client was initialized
+    uint64_t i_last;            // given back at, jsonrpc_mdate
+} clientpool_slot_t;
+
+struct clientpool_t
+{
+    int   i_sock_type;
+    char *psz_name;             // tcp server or unix conn file
+    int   i_port;
+    jsonrpc_sockopt_t sockopt;
+
+    int   i_max;
+    clientpool_slot_t *p_slots;
+
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;       // the pool thread has work
+    pthread_cond_t  ready;      // a connection became idle
+    bool  b_work;
+    bool  b_stop;
+    int   i_waiters;            // in clientpool_Get, changed atomically
+};
+
+// where the last clientpool_Get of the thread found a connection
+static __thread int sg_i_hint = 0;
+
+static void deadline( struct timespec *p_ts, uint64_t i_us )
+{
+    clock_gettime( CLOCK_REALTIME, p_ts );
+    p_ts->tv_sec += i_us / 1000000;
+    p_ts->tv_nsec += ( i_us % 1000000 ) * 1000;
+    if ( p_ts->tv_nsec >= 1000000000L )
+    {
+        p_ts->tv_sec++;
+        p_ts->tv_nsec -= 1000000000L;
+    }
+}
+
+// with the lock held
+static void wake_thread( clientpool_t *p_pool )
+{
+    p_pool->b_work = true;
+    pthread_cond_signal( &p_pool->wake );
+}
+
+static int open_slot( clientpool_t *p_pool, clientpool_slot_t *p_slot )
+{
+    if ( p_slot->b_open )
+    {
+        p_slot->client.pf_exit( &p_slot->client );
+        p_slot->b_open = false;
+    }
+    int i_ret;
+    if ( p_pool->i_sock_type == AF_UNIX || p_pool->i_sock_type == PF_UNIX )
+        i_ret = jsonrpc_client_initOpt( &p_slot->client, &p_pool->sockopt,
+                                        p_pool->i_sock_type,
+                                        p_pool->psz_name );
+    else
+        i_ret = jsonrpc_client_initOpt( &p_slot->client, &p_pool->sockopt,
+                                        p_pool->i_sock_type,
+                                        p_pool->psz_name, p_pool->i_port );
+    if ( i_ret < 0 )
+        return -1;
+    p_slot->b_open = true;
+    p_slot->i_last = jsonrpc_mdate();
+    return 0;
+}
+
+// nothing to read is the healthy state of an idle connection, a late
+// response is dropped by the next call, the end of the stream is not
+static bool is_alive( jsonrpc_client_t *p_client )
+{
+    char c;
+    ssize_t i_ret = recv( p_client->sock, &c, 1, MSG_PEEK | MSG_DONTWAIT );
+    if ( i_ret > 0 )
+        return true;
+    return i_ret < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ||
+                          errno == EINTR );
+}
+
+// only the pool thread leaves SLOT_EMPTY and SLOT_BROKEN, i_open is how
+// many empty slots callers are waiting for
+static void maintain( clientpool_t *p_pool, int i_open )
+{
+    uint64_t i_now = jsonrpc_mdate();
+    uint64_t i_idle = CLIENTPOOL_IDLE_MS * 1000ULL;
+    bool b_ready = false;
+    for ( int i = 0; i < p_pool->i_max; i++ )
+    {
+        clientpool_slot_t *p_slot = &p_pool->p_slots[i];
+        int i_state = __atomic_load_n( &p_slot->i_state, __ATOMIC_ACQUIRE );
+        if ( i_state == SLOT_BROKEN || ( i_state == SLOT_EMPTY && i_open > 0 ) )
+        {
+            if ( open_slot( p_pool, p_slot ) < 0 )
+            {
+                // retried on the next round
+                __atomic_store_n( &p_slot->i_state, SLOT_BROKEN,
+                                  __ATOMIC_RELEASE );
+                continue;
+            }
+            if ( i_state == SLOT_EMPTY )
+                i_open--;
+        }
+        else if ( i_state == SLOT_IDLE &&
+                  i_now - __atomic_load_n( &p_slot->i_last,
+                                           __ATOMIC_RELAXED ) > i_idle &&
+                  __atomic_compare_exchange_n( &p_slot->i_state, &i_state,
+                                               SLOT_BUSY, false,
+                                               __ATOMIC_ACQUIRE,
+                                               __ATOMIC_RELAXED ) )
+        {
+            if ( is_alive( &p_slot->client ) )
+                p_slot->i_last = i_now;
+            else
+            {
+                log_Warn( "client pool: idle connection %d lost, reopen", i );
+                if ( open_slot( p_pool, p_slot ) < 0 )
+                {
+                    __atomic_store_n( &p_slot->i_state, SLOT_BROKEN,
+                                      __ATOMIC_RELEASE );
+                    continue;
+                }
+            }
+        }
+        else
+            continue;
+        __atomic_store_n( &p_slot->i_state, SLOT_IDLE, __ATOMIC_SEQ_CST );
+        b_ready = true;
+    }
+    if ( b_ready && __atomic_load_n( &p_pool->i_waiters, __ATOMIC_SEQ_CST ) )
+    {
+        pthread_mutex_lock( &p_pool->lock );
+        pthread_cond_broadcast( &p_pool->ready );
+        pthread_mutex_unlock( &p_pool->lock );
+    }
+}
+
+static void *clientpool_thread( void *p_arg )
+{
+    clientpool_t *p_pool = p_arg;
+    pthread_mutex_lock( &p_pool->lock );
+    while ( !p_pool->b_stop )
+    {
+        if ( !p_pool->b_work )
+        {
+            struct timespec ts;
+            deadline( &ts, CLIENTPOOL_CHECK_MS * 1000ULL );
+            pthread_cond_timedwait( &p_pool->wake, &p_pool->lock, &ts );
+            if ( p_pool->b_stop )
+                break;
+        }
+        p_pool->b_work = false;
+        int i_open = __atomic_load_n( &p_pool->i_waiters, __ATOMIC_SEQ_CST );
+        pthread_mutex_unlock( &p_pool->lock );
+
+        maintain( p_pool, i_open );
+
+        pthread_mutex_lock( &p_pool->lock );
+    }
+    pthread_mutex_unlock( &p_pool->lock );
+    return NULL;
+}
+
+clientpool_t *clientpool_New( int i_max, int i_warm,
+                              const jsonrpc_sockopt_t *p_opt,
+                              int i_sock_flag, ... )
+{
+    if ( i_max <= 0 )
+    {
+        log_Err( "client pool of %d connections", i_max );
+        return NULL;
+    }
+    clientpool_t *p_pool = calloc( 1, sizeof(clientpool_t) );
+    if ( !p_pool )
+    {
+        log_Err( "no memory" );
+        return NULL;
+    }
+    p_pool->i_sock_type = i_sock_flag;
+    p_pool->i_max = i_max;
+    if ( p_opt )
+        p_pool->sockopt = *p_opt;
+
+    va_list args;
+    va_start( args, i_sock_flag );
+    if ( i_sock_flag == AF_INET || i_sock_flag == PF_INET )
+    {
+        p_pool->psz_name = strdup( va_arg( args, const char * ) );
+        p_pool->i_port = va_arg( args, int );
+    }
+    else if ( i_sock_flag == AF_UNIX || i_sock_flag == PF_UNIX )
+        p_pool->psz_name = strdup( va_arg( args, const char * ) );
+    else
+    {
+        va_end( args );
+        log_Err( "sock flag %d is unknown", i_sock_flag );
+        free( p_pool );
+        return NULL;
+    }
+    va_end( args );
+
+    p_pool->p_slots = calloc( i_max, sizeof(clientpool_slot_t) );
+    if ( !p_pool->psz_name || !p_pool->p_slots )
+    {
+        log_Err( "no memory" );
+        goto error;
+    }
+    for ( int i = 0; i < i_max && i < i_warm; i++ )
+    {
+        if ( open_slot( p_pool, &p_pool->p_slots[i] ) < 0 )
+            p_pool->p_slots[i].i_state = SLOT_BROKEN;
+        else
+            p_pool->p_slots[i].i_state = SLOT_IDLE;
+    }
+
+    pthread_mutex_init( &p_pool->lock, NULL );
+    pthread_cond_init( &p_pool->wake, NULL );
+    pthread_cond_init( &p_pool->ready, NULL );
+    if ( pthread_create( &p_pool->thread, NULL, clientpool_thread, p_pool ) )
+    {
+        log_Err( "create client pool thread failed" );
+        pthread_mutex_destroy( &p_pool->lock );
+        pthread_cond_destroy( &p_pool->wake );
+        pthread_cond_destroy( &p_pool->ready );
+        goto error;
+    }
+    return p_pool;
+
+error:
+    if ( p_pool->p_slots )
+    {
+        for ( int i = 0; i < i_max; i++ )
+            if ( p_pool->p_slots[i].b_open )
+                p_pool->p_slots[i].client.pf_exit( &p_pool->p_slots[i].client );
+    }
+    free( p_pool->p_slots );
+    free( p_pool->psz_name );
+    free( p_pool );
+    return NULL;
+}
+
+void clientpool_Delete( clientpool_t *p_pool )
+{
+    if ( !p_pool )
+        return;
+    pthread_mutex_lock( &p_pool->lock );
+    p_pool->b_stop = true;
+    pthread_cond_signal( &p_pool->wake );
+    pthread_cond_broadcast( &p_pool->ready );
+    pthread_mutex_unlock( &p_pool->lock );
+    pthread_join( p_pool->thread, NULL );
+
+    for ( int i = 0; i < p_pool->i_max; i++ )
+    {
+        clientpool_slot_t *p_slot = &p_pool->p_slots[i];
+        if ( p_slot->i_state == SLOT_BUSY )
+            log_Warn( "client pool: connection %d still borrowed", i );
+        if ( p_slot->b_open )
+            p_slot->client.pf_exit( &p_slot->client );
+    }
+    pthread_mutex_destroy( &p_pool->lock );
+    pthread_cond_destroy( &p_pool->wake );
+    pthread_cond_destroy( &p_pool->ready );
+    free( p_pool->p_slots );
+    free( p_pool->psz_name );
+    free( p_pool );
+}
+
+static jsonrpc_client_t *try_get( clientpool_t *p_pool )
+{
+    int i_start = sg_i_hint;
+    for ( int i = 0; i < p_pool->i_max; i++ )
+    {
+        int k = ( i_start + i ) % p_pool->i_max;
+        clientpool_slot_t *p_slot = &p_pool->p_slots[k];
+        int i_state = SLOT_IDLE;
+        if ( __atomic_load_n( &p_slot->i_state, __ATOMIC_RELAXED ) ==
+                 SLOT_IDLE &&
+             __atomic_compare_exchange_n( &p_slot->i_state, &i_state,
+                                          SLOT_BUSY, false, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_RELAXED ) )
+        {
+            sg_i_hint = k;
+            return &p_slot->client;
+        }
+    }
+    return NULL;
+}
+
+jsonrpc_client_t *clientpool_Get( clientpool_t *p_pool, int i_timeout )
+{
+    jsonrpc_client_t *p_client = try_get( p_pool );
+    if ( p_client )
+        return p_client;
+
+    // slow path: every connection is busy, broken or not opened yet
+    uint64_t i_deadline = jsonrpc_mdate() + i_timeout;
+    pthread_mutex_lock( &p_pool->lock );
+    // clientpool_Put looks at i_waiters after making its slot idle, so
+    // either it signals or try_get finds the slot
+    __atomic_add_fetch( &p_pool->i_waiters, 1, __ATOMIC_SEQ_CST );
+    wake_thread( p_pool );
+    while ( !( p_client = try_get( p_pool ) ) && !p_pool->b_stop )
+    {
+        uint64_t i_wait = CLIENTPOOL_CHECK_MS * 1000ULL;
+        if ( i_timeout > 0 )
+        {
+            uint64_t i_now = jsonrpc_mdate();
+            if ( i_now >= i_deadline )
+                break;
+            if ( i_deadline - i_now < i_wait )
+                i_wait = i_deadline - i_now;
+        }
+        struct timespec ts;
+        deadline( &ts, i_wait );
+        pthread_cond_timedwait( &p_pool->ready, &p_pool->lock, &ts );
+    }
+    __atomic_sub_fetch( &p_pool->i_waiters, 1, __ATOMIC_SEQ_CST );
+    pthread_mutex_unlock( &p_pool->lock );
+    if ( !p_client )
+        log_Warn( "client pool: no connection within %d us", i_timeout );
+    return p_client;
+}
+
+void clientpool_Put( clientpool_t *p_pool, jsonrpc_client_t *p_client )
+{
+    clientpool_slot_t *p_slot = (clientpool_slot_t*)p_client;
+    if ( p_client->b_error )
+    {
+        __atomic_store_n( &p_slot->i_state, SLOT_BROKEN, __ATOMIC_RELEASE );
+        pthread_mutex_lock( &p_pool->lock );
+        wake_thread( p_pool );
+        pthread_mutex_unlock( &p_pool->lock );
+        return;
+    }
+    __atomic_store_n( &p_slot->i_last, jsonrpc_mdate(), __ATOMIC_RELAXED );
+    __atomic_store_n( &p_slot->i_state, SLOT_IDLE, __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &p_pool->i_waiters, __ATOMIC_SEQ_CST ) > 0 )
+    {
+        pthread_mutex_lock( &p_pool->lock );
+        pthread_cond_signal( &p_pool->ready );
+        pthread_mutex_unlock( &p_pool->lock );
+    }
+}
@@ -0,0 +1,44 @@
+// file : clientpool.h
+// date : 2026-10-19
+// desc : pool of rpc connections to one endpoint, shared by threads. A
+//        thread borrows a jsonrpc_client_t with clientpool_Get, calls
+//        through it alone and gives it back with clientpool_Put. Taking
+//        and giving back an idle connection is a compare and swap on its
+//        slot, no lock. A background thread opens the connections (up to
+//        i_max, i_warm of them at clientpool_New), replaces the broken
+//        ones and checks the idle ones, so callers never connect.
+//
+
+#ifndef JSONRPC_CLIENTPOOL_H
+#define JSONRPC_CLIENTPOOL_H
+
+#include "jsonrpc_client.h"
+#include "sockopt.h"
+
+#define CLIENTPOOL_CHECK_MS 1000    // the background thread wakes up at least
+#define CLIENTPOOL_IDLE_MS  5000    // idle connections older are checked
+
+typedef struct clientpool_t clientpool_t;
+
+/*
+ * p_opt may be NULL. Then the same arguments as jsonrpc_client_init:
+ * if i_sock_flag is AF_UNIX or PF_UNIX,
+ *      const char* psz_conn_file
+ * else if AF_INET or PF_INET,
+ *      const char* psz_server_name, int i_port
+ * The i_warm connections which cannot be opened are retried in the
+ * background. NULL on error.
+ */
+clientpool_t *clientpool_New( int i_max, int i_warm,
+                              const jsonrpc_sockopt_t *p_opt,
+                              int i_sock_flag, ... );
+// every connection must have been given back
+void clientpool_Delete( clientpool_t *p_pool );
+
+// an idle connection, waiting at most i_timeout microseconds (0 forever)
+// when all are busy. NULL on timeout.
+jsonrpc_client_t *clientpool_Get( clientpool_t *p_pool, int i_timeout );
+// a connection left with b_error is replaced in the background
+void clientpool_Put( clientpool_t *p_pool, jsonrpc_client_t *p_client );
+
+#endif
@@ -0,0 +1,325 @@
+// file : fdblob.c
+// date : 2026-10-19
+// desc : binary blobs passed by descriptor over unix sockets
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include "fdblob.h"
+#include "log.h"
+#include "common.h"
+
+// a view can change under the handler, or fault past a shrunk end,
+// without these
+#define FDBLOB_SEALS ( F_SEAL_WRITE | F_SEAL_SHRINK )
+
+int fdblob_Collect( fdblob_queue_t *p_queue, struct msghdr *p_msg )
+{
+    int i_ret = ( p_msg->msg_flags & MSG_CTRUNC ) ? -1 : 0;
+    for ( struct cmsghdr *p_cmsg = CMSG_FIRSTHDR( p_msg ); p_cmsg;
+          p_cmsg = CMSG_NXTHDR( p_msg, p_cmsg ) )
+    {
+        if ( p_cmsg->cmsg_level != SOL_SOCKET ||
+             p_cmsg->cmsg_type != SCM_RIGHTS )
+            continue;
+        int i_fds = ( p_cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof(int);
+        for ( int i = 0; i < i_fds; i++ )
+        {
+            int i_fd;
+            memcpy( &i_fd, CMSG_DATA( p_cmsg ) + i * sizeof(int),
+                    sizeof(int) );
+            if ( p_queue->i_fds < FDBLOB_QUEUE )
+                p_queue->pi_fds[p_queue->i_fds++] = i_fd;
+            else
+            {
+                close( i_fd );
+                i_ret = -1;
+            }
+        }
+    }
+    if ( i_ret < 0 )
+        log_Err( "blob descriptors lost, %d queued", p_queue->i_fds );
+    return i_ret;
+}
+
+static const char *skip_space( const char *psz, const char *psz_end )
+{
+    while ( psz < psz_end &&
+            ( *psz == ' ' || *psz == '\t' || *psz == '\r' || *psz == '\n' ) )
+        psz++;
+    return psz;
+}
+
+// N of a request starting with {"blobs":N, 0 when it does not
+static int blob_count( const uint8_t *p_msg, size_t i_msg )
+{
+    static const char psz_key[] = "\"blobs\"";
+    const char *psz_end = (const char*)p_msg + i_msg;
+    const char *psz = skip_space( (const char*)p_msg, psz_end );
+    if ( psz == psz_end || *psz != '{' )
+        return 0;
+    psz = skip_space( psz + 1, psz_end );
+    if ( psz_end - psz < (ptrdiff_t)sizeof(psz_key) - 1 ||
+         memcmp( psz, psz_key, sizeof(psz_key) - 1 ) )
+        return 0;
+    psz = skip_space( psz + sizeof(psz_key) - 1, psz_end );
+    if ( psz == psz_end || *psz != ':' )
+        return 0;
+    psz = skip_space( psz + 1, psz_end );
+    int i_count = 0;
+    while ( psz < psz_end && *psz >= '0' && *psz <= '9' &&
+            i_count <= FDBLOB_MAX )
+        i_count = i_count * 10 + ( *psz++ - '0' );
+    return i_count;
+}
+
+int fdblob_Take( fdblob_queue_t *p_queue, const uint8_t *p_msg, size_t i_msg )
+{
+    fdblob_Release( p_queue );
+    int i_count = blob_count( p_msg, i_msg );
+    if ( i_count == 0 )
+        return 0;
+    if ( i_count > FDBLOB_MAX || i_count > p_queue->i_fds )
+    {
+        log_Err( "request has %d blobs, %d received", i_count,
+                 p_queue->i_fds );
+        return -1;
+    }
+    for ( int i = 0; i < i_count; i++ )
+    {
+        p_queue->blobs[i].i_fd = p_queue->pi_fds[i];
+        p_queue->blobs[i].p_data = NULL;
+        p_queue->blobs[i].i_size = 0;
+    }
+    p_queue->i_blobs = i_count;
+    p_queue->i_fds -= i_count;
+    memmove( p_queue->pi_fds, p_queue->pi_fds + i_count,
+             p_queue->i_fds * sizeof(int) );
+    return i_count;
+}
+
+void fdblob_Release( fdblob_queue_t *p_queue )
+{
+    for ( int i = 0; i < p_queue->i_blobs; i++ )
+    {
+        fdblob_t *p_blob = &p_queue->blobs[i];
+        if ( p_blob->p_data && p_blob->i_size > 0 )
+            munmap( (void*)p_blob->p_data, p_blob->i_size );
+        close( p_blob->i_fd );
+    }
+    p_queue->i_blobs = 0;
+}
+
+void fdblob_Clean( fdblob_queue_t *p_queue )
+{
+    fdblob_Release( p_queue );
+    for ( int i = 0; i < p_queue->i_fds; i++ )
+        close( p_queue->pi_fds[i] );
+    p_queue->i_fds = 0;
+    fdblob_Detach( p_queue );
+    for ( int i = 0; i < p_queue->i_batches; i++ )
+        for ( int j = 0; j < p_queue->batches[i].i_fds; j++ )
+            close( p_queue->batches[i].pi_fds[j] );
+    p_queue->i_batches = 0;
+}
+
+int fdblob_Attach( fdblob_queue_t *p_queue, int i_fd )
+{
+    if ( p_queue->i_attached == FDBLOB_MAX )
+    {
+        log_Err( "more than %d blobs in a response", FDBLOB_MAX );
+        close( i_fd );
+        return -1;
+    }
+    p_queue->pi_attached[p_queue->i_attached] = i_fd;
+    return p_queue->i_attached++;
+}
+
+void fdblob_Detach( fdblob_queue_t *p_queue )
+{
+    for ( int i = 0; i < p_queue->i_attached; i++ )
+        close( p_queue->pi_attached[i] );
+    p_queue->i_attached = 0;
+}
+
+int fdblob_Queue( fdblob_queue_t *p_queue, size_t i_offset, block_t *p_res )
+{
+    uint8_t *p = p_res->p_buffer;
+    if ( p_res->i_buffer < 2 || p[0] != '{' ||
+         p_queue->i_batches == FDBLOB_BATCHES )
+    {
+        log_Err( "response can not carry its %d blobs, dropped",
+                 p_queue->i_attached );
+        fdblob_Detach( p_queue );
+        return -1;
+    }
+    // the client takes them by the same prefix as the server (blob_count)
+    char psz_prefix[32];
+    int i_prefix = snprintf( psz_prefix, sizeof(psz_prefix), "\"blobs\":%d%s",
+                             p_queue->i_attached, p[1] == '}' ? "" : "," );
+    if ( block_Reserve( p_res, i_prefix ) < 0 )
+    {
+        log_Err( "no memory, response blobs dropped" );
+        fdblob_Detach( p_queue );
+        return -1;
+    }
+    p = p_res->p_buffer;
+    memmove( p + 1 + i_prefix, p + 1, p_res->i_buffer - 1 );
+    memcpy( p + 1, psz_prefix, i_prefix );
+    p_res->i_buffer += i_prefix;
+
+    fdblob_batch_t *p_batch = &p_queue->batches[p_queue->i_batches++];
+    p_batch->i_offset = i_offset;
+    memcpy( p_batch->pi_fds, p_queue->pi_attached,
+            p_queue->i_attached * sizeof(int) );
+    p_batch->i_fds = p_queue->i_attached;
+    p_queue->i_attached = 0;
+    return 0;
+}
+
+size_t fdblob_Next( fdblob_queue_t *p_queue, size_t i_data,
+                    const int **ppi_fds, int *pi_fds )
+{
+    *pi_fds = 0;
+    if ( p_queue->i_batches == 0 )
+        return i_data;
+    fdblob_batch_t *p_batch = &p_queue->batches[0];
+    size_t i_end = p_batch->i_offset;
+    if ( i_end == 0 )
+    {
+        *ppi_fds = p_batch->pi_fds;
+        *pi_fds = p_batch->i_fds;
+        i_end = p_queue->i_batches > 1 ? p_batch[1].i_offset : i_data;
+    }
+    return i_end < i_data ? i_end : i_data;
+}
+
+void fdblob_Sent( fdblob_queue_t *p_queue, size_t i_sent )
+{
+    if ( i_sent == 0 || p_queue->i_batches == 0 )
+        return;
+    // fdblob_Next gave the descriptors of the batch at 0 to this send
+    if ( p_queue->batches[0].i_offset == 0 )
+    {
+        for ( int i = 0; i < p_queue->batches[0].i_fds; i++ )
+            close( p_queue->batches[0].pi_fds[i] );
+        p_queue->i_batches--;
+        memmove( p_queue->batches, p_queue->batches + 1,
+                 p_queue->i_batches * sizeof(fdblob_batch_t) );
+    }
+    for ( int i = 0; i < p_queue->i_batches; i++ )
+        p_queue->batches[i].i_offset -= i_sent;
+}
+
+const uint8_t *fdblob_Map( fdblob_queue_t *p_queue, int k, size_t *pi_size )
+{
+    if ( k < 0 || k >= p_queue->i_blobs )
+        return NULL;
+    fdblob_t *p_blob = &p_queue->blobs[k];
+    if ( !p_blob->p_data )
+    {
+        int i_seals = fcntl( p_blob->i_fd, F_GET_SEALS );
+        if ( i_seals < 0 || ( i_seals & FDBLOB_SEALS ) != FDBLOB_SEALS )
+        {
+            log_Err( "blob %d is not a sealed memfd", k );
+            return NULL;
+        }
+        struct stat st;
+        if ( fstat( p_blob->i_fd, &st ) < 0 )
+        {
+            log_Err( "blob %d fstat failed (%s)", k, strerror( errno ) );
+            return NULL;
+        }
+        // nothing to map, any pointer does
+        if ( st.st_size == 0 )
+            p_blob->p_data = (const uint8_t*)"";
+        else
+        {
+            void *p_map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED,
+                                p_blob->i_fd, 0 );
+            if ( p_map == MAP_FAILED )
+            {
+                log_Err( "blob %d mmap failed (%s)", k, strerror( errno ) );
+                return NULL;
+            }
+            p_blob->p_data = p_map;
+        }
+        p_blob->i_size = st.st_size;
+    }
+    *pi_size = p_blob->i_size;
+    return p_blob->p_data;
+}
+
+int fdblob_Create( const void *p_data, size_t i_size )
+{
+    int i_fd = memfd_create( "jsonrpc-blob", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+    if ( i_fd < 0 )
+    {
+        log_Err( "memfd_create failed (%s)", strerror( errno ) );
+        return -1;
+    }
+    const uint8_t *p_buf = p_data;
+    while ( i_size > 0 )
+    {
+        ssize_t i_ret = write( i_fd, p_buf, i_size );
+        if ( i_ret < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            log_Err( "blob write failed (%s)", strerror( errno ) );
+            close( i_fd );
+            return -1;
+        }
+        p_buf += i_ret;
+        i_size -= i_ret;
+    }
+    if ( fcntl( i_fd, F_ADD_SEALS, FDBLOB_SEALS | F_SEAL_GROW | F_SEAL_SEAL ) )
+    {
+        log_Err( "blob seal failed (%s)", strerror( errno ) );
+        close( i_fd );
+        return -1;
+    }
+    return i_fd;
+}
+
+ssize_t fdblob_Send( int i_sock, const uint8_t *p_data, size_t i_data,
+                     const int *pi_fds, int i_fds )
+{
+    struct iovec iov;
+    iov.iov_base = (void*)p_data;
+    iov.iov_len = i_data;
+
+    union
+    {
+        struct cmsghdr align;
+        char buf[ FDBLOB_CONTROL ];
+    } control;
+
+    struct msghdr msg;
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if ( i_fds > 0 )
+    {
+        if ( i_fds > FDBLOB_MAX )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE( sizeof(int) * i_fds );
+        struct cmsghdr *p_cmsg = CMSG_FIRSTHDR( &msg );
+        p_cmsg->cmsg_level = SOL_SOCKET;
+        p_cmsg->cmsg_type = SCM_RIGHTS;
+        p_cmsg->cmsg_len = CMSG_LEN( sizeof(int) * i_fds );
+        memcpy( CMSG_DATA( p_cmsg ), pi_fds, sizeof(int) * i_fds );
+    }
+    return sendmsg( i_sock, &msg, MSG_NOSIGNAL );
+}
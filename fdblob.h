@@ -0,0 +1,93 @@
+// file : fdblob.h
+// date : 2026-10-19
+// desc : binary blobs passed by descriptor over unix sockets. A request
+//        starting with {"blobs":N carries N sealed memfds (SCM_RIGHTS) with
+//        its first byte, its params refer to them as {"$blob":k}. The
+//        server keeps the received descriptors in order and hands the
+//        handler a read-only mapping, the bytes are never copied.
+//        Responses carry blobs the same way, server to client.
+//
+
+#ifndef JSONRPC_FDBLOB_H
+#define JSONRPC_FDBLOB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include "block.h"
+
+#define FDBLOB_MAX   16                     // per request
+#define FDBLOB_QUEUE 64                     // received, not taken yet
+#define FDBLOB_BATCHES 8                    // responses with blobs unsent
+#define FDBLOB_CONTROL CMSG_SPACE( sizeof(int) * FDBLOB_MAX )
+
+typedef struct fdblob_t
+{
+    int            i_fd;
+    const uint8_t *p_data;                  // mapped on first use
+    size_t         i_size;
+} fdblob_t;
+
+// the descriptors of a response, sent with its first byte
+typedef struct fdblob_batch_t
+{
+    size_t i_offset;                        // of that byte in the unsent
+    // output
+    int    pi_fds[FDBLOB_MAX];
+    int    i_fds;
+} fdblob_batch_t;
+
+typedef struct fdblob_queue_t
+{
+    int      pi_fds[FDBLOB_QUEUE];          // received, in order
+    int      i_fds;
+    fdblob_t blobs[FDBLOB_MAX];             // of the request being handled
+    int      i_blobs;
+
+    // server side, going out
+    int      pi_attached[FDBLOB_MAX];       // to the response being built
+    int      i_attached;
+    fdblob_batch_t batches[FDBLOB_BATCHES]; // queued responses, in order
+    int      i_batches;
+} fdblob_queue_t;
+
+// append the descriptors of a received message, -1 (they are closed) when
+// the control data was cut or the queue is full
+int  fdblob_Collect( fdblob_queue_t *p_queue, struct msghdr *p_msg );
+// take the descriptors of the framed request p_msg, -1 when it asks for
+// more than were received
+int  fdblob_Take( fdblob_queue_t *p_queue, const uint8_t *p_msg,
+                  size_t i_msg );
+// unmap and close the blobs taken by the last request
+void fdblob_Release( fdblob_queue_t *p_queue );
+// and the ones still queued, both ways
+void fdblob_Clean( fdblob_queue_t *p_queue );
+
+// read-only view of blob k of the current request, NULL when it does not
+// exist or the memfd is not sealed against writing and shrinking
+const uint8_t *fdblob_Map( fdblob_queue_t *p_queue, int k, size_t *pi_size );
+
+// server side, i_fd (taken) goes with the response being built: its index
+// k, or -1 (i_fd closed) when it has FDBLOB_MAX already
+int  fdblob_Attach( fdblob_queue_t *p_queue, int i_fd );
+// close the attached ones, the response goes without them
+void fdblob_Detach( fdblob_queue_t *p_queue );
+// the response being built is queued i_offset bytes into the unsent output:
+// p_res gets its {"blobs":N, prefix. -1 (detached) when it is not an
+// object, FDBLOB_BATCHES wait already or on no memory.
+int  fdblob_Queue( fdblob_queue_t *p_queue, size_t i_offset,
+                   block_t *p_res );
+// of the i_data unsent bytes, how many the next send takes: up to the next
+// response with blobs. *pi_fds of *ppi_fds go with the first one.
+size_t fdblob_Next( fdblob_queue_t *p_queue, size_t i_data,
+                    const int **ppi_fds, int *pi_fds );
+// i_sent bytes of the last fdblob_Next went out, their descriptors with them
+void fdblob_Sent( fdblob_queue_t *p_queue, size_t i_sent );
+
+// client side, a sealed memfd holding a copy of p_data, -1 on error
+int  fdblob_Create( const void *p_data, size_t i_size );
+// one sendmsg of p_data with the descriptors attached, as send
+ssize_t fdblob_Send( int i_sock, const uint8_t *p_data, size_t i_data,
+                     const int *pi_fds, int i_fds );
+
+#endif
@@ -0,0 +1,166 @@
+// file : handoff.c
+// date : 2026-10-19
+// desc : pass sockets to another process over a unix socket
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "handoff.h"
+#include "log.h"
+#include "common.h"
+
+static int write_all( int i_sock, const uint8_t *p_buf, size_t i_buf )
+{
+    while ( i_buf > 0 )
+    {
+        ssize_t i_ret = send( i_sock, p_buf, i_buf, MSG_NOSIGNAL );
+        if ( i_ret < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+        p_buf += i_ret;
+        i_buf -= i_ret;
+    }
+    return 0;
+}
+
+static int read_all( int i_sock, uint8_t *p_buf, size_t i_buf )
+{
+    while ( i_buf > 0 )
+    {
+        ssize_t i_ret = recv( i_sock, p_buf, i_buf, 0 );
+        if ( i_ret < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+        if ( i_ret == 0 )
+        {
+            errno = ECONNRESET;
+            return -1;
+        }
+        p_buf += i_ret;
+        i_buf -= i_ret;
+    }
+    return 0;
+}
+
+int handoff_Send( int i_sock, const handoff_msg_t *p_msg, int i_fd,
+                  const void *p_payload )
+{
+    struct iovec iov;
+    iov.iov_base = (void*)p_msg;
+    iov.iov_len = sizeof(handoff_msg_t);
+
+    union
+    {
+        struct cmsghdr align;
+        char buf[ CMSG_SPACE(sizeof(int)) ];
+    } control;
+
+    struct msghdr msg;
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if ( i_fd >= 0 )
+    {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *p_cmsg = CMSG_FIRSTHDR( &msg );
+        p_cmsg->cmsg_level = SOL_SOCKET;
+        p_cmsg->cmsg_type = SCM_RIGHTS;
+        p_cmsg->cmsg_len = CMSG_LEN( sizeof(int) );
+        memcpy( CMSG_DATA( p_cmsg ), &i_fd, sizeof(int) );
+    }
+
+    ssize_t i_ret;
+    do
+        i_ret = sendmsg( i_sock, &msg, MSG_NOSIGNAL );
+    while ( i_ret < 0 && errno == EINTR );
+    if ( i_ret < 0 )
+    {
+        log_Err( "handoff sendmsg failed (%s)", strerror( errno ) );
+        return -1;
+    }
+    // the descriptor went with the first byte, finish the header
+    if ( write_all( i_sock, (const uint8_t*)p_msg + i_ret,
+                    sizeof(handoff_msg_t) - i_ret ) < 0 ||
+         write_all( i_sock, p_payload, p_msg->i_payload ) < 0 )
+    {
+        log_Err( "handoff send failed (%s)", strerror( errno ) );
+        return -1;
+    }
+    return 0;
+}
+
+int handoff_Recv( int i_sock, handoff_msg_t *p_msg, int *pi_fd,
+                  uint8_t **pp_payload )
+{
+    *pi_fd = -1;
+    *pp_payload = NULL;
+
+    struct iovec iov;
+    iov.iov_base = p_msg;
+    iov.iov_len = sizeof(handoff_msg_t);
+
+    union
+    {
+        struct cmsghdr align;
+        char buf[ CMSG_SPACE(sizeof(int)) ];
+    } control;
+
+    struct msghdr msg;
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t i_ret;
+    do
+        i_ret = recvmsg( i_sock, &msg, MSG_CMSG_CLOEXEC );
+    while ( i_ret < 0 && errno == EINTR );
+    if ( i_ret <= 0 )
+    {
+        if ( i_ret < 0 )
+            log_Err( "handoff recvmsg failed (%s)", strerror( errno ) );
+        return -1;
+    }
+
+    struct cmsghdr *p_cmsg = CMSG_FIRSTHDR( &msg );
+    if ( p_cmsg && p_cmsg->cmsg_level == SOL_SOCKET &&
+         p_cmsg->cmsg_type == SCM_RIGHTS )
+        memcpy( pi_fd, CMSG_DATA( p_cmsg ), sizeof(int) );
+
+    if ( read_all( i_sock, (uint8_t*)p_msg + i_ret,
+                   sizeof(handoff_msg_t) - i_ret ) < 0 )
+        goto error;
+
+    if ( p_msg->i_payload > 0 )
+    {
+        *pp_payload = malloc( p_msg->i_payload );
+        if ( !*pp_payload )
+        {
+            log_Err( "no memory" );
+            goto error;
+        }
+        if ( read_all( i_sock, *pp_payload, p_msg->i_payload ) < 0 )
+            goto error;
+    }
+    return 0;
+
+error:
+    log_Err( "handoff recv failed (%s)", strerror( errno ) );
+    if ( *pi_fd >= 0 )
+        close( *pi_fd );
+    *pi_fd = -1;
+    free( *pp_payload );
+    *pp_payload = NULL;
+    return -1;
+}
@@ -0,0 +1,40 @@
+// file : handoff.h
+// date : 2026-10-19
+// desc : pass sockets to another process over a unix socket (SCM_RIGHTS),
+//        used to upgrade a server without dropping its listeners and
+//        connections.
+//
+
+#ifndef JSONRPC_HANDOFF_H
+#define JSONRPC_HANDOFF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum handoff_kind
+{
+    HANDOFF_LISTENER = 1,       // i_arg is the family, strings: bind
+    // file, connection options (sockopt_Format)
+    HANDOFF_LISTENERS_END,      // every listener has been sent
+    HANDOFF_CONN,               // i_arg is the conn state, strings: ip,
+    // protocol, notify services; data: buffered partial request
+    HANDOFF_END,                // sender is done and exits
+};
+
+typedef struct handoff_msg_t
+{
+    uint32_t i_kind;
+    int32_t  i_arg;
+    uint32_t i_strings;         // count of '\0' terminated strings
+    uint32_t i_payload;         // bytes following the header
+} handoff_msg_t;
+
+// send p_msg with i_fd attached (-1 for none), followed by i_payload bytes
+int handoff_Send( int i_sock, const handoff_msg_t *p_msg, int i_fd,
+                  const void *p_payload );
+// *pi_fd is -1 when no descriptor came with the message, *pp_payload is
+// malloc'ed (NULL when empty) and freed by the caller
+int handoff_Recv( int i_sock, handoff_msg_t *p_msg, int *pi_fd,
+                  uint8_t **pp_payload );
+
+#endif
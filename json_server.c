@@ -51,7 +51,7 @@ static int open_tcp_socket( json_server *p_this, const char *psz_ip, int i_port
     if ( bind( p_this->tcpsock, (struct sockaddr* )&addrin, sizeof(addrin) ) < 0 )
         return -1;
 
-    if ( listen( p_this->tcpsock, 5 ) < 0 )
+    if ( listen( p_this->tcpsock, LISTEN_BACKLOG ) < 0 )
         return -1;
 
     return 0;
@@ -375,11 +375,12 @@ static int json_server_main_loop( json_server *p_this )
 				{
 					while ( true )
 					{ 
-						int client_fd = accept( events[i].data.fd, (struct sockaddr *)&client_addr, &addrlen );
+						addrlen = sizeof(client_addr);
+						int client_fd = accept4( events[i].data.fd, (struct sockaddr *)&client_addr, &addrlen,
+												 SOCK_NONBLOCK | SOCK_CLOEXEC );
 						if ( client_fd < 0 )
 							break;
 
-						socket_setblocking( client_fd, 0 );
 						struct epoll_event event;
 						event.events = EPOLLIN | EPOLLET;
 						event.data.fd = client_fd;
@@ -25,7 +25,7 @@
 #include "http_parser.h"
 
 
-#define LISTEN_BACKLOG 5
+#define LISTEN_BACKLOG SOMAXCONN
 
 #define EPOLL_SIZE 1024
 #define EPOLL_MAX_EVENT 64
@@ -6,58 +6,47 @@
 
 #include "jsonrpc_server.h"
 
-static bool JsonOrWs_request_IsComplete( jsonrpc_server_t *p_server,
-        block_t *p_req, size_t *pi_len );
-static int handle_JsonOrWs_request( jsonrpc_server_t *p_server,
-                                    block_t *p_req, block_t *p_res );
+static const jsonrpc_protocol_t *JsonOrWs_select( jsonrpc_server_t *p_this,
+                                                  const block_t *p_req );
+
+static void protocol_init( jsonrpc_protocol_t *p_proto,
+                           const jsonrpc_server_t *p_impl )
+{
+    p_proto->pf_request_IsComplete = p_impl->pf_request_IsComplete;
+    p_proto->pf_handle_handshake = p_impl->pf_handle_handshake;
+    p_proto->pf_handle_request = p_impl->pf_handle_request;
+    p_proto->pf_request_Text = p_impl->pf_request_Text;
+}
 
 int JsonrpcPlusWs_server_init( JsonrpcPlusWs_server_t *p_server )
 {
     jsonrpc_server_t *p_this = (jsonrpc_server_t *)p_server;
     jsonrpc_server_init( p_this );
 
-    p_this->pf_request_IsComplete = JsonOrWs_request_IsComplete;
-    p_this->pf_handle_request = handle_JsonOrWs_request;
+    // each connection is pinned to one of them on its first bytes
+    p_this->pf_select_protocol = JsonOrWs_select;
 
     jsonrpc_server_init( &p_server->jsonBase );
     ws_jsonrpc_server_init( &p_server->wsBase );
+    protocol_init( &p_server->json, &p_server->jsonBase );
+    protocol_init( &p_server->ws, &p_server->wsBase.self );
     return 0;
 }
 
-
-static bool IsJsonRequest( block_t *p_req );
-
-
-static bool JsonOrWs_request_IsComplete( jsonrpc_server_t *p_this,
-        block_t *p_req, size_t *pi_len )
+// a json message may start with whitespace, anything else is deemed
+// websocket (its handshake starts with GET)
+static const jsonrpc_protocol_t *JsonOrWs_select( jsonrpc_server_t *p_this,
+                                                  const block_t *p_req )
 {
     JsonrpcPlusWs_server_t *p_server = (JsonrpcPlusWs_server_t *)p_this;
-
-    if ( IsJsonRequest( p_req ) )
-        return p_server->jsonBase.pf_request_IsComplete( p_this, p_req, pi_len);
-    else
-        // deam the request is ws request
-        return p_server->wsBase.self.pf_request_IsComplete( p_this, p_req, pi_len );
-}
-
-static int handle_JsonOrWs_request( jsonrpc_server_t *p_this,
-                                    block_t *p_req, block_t *p_res )
-{
-    JsonrpcPlusWs_server_t *p_server = (JsonrpcPlusWs_server_t *)p_this;
-    if ( IsJsonRequest( p_req ) )
-        return p_server->jsonBase.pf_handle_request( p_this, p_req, p_res );
-    else
-        // deam the request is ws request
-        return p_server->wsBase.self.pf_handle_request( p_this, p_req, p_res );
-}
-
-static bool IsJsonRequest( block_t *p_req )
-{
-    if ( p_req->p_buffer[0] == '{' ||
-         ( p_req->p_buffer[0] == '\n' && p_req->p_buffer[1] == '{' ) )
-        return true;
-    else
-        return false;
+    for ( size_t i = 0; i < p_req->i_buffer; i++ )
+    {
+        uint8_t c = p_req->p_buffer[i];
+        if ( c == ' ' || c == '\t' || c == '\r' || c == '\n' )
+            continue;
+        return c == '{' ? &p_server->json : &p_server->ws;
+    }
+    return NULL;
 }
 
 /* TODO: may need this later
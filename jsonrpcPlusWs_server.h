@@ -15,6 +15,8 @@ struct JsonrpcPlusWs_server_t
 
     struct jsonrpc_server_t jsonBase;
     struct ws_jsonrpc_server_t wsBase;
+    jsonrpc_protocol_t json;                // their hooks
+    jsonrpc_protocol_t ws;
 };
 
 typedef struct JsonrpcPlusWs_server_t JsonrpcPlusWs_server_t;
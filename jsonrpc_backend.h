@@ -0,0 +1,93 @@
+// file : jsonrpc_backend.h
+// date : 2026-10-19
+// desc : the event loops serving a jsonrpc_server_t, epoll (serve_epoll in
+//        jsonrpc_server.c) and io_uring (jsonrpc_server_uring.c), and the
+//        part of the server they share. Internal, not installed.
+//
+
+#ifndef JSONRPC_BACKEND_H
+#define JSONRPC_BACKEND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "jsonrpc_server.h"
+#include "hashmap.h"
+
+#define LOOP_TIMEOUT 50             // ms, a loop wakes up at least
+#define BLOCK_KEEP (64 * 1024)      // larger buffers shrink once drained
+#define BLOCK_DEFAULT 8192
+
+#define BACKEND_FALLBACK 1          // pf_serve could not start, use epoll
+
+typedef struct jsonrpc_backend_t
+{
+    const char *psz_name;
+    // serve until the server stops: 0, -1 on error, or BACKEND_FALLBACK
+    // before anything was touched
+    int    (*pf_serve) ( jsonrpc_server_t *p_server );
+    // of a connection with p_backend state: the output it is sending and
+    // its buffer memory. NULL when the loop keeps none.
+    size_t (*pf_pending) ( jsonrpc_request_t *p_request );
+    size_t (*pf_mem) ( jsonrpc_request_t *p_request );
+    // copy up to i_size bytes received for p_request and not yet appended
+    // to p_req, for jsonrpc_request_IsCancelled. NULL when the loop leaves
+    // them in the socket.
+    size_t (*pf_received) ( jsonrpc_request_t *p_request, uint8_t *p_buf,
+                            size_t i_size );
+    bool   b_sendfile;              // Sendfile streams straight to the
+    // socket, else a window at a time through p_out
+} jsonrpc_backend_t;
+
+extern const jsonrpc_backend_t jsonrpc_backend_epoll;
+extern const jsonrpc_backend_t jsonrpc_backend_uring;
+
+/*
+ * what the loops share, all on the thread running the loop
+ */
+// SIGINT or SIGTERM was received
+bool server_Aborted( void );
+
+// sockopt_Apply and register an accepted connection in requestMap, epfd -1
+// when the loop arms its own reads. NULL on error, connfd stays open.
+jsonrpc_request_t *server_Accepted( jsonrpc_server_t *p_this, int epfd,
+                                    hashmap requestMap, int connfd,
+                                    const jsonrpc_listener_t *p_listener,
+                                    const struct sockaddr_storage *p_addr );
+// unregister a closing connection, the loop then server_Release's it
+void server_Closing( jsonrpc_server_t *p_this, hashmap requestMap,
+                     jsonrpc_request_t *p_request );
+// close the socket and free p_request
+void server_Release( jsonrpc_request_t *p_request );
+
+// handle what p_req holds, the responses queue in p_out
+void server_ProcessRequests( jsonrpc_server_t *p_server,
+                             jsonrpc_request_t *p_request );
+// the end of a loop iteration, before the output is sent
+void server_Processed( jsonrpc_server_t *p_this );
+
+// the connections with output queued during this iteration, linked by
+// p_next_flush. Each loop sends them once per iteration.
+void server_FlushLater( jsonrpc_request_t *p_request );
+jsonrpc_request_t *server_TakeFlush( void );
+bool server_HasFlush( void );
+// the output of a shared memory connection goes through its ring
+void server_ShmSend( jsonrpc_request_t *p_request );
+
+// memory budget, see i_mem_budget
+enum mem_relief
+{
+    MEM_WAIT,
+    MEM_RESUME,                     // resume every paused connection
+    MEM_SHED,                       // close the biggest paused connection
+};
+void server_MemAccount( jsonrpc_request_t *p_request );
+bool server_MemPause( jsonrpc_request_t *p_request );
+int  server_MemRelief( jsonrpc_server_t *p_this );
+jsonrpc_request_t *server_MemBiggestPaused( hashmap requestMap );
+
+// out of fds: the listeners stop until server_ListenResume says so
+void server_ListenPause( jsonrpc_server_t *p_this );
+bool server_ListenResume( jsonrpc_server_t *p_this, int *pi_sparefd );
+
+#endif
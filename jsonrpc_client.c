@@ -11,13 +11,18 @@
 #include <sys/un.h>
 #include <assert.h>
 #include <unistd.h>
+#include <poll.h>
 #include "jsonrpc_client.h"
 #include "socket.h"
 #include "log.h"
 #include "block.h"
 #include "jsonrpc_utils.h"
+#include "shmring.h"
 
 #define SOCKET_TIMEOUT  15000000        // 15 second
+#define SHM_WAIT        100000          // us, to notice a closed peer
+#define BLOCK_KEEP      (64 * 1024)     // larger buffers shrink once drained
+#define BLOCK_DEFAULT   8192
 
 extern int errno;
 
@@ -35,6 +40,9 @@ static int connect_tcp_socket( jsonrpc_client_t *p_this, const char *psz_name,
         log_Err( "open network socket failed (%s)", strerror( errno ) );
         return -1;
     }
+    // before connect, the receive buffer sets the window scale
+    if ( sockopt_Apply( p_this->sock, AF_INET, &p_this->sockopt ) < 0 )
+        return -1;
 
     // set connect timeout as 15 seconds
     if ( socket_settimeout( p_this->sock, SOCKET_TIMEOUT ) < 0 )
@@ -69,6 +77,8 @@ static int connect_unix_socket( jsonrpc_client_t *p_this,
         log_Err( "open unix socket failed (%s)", strerror( errno ) );
         return -1;
     }
+    if ( sockopt_Apply( p_this->sock, AF_UNIX, &p_this->sockopt ) < 0 )
+        return -1;
 
     // set connect timeout as 15 seconds
     if ( socket_settimeout( p_this->sock, SOCKET_TIMEOUT ) < 0 )
@@ -88,12 +98,172 @@ static int connect_unix_socket( jsonrpc_client_t *p_this,
     return 0;
 }
 
+static void shm_close( jsonrpc_client_t *p_this )
+{
+    if ( p_this->p_shm )
+    {
+        shm_Release( p_this->p_shm );
+        free( p_this->p_shm );
+        p_this->p_shm = NULL;
+    }
+}
+
+// a shared memory connection is waited on by futex, the socket only tells
+// when the server is gone
+static bool shm_peer_closed( jsonrpc_client_t *p_this )
+{
+    char c;
+    return recv( p_this->sock, &c, 1, MSG_PEEK | MSG_DONTWAIT ) == 0;
+}
+
+// socket_sendall through the ring when there is one
+static int client_send( jsonrpc_client_t *p_this, const uint8_t *p_data,
+                        int i_data )
+{
+    // the blobs go with the first byte. The request counts them, it is
+    // never sent without: on failure the call fails and the connection is
+    // dropped.
+    if ( p_this->i_blobs > 0 && i_data > 0 )
+    {
+        ssize_t i_ret;
+        while ( ( i_ret = fdblob_Send( p_this->sock, p_data, i_data,
+                                       p_this->pi_blobs,
+                                       p_this->i_blobs ) ) < 0 &&
+                errno == EINTR )
+            ;
+        if ( i_ret <= 0 )
+        {
+            // they belonged to the failed call
+            p_this->i_blobs = 0;
+            p_this->b_error = true;
+            return -1;
+        }
+        p_this->i_blobs = 0;
+        if ( i_ret == i_data )
+            return i_ret;
+        int i_sent = socket_sendall( p_this->sock, p_data + i_ret,
+                                     i_data - i_ret );
+        return i_sent < 0 ? i_ret : i_ret + i_sent;
+    }
+    if ( !p_this->p_shm )
+        return socket_sendall( p_this->sock, p_data, i_data );
+
+    int i_sent = 0;
+    int i_waited = 0;
+    while ( i_sent < i_data )
+    {
+        size_t i_ret = shm_Write( p_this->p_shm, p_data + i_sent,
+                                  i_data - i_sent );
+        i_sent += i_ret;
+        if ( i_ret > 0 )
+            i_waited = 0;
+        else if ( shm_Wait( p_this->p_shm, true, SHM_WAIT ) < 0 )
+        {
+            if ( shm_peer_closed( p_this ) )
+            {
+                errno = EPIPE;
+                break;
+            }
+            i_waited += SHM_WAIT;
+            if ( i_waited >= SOCKET_TIMEOUT )
+            {
+                errno = EAGAIN;
+                break;
+            }
+        }
+    }
+    return i_sent;
+}
+
+// recv taking the descriptors of the responses carrying blobs (fdblob.h)
+static int recv_blobs( jsonrpc_client_t *p_this, uint8_t *p_data, int i_data )
+{
+    struct iovec iov;
+    iov.iov_base = p_data;
+    iov.iov_len = i_data;
+    union
+    {
+        struct cmsghdr align;
+        char buf[ FDBLOB_CONTROL ];
+    } control;
+    struct msghdr msg;
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    int i_ret = recvmsg( p_this->sock, &msg, MSG_CMSG_CLOEXEC );
+    if ( i_ret <= 0 ||
+         ( msg.msg_controllen == 0 && !( msg.msg_flags & MSG_CTRUNC ) ) )
+        return i_ret;
+    if ( !p_this->p_rblobs &&
+         !( p_this->p_rblobs = calloc( 1, sizeof(fdblob_queue_t) ) ) )
+    {
+        // closes them
+        fdblob_queue_t lost;
+        memset( &lost, 0, sizeof(lost) );
+        log_Err( "no memory, response blobs lost" );
+        fdblob_Collect( &lost, &msg );
+        fdblob_Clean( &lost );
+        return i_ret;
+    }
+    fdblob_Collect( p_this->p_rblobs, &msg );
+    return i_ret;
+}
+
+// recv through the ring when there is one
+static int client_recv( jsonrpc_client_t *p_this, uint8_t *p_data,
+                        int i_data )
+{
+    if ( !p_this->p_shm )
+    {
+        if ( p_this->i_sock_type == AF_UNIX || p_this->i_sock_type == PF_UNIX )
+            return recv_blobs( p_this, p_data, i_data );
+        return recv( p_this->sock, p_data, i_data, 0 );
+    }
+
+    int i_waited = 0;
+    while ( true )
+    {
+        size_t i_ret = shm_Read( p_this->p_shm, p_data, i_data );
+        if ( i_ret > 0 )
+            return i_ret;
+        if ( shm_Wait( p_this->p_shm, false, SHM_WAIT ) == 0 )
+            continue;
+        if ( shm_peer_closed( p_this ) )
+        {
+            errno = 0;
+            return 0;
+        }
+        i_waited += SHM_WAIT;
+        if ( i_waited >= SOCKET_TIMEOUT )
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+}
+
 static int jsonrpc_client_reinit( jsonrpc_client_t *p_this )
 {
     int i_ret = -1;
     assert( p_this->b_error );
 
+    shm_close( p_this );
     close( p_this->sock );
+    if ( p_this->p_rblobs )
+        fdblob_Clean( p_this->p_rblobs );
+
+    // what was received on the lost connection
+    if ( !p_this->p_buf && !( p_this->p_buf = block_Alloc( BLOCK_DEFAULT ) ) )
+    {
+        log_Err( "no memory" );
+        return -1;
+    }
+    p_this->p_buf->i_buffer = 0;
+    p_this->i_scanned = 0;
+    p_this->i_braces = 0;
 
     if ( p_this->i_sock_type == AF_UNIX || p_this->i_sock_type == PF_UNIX )
     {
@@ -120,29 +290,54 @@ static int jsonrpc_client_reinit( jsonrpc_client_t *p_this )
     return 0;
 }
 
-static int read_response( jsonrpc_client_t *p_this, block_t *p_block )
+// read until p_buf starts with a complete response, of *pi_len bytes. The
+// bytes after it stay in p_buf for the next call.
+static int read_response( jsonrpc_client_t *p_this, size_t *pi_len )
 {
     int i_read;
-    int fd = p_this->sock;
 
     while ( true )
     {
-        if ( p_block->i_buffer + 4096 >= p_block->i_maxlen )
+        block_t *p_buf = p_this->p_buf;
+        // NOTE: the response string should contain '\0' at end, it means
+        // server should send it. It may follow a dropped one. The bytes
+        // already scanned by the last call are not scanned again.
+        if ( p_buf->i_buffer > 0 &&
+             json_request_Scan( p_buf, &p_this->i_scanned, &p_this->i_braces,
+                                pi_len ) )
+        {
+            if ( *pi_len == JSONRPC_OVERSIZE )
+            {
+                log_Err( "jsonrpc_call response is too large" );
+                p_this->b_error = true;
+                return -1;
+            }
+            break;
+        }
+
+        // doubles, a large response is read in a few reallocs
+        if ( p_buf->i_buffer + 4096 >= p_buf->i_maxlen )
         {
-            p_block = block_Realloc( p_block, 4096 );
-            if ( !p_block )
+            p_this->p_buf = block_Realloc( p_buf, p_buf->i_maxlen );
+            if ( !p_this->p_buf )
             {
                 log_Err( "no memory %s %d", __FILE__, __LINE__ );
+                p_this->b_error = true;
                 return -1;
             }
+            p_buf = p_this->p_buf;
         }
 
-        i_read = recv( fd, p_block->p_buffer + p_block->i_buffer, 4096, 0 );
+        i_read = client_recv( p_this, p_buf->p_buffer + p_buf->i_buffer,
+                              p_buf->i_maxlen - p_buf->i_buffer );
         if ( i_read < 0 )
         {
             if ( errno == EAGAIN )
             {
                 log_Warn( "jsonrpc client recv timeout" );
+                // the rest of a cut response can not be told apart
+                if ( p_buf->i_buffer > 0 )
+                    p_this->b_error = true;
                 return -1;
             }
             else if ( errno == EINTR )
@@ -162,47 +357,78 @@ static int read_response( jsonrpc_client_t *p_this, block_t *p_block )
             return -1;
         }
         else
-        {
-            p_block->i_buffer += i_read;
-            // NOTE: the request string should contain '\0' at end, it means
-            // client should send it.
-            size_t i_len;
-            if ( json_request_IsComplete( p_block, &i_len ) )
-            {
-                if ( i_len < p_block->i_buffer )
-                    log_Warn( "jsonrpc_call recved more data than one response "
-                              "%s", (char*)(p_block->p_buffer + i_len) );
-                break;
-            }
-            else
-                log_Warn( "jsonrpc_call recved request is incomplete" );
-        }
+            p_buf->i_buffer += i_read;
     }
 
     return 0;
 }
 
-struct json_object *jsonrpc_call( jsonrpc_client_t *p_this,
-                                  const char *psz_method,
-                                  struct json_object *p_params )
+// the response at the head of p_buf has been read
+static void drop_response( jsonrpc_client_t *p_this, size_t i_len )
 {
-    struct json_object *p_req, *p_res;
-    char err[256];
+    block_t *p_buf = p_this->p_buf;
+    // its blobs, until the next one
+    if ( p_this->p_rblobs &&
+         fdblob_Take( p_this->p_rblobs, p_buf->p_buffer, i_len ) < 0 )
+        p_this->b_error = true;
+    memmove( p_buf->p_buffer, p_buf->p_buffer + i_len,
+             p_buf->i_buffer - i_len );
+    p_buf->i_buffer -= i_len;
+    if ( p_buf->i_maxlen > BLOCK_KEEP )
+        block_Shrink( p_buf, BLOCK_DEFAULT );
+}
 
-    if ( p_this->b_error )
+// the request in p_out has been sent
+static void release_out( jsonrpc_client_t *p_this )
+{
+    p_this->p_out->i_buffer = 0;
+    if ( p_this->p_out->i_maxlen > BLOCK_KEEP )
+        block_Shrink( p_this->p_out, BLOCK_DEFAULT );
+}
+
+// the notification giving up on call i_id, its length without the '\0'
+static int cancel_request( char *psz_req, size_t i_size, int i_id )
+{
+    return snprintf( psz_req, i_size,
+                     "{\"jsonrpc\":\"2.0\",\"method\":\""
+                     JSONRPC_CANCEL_METHOD "\",\"params\":{\"id\":%d}}",
+                     i_id );
+}
+
+// tell the server to give up on call i_id, its response (an error when it
+// had not run yet) is dropped by the next call
+static void send_cancel( jsonrpc_client_t *p_this, int i_id )
+{
+    char psz_req[128];
+    int i_req = cancel_request( psz_req, sizeof(psz_req), i_id );
+    if ( client_send( p_this, (uint8_t*)psz_req, i_req + 1 ) < i_req + 1 )
     {
-        if ( jsonrpc_client_reinit( p_this ) < 0 )
-        {
-            p_res = json_object_new_object();
-            sprintf( err, "jsonrpc_client_reinit failed (%s)", strerror(errno));
-            json_object_object_add( p_res, "error",
-                                    json_object_new_string( err ) );
-            return p_res;
-        }
+        log_Warn( "jsonrpc client send cancel failed (%s), close connection",
+                  strerror( errno ) );
+        p_this->b_error = true;
     }
+}
+
+// the response of an earlier call, one without id is taken
+static bool is_stale( struct json_object *p_res, int i_id )
+{
+    if ( !json_object_is_type( p_res, json_type_object ) )
+        return false;
+    struct json_object *p_id = json_object_object_get( p_res, "id" );
+    return p_id && json_object_get_int( p_id ) != i_id;
+}
 
-    p_req = json_object_new_object();
-    p_res = json_object_new_object();
+// the request of the next call, p_params is taken
+static struct json_object *new_request( jsonrpc_client_t *p_this,
+                                        const char *psz_method,
+                                        struct json_object *p_params,
+                                        int *pi_id )
+{
+    struct json_object *p_req = json_object_new_object();
+    // first, the server counts the descriptors without parsing
+    if ( p_this->i_blobs > 0 )
+        json_object_object_add( p_req, JSONRPC_BLOBS_KEY,
+                                json_object_new_int( p_this->i_blobs ) );
     json_object_object_add( p_req, "jsonrpc", json_object_new_string("2.0") );
     json_object_object_add( p_req, "method",
                             json_object_new_string( psz_method ) );
@@ -211,82 +437,360 @@ struct json_object *jsonrpc_call( jsonrpc_client_t *p_this,
     if ( !p_params )
         p_params = json_object_new_array();
     json_object_object_add( p_req, "params", p_params );
-    const char *psz_req = json_object_to_json_string( p_req );
+    *pi_id = p_this->i_id = ( p_this->i_id + 1 ) & 0x7fffffff;
+    json_object_object_add( p_req, "id", json_object_new_int( *pi_id ) );
+    return p_req;
+}
 
-    int i_send;
+static struct json_object *error_response( const char *psz_err )
+{
+    struct json_object *p_res = json_object_new_object();
+    json_object_object_add( p_res, "error", json_object_new_string( psz_err ) );
+    return p_res;
+}
+
+// send the '\0' terminated request, on error b_error is set and errno
+// tells why
+static int send_request( jsonrpc_client_t *p_this, const uint8_t *p_req,
+                         size_t i_req )
+{
+    size_t i_sent = 0;
+    while ( i_sent < i_req )
+    {
+        int i_send = client_send( p_this, p_req + i_sent, i_req - i_sent );
+        if ( i_send > 0 )
+            i_sent += i_send;
+        if ( i_sent == i_req )
+            break;
+        // the blobs could not go, see client_send
+        if ( p_this->b_error )
+            return -1;
+        if ( errno == EAGAIN )
+            // socket send buffer is full
+            log_Warn( "jsonrpc client send request timeout, try again" );
+        else if ( errno != EINTR )
+        {
+            p_this->b_error = true;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// send request i_id and wait for its response
+static struct json_object *send_call( jsonrpc_client_t *p_this,
+                                      const uint8_t *p_req, size_t i_req,
+                                      int i_id )
+{
+    char err[256];
 
+    if ( send_request( p_this, p_req, i_req ) < 0 )
+    {
+        snprintf( err, sizeof(err), "jsonrpc send failed (%s)",
+                  strerror(errno) );
+        return error_response( err );
+    }
+
+    struct json_object *p_res;
+    size_t i_len;
     while ( true )
     {
-        i_send = socket_sendall( p_this->sock, (uint8_t*)psz_req,
-                                 strlen(psz_req) + 1 );
-        if ( i_send < strlen(psz_req) + 1 )
+        if ( read_response( p_this, &i_len ) < 0 )
         {
-            if ( errno == EAGAIN )
-            {
-                // socket send buffer is full
-                log_Warn( "jsonrpc client send request timeout, try again" );
-                psz_req = psz_req + i_send;
-                continue;
-            }
-            else if ( errno == EINTR )
-                continue;
+            if ( errno == 0 )
+                sprintf( err, "jsonrpc recv failed, peer closed connection" );
             else
             {
-                p_this->b_error = true;
-                snprintf( err, sizeof(err), "jsonrpc send failed (%s)",
+                snprintf( err, sizeof(err) - 1, "jsonrpc recv failed (%s)",
                           strerror(errno) );
-                json_object_object_add( p_res, "error",
-                                        json_object_new_string( err ) );
-                json_object_put( p_req );
-                return p_res;
+                if ( errno == EAGAIN )
+                {
+                    sprintf( err, "timeout while receiving" );
+                    if ( !p_this->b_error )
+                        send_cancel( p_this, i_id );
+                }
             }
+            return error_response( err );
         }
-        else
+
+        p_res = json_tokener_parse( (char*)p_this->p_buf->p_buffer );
+        //log_Dbg( "jsonrpc_call got result: %s", json_object_to_json_string(p_res) );
+        if ( is_error( p_res ) )
         {
+            snprintf( err, sizeof(err) - 1,
+                      "jsonrpc parse response failed, response: %s",
+                      (char*)p_this->p_buf->p_buffer );
+            drop_response( p_this, i_len );
+            return error_response( err );
+        }
+        drop_response( p_this, i_len );
+        if ( !is_stale( p_res, i_id ) )
             break;
+
+        log_Dbg( "jsonrpc_call dropped the response of a timed out call" );
+        json_object_put( p_res );
+    }
+
+    log_Dbg( "jsonrpc client jsonrpc_call exit normally" );
+    return p_res;
+}
+
+struct json_object *jsonrpc_call( jsonrpc_client_t *p_this,
+                                  const char *psz_method,
+                                  struct json_object *p_params )
+{
+    char err[256];
+
+    if ( p_this->b_error )
+    {
+        if ( jsonrpc_client_reinit( p_this ) < 0 )
+        {
+            sprintf( err, "jsonrpc_client_reinit failed (%s)", strerror(errno));
+            return error_response( err );
+        }
+    }
+
+    int i_id;
+    struct json_object *p_req = new_request( p_this, psz_method, p_params,
+                                             &i_id );
+    const char *psz_req = json_object_to_json_string( p_req );
+    struct json_object *p_res = send_call( p_this, (const uint8_t*)psz_req,
+                                           strlen( psz_req ) + 1, i_id );
+    json_object_put( p_req );
+    return p_res;
+}
+
+/*
+ * prepared calls
+ */
+#define ENVELOPE_HEAD "{\"jsonrpc\":\"2.0\",\"method\":"
+#define ENVELOPE_PARAMS ",\"params\":"
+
+struct jsonrpc_prepared_t
+{
+    char  *psz_method;
+    char  *psz_prefix;          // the request up to the params
+    size_t i_prefix;
+};
+
+jsonrpc_prepared_t *jsonrpc_client_Prepare( const char *psz_method )
+{
+    jsonrpc_prepared_t *p_prep = calloc( 1, sizeof(jsonrpc_prepared_t) );
+    if ( !p_prep )
+    {
+        log_Err( "no memory" );
+        return NULL;
+    }
+    // quoted and escaped as json-c does it for new_request
+    struct json_object *p_method = json_object_new_string( psz_method );
+    const char *psz_quoted = json_object_to_json_string( p_method );
+    p_prep->i_prefix = strlen( ENVELOPE_HEAD ) + strlen( psz_quoted ) +
+                       strlen( ENVELOPE_PARAMS );
+    p_prep->psz_method = strdup( psz_method );
+    p_prep->psz_prefix = malloc( p_prep->i_prefix + 1 );
+    if ( !p_prep->psz_method || !p_prep->psz_prefix )
+    {
+        log_Err( "no memory" );
+        json_object_put( p_method );
+        jsonrpc_client_Unprepare( p_prep );
+        return NULL;
+    }
+    sprintf( p_prep->psz_prefix, "%s%s%s", ENVELOPE_HEAD, psz_quoted,
+             ENVELOPE_PARAMS );
+    json_object_put( p_method );
+    return p_prep;
+}
+
+void jsonrpc_client_Unprepare( jsonrpc_prepared_t *p_prep )
+{
+    if ( !p_prep )
+        return;
+    free( p_prep->psz_method );
+    free( p_prep->psz_prefix );
+    free( p_prep );
+}
+
+static struct json_object *call_prepared( jsonrpc_client_t *p_this,
+                                          const jsonrpc_prepared_t *p_prep,
+                                          struct json_object *p_params )
+{
+    char err[256];
+
+    // the blobs member comes first, before the envelope
+    if ( p_this->i_blobs > 0 )
+        return jsonrpc_call( p_this, p_prep->psz_method, p_params );
+
+    if ( p_this->b_error )
+    {
+        if ( jsonrpc_client_reinit( p_this ) < 0 )
+        {
+            sprintf( err, "jsonrpc_client_reinit failed (%s)", strerror(errno));
+            if ( p_params )
+                json_object_put( p_params );
+            return error_response( err );
         }
     }
 
+    const char *psz_params = p_params ?
+        json_object_to_json_string( p_params ) : "[]";
+    size_t i_params = strlen( psz_params );
+    int i_id = p_this->i_id = ( p_this->i_id + 1 ) & 0x7fffffff;
+    char psz_tail[32];
+    size_t i_tail = snprintf( psz_tail, sizeof(psz_tail), ",\"id\":%d}",
+                              i_id ) + 1;
+    size_t i_req = p_prep->i_prefix + i_params + i_tail;
+
+    block_t *p_out = p_this->p_out;
+    if ( p_out && i_req > p_out->i_maxlen )
+        p_out = p_this->p_out = block_Realloc( p_out,
+                                               i_req - p_out->i_maxlen );
+    if ( !p_out )
+    {
+        log_Err( "no memory" );
+        p_this->p_out = block_Alloc( BLOCK_DEFAULT );
+        if ( p_params )
+            json_object_put( p_params );
+        return error_response( "no memory" );
+    }
+    memcpy( p_out->p_buffer, p_prep->psz_prefix, p_prep->i_prefix );
+    memcpy( p_out->p_buffer + p_prep->i_prefix, psz_params, i_params );
+    memcpy( p_out->p_buffer + p_prep->i_prefix + i_params, psz_tail, i_tail );
+    p_out->i_buffer = i_req;
+    if ( p_params )
+        json_object_put( p_params );
+
+    struct json_object *p_res = send_call( p_this, p_out->p_buffer, i_req,
+                                           i_id );
+    release_out( p_this );
+    return p_res;
+}
 
-    block_t *p_block = block_Alloc( 4096 );
-    if ( read_response( p_this, p_block ) < 0 )
+// the calls of p_ress still without a response get psz_err
+static void batch_fail( struct json_object *p_ress, int i_calls,
+                        const char *psz_err )
+{
+    for ( int i = 0; i < i_calls; i++ )
+        if ( !json_object_array_get_idx( p_ress, i ) )
+            json_object_array_put_idx( p_ress, i, error_response( psz_err ) );
+}
+
+struct json_object *jsonrpc_call_batch( jsonrpc_client_t *p_this,
+                                        const char **ppsz_method,
+                                        struct json_object **pp_params,
+                                        int i_calls )
+{
+    struct json_object *p_ress = json_object_new_array();
+    char err[256];
+
+    if ( i_calls <= 0 )
+        return p_ress;
+    if ( p_this->b_error )
     {
-        if ( errno == 0 )
-            sprintf( err, "jsonrpc recv failed, peer closed connection" );
-        else
+        if ( jsonrpc_client_reinit( p_this ) < 0 )
         {
-            snprintf( err, sizeof(err) - 1, "jsonrpc recv failed (%s)",
-                      strerror(errno) );
-            if ( errno == EAGAIN )
-                sprintf( err, "timeout while receiving" );
+            sprintf( err, "jsonrpc_client_reinit failed (%s)", strerror(errno));
+            batch_fail( p_ress, i_calls, err );
+            for ( int i = 0; pp_params && i < i_calls; i++ )
+                if ( pp_params[i] )
+                    json_object_put( pp_params[i] );
+            return p_ress;
         }
-        json_object_object_add( p_res, "error",
-                                json_object_new_string( err ) );
-        block_Release( p_block );
-        json_object_put( p_req );
-        return p_res;
     }
 
-    struct json_object *p_tmp = json_tokener_parse( (char*)p_block->p_buffer );
-    //log_Dbg( "jsonrpc_call got result: %s", json_object_to_json_string(p_tmp) );
-    if ( is_error( p_tmp ) )
+    // the requests back to back, ids follow each other from i_first
+    block_t *p_out = p_this->p_out;
+    if ( p_out )
+        p_out->i_buffer = 0;
+    int i_first = 0;
+    for ( int i = 0; i < i_calls; i++ )
     {
-        snprintf( err, sizeof(err) - 1,
-                  "jsonrpc parse response failed, response: %s",
-                  (char*)p_block->p_buffer );
-        json_object_object_add( p_res, "error",
-                                json_object_new_string( err ) );
-        block_Release( p_block );
+        int i_id;
+        struct json_object *p_req =
+            new_request( p_this, ppsz_method[i],
+                         pp_params ? pp_params[i] : NULL, &i_id );
+        if ( i == 0 )
+            i_first = i_id;
+        const char *psz_req = json_object_to_json_string( p_req );
+        if ( p_out )
+            p_out = block_Append( p_out, (uint8_t*)psz_req,
+                                  strlen( psz_req ) + 1 );
         json_object_put( p_req );
-        return p_res;
     }
+    if ( !p_out )
+    {
+        log_Err( "no memory" );
+        p_this->p_out = block_Alloc( BLOCK_DEFAULT );
+        batch_fail( p_ress, i_calls, "no memory" );
+        return p_ress;
+    }
+    p_this->p_out = p_out;
 
-    json_object_put( p_req );
-    json_object_put( p_res );
-    block_Release( p_block );
-    p_res = p_tmp;
-    log_Dbg( "jsonrpc client jsonrpc_call exit normally" );
-    return p_res;
+    int i_ret = send_request( p_this, p_out->p_buffer, p_out->i_buffer );
+    release_out( p_this );
+    if ( i_ret < 0 )
+    {
+        snprintf( err, sizeof(err), "jsonrpc send failed (%s)",
+                  strerror(errno) );
+        batch_fail( p_ress, i_calls, err );
+        return p_ress;
+    }
+
+    size_t i_len;
+    int i_left = i_calls;
+    while ( i_left > 0 )
+    {
+        if ( read_response( p_this, &i_len ) < 0 )
+        {
+            if ( errno == 0 )
+                sprintf( err, "jsonrpc recv failed, peer closed connection" );
+            else
+            {
+                snprintf( err, sizeof(err) - 1, "jsonrpc recv failed (%s)",
+                          strerror(errno) );
+                if ( errno == EAGAIN )
+                {
+                    sprintf( err, "timeout while receiving" );
+                    for ( int i = 0; i < i_calls && !p_this->b_error; i++ )
+                        if ( !json_object_array_get_idx( p_ress, i ) )
+                            send_cancel( p_this,
+                                         ( i_first + i ) & 0x7fffffff );
+                }
+            }
+            batch_fail( p_ress, i_calls, err );
+            break;
+        }
+
+        struct json_object *p_tmp =
+            json_tokener_parse( (char*)p_this->p_buf->p_buffer );
+        drop_response( p_this, i_len );
+        if ( is_error( p_tmp ) )
+        {
+            // which call it answered is unknown, nor are the next ones
+            p_this->b_error = true;
+            batch_fail( p_ress, i_calls, "jsonrpc parse response failed" );
+            break;
+        }
+
+        // one without id answers the first call still waiting
+        struct json_object *p_id =
+            json_object_is_type( p_tmp, json_type_object ) ?
+            json_object_object_get( p_tmp, "id" ) : NULL;
+        int i_idx = 0;
+        if ( p_id )
+            i_idx = ( json_object_get_int( p_id ) - i_first ) & 0x7fffffff;
+        else
+            while ( json_object_array_get_idx( p_ress, i_idx ) )
+                i_idx++;
+        if ( i_idx >= i_calls || json_object_array_get_idx( p_ress, i_idx ) )
+        {
+            log_Dbg( "jsonrpc_call dropped the response of a timed out call" );
+            json_object_put( p_tmp );
+            continue;
+        }
+        json_object_array_put_idx( p_ress, i_idx, p_tmp );
+        i_left--;
+    }
+    return p_ress;
 }
 
 // jsonrpc_notify must use short connection
@@ -305,6 +809,9 @@ int jsonrpc_notify( jsonrpc_client_t *p_this, const char *psz_method,
         log_Err( "no memory" );
         return -1;
     }
+    if ( p_this->i_blobs > 0 )
+        json_object_object_add( p_req, JSONRPC_BLOBS_KEY,
+                                json_object_new_int( p_this->i_blobs ) );
     json_object_object_add( p_req, "jsonrpc", json_object_new_string("2.0") );
     json_object_object_add( p_req, "method",
                             json_object_new_string( psz_method ) );
@@ -314,8 +821,7 @@ int jsonrpc_notify( jsonrpc_client_t *p_this, const char *psz_method,
     const char *psz_req = json_object_to_json_string( p_req );
 
     int i_send;
-    i_send = socket_sendall( p_this->sock, (uint8_t*)psz_req,
-                             strlen(psz_req) + 1 );
+    i_send = client_send( p_this, (uint8_t*)psz_req, strlen(psz_req) + 1 );
     if ( i_send < strlen(psz_req) + 1 )
     {
         if ( errno == EAGAIN )
@@ -342,13 +848,13 @@ int jsonrpc_notify( jsonrpc_client_t *p_this, const char *psz_method,
 static struct json_object *get_notify( jsonrpc_client_t *p_this,
                                        bool b_block, int i_timeout )
 {
-    block_t *p_buf = p_this->p_buf;
-
     if ( p_this->b_error )
     {
         if ( jsonrpc_client_reinit( p_this ) < 0 )
             return NULL;
     }
+    // reinit may have replaced it
+    block_t *p_buf = p_this->p_buf;
 
     bool b_old_block = socket_getblocking( p_this->sock );
     if ( b_block != b_old_block )
@@ -381,12 +887,14 @@ static struct json_object *get_notify( jsonrpc_client_t *p_this,
     {
         if ( p_buf->i_buffer + 4096 >= p_buf->i_maxlen )
         {
-            p_buf = block_Realloc( p_buf, 4096 );
-            if ( !p_buf )
+            p_this->p_buf = block_Realloc( p_buf, 4096 );
+            if ( !p_this->p_buf )
             {
                 log_Err( "no memory" );
+                p_this->b_error = true;
                 goto error;
             }
+            p_buf = p_this->p_buf;
         }
         i_read = recv( p_this->sock, p_buf->p_buffer + p_buf->i_buffer,
                        4096, 0 );
@@ -461,6 +969,13 @@ static int handshake( jsonrpc_client_t *p_this, const char *psz_protocol,
                                    json_object_new_string( ppsz_notifyService[i] ) );
         json_object_object_add( p_proto, "notifyServiceNames", p_array );
     }
+    bool b_shm = p_this->sockopt.i_shm_ring > 0 &&
+                 !strcasecmp( psz_protocol, "rpc" ) &&
+                 ( p_this->i_sock_type == AF_UNIX ||
+                   p_this->i_sock_type == PF_UNIX );
+    if ( b_shm )
+        json_object_object_add( p_proto, "shm",
+                            json_object_new_int( p_this->sockopt.i_shm_ring ) );
     const char *psz_data = json_object_to_json_string( p_proto );
     size_t i_data = strlen( psz_data ) + 1;
     if ( socket_sendall( p_this->sock,
@@ -476,9 +991,15 @@ static int handshake( jsonrpc_client_t *p_this, const char *psz_protocol,
     char buf[1024];
     int i_buf = 0;
     int i_read;
+    int i_memfd = -1;
     while ( true )
     {
-        i_read = recv( p_this->sock, buf + i_buf, 1024, 0 );
+        // the server attaches the memfd of the rings to its answer
+        if ( b_shm && i_memfd < 0 )
+            i_read = shm_RecvFd( p_this->sock, buf + i_buf,
+                                 sizeof(buf) - i_buf, &i_memfd );
+        else
+            i_read = recv( p_this->sock, buf + i_buf, sizeof(buf) - i_buf, 0 );
         if ( i_read == 0 )
             break;
         else if ( i_read < 0 )
@@ -496,13 +1017,33 @@ static int handshake( jsonrpc_client_t *p_this, const char *psz_protocol,
             break;
         }
     }
+    if ( b_ok && i_memfd >= 0 )
+    {
+        p_this->p_shm = malloc( sizeof(shm_t) );
+        if ( !p_this->p_shm )
+            log_Err( "no memory" );
+        else if ( shm_Attach( p_this->p_shm, i_memfd, p_this->sock ) < 0 )
+        {
+            // the server reads the ring only
+            free( p_this->p_shm );
+            p_this->p_shm = NULL;
+        }
+        if ( !p_this->p_shm )
+            b_ok = false;
+    }
+    if ( i_memfd >= 0 )
+        close( i_memfd );
     return b_ok ? 0 : -1;
 }
 
 static int _jsonrpc_client_init( jsonrpc_client_t *p_this,
                                  const char *psz_arg_proto,
+                                 const jsonrpc_sockopt_t *p_opt,
                                  int i_sock_flag, va_list args )
 {
+    memset( &p_this->sockopt, 0, sizeof(p_this->sockopt) );
+    if ( p_opt )
+        p_this->sockopt = *p_opt;
     p_this->i_sock_type = i_sock_flag;
     p_this->b_error = false;
     p_this->psz_unix_conn_file = NULL;
@@ -511,14 +1052,24 @@ static int _jsonrpc_client_init( jsonrpc_client_t *p_this,
     p_this->psz_protocol = NULL;
     p_this->ppsz_notifyService = NULL;
     p_this->i_notifyService = 0;
+    p_this->i_id = 0;
+    p_this->p_shm = NULL;
+    p_this->i_blobs = 0;
+    p_this->p_rblobs = NULL;
+    p_this->i_scanned = 0;
+    p_this->i_braces = 0;
 
     p_this->pf_call = jsonrpc_call;
+    p_this->pf_call_batch = jsonrpc_call_batch;
+    p_this->pf_call_prepared = call_prepared;
     p_this->pf_notify = jsonrpc_notify;
     p_this->pf_get_notify = get_notify;
     p_this->pf_exit = jsonrpc_client_exit;
+    p_this->pf_on_reconnected = NULL;
 
-    p_this->p_buf = block_Alloc( 4096 );
-    if ( !p_this->p_buf )
+    p_this->p_buf = block_Alloc( BLOCK_DEFAULT );
+    p_this->p_out = block_Alloc( BLOCK_DEFAULT );
+    if ( !p_this->p_buf || !p_this->p_out )
     {
         log_Err( "no memory" );
         goto error;
@@ -606,7 +1157,20 @@ int jsonrpc_client_init( jsonrpc_client_t *p_this, int i_sock_flag, ... )
 {
     va_list args;
     va_start( args, i_sock_flag );
-    int i_ret = _jsonrpc_client_init( p_this, "rpc", i_sock_flag, args );
+    int i_ret = _jsonrpc_client_init( p_this, "rpc", NULL, i_sock_flag,
+                                      args );
+    va_end( args );
+    return i_ret;
+}
+
+int jsonrpc_client_initOpt( jsonrpc_client_t *p_this,
+                            const jsonrpc_sockopt_t *p_opt,
+                            int i_sock_flag, ... )
+{
+    va_list args;
+    va_start( args, i_sock_flag );
+    int i_ret = _jsonrpc_client_init( p_this, "rpc", p_opt, i_sock_flag,
+                                      args );
     va_end( args );
     return i_ret;
 }
@@ -616,11 +1180,51 @@ int jsonrpc_client_subscribe_init( jsonrpc_client_t *p_this,
 {
     va_list args;
     va_start( args, i_sock_flag );
-    int i_ret = _jsonrpc_client_init( p_this, "notify", i_sock_flag, args );
+    int i_ret = _jsonrpc_client_init( p_this, "notify", NULL, i_sock_flag,
+                                      args );
     va_end( args );
     return i_ret;
 }
 
+struct json_object *jsonrpc_client_Blob( jsonrpc_client_t *p_this, int i_fd )
+{
+    if ( ( p_this->i_sock_type != AF_UNIX && p_this->i_sock_type != PF_UNIX ) ||
+         p_this->p_shm )
+    {
+        log_Err( "blobs go over plain unix sockets only" );
+        return NULL;
+    }
+    if ( p_this->i_blobs == FDBLOB_MAX )
+    {
+        log_Err( "more than %d blobs in a call", FDBLOB_MAX );
+        return NULL;
+    }
+    struct json_object *p_ref = json_object_new_object();
+    if ( !p_ref )
+    {
+        log_Err( "no memory" );
+        return NULL;
+    }
+    json_object_object_add( p_ref, JSONRPC_BLOB_KEY,
+                            json_object_new_int( p_this->i_blobs ) );
+    p_this->pi_blobs[ p_this->i_blobs++ ] = i_fd;
+    return p_ref;
+}
+
+const uint8_t *jsonrpc_client_ResultBlob( jsonrpc_client_t *p_this,
+                                          struct json_object *p_ref,
+                                          size_t *pi_size )
+{
+    struct json_object *p_index;
+    if ( !p_this->p_rblobs ||
+         !json_object_is_type( p_ref, json_type_object ) ||
+         !( p_index = json_object_object_get( p_ref, JSONRPC_BLOB_KEY ) ) ||
+         !json_object_is_type( p_index, json_type_int ) )
+        return NULL;
+    return fdblob_Map( p_this->p_rblobs, json_object_get_int( p_index ),
+                       pi_size );
+}
+
 static void jsonrpc_client_exit( jsonrpc_client_t *p_this )
 {
     if ( p_this->psz_unix_conn_file )
@@ -633,9 +1237,440 @@ static void jsonrpc_client_exit( jsonrpc_client_t *p_this )
         free( p_this->ppsz_notifyService[i] );
     free( p_this->ppsz_notifyService );
 
+    shm_close( p_this );
     close( p_this->sock );
+    if ( p_this->p_rblobs )
+    {
+        fdblob_Clean( p_this->p_rblobs );
+        free( p_this->p_rblobs );
+    }
 
     if ( p_this->p_buf)
         block_Release( p_this->p_buf );
+    if ( p_this->p_out )
+        block_Release( p_this->p_out );
+}
+
+
+/*
+ * pipelined calls
+ */
+typedef struct async_call_t
+{
+    pf_async_callback_t pf_cb;
+    void *p_data;
+    struct json_object *p_res;      // of a future, once received
+    bool  b_abandoned;              // its pf_wait timed out
+} async_call_t;
+
+// p_res is taken
+static void async_deliver( jsonrpc_async_t *p_this, int i_id,
+                           struct json_object *p_res )
+{
+    hashmap_key_t key;
+    key.type = 'l';
+    key.u.i_int32 = i_id;
+    async_call_t *p_call = hashmap_get( p_this->pendingMap, key );
+    if ( !p_call || p_call->p_res )
+    {
+        log_Warn( "jsonrpc async dropped the response of unknown call %d",
+                  i_id );
+        json_object_put( p_res );
+        return;
+    }
+    p_this->i_pending--;
+    if ( p_call->pf_cb || p_call->b_abandoned )
+    {
+        hashmap_pop( p_this->pendingMap, key, NULL );
+        if ( p_call->pf_cb )
+            p_call->pf_cb( p_this, i_id, p_res, p_call->p_data );
+        json_object_put( p_res );
+        free( p_call );
+        return;
+    }
+    p_call->p_res = p_res;
+}
+
+// every call still waiting gets psz_err
+static void async_fail_all( jsonrpc_async_t *p_this, const char *psz_err )
+{
+    if ( p_this->i_pending == 0 )
+        return;
+    int *pi_ids = malloc( p_this->i_pending * sizeof(int) );
+    if ( !pi_ids )
+    {
+        log_Err( "no memory" );
+        return;
+    }
+    int i_ids = 0;
+    hashmap_iterator it = hashmap_iterate( p_this->pendingMap );
+    while ( hashmap_next( &it ) && i_ids < p_this->i_pending )
+    {
+        async_call_t *p_call = it.p_val;
+        if ( !p_call->p_res )
+            pi_ids[i_ids++] = it.key.u.i_int32;
+    }
+    // the callbacks may queue new calls, on the next connection
+    for ( int i = 0; i < i_ids; i++ )
+        async_deliver( p_this, pi_ids[i], error_response( psz_err ) );
+    free( pi_ids );
+}
+
+static int async_flush( jsonrpc_async_t *p_this )
+{
+    block_t *p_out = p_this->p_out;
+    size_t i_sent = 0;
+    while ( i_sent < p_out->i_buffer )
+    {
+        ssize_t i_ret = send( p_this->client.sock, p_out->p_buffer + i_sent,
+                              p_out->i_buffer - i_sent, MSG_NOSIGNAL );
+        if ( i_ret < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                break;
+            log_Err( "jsonrpc async send failed (%s), close connection",
+                     strerror( errno ) );
+            return -1;
+        }
+        i_sent += i_ret;
+    }
+    memmove( p_out->p_buffer, p_out->p_buffer + i_sent,
+             p_out->i_buffer - i_sent );
+    p_out->i_buffer -= i_sent;
+    return 0;
+}
+
+// p_out is left as it was when out of memory
+static int async_queue( jsonrpc_async_t *p_this, const char *psz_req )
+{
+    size_t i_req = strlen( psz_req ) + 1;
+    if ( block_Reserve( p_this->p_out, i_req ) < 0 )
+    {
+        log_Err( "no memory" );
+        return -1;
+    }
+    block_t *p_out = p_this->p_out;
+    memcpy( p_out->p_buffer + p_out->i_buffer, psz_req, i_req );
+    p_out->i_buffer += i_req;
+    return 0;
+}
+
+// queue psz_req, sent at once unless the socket is already behind. A send
+// failure is reported to the calls by the next pf_process.
+static int async_send( jsonrpc_async_t *p_this, const char *psz_req )
+{
+    bool b_idle = p_this->p_out->i_buffer == 0;
+    if ( async_queue( p_this, psz_req ) < 0 )
+        return -1;
+    if ( b_idle && async_flush( p_this ) < 0 )
+        p_this->client.b_error = true;
+    return 0;
 }
 
+// the call a response without id answers: the server answers in order,
+// the oldest one still waiting. 0 when none waits.
+static int async_oldest( jsonrpc_async_t *p_this )
+{
+    int i_oldest = 0, i_age = -1;
+    hashmap_iterator it = hashmap_iterate( p_this->pendingMap );
+    while ( hashmap_next( &it ) )
+    {
+        async_call_t *p_call = it.p_val;
+        int i_id = it.key.u.i_int32;
+        if ( p_call->p_res ||
+             ( ( p_this->client.i_id - i_id ) & 0x7fffffff ) <= i_age )
+            continue;
+        i_age = ( p_this->client.i_id - i_id ) & 0x7fffffff;
+        i_oldest = i_id;
+    }
+    return i_oldest;
+}
+
+// hand out the complete responses at the head of p_in
+static int async_parse( jsonrpc_async_t *p_this )
+{
+    block_t *p_in = p_this->p_in;
+    size_t i_pos = 0, i_len;
+    int i_done = 0;
+    while ( i_pos < p_in->i_buffer )
+    {
+        // the head of a partial response is not scanned again
+        block_t rest = { p_in->i_maxlen - i_pos, p_in->i_buffer - i_pos,
+                         p_in->p_buffer + i_pos };
+        if ( !json_request_Scan( &rest, &p_this->i_scanned,
+                                 &p_this->i_braces, &i_len ) )
+            break;
+        if ( i_len == JSONRPC_OVERSIZE )
+        {
+            log_Err( "jsonrpc async response is too large" );
+            return -1;
+        }
+        struct json_object *p_res =
+            json_tokener_parse( (char*)p_in->p_buffer + i_pos );
+        i_pos += i_len;
+        if ( is_error( p_res ) )
+        {
+            log_Err( "jsonrpc async parse response failed" );
+            return -1;
+        }
+        // one without id (an error before the server read it) answers the
+        // oldest call, as in pf_call_batch
+        struct json_object *p_id = json_object_is_type( p_res,
+                                                        json_type_object ) ?
+            json_object_object_get( p_res, "id" ) : NULL;
+        async_deliver( p_this, p_id ? json_object_get_int( p_id ) :
+                                      async_oldest( p_this ), p_res );
+        i_done++;
+    }
+    memmove( p_in->p_buffer, p_in->p_buffer + i_pos, p_in->i_buffer - i_pos );
+    p_in->i_buffer -= i_pos;
+    return i_done;
+}
+
+static int async_read( jsonrpc_async_t *p_this )
+{
+    int i_done = 0;
+    while ( true )
+    {
+        // p_in is left as it was when out of memory
+        block_t *p_in = p_this->p_in;
+        if ( block_Reserve( p_in, 4096 ) < 0 )
+        {
+            log_Err( "no memory" );
+            return -1;
+        }
+        ssize_t i_read = recv( p_this->client.sock,
+                               p_in->p_buffer + p_in->i_buffer,
+                               p_in->i_maxlen - p_in->i_buffer, 0 );
+        if ( i_read < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                return i_done;
+            log_Err( "jsonrpc async recv failed (%s), close connection",
+                     strerror( errno ) );
+            return -1;
+        }
+        if ( i_read == 0 )
+        {
+            log_Warn( "peer closed connection while read" );
+            return -1;
+        }
+        p_in->i_buffer += i_read;
+        int i_ret = async_parse( p_this );
+        if ( i_ret < 0 )
+            return -1;
+        i_done += i_ret;
+    }
+}
+
+static int async_process( jsonrpc_async_t *p_this )
+{
+    int i_done = -1;
+    if ( !p_this->client.b_error &&
+         async_flush( p_this ) == 0 &&
+         ( i_done = async_read( p_this ) ) >= 0 )
+        return i_done;
+
+    p_this->client.b_error = true;
+    p_this->p_out->i_buffer = 0;
+    if ( p_this->p_in )
+        p_this->p_in->i_buffer = 0;
+    p_this->i_scanned = 0;
+    p_this->i_braces = 0;
+    async_fail_all( p_this, "jsonrpc connection lost" );
+    return -1;
+}
+
+static int async_events( jsonrpc_async_t *p_this )
+{
+    return POLLIN | ( p_this->p_out->i_buffer > 0 ? POLLOUT : 0 );
+}
+
+static int async_call( jsonrpc_async_t *p_this, const char *psz_method,
+                       struct json_object *p_params,
+                       pf_async_callback_t pf_cb, void *p_data )
+{
+    // the calls of the lost connection were failed by pf_process
+    if ( p_this->client.b_error && p_this->i_pending == 0 )
+    {
+        if ( jsonrpc_client_reinit( &p_this->client ) < 0 ||
+             socket_setblocking( p_this->client.sock, false ) < 0 )
+        {
+            p_this->client.b_error = true;
+            if ( p_params )
+                json_object_put( p_params );
+            return -1;
+        }
+    }
+    if ( p_this->client.b_error )
+    {
+        log_Err( "jsonrpc async connection lost, pf_process first" );
+        if ( p_params )
+            json_object_put( p_params );
+        return -1;
+    }
+
+    async_call_t *p_call = malloc( sizeof(async_call_t) );
+    if ( !p_call )
+    {
+        log_Err( "no memory" );
+        if ( p_params )
+            json_object_put( p_params );
+        return -1;
+    }
+    p_call->pf_cb = pf_cb;
+    p_call->p_data = p_data;
+    p_call->p_res = NULL;
+    p_call->b_abandoned = false;
+
+    struct json_object *p_req = json_object_new_object();
+    json_object_object_add( p_req, "jsonrpc", json_object_new_string("2.0") );
+    json_object_object_add( p_req, "method",
+                            json_object_new_string( psz_method ) );
+    if ( !p_params )
+        p_params = json_object_new_array();
+    json_object_object_add( p_req, "params", p_params );
+    int i_id = p_this->client.i_id = ( p_this->client.i_id + 1 ) & 0x7fffffff;
+    json_object_object_add( p_req, "id", json_object_new_int( i_id ) );
+    // pending before it is sent, a send failure fails it
+    hashmap_key_t key;
+    key.type = 'l';
+    key.u.i_int32 = i_id;
+    hashmap_put( p_this->pendingMap, key, p_call );
+    p_this->i_pending++;
+    int i_ret = async_send( p_this, json_object_to_json_string( p_req ) );
+    json_object_put( p_req );
+    if ( i_ret < 0 )
+    {
+        hashmap_pop( p_this->pendingMap, key, NULL );
+        p_this->i_pending--;
+        free( p_call );
+        return -1;
+    }
+    return i_id;
+}
+
+static struct json_object *async_wait( jsonrpc_async_t *p_this, int i_id,
+                                       int i_timeout )
+{
+    hashmap_key_t key;
+    key.type = 'l';
+    key.u.i_int32 = i_id;
+    async_call_t *p_call = hashmap_get( p_this->pendingMap, key );
+    if ( !p_call || p_call->pf_cb )
+        return error_response( "jsonrpc async wait on an unknown call" );
+
+    uint64_t i_deadline = jsonrpc_mdate() + i_timeout;
+    while ( !p_call->p_res )
+    {
+        if ( p_this->client.b_error )
+        {
+            async_process( p_this );
+            if ( p_call->p_res )
+                break;
+            // async_fail_all ran out of memory before it reached this call
+            hashmap_pop( p_this->pendingMap, key, NULL );
+            p_this->i_pending--;
+            free( p_call );
+            return error_response( "jsonrpc connection lost" );
+        }
+        int i_ms = -1;
+        if ( i_timeout > 0 )
+        {
+            uint64_t i_now = jsonrpc_mdate();
+            if ( i_now >= i_deadline )
+            {
+                // the server gives up on it too, the response is dropped
+                // when it comes
+                char psz_req[128];
+                cancel_request( psz_req, sizeof(psz_req), i_id );
+                async_send( p_this, psz_req );
+                p_call->b_abandoned = true;
+                return error_response( "timeout while receiving" );
+            }
+            i_ms = ( i_deadline - i_now + 999 ) / 1000;
+        }
+        struct pollfd pfd = { p_this->client.sock, async_events( p_this ), 0 };
+        int i_ret = poll( &pfd, 1, i_ms );
+        if ( i_ret < 0 && errno != EINTR )
+        {
+            log_Err( "jsonrpc async poll failed (%s)", strerror( errno ) );
+            p_this->client.b_error = true;
+        }
+        else if ( i_ret > 0 )
+            async_process( p_this );
+    }
+    hashmap_pop( p_this->pendingMap, key, NULL );
+    struct json_object *p_res = p_call->p_res;
+    free( p_call );
+    return p_res;
+}
+
+static void async_exit( jsonrpc_async_t *p_this )
+{
+    jsonrpc_client_exit( &p_this->client );
+    if ( p_this->pendingMap )
+    {
+        hashmap_iterator it = hashmap_iterate( p_this->pendingMap );
+        while ( hashmap_next( &it ) )
+        {
+            async_call_t *p_call = it.p_val;
+            if ( p_call->p_res )
+                json_object_put( p_call->p_res );
+            free( p_call );
+        }
+        hashmap_free( p_this->pendingMap );
+        p_this->pendingMap = NULL;
+    }
+    if ( p_this->p_out )
+        block_Release( p_this->p_out );
+    if ( p_this->p_in )
+        block_Release( p_this->p_in );
+    p_this->p_out = p_this->p_in = NULL;
+}
+
+int jsonrpc_async_init( jsonrpc_async_t *p_this, int i_sock_flag, ... )
+{
+    p_this->pendingMap = NULL;
+    p_this->i_pending = 0;
+    p_this->p_out = NULL;
+    p_this->p_in = NULL;
+    p_this->i_scanned = 0;
+    p_this->i_braces = 0;
+    p_this->pf_call = async_call;
+    p_this->pf_wait = async_wait;
+    p_this->pf_events = async_events;
+    p_this->pf_process = async_process;
+    p_this->pf_exit = async_exit;
+
+    va_list args;
+    va_start( args, i_sock_flag );
+    int i_ret = _jsonrpc_client_init( &p_this->client, "rpc", NULL,
+                                      i_sock_flag, args );
+    va_end( args );
+    if ( i_ret < 0 )
+        return -1;
+
+    p_this->pendingMap = hashmap_create(101);
+    p_this->p_out = block_Alloc( 4096 );
+    p_this->p_in = block_Alloc( 4096 );
+    if ( !p_this->pendingMap || !p_this->p_out || !p_this->p_in )
+    {
+        log_Err( "no memory" );
+        goto error;
+    }
+    if ( socket_setblocking( p_this->client.sock, false ) < 0 )
+    {
+        log_Err( "jsonrpc async set non-blocking failed" );
+        goto error;
+    }
+    return 0;
+
+error:
+    async_exit( p_this );
+    return -1;
+}
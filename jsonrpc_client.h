@@ -10,8 +10,12 @@
 #include <json/json.h>
 #include <stdbool.h>
 #include "block.h"
+#include "hashmap.h"
+#include "sockopt.h"
+#include "fdblob.h"
 
 typedef struct jsonrpc_client_t jsonrpc_client_t;
+typedef struct jsonrpc_prepared_t jsonrpc_prepared_t;
 
 struct jsonrpc_client_t
 {
@@ -31,10 +35,38 @@ struct jsonrpc_client_t
     char **ppsz_notifyService;
     int    i_notifyService;
 
-    block_t *p_buf;             // used for cache
+    block_t *p_buf;             // used for cache, received bytes not read
+    // yet: what follows a response is kept for the next call
+    size_t   i_scanned;         // of p_buf, by json_request_Scan
+    int      i_braces;
+    block_t *p_out;             // request being sent, reused by
+    // pf_call_prepared and pf_call_batch
+    int      i_id;              // of the last call, responses to earlier
+    // ones (timed out and cancelled) are dropped
+    jsonrpc_sockopt_t sockopt;  // applied at each (re)connect
+    struct shm_t *p_shm;        // shared memory rings, when the server
+    // granted sockopt.i_shm_ring, else NULL
+    int      pi_blobs[FDBLOB_MAX];  // sent with the next call or notify
+    int      i_blobs;
+    fdblob_queue_t *p_rblobs;   // received with the responses, NULL until
+    // a response carries some
 
     struct json_object* (*pf_call) ( jsonrpc_client_t *p_this,
                                      const char *psz_mothod, struct json_object* p_params );
+    // same as pf_call, with the envelope of jsonrpc_client_Prepare: only
+    // p_params is serialized, into p_out
+    struct json_object* (*pf_call_prepared) ( jsonrpc_client_t *p_this,
+                                              const jsonrpc_prepared_t *p_prep,
+                                              struct json_object* p_params );
+    // i_calls requests sent back to back, then their responses are read:
+    // one round trip. ppsz_method[i] is called with pp_params[i] (taken,
+    // NULL for no parameter, pp_params may be NULL). Returns an array of
+    // the i_calls responses in the order of the calls, each as pf_call
+    // returns it. The caller puts the array.
+    struct json_object* (*pf_call_batch) ( jsonrpc_client_t *p_this,
+                                           const char **ppsz_method,
+                                           struct json_object **pp_params,
+                                           int i_calls );
     int                 (*pf_notify) ( jsonrpc_client_t *p_this,
                                        const char *psz_mothod, struct json_object* p_params );
     struct json_object* (*pf_get_notify) ( jsonrpc_client_t *p_this,
@@ -51,6 +83,10 @@ struct jsonrpc_client_t
  *      const char* psz_server_name, int i_port
  */
 int jsonrpc_client_init( jsonrpc_client_t *p_this, int i_sock_flag, ... );
+// same as jsonrpc_client_init, p_opt may be NULL
+int jsonrpc_client_initOpt( jsonrpc_client_t *p_this,
+                            const jsonrpc_sockopt_t *p_opt,
+                            int i_sock_flag, ... );
 
 /*
  * if i_sock_flag is AF_UNIX or PF_UNIX, the following params are
@@ -63,5 +99,80 @@ int jsonrpc_client_init( jsonrpc_client_t *p_this, int i_sock_flag, ... );
 int jsonrpc_client_subscribe_init( jsonrpc_client_t *p_this,
                                    int i_sock_flag, ... );
 
+/*
+ * pass i_fd, a memfd sealed against writing and shrinking (fdblob_Create
+ * makes one), with the next pf_call or pf_notify. Put the returned
+ * { "$blob": k } in its params, the server handler maps it with
+ * jsonrpc_request_Blob. i_fd stays the caller's, open until that call
+ * returns. Unix sockets to a listener with conn.b_blobs only, not over
+ * shared memory rings. NULL on error.
+ */
+struct json_object *jsonrpc_client_Blob( jsonrpc_client_t *p_this, int i_fd );
+
+/*
+ * read-only view of the blob p_ref ({ "$blob": k }) refers to in the result
+ * of the last pf_call, attached by the handler with
+ * jsonrpc_request_ResultBlob. Valid until the next call, NULL when there is
+ * no such blob.
+ */
+const uint8_t *jsonrpc_client_ResultBlob( jsonrpc_client_t *p_this,
+                                          struct json_object *p_ref,
+                                          size_t *pi_size );
+
+/*
+ * prepared call of psz_method for pf_call_prepared: the request up to the
+ * params is serialized once. A handle is only read by the calls, any
+ * client and thread may use it. NULL on no memory.
+ */
+jsonrpc_prepared_t *jsonrpc_client_Prepare( const char *psz_method );
+void jsonrpc_client_Unprepare( jsonrpc_prepared_t *p_prep );
+
+/* pipelined calls, many outstanding on one connection.
+ * pf_call queues the request and returns its id (-1 on error) without
+ * waiting, the response is matched by id and given to pf_cb, or kept for
+ * pf_wait when pf_cb is NULL (a future). pf_cb borrows p_res, it is put
+ * once pf_cb returns. p_params is taken as by pf_call of the client.
+ * The socket (client.sock) is non-blocking: poll it for pf_events and
+ * call pf_process when it is ready, it sends what is queued and runs the
+ * callbacks of the responses received, or let pf_wait do both. When the
+ * connection is lost the pending calls get an { "error": .. } response
+ * from pf_process, and the next pf_call reconnects.
+ * Not thread safe, pf_wait is not for callbacks, plain sockets only (no
+ * shared memory rings or blobs).
+ */
+typedef struct jsonrpc_async_t jsonrpc_async_t;
+typedef void (*pf_async_callback_t) ( jsonrpc_async_t *p_this, int i_id,
+                                      struct json_object *p_res,
+                                      void *p_data );
+
+struct jsonrpc_async_t
+{
+    jsonrpc_client_t client;    // the connection, do not call through it
+    hashmap   pendingMap;       // key is id, value is the pending call
+    int       i_pending;        // calls waiting for their response
+    block_t  *p_out;            // requests not sent yet
+    block_t  *p_in;             // received, not a whole response yet
+    size_t    i_scanned;        // of p_in, by json_request_Scan
+    int       i_braces;
+
+    int  (*pf_call) ( jsonrpc_async_t *p_this, const char *psz_method,
+                      struct json_object *p_params,
+                      pf_async_callback_t pf_cb, void *p_data );
+    // the response of future i_id, processing the others meanwhile.
+    // i_timeout in microseconds, 0 never times out. On timeout the server
+    // is told to give up on the call, a late response is dropped. Caller
+    // puts the returned object.
+    struct json_object *(*pf_wait) ( jsonrpc_async_t *p_this, int i_id,
+                                     int i_timeout );
+    // POLLIN, and POLLOUT while requests are queued (same as EPOLL*)
+    int  (*pf_events) ( jsonrpc_async_t *p_this );
+    // responses handled, -1 when the connection is lost
+    int  (*pf_process) ( jsonrpc_async_t *p_this );
+    void (*pf_exit) ( jsonrpc_async_t *p_this );
+};
+
+// same arguments as jsonrpc_client_init
+int jsonrpc_async_init( jsonrpc_async_t *p_this, int i_sock_flag, ... );
+
 #endif
 
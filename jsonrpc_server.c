@@ -9,33 +9,87 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <netdb.h>
 #include <sys/un.h>
 #include <errno.h>
 #include <signal.h>
 #include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <linux/filter.h>
 #include <assert.h>
 #include "jsonrpc_server.h"
+#include "jsonrpc_backend.h"
 #include "log.h"
 #include "block.h"
 #include "socket.h"
 #include "jsonrpc_utils.h"
+#include "trace.h"
+#include "ratelimit.h"
+#include "rescache.h"
+#include "handoff.h"
+#include "shmring.h"
+#include "fdblob.h"
+#include "capture.h"
 
 extern int errno;
 
-#define LISTEN_BACKLOG 5
+#define LISTEN_BACKLOG SOMAXCONN
+#define ACCEPT_BATCH 64     // per listener and loop iteration
+#define UPGRADE_DRAIN_TIMEOUT 30000000      // 30 seconds
+#define UPGRADE_IO_TIMEOUT 5                // seconds, a stalled peer fails
 
 #define EPOLL_SIZE 1024
 #define EPOLL_MAX_EVENT 64
-#define EPOLL_TIMEOUT 50    // 0.05 second
 
+#define RESCACHE_DEFAULT_BYTES (64 * 1024 * 1024)
 
+#define MAX_REQUEST_DEFAULT (16 * 1024 * 1024)
+#define MAX_OUTPUT_DEFAULT (4 * 1024 * 1024)
+#define MEM_PAUSE_TIMEOUT 1000000   // 1 second
+#define LISTEN_RETRY 1000000        // 1 second, fds not freed by connections
+
+#define CANCEL_ID_MAX 64            // longer ids can not be cancelled
+#define CANCEL_QUEUE_MAX 4096       // bytes of ids cancelled ahead
+#define CANCEL_PEEK 16384           // bytes looked at by IsCancelled
+#define CANCEL_TEXT_MAX 512         // longer framed messages are no cancel
+
+
+// pre-serialized, rejecting an over-limit call must stay cheap
+static const char RATELIMIT_RESPONSE[] =
+    "{ \"jsonrpc\": \"2.0\", \"error\": \"rate limit exceeded\" }";
+static const char OVERSIZE_RESPONSE[] =
+    "{ \"jsonrpc\": \"2.0\", \"error\": \"request too large\" }";
+static const char CANCELLED_RESPONSE[] =
+    "{ \"jsonrpc\": \"2.0\", \"error\": \"request cancelled\" }";
+// ends an array stream whose call was cancelled
+static const char CANCELLED_TRAILER[] = "],\"error\":\"request cancelled\"}";
 
 static bool sg_b_abort = false;
+// connection whose request is being handled by this thread
+static __thread jsonrpc_request_t *sg_p_current_request = NULL;
+// server whose loop runs on this thread
+static __thread jsonrpc_server_t *sg_p_server = NULL;
+
+#define STAT_INC( field ) \
+    do { if ( sg_p_server ) sg_p_server->stats.field++; } while ( 0 )
 
+// loop served by this thread, NULL outside serve
+static __thread const jsonrpc_backend_t *sg_p_backend = NULL;
+// connections with output queued in this loop iteration
+static __thread jsonrpc_request_t *sg_p_flush = NULL;
 
-static int process_write( int fd, block_t *p_res );
+
+static int process_write( jsonrpc_request_t *p_request );
 static void remove_request_references( jsonrpc_server_t *p_this,
                                        jsonrpc_request_t *p_request );
+static bool stream_pump( jsonrpc_request_t *p_request );
+static void stream_free( jsonrpc_stream_t *p_stream );
+static void cancel_scan( jsonrpc_server_t *p_server,
+                         jsonrpc_request_t *p_request );
 
 void handle_signal( int signum )
 {
@@ -43,13 +97,19 @@ void handle_signal( int signum )
         sg_b_abort = true;
 }
 
+bool server_Aborted( void )
+{
+    return sg_b_abort;
+}
+
 static int jsonrpc_request_init( jsonrpc_request_t *p_request )
 {
     p_request->i_sockfd = -1;
     memset( p_request->psz_ip, 0, sizeof( p_request->psz_ip ) );
-    p_request->p_req = block_Alloc( 8192 );
-    p_request->p_res = block_Alloc( 8192 );
-    if ( !p_request->p_req || !p_request->p_res )
+    p_request->p_req = block_Alloc( BLOCK_DEFAULT );
+    p_request->p_res = block_Alloc( BLOCK_DEFAULT );
+    p_request->p_out = block_Alloc( BLOCK_DEFAULT );
+    if ( !p_request->p_req || !p_request->p_res || !p_request->p_out )
     {
         log_Err( "no memory" );
         return -1;
@@ -59,6 +119,25 @@ static int jsonrpc_request_init( jsonrpc_request_t *p_request )
     p_request->ppsz_notify_service = NULL;
     p_request->i_notify_service = 0;
     p_request->p_next = NULL;
+    p_request->b_handed_off = false;
+    p_request->p_backend = NULL;
+    p_request->i_mem = 0;
+    p_request->b_paused = false;
+    p_request->p_stream = NULL;
+    p_request->b_queued = false;
+    p_request->b_linger = false;
+    p_request->b_blocked = false;
+    p_request->b_held = false;
+    p_request->b_pollout = false;
+    p_request->p_next_flush = NULL;
+    p_request->psz_id = NULL;
+    p_request->b_cancelled = false;
+    p_request->p_cancel = NULL;
+    p_request->i_scanned = 0;
+    p_request->p_shm = NULL;
+    p_request->i_shm_ring = 0;
+    p_request->p_blobs = NULL;
+    p_request->p_proto = NULL;
     return 0;
 }
 
@@ -73,15 +152,64 @@ static jsonrpc_request_t *jsonrpc_request_create()
     if ( jsonrpc_request_init( p_request ) < 0 )
     {
         log_Err( "jsonrpc_request_init failed" );
+        free( p_request );
         return NULL;
     }
     return p_request;
 }
 
+void server_FlushLater( jsonrpc_request_t *p_request )
+{
+    if ( p_request->b_queued )
+        return;
+    p_request->b_queued = true;
+    p_request->p_next_flush = sg_p_flush;
+    sg_p_flush = p_request;
+}
+
+jsonrpc_request_t *server_TakeFlush( void )
+{
+    jsonrpc_request_t *p_flush = sg_p_flush;
+    sg_p_flush = NULL;
+    return p_flush;
+}
+
+bool server_HasFlush( void )
+{
+    return sg_p_flush != NULL;
+}
+
+static void flush_cancel( jsonrpc_request_t *p_request )
+{
+    jsonrpc_request_t **pp = &sg_p_flush;
+    while ( *pp && *pp != p_request )
+        pp = &(*pp)->p_next_flush;
+    if ( *pp )
+        *pp = p_request->p_next_flush;
+    p_request->b_queued = false;
+}
+
 static void jsonrpc_request_destroy( jsonrpc_request_t *p_request )
 {
+    if ( p_request->b_queued )
+        flush_cancel( p_request );
+    if ( p_request->p_stream )
+        stream_free( p_request->p_stream );
     block_Release( p_request->p_req );
     block_Release( p_request->p_res );
+    block_Release( p_request->p_out );
+    if ( p_request->p_cancel )
+        block_Release( p_request->p_cancel );
+    if ( p_request->p_shm )
+    {
+        shm_Release( p_request->p_shm );
+        free( p_request->p_shm );
+    }
+    if ( p_request->p_blobs )
+    {
+        fdblob_Clean( p_request->p_blobs );
+        free( p_request->p_blobs );
+    }
 
     free( p_request->psz_protocol );
     for ( int i = 0; i < p_request->i_notify_service; i++ )
@@ -89,10 +217,125 @@ static void jsonrpc_request_destroy( jsonrpc_request_t *p_request )
     free( p_request->ppsz_notify_service );
 }
 
+void server_Release( jsonrpc_request_t *p_request )
+{
+    if ( p_request->i_sockfd >= 0 )
+        close( p_request->i_sockfd );
+    jsonrpc_request_destroy( p_request );
+    free( p_request );
+}
+
+// output the loop has taken from p_out and not sent yet
+static size_t loop_pending( jsonrpc_request_t *p_request )
+{
+    return p_request->p_backend ? sg_p_backend->pf_pending( p_request ) : 0;
+}
+
+// unsent response bytes of a connection
+static size_t output_pending( jsonrpc_request_t *p_request )
+{
+    return p_request->p_res->i_buffer + p_request->p_out->i_buffer +
+           loop_pending( p_request );
+}
+
+// track the buffer memory of a connection, call it after it changed
+void server_MemAccount( jsonrpc_request_t *p_request )
+{
+    jsonrpc_server_t *p_this = sg_p_server;
+    if ( !p_this )
+        return;
+    size_t i_mem = p_request->p_req->i_maxlen + p_request->p_res->i_maxlen +
+                   p_request->p_out->i_maxlen +
+                   ( p_request->p_backend ?
+                     sg_p_backend->pf_mem( p_request ) : 0 );
+    p_this->i_mem_used += i_mem - p_request->i_mem;
+    p_request->i_mem = i_mem;
+}
+
+static void mem_release( jsonrpc_request_t *p_request )
+{
+    jsonrpc_server_t *p_this = sg_p_server;
+    if ( !p_this )
+        return;
+    p_this->i_mem_used -= p_request->i_mem;
+    p_request->i_mem = 0;
+    p_this->i_connections--;
+    if ( p_request->b_paused )
+        p_this->i_paused--;
+    p_request->b_paused = false;
+}
+
+// over the global budget, a connection holding more than the average
+// stops reading, see server_MemRelief
+bool server_MemPause( jsonrpc_request_t *p_request )
+{
+    jsonrpc_server_t *p_this = sg_p_server;
+    if ( p_request->b_paused )
+        return true;
+    if ( !p_this || !p_this->i_mem_budget ||
+         p_this->i_mem_used <= p_this->i_mem_budget ||
+         p_request->i_mem * p_this->i_connections <= p_this->i_mem_used )
+        return false;
+
+    log_Warn( "memory budget exceeded (%zu bytes), pause reading %s "
+              "(fd:%d, %zu bytes)", p_this->i_mem_used, p_request->psz_ip,
+              p_request->i_sockfd, p_request->i_mem );
+    p_request->b_paused = true;
+    if ( p_this->i_paused++ == 0 )
+        p_this->i_pause_deadline = jsonrpc_mdate() + MEM_PAUSE_TIMEOUT;
+    return true;
+}
+
+// once per loop iteration, paused connections resume under 3/4 of the
+// budget. Still over it after MEM_PAUSE_TIMEOUT, what they hold is not
+// going away by itself and the biggest one is dropped.
+int server_MemRelief( jsonrpc_server_t *p_this )
+{
+    if ( p_this->i_paused == 0 )
+        return MEM_WAIT;
+    if ( p_this->i_mem_used <= p_this->i_mem_budget / 4 * 3 )
+        return MEM_RESUME;
+    uint64_t i_now = jsonrpc_mdate();
+    if ( i_now < p_this->i_pause_deadline )
+        return MEM_WAIT;
+    p_this->i_pause_deadline = i_now + MEM_PAUSE_TIMEOUT;
+    return MEM_SHED;
+}
+
+jsonrpc_request_t *server_MemBiggestPaused( hashmap requestMap )
+{
+    jsonrpc_request_t *p_biggest = NULL;
+    hashmap_iterator it = hashmap_iterate( requestMap );
+    while ( hashmap_next( &it ) )
+    {
+        jsonrpc_request_t *p_request = it.p_val;
+        if ( p_request->b_paused &&
+             ( !p_biggest || p_request->i_mem > p_biggest->i_mem ) )
+            p_biggest = p_request;
+    }
+    return p_biggest;
+}
+
+// close once the pending output is sent
+static void close_after_write( jsonrpc_request_t *p_request )
+{
+    p_request->i_state = CONN_CLOSED;
+    p_request->p_req->i_buffer = 0;
+    p_request->b_linger = true;
+    server_FlushLater( p_request );
+}
+
 // notify_dispatch functions can use this to send notify
 int jsonrpc_request_sendResponse( jsonrpc_request_t *p_request,
                                   block_t *p_block )
 {
+    if ( sg_p_server && output_pending( p_request ) + p_block->i_buffer >
+                        sg_p_server->i_max_output )
+    {
+        log_Warn( "drop response to %s, %zu bytes not sent yet",
+                  p_request->psz_ip, output_pending( p_request ) );
+        return -1;
+    }
     block_t *p_res = p_request->p_res;
     if ( p_res->i_buffer + p_block->i_buffer >= p_res->i_maxlen )
     {
@@ -106,7 +349,7 @@ int jsonrpc_request_sendResponse( jsonrpc_request_t *p_request,
     memcpy( p_res->p_buffer + p_res->i_buffer, p_block->p_buffer,
             p_block->i_buffer );
     p_res->i_buffer += p_block->i_buffer;
-    return process_write( p_request->i_sockfd, p_res );
+    return process_write( p_request );
 }
 
 
@@ -140,6 +383,22 @@ static int register_member_function( jsonrpc_server_t *p_this,
     return __register_function( p_this, psz_method, pmf );
 }
 
+static int register_stream( jsonrpc_server_t *p_this, const char *psz_method,
+                            pf_rpc_stream_callback_t pf )
+{
+    if ( !p_this->b_initialized )
+    {
+        log_Err( "register_stream is called before initialization" );
+        return -1;
+    }
+
+    hashmap_key_t key;
+    key.u.psz_string = psz_method;
+    key.type = 'c';
+    hashmap_put( p_this->streamMap, key, (void*)pf );
+    return 0;
+}
+
 static int register_class_object( jsonrpc_server_t *p_this,
                                   const char *psz_class, void *p_obj )
 {
@@ -187,12 +446,215 @@ static int register_notify_services( jsonrpc_server_t *p_this,
     return 0;
 }
 
+static int set_ip_ratelimit( jsonrpc_server_t *p_this, int i_sources,
+                             double f_rate, double f_burst )
+{
+    if ( i_sources <= 0 || i_sources > RATELIMIT_MAX_SOURCES )
+    {
+        log_Err( "ip rate limit of %d sources, 1 to %d", i_sources,
+                 RATELIMIT_MAX_SOURCES );
+        return -1;
+    }
+    ratelimit_t *p_limit = ratelimit_New( i_sources, f_rate, f_burst );
+    if ( !p_limit )
+        return JSONRPC_ERR_NOMEM;
+
+    ratelimit_Delete( p_this->p_iplimit );
+    p_this->p_iplimit = p_limit;
+    return 0;
+}
+
+static int set_capture( jsonrpc_server_t *p_this, const char *psz_file,
+                        double f_sample )
+{
+    capture_Delete( p_this->p_capture );
+    p_this->p_capture = NULL;
+    if ( f_sample <= 0 )
+        return 0;
+
+    int i_every = f_sample >= 1 ? 1 : (int)( 1 / f_sample + 0.5 );
+    p_this->p_capture = capture_New( psz_file, i_every );
+    return p_this->p_capture ? 0 : -1;
+}
+
+static int set_method_ratelimit( jsonrpc_server_t *p_this,
+                                 const char *psz_method,
+                                 double f_rate, double f_burst )
+{
+    hashmap_key_t key;
+    key.type = 'c';
+    key.u.psz_string = psz_method;
+    ratelimit_bucket_t *p_bucket = hashmap_get( p_this->methodLimitMap, key );
+    if ( !p_bucket )
+    {
+        // bucket and method name in one allocation, the name is the key
+        p_bucket = malloc( sizeof(ratelimit_bucket_t) + strlen(psz_method) + 1 );
+        if ( !p_bucket )
+        {
+            log_Err( "no memory" );
+            return JSONRPC_ERR_NOMEM;
+        }
+        key.u.psz_string = strcpy( (char*)(p_bucket + 1), psz_method );
+        hashmap_put( p_this->methodLimitMap, key, p_bucket );
+    }
+    ratelimit_bucket_Init( p_bucket, f_rate, f_burst );
+    return 0;
+}
+
+typedef struct method_opt_t
+{
+    int  i_cache_ttl;               // ms, 0 is not cached
+    bool b_coalesce;
+    char psz_method[];
+} method_opt_t;
+
+typedef struct flight_t
+{
+    uint8_t *p_body;                // serialized response without "id"
+    size_t   i_body;
+    char     psz_key[];
+} flight_t;
+
+static method_opt_t *get_method_opt( jsonrpc_server_t *p_this,
+                                     const char *psz_method )
+{
+    hashmap_key_t key;
+    key.type = 'c';
+    key.u.psz_string = psz_method;
+    method_opt_t *p_opt = hashmap_get( p_this->methodOptMap, key );
+    if ( !p_opt )
+    {
+        p_opt = malloc( sizeof(method_opt_t) + strlen(psz_method) + 1 );
+        if ( !p_opt )
+        {
+            log_Err( "no memory" );
+            return NULL;
+        }
+        p_opt->i_cache_ttl = 0;
+        p_opt->b_coalesce = false;
+        key.u.psz_string = strcpy( p_opt->psz_method, psz_method );
+        hashmap_put( p_this->methodOptMap, key, p_opt );
+    }
+    return p_opt;
+}
+
+static int register_cacheable( jsonrpc_server_t *p_this,
+                               const char *psz_method, int i_ttl )
+{
+    if ( !p_this->p_cache )
+    {
+        p_this->p_cache = rescache_New( p_this->i_cache_bytes );
+        if ( !p_this->p_cache )
+            return JSONRPC_ERR_NOMEM;
+    }
+
+    method_opt_t *p_opt = get_method_opt( p_this, psz_method );
+    if ( !p_opt )
+        return JSONRPC_ERR_NOMEM;
+    p_opt->i_cache_ttl = i_ttl;
+    return 0;
+}
+
+static int register_coalesced( jsonrpc_server_t *p_this,
+                               const char *psz_method )
+{
+    method_opt_t *p_opt = get_method_opt( p_this, psz_method );
+    if ( !p_opt )
+        return JSONRPC_ERR_NOMEM;
+    p_opt->b_coalesce = true;
+    return 0;
+}
+
+static void flight_add( jsonrpc_server_t *p_this, const char *psz_key,
+                        const char *psz_body, size_t i_body )
+{
+    flight_t *p_flight = malloc( sizeof(flight_t) + strlen(psz_key) + 1 );
+    uint8_t *p_body = malloc( i_body );
+    if ( !p_flight || !p_body )
+    {
+        // the next identical call just runs the handler again
+        log_Err( "no memory" );
+        free( p_flight );
+        free( p_body );
+        return;
+    }
+    memcpy( p_body, psz_body, i_body );
+    p_flight->p_body = p_body;
+    p_flight->i_body = i_body;
+
+    hashmap_key_t key;
+    key.type = 'c';
+    key.u.psz_string = strcpy( p_flight->psz_key, psz_key );
+    hashmap_put( p_this->flightMap, key, p_flight );
+}
+
+// the loop iteration is over, later calls no longer overlap these executions
+static void flights_clear( jsonrpc_server_t *p_this )
+{
+    if ( hashmap_get_len( p_this->flightMap ) == 0 )
+        return;
+
+    hashmap_iterator it = hashmap_iterate( p_this->flightMap );
+    while ( hashmap_next( &it ) )
+    {
+        flight_t *p_flight = it.p_val;
+        free( p_flight->p_body );
+        free( p_flight );
+    }
+    hashmap_free( p_this->flightMap );
+    p_this->flightMap = hashmap_create(101);
+}
+
+static void cache_invalidate( jsonrpc_server_t *p_this, const char *psz_method,
+                              struct json_object *p_params )
+{
+    if ( p_this->p_cache )
+        rescache_Invalidate( p_this->p_cache, psz_method, p_params );
+}
+
+void jsonrpc_cache_Invalidate( const char *psz_method,
+                               struct json_object *p_params )
+{
+    if ( sg_p_server )
+        cache_invalidate( sg_p_server, psz_method, p_params );
+}
+
 static bool __json_request_IsComplete( jsonrpc_server_t *p_server,
                                        block_t *p_req, size_t *pi_len )
 {
     return json_request_IsComplete( p_req, pi_len );
 }
 
+// recv taking the descriptors sent along (fdblob.h), the ones that can not
+// be kept fail the connection: the next requests would get the wrong blobs
+static ssize_t recv_blobs( jsonrpc_request_t *p_request, uint8_t *p_buf,
+                           size_t i_buf )
+{
+    struct iovec iov;
+    iov.iov_base = p_buf;
+    iov.iov_len = i_buf;
+
+    union
+    {
+        struct cmsghdr align;
+        char buf[ FDBLOB_CONTROL ];
+    } control;
+
+    struct msghdr msg;
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t i_ret = recvmsg( p_request->i_sockfd, &msg, MSG_CMSG_CLOEXEC );
+    if ( i_ret > 0 && fdblob_Collect( p_request->p_blobs, &msg ) < 0 )
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    return i_ret;
+}
+
 static void process_read( jsonrpc_server_t *p_server,
                           jsonrpc_request_t *p_request )
 {
@@ -203,6 +665,9 @@ static void process_read( jsonrpc_server_t *p_server,
 
     while ( true )
     {
+        // already too big, server_ProcessRequests rejects it
+        if ( p_req->i_buffer > p_server->i_max_request )
+            break;
         if ( p_req->i_buffer + 4096 >= p_req->i_maxlen )
         {
             p_req = block_Realloc( p_req, 4096 );
@@ -213,7 +678,12 @@ static void process_read( jsonrpc_server_t *p_server,
             }
         }
 
-        i_read = recv( fd, p_req->p_buffer + p_req->i_buffer, 4096, 0 );
+        STAT_INC( i_syscalls );
+        if ( p_request->p_blobs )
+            i_read = recv_blobs( p_request, p_req->p_buffer + p_req->i_buffer,
+                                 4096 );
+        else
+            i_read = recv( fd, p_req->p_buffer + p_req->i_buffer, 4096, 0 );
         if ( i_read < 0 )
         {
             if ( errno == EAGAIN )
@@ -237,6 +707,9 @@ static void process_read( jsonrpc_server_t *p_server,
         else
         {
             p_req->i_buffer += i_read;
+            // doorbells, the requests come through the shared ring
+            if ( p_request->p_shm )
+                p_req->i_buffer -= i_read;
             // drop notify request except handshake
             if ( p_request->psz_protocol
                  && !strcasecmp( p_request->psz_protocol, "notify" )
@@ -250,42 +723,278 @@ static void process_read( jsonrpc_server_t *p_server,
     }
 }
 
-static void process_requests( jsonrpc_server_t *p_server,
-                              jsonrpc_request_t *p_request )
+// set p_resblock to an already serialized response
+static int copy_response( block_t *p_resblock, const uint8_t *p_data,
+                          size_t i_data )
+{
+    if ( i_data >= p_resblock->i_maxlen )
+    {
+        p_resblock = block_Realloc( p_resblock, i_data );
+        if ( !p_resblock )
+        {
+            log_Err( "no memory" );
+            return JSONRPC_ERR_NOMEM;
+        }
+    }
+    memcpy( p_resblock->p_buffer, p_data, i_data );
+    p_resblock->i_buffer = i_data;
+    return 0;
+}
+
+// set p_resblock to a serialized response, splicing the i_id bytes of json
+// at p_id in front of the other members as "id"
+static int splice_response( block_t *p_resblock, const uint8_t *p_body,
+                            size_t i_body, const char *p_id, size_t i_id )
+{
+    assert( p_body[0] == '{' );
+    size_t i_data = i_body + i_id + 6;      // {"id":<id>, then body after '{'
+    if ( i_data >= p_resblock->i_maxlen )
+    {
+        p_resblock = block_Realloc( p_resblock, i_data );
+        if ( !p_resblock )
+        {
+            log_Err( "no memory" );
+            return JSONRPC_ERR_NOMEM;
+        }
+    }
+    uint8_t *p = p_resblock->p_buffer;
+    memcpy( p, "{\"id\":", 6 );
+    memcpy( p + 6, p_id, i_id );
+    p[ 6 + i_id ] = ',';
+    memcpy( p + 7 + i_id, p_body + 1, i_body - 1 );
+    p_resblock->i_buffer = i_data;
+    return 0;
+}
+
+// set p_resblock to a serialized response, with "id" when the request had
+// one. Cached and coalesced bodies are stored without "id" so that every
+// caller gets its own back.
+static int set_response( block_t *p_resblock, const uint8_t *p_body,
+                         size_t i_body, const char *psz_id )
+{
+    if ( !psz_id )
+        return copy_response( p_resblock, p_body, i_body );
+    return splice_response( p_resblock, p_body, i_body, psz_id,
+                            strlen( psz_id ) );
+}
+
+// set p_resblock to one of the pre-serialized responses, the request's raw
+// id (i_id bytes at p_id) spliced in when it had one. The '\0' terminator
+// is part of the response.
+static int reject_with( block_t *p_resblock, const char *psz_response,
+                        const char *p_id, size_t i_id )
+{
+    size_t i_response = strlen( psz_response ) + 1;
+    int i_ret = p_id ?
+        splice_response( p_resblock, (const uint8_t*)psz_response, i_response,
+                         p_id, i_id ) :
+        copy_response( p_resblock, (const uint8_t*)psz_response, i_response );
+    return i_ret < 0 ? JSONRPC_ERR_NOMEM : -1;
+}
+
+// answer with an error if the protocol has one, and close
+static void reject_oversize( jsonrpc_server_t *p_server,
+                             jsonrpc_request_t *p_request )
+{
+    log_Warn( "request from %s over %zu bytes, close connection",
+              p_request->psz_ip, p_server->i_max_request );
+    // it was not parsed, the id is not known
+    if ( p_request->i_state == CONN_HANDSHAKED &&
+         p_request->psz_protocol &&
+         !strcasecmp( p_request->psz_protocol, "rpc" ) &&
+         p_request->p_res->i_buffer == 0 )
+    {
+        reject_with( p_request->p_res, OVERSIZE_RESPONSE, NULL, 0 );
+        process_write( p_request );
+    }
+    close_after_write( p_request );
+}
+
+// the framing hook of the connection's protocol
+static inline bool request_IsComplete( jsonrpc_server_t *p_server,
+                                       jsonrpc_request_t *p_request,
+                                       block_t *p_req, size_t *pi_len )
+{
+    if ( p_request->p_proto )
+        return p_request->p_proto->pf_request_IsComplete( p_server, p_req,
+                                                          pi_len );
+    return p_server->pf_request_IsComplete( p_server, p_req, pi_len );
+}
+
+// false while the first bytes do not tell the protocol yet
+static bool select_protocol( jsonrpc_server_t *p_server,
+                             jsonrpc_request_t *p_request )
+{
+    block_t *p_req = p_request->p_req;
+    if ( p_req->i_buffer > 0 )
+        p_request->p_proto = p_server->pf_select_protocol( p_server, p_req );
+    if ( !p_request->p_proto && p_req->i_buffer > p_server->i_max_request )
+        reject_oversize( p_server, p_request );
+    return p_request->p_proto != NULL;
+}
+
+// move what the client wrote to the shared ring into p_req and arm its
+// doorbell (shm_Arm). A doorbell also says there is room for the output.
+static void shm_pull( jsonrpc_server_t *p_server, jsonrpc_request_t *p_request )
+{
+    shm_t *p_shm = p_request->p_shm;
+    block_t *p_req = p_request->p_req;
+    if ( p_request->b_blocked )
+    {
+        p_request->b_blocked = false;
+        server_FlushLater( p_request );
+    }
+    do
+    {
+        size_t i_ready;
+        while ( ( i_ready = shm_Readable( p_shm ) ) > 0 )
+        {
+            // already too big, server_ProcessRequests rejects it
+            if ( p_req->i_buffer > p_server->i_max_request )
+                return;
+            if ( p_req->i_buffer + i_ready >= p_req->i_maxlen &&
+                 !block_Realloc( p_req, i_ready ) )
+            {
+                log_Err( "no memory %s %d", __FILE__, __LINE__ );
+                abort();
+            }
+            p_req->i_buffer += shm_Read( p_shm,
+                                         p_req->p_buffer + p_req->i_buffer,
+                                         i_ready );
+        }
+    } while ( !shm_Arm( p_shm, false ) );
+}
+
+// copy the output to the shared ring, when it is full the client's
+// doorbell tells when there is room (shm_pull)
+void server_ShmSend( jsonrpc_request_t *p_request )
+{
+    shm_t *p_shm = p_request->p_shm;
+    block_t *p_out = p_request->p_out;
+    size_t i_sent = 0;
+    while ( i_sent < p_out->i_buffer )
+    {
+        size_t i_ret = shm_Write( p_shm, p_out->p_buffer + i_sent,
+                                  p_out->i_buffer - i_sent );
+        i_sent += i_ret;
+        if ( i_ret == 0 && shm_Arm( p_shm, true ) )
+        {
+            p_request->b_blocked = true;
+            break;
+        }
+    }
+    memmove( p_out->p_buffer, p_out->p_buffer + i_sent,
+             p_out->i_buffer - i_sent );
+    p_out->i_buffer -= i_sent;
+    if ( p_out->i_maxlen > BLOCK_KEEP )
+        block_Shrink( p_out, BLOCK_DEFAULT );
+    server_MemAccount( p_request );
+}
+
+void server_ProcessRequests( jsonrpc_server_t *p_server,
+                             jsonrpc_request_t *p_request )
 {
     int fd = p_request->i_sockfd;
     block_t *p_req = p_request->p_req;
     block_t *p_res = p_request->p_res;
 
+    if ( p_request->p_shm )
+        shm_pull( p_server, p_request );
+
+    // a streamed result holds the next requests back until it is complete,
+    // as does output over i_max_output, the cancellations among them are
+    // taken out meanwhile
+    if ( p_request->p_stream || p_request->b_held )
+        cancel_scan( p_server, p_request );
+    if ( p_request->p_stream && stream_pump( p_request ) )
+    {
+        server_MemAccount( p_request );
+        return;
+    }
+
+    // rejected, waiting for the close
+    if ( p_request->i_state == CONN_CLOSED )
+    {
+        p_req->i_buffer = 0;
+        return;
+    }
+
     if ( p_server->pf_get_request )
+    {
+        TRACE_BEGIN( "pf_get_request", fd );
         p_server->pf_get_request( p_server, p_request );
+        TRACE_END( "pf_get_request", fd );
+    }
+
+    // pinned once, the hooks are not chosen per message
+    if ( p_server->pf_select_protocol && !p_request->p_proto &&
+         !select_protocol( p_server, p_request ) )
+    {
+        server_MemAccount( p_request );
+        return;
+    }
 
     // NOTE: the request string should contain '\0' at end, it means
     // client should send it.
     size_t i_len = 0;
-    while ( p_server->pf_request_IsComplete( p_server, p_req, &i_len ) )
-    {
-        // if the response of the previous request has not been send
-        // completely (sendbuf full), this request may arrive. In this
-        // case, drop this request and suggest user to enlarge sendbuf
-        // or faster client recv.
-        if ( p_res->i_buffer != 0 )
-        {
-            log_Warn( "drop rpc request, the response of previous "
-                      "request has not been send completely. "
-                      "Should enlarge sendbuf or speed up client "
-                      "recv." );
-
-            memmove( p_req->p_buffer, p_req->p_buffer + i_len,
-                     p_req->i_buffer - i_len );
-            p_req->i_buffer -= i_len;
-            continue;
+    while ( true )
+    {
+        TRACE_BEGIN( "framing", fd );
+        bool b_complete = request_IsComplete( p_server, p_request, p_req,
+                                              &i_len );
+        TRACE_END( "framing", fd );
+        // the framing hook reports JSONRPC_OVERSIZE as soon as it knows
+        if ( ( !b_complete && p_req->i_buffer > p_server->i_max_request ) ||
+             ( b_complete && ( i_len == JSONRPC_OVERSIZE ||
+                               i_len > p_server->i_max_request ) ) )
+        {
+            reject_oversize( p_server, p_request );
+            break;
+        }
+        if ( !b_complete )
+        {
+            p_request->b_held = false;
+            break;
+        }
+
+        // the client does not read its responses fast enough: the next
+        // requests wait in p_req until the output drains, epoll_send and
+        // uring_on_send come back here. So do they behind FDBLOB_BATCHES
+        // responses carrying blobs.
+        if ( output_pending( p_request ) > p_server->i_max_output ||
+             ( p_request->p_blobs &&
+               p_request->p_blobs->i_batches == FDBLOB_BATCHES ) )
+        {
+            if ( !p_request->b_held &&
+                 output_pending( p_request ) > p_server->i_max_output )
+                log_Warn( "%s does not read its responses, %zu bytes "
+                          "unsent: requests wait. Should enlarge sendbuf "
+                          "(jsonrpc_sockopt_t i_sndbuf) or speed up client "
+                          "recv.", p_request->psz_ip,
+                          output_pending( p_request ) );
+            p_request->b_held = true;
+            break;
+        }
+
+        // the blobs of this request, until the next one (fdblob.h)
+        if ( p_request->p_blobs &&
+             fdblob_Take( p_request->p_blobs, p_req->p_buffer, i_len ) < 0 )
+        {
+            log_Err( "blobs of %s out of step, close connection",
+                     p_request->psz_ip );
+            close_after_write( p_request );
+            break;
         }
 
         int ret;
         if ( p_request->i_state == CONN_CONNECTED )
         {
-            ret = p_server->pf_handle_handshake( p_server, p_request );
+            TRACE_BEGIN( "pf_handle_handshake", fd );
+            ret = p_request->p_proto ?
+                  p_request->p_proto->pf_handle_handshake( p_server,
+                                                           p_request ) :
+                  p_server->pf_handle_handshake( p_server, p_request );
+            TRACE_END( "pf_handle_handshake", fd );
             if ( ret < 0 )
             {
                 log_Dbg( "handshake failed, close conntion" );
@@ -298,73 +1007,1384 @@ static void process_requests( jsonrpc_server_t *p_server,
             }
             else
             {
-                process_write( fd, p_res );
+                process_write( p_request );
                 p_request->i_state = CONN_HANDSHAKED;
                 log_Dbg( "handshake succeed (fd:%d)", fd );
+                if ( p_request->p_shm )
+                    shm_pull( p_server, p_request );
             }
         }
         else if ( p_request->i_state == CONN_HANDSHAKED )
         {
             assert( p_res->i_buffer == 0 );
-            p_server->pf_handle_request( p_server,
-                                         p_request->p_req,
-                                         p_request->p_res );
+            TRACE_BEGIN( "pf_handle_request", fd );
+            sg_p_current_request = p_request;
+            if ( p_request->p_proto )
+                p_request->p_proto->pf_handle_request( p_server,
+                                                       p_request->p_req,
+                                                       p_request->p_res );
+            else
+                p_server->pf_handle_request( p_server,
+                                             p_request->p_req,
+                                             p_request->p_res );
+            sg_p_current_request = NULL;
+            TRACE_END( "pf_handle_request", fd );
+            STAT_INC( i_requests );
             // write response on both success and error condations
-            process_write( fd, p_res );
+            process_write( p_request );
         }
 
         // next request
         memmove( p_req->p_buffer, p_req->p_buffer + i_len,
                  p_req->i_buffer - i_len );
         p_req->i_buffer -= i_len;
+        p_request->i_scanned = 0;
+
+        if ( p_request->p_stream )
+            cancel_scan( p_server, p_request );
+        if ( p_request->p_stream && stream_pump( p_request ) )
+            break;
     }
+
+    // the handlers are done with the views
+    if ( p_request->p_blobs )
+        fdblob_Release( p_request->p_blobs );
+
+    if ( p_req->i_maxlen > BLOCK_KEEP )
+        block_Shrink( p_req, BLOCK_DEFAULT );
+    server_MemAccount( p_request );
 }
 
-static int process_write( int fd, block_t *p_res )
+// queue the response, the output of a connection goes out in one send per
+// loop iteration (epoll_flush, uring_flush)
+static int process_write( jsonrpc_request_t *p_request )
 {
-    int i_remain = p_res->i_buffer;
-    uint8_t *ptr = p_res->p_buffer;
-    int i_ret = 0;
-    int i_send = 0;
-    while ( i_remain > 0 )
+    block_t *p_res = p_request->p_res;
+    fdblob_queue_t *p_blobs = p_request->p_blobs;
+    if ( p_request->i_state == CONN_CLOSED )
     {
-        i_send = send( fd, ptr, i_remain, 0 );
-        if ( i_send < 0 )
+        p_res->i_buffer = 0;
+        if ( p_blobs )
+            fdblob_Detach( p_blobs );
+        return -1;
+    }
+    if ( p_blobs && p_blobs->i_attached > 0 )
+    {
+        // sent with the first byte of the response (epoll_send,
+        // uring_submit_send)
+        if ( p_res->i_buffer > 0 )
+            fdblob_Queue( p_blobs, p_request->p_out->i_buffer +
+                                   loop_pending( p_request ), p_res );
+        else
+            fdblob_Detach( p_blobs );
+    }
+    if ( p_res->i_buffer == 0 )
+        return 0;
+
+    p_request->p_out = block_Append( p_request->p_out, p_res->p_buffer,
+                                     p_res->i_buffer );
+    if ( !p_request->p_out )
+    {
+        log_Err( "no memory %s %d", __FILE__, __LINE__ );
+        abort();
+    }
+    p_res->i_buffer = 0;
+    if ( p_res->i_maxlen > BLOCK_KEEP )
+        block_Shrink( p_res, BLOCK_DEFAULT );
+    server_MemAccount( p_request );
+    server_FlushLater( p_request );
+    return 0;
+}
+
+
+// after the events of an iteration have been processed
+void server_Processed( jsonrpc_server_t *p_this )
+{
+    if ( p_this->pf_on_processed )
+    {
+        TRACE_BEGIN( "pf_on_processed", 0 );
+        p_this->pf_on_processed( p_this );
+        TRACE_END( "pf_on_processed", 0 );
+    }
+    flights_clear( p_this );
+    trace_DumpIfRequested();
+}
+
+// out of fds without a spare one to drop the pending connection with, a
+// listener stays readable and accept fails again at once: the listeners
+// stop until a connection goes (or LISTEN_RETRY) and the spare reopens
+void server_ListenPause( jsonrpc_server_t *p_this )
+{
+    if ( p_this->i_listen_conns < 0 )
+        log_Warn( "out of fds, stop accepting until a connection closes" );
+    p_this->i_listen_conns = p_this->i_connections;
+    p_this->i_listen_retry = jsonrpc_mdate() + LISTEN_RETRY;
+}
+
+// true when the paused listeners can accept again
+bool server_ListenResume( jsonrpc_server_t *p_this, int *pi_sparefd )
+{
+    if ( p_this->i_listen_conns < 0 ||
+         ( p_this->i_connections >= p_this->i_listen_conns &&
+           jsonrpc_mdate() < p_this->i_listen_retry ) )
+        return false;
+    *pi_sparefd = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+    if ( *pi_sparefd < 0 )
+    {
+        server_ListenPause( p_this );
+        return false;
+    }
+    log_Warn( "fds available again, accepting connections" );
+    p_this->i_listen_conns = -1;
+    return true;
+}
+
+static void epoll_listen( jsonrpc_server_t *p_this, int epfd, bool b_listen )
+{
+    for ( int i = 0; i < p_this->i_listeners; i++ )
+    {
+        jsonrpc_listener_t *p_listener = &p_this->p_listeners[i];
+        if ( p_listener->b_paused != b_listen )
+            continue;
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = p_listener->i_fd;
+        if ( epoll_ctl( epfd, b_listen ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+                        p_listener->i_fd, &event ) < 0 )
         {
-            i_ret = -1;
-            if ( errno == EAGAIN )
-                break;
-            else
+            log_Err( "epoll %s listening sock failed (%s)",
+                     b_listen ? "add" : "del", strerror(errno) );
+            continue;
+        }
+        p_listener->b_paused = !b_listen;
+    }
+}
+
+// streamed result, see jsonrpc_stream_Begin
+struct jsonrpc_stream_t
+{
+    jsonrpc_request_t *p_request;   // written to as produced, or NULL when
+    // the result is collected in p_out (websocket)
+    block_t  *p_out;
+    int       i_kind;
+    bool      b_begun;
+    bool      b_first;              // no element emitted yet
+    bool      b_eof;                // pf_next returned 0
+    pf_rpc_stream_next_t pf_next;
+    void    (*pf_close) ( void *p_opaque );
+    void     *p_opaque;
+    int       i_file;               // Sendfile range not sent yet, or -1
+    off_t     i_offset;
+    size_t    i_count;
+    char     *psz_id;               // of the call, or NULL
+    char      psz_error[128];
+};
+
+enum stream_step
+{
+    STREAM_MORE,
+    STREAM_WAIT,                    // socket full while sending a file
+    STREAM_DONE,
+    STREAM_FAILED,
+};
+
+static void stream_append( jsonrpc_stream_t *p_stream, const void *p_data,
+                           size_t i_data )
+{
+    if ( !block_Append( p_stream->p_out, (uint8_t*)p_data, i_data ) )
+    {
+        log_Err( "no memory %s %d", __FILE__, __LINE__ );
+        abort();
+    }
+}
+
+// the last bytes of the response and its '\0' terminator
+static void stream_end( jsonrpc_stream_t *p_stream, const char *psz_trailer )
+{
+    stream_append( p_stream, psz_trailer, strlen( psz_trailer ) + 1 );
+}
+
+static void stream_free( jsonrpc_stream_t *p_stream )
+{
+    if ( p_stream->b_begun && p_stream->pf_close )
+        p_stream->pf_close( p_stream->p_opaque );
+    free( p_stream->psz_id );
+    free( p_stream );
+}
+
+int jsonrpc_stream_Begin( jsonrpc_stream_t *p_stream, int i_kind,
+                          pf_rpc_stream_next_t pf_next,
+                          void (*pf_close) ( void *p_opaque ),
+                          void *p_opaque )
+{
+    if ( p_stream->b_begun )
+    {
+        log_Err( "jsonrpc stream has already begun" );
+        return -1;
+    }
+    p_stream->i_kind = i_kind;
+    p_stream->pf_next = pf_next;
+    p_stream->pf_close = pf_close;
+    p_stream->p_opaque = p_opaque;
+    p_stream->b_begun = true;
+    return 0;
+}
+
+void jsonrpc_stream_Error( jsonrpc_stream_t *p_stream, const char *psz_error )
+{
+    snprintf( p_stream->psz_error, sizeof(p_stream->psz_error), "%s",
+              psz_error );
+}
+
+int jsonrpc_stream_Element( jsonrpc_stream_t *p_stream,
+                            struct json_object *p_elem )
+{
+    if ( p_stream->i_kind != JSONRPC_STREAM_ARRAY )
+        return -1;
+    const char *psz_elem = json_object_to_json_string( p_elem );
+    if ( !p_stream->b_first )
+        stream_append( p_stream, ",", 1 );
+    p_stream->b_first = false;
+    stream_append( p_stream, psz_elem, strlen( psz_elem ) );
+    return 0;
+}
+
+int jsonrpc_stream_Write( jsonrpc_stream_t *p_stream, const void *p_data,
+                          size_t i_data )
+{
+    if ( p_stream->i_kind != JSONRPC_STREAM_RAW || p_stream->i_file >= 0 )
+        return -1;
+    stream_append( p_stream, p_data, i_data );
+    return 0;
+}
+
+int jsonrpc_stream_Sendfile( jsonrpc_stream_t *p_stream, int i_fd,
+                             off_t i_offset, size_t i_count )
+{
+    if ( p_stream->i_kind != JSONRPC_STREAM_RAW || p_stream->i_file >= 0 )
+        return -1;
+    if ( i_count == 0 )
+        return 0;
+    p_stream->i_file = i_fd;
+    p_stream->i_offset = i_offset;
+    p_stream->i_count = i_count;
+    return 0;
+}
+
+// the pending Sendfile range. With io_uring, or without a connection, it is
+// read into the output a window at a time.
+static int stream_file( jsonrpc_stream_t *p_stream )
+{
+    jsonrpc_request_t *p_request = p_stream->p_request;
+    if ( p_request && sg_p_backend->b_sendfile && !p_request->p_shm )
+    {
+        // after the output produced before it, epoll_send pumps the
+        // stream again once that is sent
+        process_write( p_request );
+        if ( p_request->p_out->i_buffer != 0 )
+            return STREAM_WAIT;
+        while ( p_stream->i_count > 0 )
+        {
+            STAT_INC( i_syscalls );
+            ssize_t i_sent = sendfile( p_request->i_sockfd, p_stream->i_file,
+                                       &p_stream->i_offset, p_stream->i_count );
+            if ( i_sent < 0 && errno == EAGAIN )
             {
-                log_Err( "write failed (%s)", strerror(errno) );
-                break;
+                // arm EPOLLOUT
+                p_request->b_blocked = true;
+                server_FlushLater( p_request );
+                return STREAM_WAIT;
+            }
+            if ( i_sent <= 0 )
+            {
+                log_Err( "sendfile failed (%s)",
+                         i_sent < 0 ? strerror(errno) : "end of file" );
+                return STREAM_FAILED;
             }
+            p_stream->i_count -= i_sent;
         }
-        else
+        p_stream->i_file = -1;
+        return STREAM_MORE;
+    }
+
+    block_t *p_out = p_stream->p_out;
+    size_t i_chunk = p_stream->i_count < JSONRPC_STREAM_WINDOW ?
+                     p_stream->i_count : JSONRPC_STREAM_WINDOW;
+    if ( p_out->i_buffer + i_chunk >= p_out->i_maxlen &&
+         !block_Realloc( p_out, i_chunk ) )
+    {
+        log_Err( "no memory %s %d", __FILE__, __LINE__ );
+        abort();
+    }
+    ssize_t i_read = pread( p_stream->i_file, p_out->p_buffer + p_out->i_buffer,
+                            i_chunk, p_stream->i_offset );
+    if ( i_read <= 0 )
+    {
+        log_Err( "stream file read failed (%s)",
+                 i_read < 0 ? strerror(errno) : "end of file" );
+        return STREAM_FAILED;
+    }
+    p_out->i_buffer += i_read;
+    p_stream->i_offset += i_read;
+    p_stream->i_count -= i_read;
+    if ( p_stream->i_count == 0 )
+        p_stream->i_file = -1;
+    return STREAM_MORE;
+}
+
+// the client cancelled the call. An array ends after the elements sent so
+// far, a raw value can not be ended.
+static int stream_cancel( jsonrpc_stream_t *p_stream )
+{
+    log_Dbg( "stream to %s cancelled", p_stream->p_request->psz_ip );
+    if ( p_stream->i_kind != JSONRPC_STREAM_ARRAY )
+        return STREAM_FAILED;
+    stream_end( p_stream, CANCELLED_TRAILER );
+    return STREAM_DONE;
+}
+
+static int stream_step( jsonrpc_stream_t *p_stream )
+{
+    if ( p_stream->p_request && p_stream->p_request->b_cancelled &&
+         !p_stream->b_eof )
+        return stream_cancel( p_stream );
+    if ( p_stream->i_file >= 0 )
+        return stream_file( p_stream );
+    if ( p_stream->b_eof )
+    {
+        stream_end( p_stream, p_stream->i_kind == JSONRPC_STREAM_ARRAY ?
+                              "]}" : "}" );
+        return STREAM_DONE;
+    }
+
+    sg_p_current_request = p_stream->p_request;
+    int i_ret = p_stream->pf_next( p_stream, p_stream->p_opaque );
+    sg_p_current_request = NULL;
+    if ( i_ret < 0 )
+        return STREAM_FAILED;
+    if ( i_ret == 0 )
+        p_stream->b_eof = true;
+    return STREAM_MORE;
+}
+
+// produce while the connection has room for it, return true while the
+// stream goes on. It is pumped again once its output has been sent.
+static bool stream_pump( jsonrpc_request_t *p_request )
+{
+    jsonrpc_stream_t *p_stream = p_request->p_stream;
+    int i_step = STREAM_MORE;
+    // a cancelled one ends without waiting for room
+    while ( i_step == STREAM_MORE && p_request->i_state != CONN_CLOSED &&
+            ( output_pending( p_request ) < JSONRPC_STREAM_WINDOW ||
+              p_request->b_cancelled ) )
+        i_step = stream_step( p_stream );
+    process_write( p_request );
+    if ( i_step == STREAM_MORE || i_step == STREAM_WAIT )
+        return true;
+
+    p_request->p_stream = NULL;
+    p_request->psz_id = NULL;
+    p_request->b_cancelled = false;
+    stream_free( p_stream );
+    if ( i_step == STREAM_FAILED )
+    {
+        log_Warn( "stream to %s failed, close connection", p_request->psz_ip );
+        close_after_write( p_request );
+    }
+    return false;
+}
+
+// run a stream callback. The response header goes to p_resblock, the rest
+// follows from stream_pump, or here when the caller wraps the response.
+static int stream_open( pf_rpc_stream_callback_t pf_stream,
+                        struct json_object *p_params, const char *psz_id,
+                        block_t *p_reqblock, block_t *p_resblock,
+                        char *psz_err, size_t i_err )
+{
+    jsonrpc_stream_t *p_stream = calloc( 1, sizeof(jsonrpc_stream_t) );
+    if ( !p_stream )
+    {
+        log_Err( "no memory" );
+        snprintf( psz_err, i_err, "no memory" );
+        return JSONRPC_ERR_NOMEM;
+    }
+    p_stream->p_out = p_resblock;
+    p_stream->b_first = true;
+    p_stream->i_file = -1;
+
+    pf_stream( p_params, p_stream );
+    if ( !p_stream->b_begun || p_stream->psz_error[0] )
+    {
+        snprintf( psz_err, i_err, "%s", p_stream->psz_error[0] ?
+                  p_stream->psz_error : "jsonrpc_server stream not begun" );
+        stream_free( p_stream );
+        return -1;
+    }
+
+    if ( psz_id )
+    {
+        stream_append( p_stream, "{\"id\":", 6 );
+        stream_append( p_stream, psz_id, strlen( psz_id ) );
+        stream_append( p_stream, ",", 1 );
+    }
+    else
+        stream_append( p_stream, "{", 1 );
+    stream_append( p_stream, "\"jsonrpc\":\"2.0\",\"result\":", 25 );
+    if ( p_stream->i_kind == JSONRPC_STREAM_ARRAY )
+        stream_append( p_stream, "[", 1 );
+
+    jsonrpc_request_t *p_request = sg_p_current_request;
+    if ( p_request && p_reqblock == p_request->p_req &&
+         p_resblock == p_request->p_res )
+    {
+        // no copy when out of memory, it can not be cancelled then
+        p_stream->psz_id = psz_id ? strdup( psz_id ) : NULL;
+        p_stream->p_request = p_request;
+        p_request->p_stream = p_stream;
+        p_request->psz_id = p_stream->psz_id;
+        p_request->b_cancelled = false;
+        return 0;
+    }
+
+    int i_step;
+    while ( ( i_step = stream_step( p_stream ) ) == STREAM_MORE )
+        ;
+    stream_free( p_stream );
+    if ( i_step != STREAM_DONE )
+    {
+        p_resblock->i_buffer = 0;
+        snprintf( psz_err, i_err, "jsonrpc_server stream failed" );
+        return -1;
+    }
+    return 0;
+}
+
+
+
+// cancellation, see jsonrpc_request_IsCancelled
+
+// the call id of cancel params, { "id": <id> } or [ <id> ]
+static bool cancel_params_id( struct json_object *p_params, char *psz_id )
+{
+    struct json_object *p_id = NULL;
+    if ( !p_params )
+        return false;
+    if ( json_object_is_type( p_params, json_type_object ) )
+        p_id = json_object_object_get( p_params, "id" );
+    else if ( json_object_is_type( p_params, json_type_array ) &&
+              json_object_array_length( p_params ) > 0 )
+        p_id = json_object_array_get_idx( p_params, 0 );
+    if ( !p_id )
+        return false;
+    const char *psz = json_object_to_json_string( p_id );
+    if ( strlen( psz ) >= CANCEL_ID_MAX )
+        return false;
+    strcpy( psz_id, psz );
+    return true;
+}
+
+// the id p_msg cancels if it is a cancel notification, which are only
+// parsed when they name the method
+static bool cancel_msg_id( const uint8_t *p_msg, size_t i_msg, char *psz_id )
+{
+    if ( i_msg == 0 || p_msg[ i_msg - 1 ] != '\0' ||
+         !memmem( p_msg, i_msg, JSONRPC_CANCEL_METHOD,
+                  sizeof(JSONRPC_CANCEL_METHOD) - 1 ) )
+        return false;
+    struct json_object *p_msgobj = json_tokener_parse( (const char*)p_msg );
+    if ( is_error( p_msgobj ) )
+        return false;
+    bool b_cancel = false;
+    if ( json_object_is_type( p_msgobj, json_type_object ) )
+    {
+        struct json_object *p_method =
+            json_object_object_get( p_msgobj, "method" );
+        if ( p_method && !strcmp( json_object_get_string( p_method ),
+                                  JSONRPC_CANCEL_METHOD ) )
+            b_cancel = cancel_params_id(
+                           json_object_object_get( p_msgobj, "params" ),
+                           psz_id );
+    }
+    json_object_put( p_msgobj );
+    return b_cancel;
+}
+
+// psz_id among the calls cancelled ahead, or NULL
+static uint8_t *cancel_find( block_t *p_cancel, const char *psz_id )
+{
+    size_t i_id = strlen( psz_id ) + 1;
+    size_t i = 0;
+    while ( i < p_cancel->i_buffer )
+    {
+        uint8_t *p = p_cancel->p_buffer + i;
+        size_t i_len = strlen( (char*)p ) + 1;
+        if ( i_len == i_id && !memcmp( p, psz_id, i_id ) )
+            return p;
+        i += i_len;
+    }
+    return NULL;
+}
+
+// take psz_id out of the calls cancelled ahead, true if it was one
+static bool cancel_take( jsonrpc_request_t *p_request, const char *psz_id )
+{
+    block_t *p_cancel = p_request->p_cancel;
+    uint8_t *p;
+    if ( !p_cancel || !psz_id || !( p = cancel_find( p_cancel, psz_id ) ) )
+        return false;
+    size_t i_len = strlen( psz_id ) + 1;
+    memmove( p, p + i_len, p_cancel->p_buffer + p_cancel->i_buffer - p - i_len );
+    p_cancel->i_buffer -= i_len;
+    return true;
+}
+
+// a cancellation read ahead, of the call being handled or streamed or of
+// one queued behind it. Its own message takes it out again when reached
+// (see handle_call), a call before it has been rejected by then.
+static void cancel_apply( jsonrpc_request_t *p_request, const char *psz_id )
+{
+    if ( p_request->psz_id && !strcmp( p_request->psz_id, psz_id ) )
+    {
+        p_request->b_cancelled = true;
+        return;
+    }
+    if ( !p_request->p_cancel &&
+         !( p_request->p_cancel = block_Alloc( CANCEL_QUEUE_MAX ) ) )
+    {
+        log_Err( "no memory" );
+        return;
+    }
+    block_t *p_cancel = p_request->p_cancel;
+    size_t i_id = strlen( psz_id ) + 1;
+    // seen again by a later scan or poll
+    if ( cancel_find( p_cancel, psz_id ) )
+        return;
+    if ( p_cancel->i_buffer + i_id > p_cancel->i_maxlen )
+    {
+        log_Warn( "too many cancellations from %s, ignored",
+                  p_request->psz_ip );
+        return;
+    }
+    memcpy( p_cancel->p_buffer + p_cancel->i_buffer, psz_id, i_id );
+    p_cancel->i_buffer += i_id;
+}
+
+// the messages of the connection are not json text, see pf_request_Text
+static inline bool request_IsFramed( jsonrpc_server_t *p_server,
+                                     jsonrpc_request_t *p_request )
+{
+    return p_request->p_proto ? p_request->p_proto->pf_request_Text != NULL :
+                                p_server->pf_request_Text != NULL;
+}
+
+// the text hook of the connection's protocol
+static inline block_t *request_Text( jsonrpc_server_t *p_server,
+                                     jsonrpc_request_t *p_request,
+                                     const block_t *p_msg )
+{
+    if ( p_request->p_proto )
+        return p_request->p_proto->pf_request_Text( p_server, p_msg );
+    return p_server->pf_request_Text( p_server, p_msg );
+}
+
+// apply p_msg, a complete message, if it is a cancel notification
+static void cancel_message( jsonrpc_server_t *p_server,
+                            jsonrpc_request_t *p_request,
+                            uint8_t *p_msg, size_t i_msg )
+{
+    char psz_id[CANCEL_ID_MAX];
+    if ( !request_IsFramed( p_server, p_request ) )
+    {
+        if ( cancel_msg_id( p_msg, i_msg, psz_id ) )
+            cancel_apply( p_request, psz_id );
+        return;
+    }
+    // framed (websocket), decoded unless too long to be one
+    if ( i_msg > CANCEL_TEXT_MAX )
+        return;
+    block_t msg = { i_msg, i_msg, p_msg };
+    block_t *p_text = request_Text( p_server, p_request, &msg );
+    if ( !p_text )
+        return;
+    if ( cancel_msg_id( p_text->p_buffer, p_text->i_buffer + 1, psz_id ) )
+        cancel_apply( p_request, psz_id );
+    block_Release( p_text );
+}
+
+// apply the cancel notifications among the complete messages at the head
+// of p_data, return the bytes they take
+static size_t cancel_frames( jsonrpc_server_t *p_server,
+                             jsonrpc_request_t *p_request,
+                             uint8_t *p_data, size_t i_data, size_t i_maxlen )
+{
+    size_t i_done = 0;
+    while ( i_done < i_data )
+    {
+        // the rest, seen through a block for the framing hook
+        block_t rest;
+        rest.p_buffer = p_data + i_done;
+        rest.i_buffer = i_data - i_done;
+        rest.i_maxlen = i_maxlen - i_done;
+        size_t i_len = 0;
+        if ( !request_IsComplete( p_server, p_request, &rest, &i_len ) ||
+             i_len == JSONRPC_OVERSIZE || i_len == 0 ||
+             i_len > rest.i_buffer )
+            break;
+        cancel_message( p_server, p_request, rest.p_buffer, i_len );
+        i_done += i_len;
+    }
+    return i_done;
+}
+
+// apply the cancel notifications among the complete messages in p_req
+// beyond i_scanned
+static void cancel_scan( jsonrpc_server_t *p_server,
+                         jsonrpc_request_t *p_request )
+{
+    block_t *p_req = p_request->p_req;
+    p_request->i_scanned +=
+        cancel_frames( p_server, p_request,
+                       p_req->p_buffer + p_request->i_scanned,
+                       p_req->i_buffer - p_request->i_scanned,
+                       p_req->i_maxlen - p_request->i_scanned );
+}
+
+// apply the cancellations among the '\0' terminated messages of p_data,
+// the first one is skipped unless b_whole (p_data may start inside). Those
+// of queued calls are kept for when the calls are reached.
+static void cancel_search( jsonrpc_request_t *p_request,
+                           const uint8_t *p_data, size_t i_data, bool b_whole )
+{
+    const uint8_t *p = p_data, *p_end = p_data + i_data, *p_zero;
+    while ( p < p_end && ( p_zero = memchr( p, '\0', p_end - p ) ) )
+    {
+        char psz_cancel[CANCEL_ID_MAX];
+        if ( b_whole && cancel_msg_id( p, p_zero + 1 - p, psz_cancel ) )
+            cancel_apply( p_request, psz_cancel );
+        b_whole = true;
+        p = p_zero + 1;
+    }
+}
+
+const uint8_t *jsonrpc_request_Blob( struct json_object *p_ref,
+                                     size_t *pi_size )
+{
+    jsonrpc_request_t *p_request = sg_p_current_request;
+    struct json_object *p_index;
+    if ( !p_request || !p_request->p_blobs ||
+         !json_object_is_type( p_ref, json_type_object ) ||
+         !( p_index = json_object_object_get( p_ref, JSONRPC_BLOB_KEY ) ) ||
+         !json_object_is_type( p_index, json_type_int ) )
+        return NULL;
+    return fdblob_Map( p_request->p_blobs, json_object_get_int( p_index ),
+                       pi_size );
+}
+
+struct json_object *jsonrpc_request_ResultBlob( int i_fd )
+{
+    jsonrpc_request_t *p_request = sg_p_current_request;
+    if ( i_fd < 0 )
+        return NULL;
+    if ( !p_request || !p_request->p_blobs || p_request->p_shm )
+    {
+        log_Err( "result blobs go over plain unix sockets only" );
+        close( i_fd );
+        return NULL;
+    }
+    struct json_object *p_ref = json_object_new_object();
+    if ( !p_ref )
+    {
+        log_Err( "no memory" );
+        close( i_fd );
+        return NULL;
+    }
+    int k = fdblob_Attach( p_request->p_blobs, i_fd );
+    if ( k < 0 )
+    {
+        json_object_put( p_ref );
+        return NULL;
+    }
+    json_object_object_add( p_ref, JSONRPC_BLOB_KEY, json_object_new_int( k ) );
+    return p_ref;
+}
+
+// what the client sent after p_req, up to i_size bytes: first what the
+// loop received and holds (the pending io_uring completions), then what is
+// still in the socket
+static size_t cancel_ahead( jsonrpc_request_t *p_request, uint8_t *p_buf,
+                            size_t i_size )
+{
+    size_t i_len = 0;
+    if ( p_request->p_backend && sg_p_backend->pf_received )
+        i_len = sg_p_backend->pf_received( p_request, p_buf, i_size );
+    if ( i_len < i_size )
+    {
+        STAT_INC( i_syscalls );
+        ssize_t i_peek = recv( p_request->i_sockfd, p_buf + i_len,
+                               i_size - i_len, MSG_PEEK | MSG_DONTWAIT );
+        if ( i_peek > 0 )
+            i_len += i_peek;
+    }
+    return i_len;
+}
+
+bool jsonrpc_request_IsCancelled( void )
+{
+    jsonrpc_request_t *p_request = sg_p_current_request;
+    if ( !p_request || !p_request->psz_id )
+        return false;
+    if ( p_request->b_cancelled )
+        return true;
+
+    jsonrpc_server_t *p_server = sg_p_server;
+    block_t *p_req = p_request->p_req;
+    // the room left for a framing hook writing past the data
+    uint8_t p_ahead[CANCEL_PEEK + 1];
+    size_t i_ahead = 0;
+    if ( !p_server || !request_IsFramed( p_server, p_request ) )
+    {
+        cancel_search( p_request, p_req->p_buffer, p_req->i_buffer, true );
+        // it continues the message p_req ends with, if any. The socket of
+        // a shared memory connection only has doorbells.
+        if ( !p_request->b_cancelled && !p_request->p_shm &&
+             ( i_ahead = cancel_ahead( p_request, p_ahead,
+                                       CANCEL_PEEK ) ) > 0 )
+            cancel_search( p_request, p_ahead, i_ahead,
+                           p_req->i_buffer == 0 ||
+                           p_req->p_buffer[ p_req->i_buffer - 1 ] == '\0' );
+        return p_request->b_cancelled;
+    }
+
+    // framed, the message p_req ends with goes on in what was received
+    size_t i_done = cancel_frames( p_server, p_request, p_req->p_buffer,
+                                   p_req->i_buffer, p_req->i_maxlen );
+    size_t i_tail = p_req->i_buffer - i_done;
+    if ( p_request->b_cancelled || i_tail >= CANCEL_PEEK )
+        return p_request->b_cancelled;
+    memcpy( p_ahead, p_req->p_buffer + i_done, i_tail );
+    i_ahead = i_tail + cancel_ahead( p_request, p_ahead + i_tail,
+                                     CANCEL_PEEK - i_tail );
+    if ( i_ahead > i_tail )
+        cancel_frames( p_server, p_request, p_ahead, i_ahead,
+                       sizeof(p_ahead) );
+    return p_request->b_cancelled;
+}
+
+static jsonrpc_listener_t *find_listener( jsonrpc_server_t *p_this,
+                                          int i_fd )
+{
+    for ( int i = 0; i < p_this->i_listeners; i++ )
+        if ( p_this->p_listeners[i].i_fd == i_fd )
+            return &p_this->p_listeners[i];
+    return NULL;
+}
+
+static int format_peer( const struct sockaddr_storage *p_addr,
+                        char *psz_ip, size_t i_size )
+{
+    const void *p_src;
+    switch ( p_addr->ss_family )
+    {
+    case AF_INET:
+        p_src = &((const struct sockaddr_in*)p_addr)->sin_addr;
+        break;
+    case AF_INET6:
+        p_src = &((const struct sockaddr_in6*)p_addr)->sin6_addr;
+        break;
+    default:
+        snprintf( psz_ip, i_size, "unix" );
+        return 0;
+    }
+    return inet_ntop( p_addr->ss_family, p_src, psz_ip, i_size ) ? 0 : -1;
+}
+
+static int add_listener( jsonrpc_server_t *p_this, int i_fd, int i_family,
+                         const char *psz_file,
+                         const jsonrpc_sockopt_t *p_conn );
+
+// what a unix listener offers its connections: shared memory rings, granted
+// in the handshake, and blobs by descriptor, received with recvmsg
+static void unix_options( jsonrpc_request_t *p_request,
+                          const jsonrpc_listener_t *p_listener )
+{
+    if ( p_listener->i_family != AF_UNIX )
+        return;
+    p_request->i_shm_ring = p_listener->conn.i_shm_ring;
+    if ( p_listener->conn.b_blobs )
+    {
+        p_request->p_blobs = calloc( 1, sizeof(fdblob_queue_t) );
+        if ( !p_request->p_blobs )
+            log_Err( "no memory, connection %d takes no blobs",
+                     p_request->i_sockfd );
+    }
+}
+
+// register an accepted or inherited connection with the loop
+static jsonrpc_request_t *add_connection( jsonrpc_server_t *p_this, int epfd,
+                                          hashmap requestMap, int connfd )
+{
+    if ( p_this->pf_on_client_connected )
+    {
+        TRACE_BEGIN( "pf_on_client_connected", connfd );
+        p_this->pf_on_client_connected( p_this, connfd );
+        TRACE_END( "pf_on_client_connected", connfd );
+    }
+
+    // epfd is -1 for the io_uring loop, it arms its own recv. EPOLLOUT is
+    // only armed while output waits for room, see epoll_send
+    if ( epfd >= 0 )
+    {
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLET;
+        event.data.fd = connfd;
+        STAT_INC( i_syscalls );
+        if ( epoll_ctl( epfd, EPOLL_CTL_ADD, connfd, &event ) < 0)
         {
-            ptr += i_send;
-            i_remain -= i_send;
+            log_Err( "epoll ctl failed (%s)", strerror(errno) );
+            return NULL;
         }
     }
 
-    memmove( p_res->p_buffer,
-             p_res->p_buffer + p_res->i_buffer - i_remain,
-             i_remain );
-    p_res->i_buffer = i_remain;
+    hashmap_key_t key;
+    key.type = 'l';
+    key.u.i_int32 = connfd;
+    assert( !hashmap_get( requestMap, key ) );
+    jsonrpc_request_t *p_request = jsonrpc_request_create();
+    if ( !p_request )
+    {
+        log_Err( "jsonrpc_request_create failed" );
+        return NULL;
+    }
+    p_request->i_sockfd = connfd;
+    p_request->i_state = CONN_CONNECTED;
+    hashmap_put( requestMap, key, p_request );
+    if ( sg_p_server )
+        sg_p_server->i_connections++;
+    server_MemAccount( p_request );
+    return p_request;
+}
 
+jsonrpc_request_t *server_Accepted( jsonrpc_server_t *p_this, int epfd,
+                                    hashmap requestMap, int connfd,
+                                    const jsonrpc_listener_t *p_listener,
+                                    const struct sockaddr_storage *p_addr )
+{
+    // failures are logged, the connection still works
+    sockopt_Apply( connfd, p_listener->i_family, &p_listener->conn );
+    jsonrpc_request_t *p_request =
+        add_connection( p_this, epfd, requestMap, connfd );
+    if ( !p_request )
+        return NULL;
+    unix_options( p_request, p_listener );
+    if ( format_peer( p_addr, p_request->psz_ip,
+                      sizeof(p_request->psz_ip) ) < 0 )
+        log_Err( "inet_ntop failed %s", strerror( errno ) );
+    log_Dbg( "jsonrpc server add connfd" );
+    return p_request;
+}
+
+void server_Closing( jsonrpc_server_t *p_this, hashmap requestMap,
+                     jsonrpc_request_t *p_request )
+{
+    int i_fd = p_request->i_sockfd;
+    p_request->i_state = CONN_CLOSED;
+    // a connection handed off to the next process lives on there
+    if ( p_this->pf_on_client_closed && !p_request->b_handed_off )
+    {
+        TRACE_BEGIN( "pf_on_client_closed", i_fd );
+        p_this->pf_on_client_closed( p_this, i_fd );
+        TRACE_END( "pf_on_client_closed", i_fd );
+    }
+
+    hashmap_key_t key;
+    key.type = 'l';
+    key.u.i_int32 = i_fd;
+    hashmap_pop( requestMap, key, NULL );
+    remove_request_references( p_this, p_request );
+    mem_release( p_request );
+}
+
+static void remove_connection( jsonrpc_server_t *p_this, int epfd,
+                               hashmap requestMap,
+                               jsonrpc_request_t *p_request )
+{
+    int i_fd = p_request->i_sockfd;
+    if ( epoll_ctl( epfd, EPOLL_CTL_DEL, i_fd, NULL ) < 0 )
+        log_Err( "epoll del failed (%s)", strerror(errno) );
+    server_Closing( p_this, requestMap, p_request );
+    server_Release( p_request );
+}
+
+// both ends of an upgrade socket pass every listener and connection: the
+// peer must run as our user, and a stalled one fails the handoff instead of
+// blocking the loop
+static int upgrade_peer( int i_fd )
+{
+    struct ucred cred;
+    socklen_t i_len = sizeof(cred);
+    if ( getsockopt( i_fd, SOL_SOCKET, SO_PEERCRED, &cred, &i_len ) < 0 )
+    {
+        log_Err( "upgrade: peer credentials (%s)", strerror(errno) );
+        return -1;
+    }
+    if ( cred.uid != geteuid() )
+    {
+        log_Err( "upgrade: peer pid %d runs as uid %u, rejected",
+                 (int)cred.pid, (unsigned)cred.uid );
+        return -1;
+    }
+
+    struct timeval tv = { UPGRADE_IO_TIMEOUT, 0 };
+    if ( setsockopt( i_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) ) < 0 ||
+         setsockopt( i_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv) ) < 0 )
+    {
+        log_Err( "upgrade: socket timeout (%s)", strerror(errno) );
+        return -1;
+    }
+    return 0;
+}
+
+// the next process connected to the upgrade socket: hand it the listeners
+// and stop accepting
+static int upgrade_begin( jsonrpc_server_t *p_this, int epfd )
+{
+    int i_fd = accept4( p_this->i_upgradesock, NULL, NULL, SOCK_CLOEXEC );
+    if ( i_fd < 0 )
+    {
+        log_Err( "accept upgrade (%s)", strerror(errno) );
+        return -1;
+    }
+    if ( upgrade_peer( i_fd ) < 0 )
+    {
+        close( i_fd );
+        return -1;
+    }
+
+    handoff_msg_t msg;
+    for ( int i = 0; i < p_this->i_listeners; i++ )
+    {
+        jsonrpc_listener_t *p_listener = &p_this->p_listeners[i];
+        const char *psz_file = p_listener->psz_bind_file ?
+                               p_listener->psz_bind_file : "";
+        // the bind file, then the options of its connections. What was set
+        // on the listener socket itself goes with it.
+        char psz_payload[PATH_MAX + SOCKOPT_FORMAT_MAX];
+        size_t i_file = strlen( psz_file ) + 1;
+        int i_conn = i_file < PATH_MAX ?
+            sockopt_Format( &p_listener->conn, psz_payload + i_file,
+                            sizeof(psz_payload) - i_file ) : -1;
+        if ( i_conn < 0 )
+        {
+            log_Err( "upgrade: listener %s options do not fit", psz_file );
+            close( i_fd );
+            return -1;
+        }
+        memcpy( psz_payload, psz_file, i_file );
+        msg.i_kind = HANDOFF_LISTENER;
+        msg.i_arg = p_listener->i_family;
+        msg.i_strings = 2;
+        msg.i_payload = i_file + i_conn + 1;
+        if ( handoff_Send( i_fd, &msg, p_listener->i_fd, psz_payload ) < 0 )
+        {
+            close( i_fd );
+            return -1;
+        }
+    }
+    msg.i_kind = HANDOFF_LISTENERS_END;
+    msg.i_arg = 0;
+    msg.i_strings = 0;
+    msg.i_payload = 0;
+    if ( handoff_Send( i_fd, &msg, -1, NULL ) < 0 )
+    {
+        close( i_fd );
+        return -1;
+    }
+
+    // the next process owns the listeners and their files now
+    for ( int i = 0; i < p_this->i_listeners; i++ )
+    {
+        jsonrpc_listener_t *p_listener = &p_this->p_listeners[i];
+        epoll_ctl( epfd, EPOLL_CTL_DEL, p_listener->i_fd, NULL );
+        close( p_listener->i_fd );
+        free( p_listener->psz_bind_file );
+    }
+    free( p_this->p_listeners );
+    p_this->p_listeners = NULL;
+    p_this->i_listeners = 0;
+
+    epoll_ctl( epfd, EPOLL_CTL_DEL, p_this->i_upgradesock, NULL );
+    close( p_this->i_upgradesock );
+    p_this->i_upgradesock = -1;
+    free( p_this->psz_upgrade_file );
+    p_this->psz_upgrade_file = NULL;
+
+    p_this->i_upgradefd = i_fd;
+    p_this->i_drain_deadline = jsonrpc_mdate() + UPGRADE_DRAIN_TIMEOUT;
+    log_Warn( "upgrade: listeners handed off, draining connections" );
+    return 0;
+}
+
+static int upgrade_send_connection( jsonrpc_server_t *p_this,
+                                    jsonrpc_request_t *p_request )
+{
+    const char *psz_protocol = p_request->psz_protocol ?
+                               p_request->psz_protocol : "";
+    size_t i_payload = strlen( p_request->psz_ip ) + 1 +
+                       strlen( psz_protocol ) + 1 + p_request->p_req->i_buffer;
+    for ( int i = 0; i < p_request->i_notify_service; i++ )
+        i_payload += strlen( p_request->ppsz_notify_service[i] ) + 1;
+
+    uint8_t *p_payload = malloc( i_payload );
+    if ( !p_payload )
+    {
+        log_Err( "no memory" );
+        return JSONRPC_ERR_NOMEM;
+    }
+    uint8_t *p = p_payload;
+    p = (uint8_t*)stpcpy( (char*)p, p_request->psz_ip ) + 1;
+    p = (uint8_t*)stpcpy( (char*)p, psz_protocol ) + 1;
+    for ( int i = 0; i < p_request->i_notify_service; i++ )
+        p = (uint8_t*)stpcpy( (char*)p, p_request->ppsz_notify_service[i] ) + 1;
+    memcpy( p, p_request->p_req->p_buffer, p_request->p_req->i_buffer );
+
+    handoff_msg_t msg;
+    msg.i_kind = HANDOFF_CONN;
+    msg.i_arg = p_request->i_state;
+    msg.i_strings = 2 + p_request->i_notify_service;
+    msg.i_payload = i_payload;
+    int i_ret = handoff_Send( p_this->i_upgradefd, &msg, p_request->i_sockfd,
+                              p_payload );
+    free( p_payload );
     return i_ret;
 }
 
+// pass on, or close, every connection without pending output. Return true
+// once none is left (or the drain timed out) and the handoff is over.
+static bool upgrade_drain( jsonrpc_server_t *p_this, int epfd,
+                           hashmap requestMap )
+{
+    int i_conns = hashmap_get_len( requestMap );
+    bool b_timeout = jsonrpc_mdate() >= p_this->i_drain_deadline;
+    if ( i_conns > 0 )
+    {
+        // collect first, removing while iterating is not allowed
+        jsonrpc_request_t **pp_idle = malloc( i_conns * sizeof(*pp_idle) );
+        if ( !pp_idle )
+        {
+            log_Err( "no memory" );
+            return false;
+        }
+        int i_idle = 0;
+        hashmap_iterator it = hashmap_iterate( requestMap );
+        while ( hashmap_next( &it ) )
+        {
+            jsonrpc_request_t *p_request = it.p_val;
+            if ( ( output_pending( p_request ) == 0 && !p_request->p_stream ) ||
+                 b_timeout )
+                pp_idle[ i_idle++ ] = p_request;
+        }
 
-static int serve( jsonrpc_server_t *p_this )
+        for ( int i = 0; i < i_idle; i++ )
+        {
+            jsonrpc_request_t *p_request = pp_idle[i];
+            // shared rings and queued blobs stay with this process, closed
+            if ( p_this->b_handoff_conns && output_pending( p_request ) == 0 &&
+                 !p_request->p_stream && !p_request->p_shm &&
+                 !p_request->p_blobs )
+            {
+                if ( upgrade_send_connection( p_this, p_request ) < 0 )
+                {
+                    log_Err( "upgrade: handing off connections failed, "
+                             "closing the remaining ones" );
+                    p_this->b_handoff_conns = false;
+                }
+                else
+                    p_request->b_handed_off = true;
+            }
+            remove_connection( p_this, epfd, requestMap, p_request );
+        }
+        free( pp_idle );
+        i_conns -= i_idle;
+    }
+    if ( i_conns > 0 )
+        return false;
+
+    handoff_msg_t msg;
+    msg.i_kind = HANDOFF_END;
+    msg.i_arg = 0;
+    msg.i_strings = 0;
+    msg.i_payload = 0;
+    handoff_Send( p_this->i_upgradefd, &msg, -1, NULL );
+    close( p_this->i_upgradefd );
+    p_this->i_upgradefd = -1;
+    log_Warn( "upgrade: handoff done%s", b_timeout ? " (timed out)" : "" );
+    return true;
+}
+
+static const char *next_string( const uint8_t **pp, const uint8_t *p_end )
 {
-    if ( !p_this->b_initialized )
+    const uint8_t *p_zero = memchr( *pp, '\0', p_end - *pp );
+    if ( !p_zero )
+        return NULL;
+    const char *psz = (const char*)*pp;
+    *pp = p_zero + 1;
+    return psz;
+}
+
+static int adopt_connection( jsonrpc_server_t *p_this, int epfd,
+                             hashmap requestMap, const handoff_msg_t *p_msg,
+                             int i_fd, const uint8_t *p_payload )
+{
+    const uint8_t *p = p_payload, *p_end = p_payload + p_msg->i_payload;
+    const char *psz_ip = p ? next_string( &p, p_end ) : NULL;
+    const char *psz_protocol = psz_ip ? next_string( &p, p_end ) : NULL;
+    if ( !psz_protocol || p_msg->i_strings < 2 )
     {
-        log_Err( "jsonrpc server has not been initialized" );
+        log_Err( "takeover: malformed connection" );
+        close( i_fd );
+        return 0;
+    }
+
+    jsonrpc_request_t *p_request =
+        add_connection( p_this, epfd, requestMap, i_fd );
+    if ( !p_request )
+    {
+        close( i_fd );
         return -1;
     }
-    assert( p_this->tcpsock != -1 || p_this->unixsock != -1 );
+    snprintf( p_request->psz_ip, sizeof(p_request->psz_ip), "%s", psz_ip );
+    p_request->i_state = p_msg->i_arg;
+    if ( *psz_protocol )
+    {
+        p_request->psz_protocol = strdup( psz_protocol );
+        if ( !p_request->psz_protocol )
+            goto nomem;
+    }
+
+    int i_services = p_msg->i_strings - 2;
+    if ( i_services > 0 )
+    {
+        p_request->ppsz_notify_service = malloc( sizeof(char*) * i_services );
+        if ( !p_request->ppsz_notify_service )
+            goto nomem;
+    }
+    for ( int i = 0; i < i_services; i++ )
+    {
+        const char *psz_service = next_string( &p, p_end );
+        if ( !psz_service )
+        {
+            log_Err( "takeover: malformed connection" );
+            remove_connection( p_this, epfd, requestMap, p_request );
+            return 0;
+        }
+        char *psz_dup = strdup( psz_service );
+        if ( !psz_dup )
+            goto nomem;
+        p_request->ppsz_notify_service[ p_request->i_notify_service++ ] =
+            psz_dup;
+
+        // put request at head of list in notifyServiceMap
+        hashmap_key_t key;
+        key.type = 'c';
+        key.u.psz_string = psz_dup;
+        jsonrpc_request_t *p_headreq =
+            hashmap_get( p_this->notifyServiceMap, key );
+        p_request->p_next = p_headreq;
+        hashmap_put( p_this->notifyServiceMap, key, p_request );
+    }
+
+    // buffered partial request, more of it is read on the next EPOLLIN
+    size_t i_data = p_end - p;
+    if ( i_data > 0 )
+    {
+        block_t *p_req = block_Alloc( i_data + 1 );
+        if ( !p_req )
+            goto nomem;
+        memcpy( p_req->p_buffer, p, i_data );
+        p_req->i_buffer = i_data;
+        block_Release( p_request->p_req );
+        p_request->p_req = p_req;
+    }
+    log_Dbg( "takeover: adopted connection from %s", p_request->psz_ip );
+    return 0;
+
+nomem:
+    log_Err( "no memory" );
+    remove_connection( p_this, epfd, requestMap, p_request );
+    return 0;
+}
+
+// the previous process passes a connection, or is done
+static int takeover_connection( jsonrpc_server_t *p_this, int epfd,
+                                hashmap requestMap )
+{
+    handoff_msg_t msg;
+    int i_fd;
+    uint8_t *p_payload;
+    if ( handoff_Recv( p_this->i_takeoverfd, &msg, &i_fd, &p_payload ) < 0 ||
+         msg.i_kind == HANDOFF_END )
+    {
+        log_Warn( "takeover done" );
+        epoll_ctl( epfd, EPOLL_CTL_DEL, p_this->i_takeoverfd, NULL );
+        close( p_this->i_takeoverfd );
+        p_this->i_takeoverfd = -1;
+        if ( i_fd >= 0 )
+            close( i_fd );
+        free( p_payload );
+        return 0;
+    }
+    if ( msg.i_kind != HANDOFF_CONN || i_fd < 0 )
+    {
+        log_Err( "takeover: unexpected message %u", msg.i_kind );
+        if ( i_fd >= 0 )
+            close( i_fd );
+        free( p_payload );
+        return 0;
+    }
+
+    int i_ret = adopt_connection( p_this, epfd, requestMap, &msg, i_fd,
+                                  p_payload );
+    free( p_payload );
+    return i_ret;
+}
+
+// edge triggered, a resumed connection is read without waiting for an
+// event
+static void epoll_relieve( jsonrpc_server_t *p_this, int epfd,
+                           hashmap requestMap )
+{
+    switch ( server_MemRelief( p_this ) )
+    {
+    case MEM_RESUME:
+    {
+        hashmap_iterator it = hashmap_iterate( requestMap );
+        while ( hashmap_next( &it ) )
+        {
+            jsonrpc_request_t *p_request = it.p_val;
+            if ( !p_request->b_paused )
+                continue;
+            p_request->b_paused = false;
+            p_this->i_paused--;
+            process_read( p_this, p_request );
+            server_ProcessRequests( p_this, p_request );
+        }
+        break;
+    }
+    case MEM_SHED:
+    {
+        jsonrpc_request_t *p_request = server_MemBiggestPaused( requestMap );
+        log_Warn( "memory budget exceeded (%zu bytes), close %s (fd:%d, "
+                  "%zu bytes)", p_this->i_mem_used, p_request->psz_ip,
+                  p_request->i_sockfd, p_request->i_mem );
+        remove_connection( p_this, epfd, requestMap, p_request );
+        break;
+    }
+    }
+}
+
+// send the queued output of a connection. What the socket does not take
+// waits for EPOLLOUT, armed only meanwhile.
+static void epoll_send( jsonrpc_server_t *p_this, int epfd,
+                        jsonrpc_request_t *p_request )
+{
+    int fd = p_request->i_sockfd;
+    block_t *p_out = p_request->p_out;
+    TRACE_BEGIN( "process_write", fd );
+    size_t i_sent = 0;
+    if ( p_request->p_shm )
+        server_ShmSend( p_request );
+    while ( !p_request->p_shm && i_sent < p_out->i_buffer &&
+            !p_request->b_blocked )
+    {
+        STAT_INC( i_syscalls );
+        ssize_t i_ret;
+        if ( p_request->p_blobs )
+        {
+            // the blobs of a response go with its first byte
+            const int *pi_fds;
+            int i_fds;
+            size_t i_chunk = fdblob_Next( p_request->p_blobs,
+                                          p_out->i_buffer - i_sent,
+                                          &pi_fds, &i_fds );
+            i_ret = fdblob_Send( fd, p_out->p_buffer + i_sent, i_chunk,
+                                 pi_fds, i_fds );
+            if ( i_ret > 0 )
+                fdblob_Sent( p_request->p_blobs, i_ret );
+        }
+        else
+            i_ret = send( fd, p_out->p_buffer + i_sent,
+                          p_out->i_buffer - i_sent, 0 );
+        if ( i_ret >= 0 )
+            i_sent += i_ret;
+        else if ( errno == EAGAIN )
+            p_request->b_blocked = true;
+        else
+        {
+            log_Err( "write failed (%s)", strerror(errno) );
+            // the output is lost, EPOLLHUP removes the connection
+            p_request->i_state = CONN_CLOSED;
+            p_request->p_req->i_buffer = 0;
+            p_request->b_linger = false;
+            shutdown( fd, SHUT_RDWR );
+            i_sent = p_out->i_buffer;
+        }
+    }
+    memmove( p_out->p_buffer, p_out->p_buffer + i_sent,
+             p_out->i_buffer - i_sent );
+    p_out->i_buffer -= i_sent;
+    if ( p_out->i_maxlen > BLOCK_KEEP )
+        block_Shrink( p_out, BLOCK_DEFAULT );
+    server_MemAccount( p_request );
+    TRACE_END( "process_write", fd );
+
+    // a full shared ring waits for a doorbell
+    if ( !p_request->p_shm && p_request->b_blocked != p_request->b_pollout )
+    {
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLET |
+                       ( p_request->b_blocked ? EPOLLOUT : 0 );
+        event.data.fd = fd;
+        STAT_INC( i_syscalls );
+        if ( epoll_ctl( epfd, EPOLL_CTL_MOD, fd, &event ) < 0 )
+            log_Err( "epoll ctl failed (%s)", strerror(errno) );
+        else
+            p_request->b_pollout = p_request->b_blocked;
+    }
+    if ( p_request->b_blocked )
+        return;
+
+    if ( p_request->b_linger )
+    {
+        p_request->b_linger = false;
+        shutdown( fd, SHUT_RDWR );
+        // generate EPIPE and EPOLLHUP
+        char c = 0;
+        send( fd, &c, 1, 0 );
+    }
+    // room for more of a streamed result, or for the held requests
+    else if ( p_request->p_stream || p_request->b_held )
+        server_ProcessRequests( p_this, p_request );
+}
+
+// the responses of this iteration, one send per connection instead of one
+// per response
+// a stream resumed by epoll_send queues its next window for the next
+// iteration, the loop reads in between (cancellations, other connections)
+static void epoll_flush( jsonrpc_server_t *p_this, int epfd )
+{
+    jsonrpc_request_t *p_flush = sg_p_flush;
+    sg_p_flush = NULL;
+    while ( p_flush )
+    {
+        jsonrpc_request_t *p_request = p_flush;
+        p_flush = p_request->p_next_flush;
+        p_request->b_queued = false;
+        epoll_send( p_this, epfd, p_request );
+    }
+}
 
+static int serve_epoll( jsonrpc_server_t *p_this )
+{
     int epfd = -1;
     if ( (epfd = epoll_create( EPOLL_SIZE )) < 0 )
     {
@@ -372,24 +2392,38 @@ static int serve( jsonrpc_server_t *p_this )
         return -1;
     }
 
-    int socks[2];
-    socks[0] = p_this->tcpsock;
-    socks[1] = p_this->unixsock;
-    for ( int i = 0; i < sizeof(socks)/sizeof(socks[0]); i++ )
+    // spare descriptor, released to accept and drop a connection when out
+    // of fds, otherwise the pending connection keeps the listener readable
+    int i_sparefd = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+
+    for ( int i = 0; i < p_this->i_listeners; i++ )
     {
-        if ( socks[i] != -1 )
+        // level triggered, at most ACCEPT_BATCH accepts per iteration
+        // and the remaining backlog is reported again
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = p_this->p_listeners[i].i_fd;
+        if ( epoll_ctl( epfd, EPOLL_CTL_ADD, event.data.fd, &event ) < 0 )
         {
-            socket_setblocking( socks[i], 0 );
-
-            struct epoll_event event;
-            event.events = EPOLLIN | EPOLLET;
-            event.data.fd = socks[i];
-            if ( epoll_ctl( epfd, EPOLL_CTL_ADD, socks[i], &event ) < 0 )
-            {
-                log_Err( "epoll add listening sock failed (%s)",
-                         strerror(errno) );
-                return -1;
-            }
+            log_Err( "epoll add listening sock failed (%s)",
+                     strerror(errno) );
+            return -1;
+        }
+    }
+    int fds[2];
+    fds[0] = p_this->i_upgradesock;
+    fds[1] = p_this->i_takeoverfd;
+    for ( size_t i = 0; i < sizeof(fds)/sizeof(fds[0]); i++ )
+    {
+        if ( fds[i] == -1 )
+            continue;
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fds[i];
+        if ( epoll_ctl( epfd, EPOLL_CTL_ADD, fds[i], &event ) < 0 )
+        {
+            log_Err( "epoll add upgrade sock failed (%s)", strerror(errno) );
+            return -1;
         }
     }
 
@@ -401,9 +2435,15 @@ static int serve( jsonrpc_server_t *p_this )
 
     struct epoll_event events[EPOLL_MAX_EVENT];
     int i_ready;
+    bool b_upgrade = false;
     while ( !sg_b_abort )
     {
-        i_ready = epoll_wait( epfd, events, EPOLL_MAX_EVENT, EPOLL_TIMEOUT );
+        TRACE_BEGIN( "epoll_wait", 0 );
+        STAT_INC( i_syscalls );
+        // no waiting with output queued
+        i_ready = epoll_wait( epfd, events, EPOLL_MAX_EVENT,
+                              sg_p_flush ? 0 : LOOP_TIMEOUT );
+        TRACE_END( "epoll_wait", i_ready );
         if ( i_ready < 0 )
         {
             if ( errno == EINTR )
@@ -416,128 +2456,144 @@ static int serve( jsonrpc_server_t *p_this )
         {
             for ( int i = 0; i < i_ready; i++ )
             {
-                if ( events[i].data.fd == p_this->tcpsock ||
-                     events[i].data.fd == p_this->unixsock )
+                jsonrpc_listener_t *p_listener =
+                    find_listener( p_this, events[i].data.fd );
+                if ( p_listener )
                 {
-                    while ( true )
+                    TRACE_BEGIN( "accept", events[i].data.fd );
+                    for ( int i_accept = 0; i_accept < ACCEPT_BATCH;
+                          i_accept++ )
                     {
-                        struct sockaddr_in addr;
+                        struct sockaddr_storage addr;
                         socklen_t addrlen = sizeof( addr );
-                        int connfd = accept( events[i].data.fd,
-                                             &addr, &addrlen );
+                        STAT_INC( i_syscalls );
+                        int connfd = accept4( events[i].data.fd,
+                                              (struct sockaddr*)&addr,
+                                              &addrlen,
+                                              SOCK_NONBLOCK | SOCK_CLOEXEC );
                         if ( connfd < 0 )
                         {
-                            if ( errno == EAGAIN )
+                            if ( errno == EAGAIN || errno == EWOULDBLOCK )
                                 break;
-                            else
+                            if ( errno == EINTR || errno == ECONNABORTED )
+                                continue;
+                            if ( errno == EMFILE || errno == ENFILE )
                             {
-                                log_Err( "accept (%s)", strerror(errno) );
+                                if ( i_sparefd >= 0 )
+                                {
+                                    log_Warn( "accept (%s), dropping "
+                                              "connection", strerror(errno) );
+                                    close( i_sparefd );
+                                    connfd = accept( events[i].data.fd,
+                                                     NULL, NULL );
+                                    if ( connfd >= 0 )
+                                        close( connfd );
+                                    i_sparefd = open( "/dev/null",
+                                                      O_RDONLY | O_CLOEXEC );
+                                }
+                                if ( i_sparefd >= 0 )
+                                    continue;
+                                server_ListenPause( p_this );
+                                epoll_listen( p_this, epfd, false );
                                 break;
                             }
+                            log_Err( "accept (%s)", strerror(errno) );
+                            break;
                         }
 
-                        if ( p_this->pf_on_client_connected )
-                            p_this->pf_on_client_connected( p_this, connfd );
-
-                        socket_setblocking( connfd, 0 );
-                        struct epoll_event event;
-                        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
-                        event.data.fd = connfd;
-                        if ( epoll_ctl( epfd, EPOLL_CTL_ADD,
-                                        connfd, &event ) < 0)
+                        if ( !server_Accepted( p_this, epfd, requestMap, connfd,
+                                               p_listener, &addr ) )
                         {
-                            log_Err( "epoll ctl failed (%s)", strerror(errno) );
+                            close( connfd );
                             goto error;
                         }
-
-                        key.u.i_int32 = connfd;
-                        assert( !hashmap_get( requestMap, key ) );
-                        jsonrpc_request_t *p_request = jsonrpc_request_create();
-                        if ( !p_request )
-                        {
-                            log_Err( "jsonrpc_request_create failed" );
-                            goto error;
-                        }
-                        p_request->i_sockfd = connfd;
-                        p_request->i_state = CONN_CONNECTED;
-                        if ( !inet_ntop( AF_INET, &addr.sin_addr,
-                                         p_request->psz_ip, 16 ) )
-                        {
-                            log_Err( "inet_ntop failed %s", strerror( errno ) );
-                            goto error;
-                        }
-                        hashmap_put( requestMap, key, p_request );
-
-                        log_Dbg( "jsonrpc server add connfd" );
                     }
+                    TRACE_END( "accept", events[i].data.fd );
+                }
+                else if ( events[i].data.fd == p_this->i_upgradesock )
+                {
+                    // after this batch, it closes listeners that may
+                    // still have events in it
+                    b_upgrade = true;
+                }
+                else if ( events[i].data.fd == p_this->i_takeoverfd )
+                {
+                    if ( takeover_connection( p_this, epfd, requestMap ) < 0 )
+                        goto error;
                 }
                 else if ( events[i].events & EPOLLHUP ||
                           events[i].events & EPOLLERR )
                 {
                     int i_fd = events[i].data.fd;
                     log_Dbg( "epoll pollhup enter (fd:%d)", i_fd );
-                    if ( epoll_ctl( epfd, EPOLL_CTL_DEL, i_fd,
-                                    &events[i] ) < 0 )
-                    {
-                        log_Err( "epoll del failed (%s)", strerror(errno) );
-                        goto error;
-                    }
-
-                    if ( p_this->pf_on_client_closed )
-                        p_this->pf_on_client_closed( p_this, i_fd );
-
-                    close( i_fd );
-
                     key.u.i_int32 = i_fd;
                     jsonrpc_request_t *p_request;
-                    p_request = hashmap_pop( requestMap, key, NULL );
-                    // remove request references before delete it
-                    remove_request_references( p_this, p_request );
-                    jsonrpc_request_destroy( p_request );
+                    p_request = hashmap_get( requestMap, key );
+                    // same as any other close, see remove_connection
+                    STAT_INC( i_syscalls );
+                    remove_connection( p_this, epfd, requestMap, p_request );
 
                     log_Dbg( "epoll pollhup exit" );
                 }
-                else if ( events[i].events & EPOLLIN )
+                else
                 {
                     int i_fd = events[i].data.fd;
-                    log_Dbg( "epoll pollin enter (fd:%d)", i_fd );
                     key.u.i_int32 = i_fd;
                     jsonrpc_request_t *p_request;
                     p_request = hashmap_get( requestMap, key );
                     assert( i_fd == p_request->i_sockfd );
-                    // buffer all data from socket recv buf
-                    process_read( p_this, p_request );
-                    // process requests and write response to socket send buf
-                    process_requests( p_this, p_request );
-
-                    log_Dbg( "epoll pollin exit (fd:%d)", i_fd );
-                }
-                else if ( events[i].events & EPOLLOUT )
-                {
-                    int i_fd = events[i].data.fd;
-                    log_Dbg( "epoll pollout enter (fd:%d)", i_fd );
-                    key.u.i_int32 = i_fd;
-                    jsonrpc_request_t *p_request;
-                    p_request = hashmap_get( requestMap, key );
-                    process_write( i_fd, p_request->p_res );
-
-                    log_Dbg( "epoll pollout exit (fd:%d)", i_fd );
+                    // over the memory budget, read it in epoll_relieve
+                    if ( events[i].events & EPOLLIN &&
+                         !server_MemPause( p_request ) )
+                    {
+                        log_Dbg( "epoll pollin enter (fd:%d)", i_fd );
+                        // buffer all data from socket recv buf
+                        TRACE_BEGIN( "process_read", i_fd );
+                        process_read( p_this, p_request );
+                        TRACE_END( "process_read", i_fd );
+                        // process requests, the responses are sent by
+                        // epoll_flush
+                        server_ProcessRequests( p_this, p_request );
+                        log_Dbg( "epoll pollin exit (fd:%d)", i_fd );
+                    }
+                    if ( events[i].events & EPOLLOUT )
+                    {
+                        log_Dbg( "epoll pollout enter (fd:%d)", i_fd );
+                        p_request->b_blocked = false;
+                        epoll_send( p_this, epfd, p_request );
+                        log_Dbg( "epoll pollout exit (fd:%d)", i_fd );
+                    }
                 }
             }
         } // epoll wait
-        // after epoll_wait has been processed
-        if ( p_this->pf_on_processed )
-            p_this->pf_on_processed( p_this );
+        server_Processed( p_this );
+        epoll_relieve( p_this, epfd, requestMap );
+        epoll_flush( p_this, epfd );
+        if ( server_ListenResume( p_this, &i_sparefd ) )
+            epoll_listen( p_this, epfd, true );
+        p_this->stats.i_loops++;
+        if ( b_upgrade )
+        {
+            b_upgrade = false;
+            if ( upgrade_begin( p_this, epfd ) < 0 )
+                log_Err( "upgrade handoff failed, keep serving" );
+        }
+        // handing off to a new process, stop once everything is passed on
+        if ( p_this->i_upgradefd != -1 &&
+             upgrade_drain( p_this, epfd, requestMap ) )
+            break;
     }
 
     log_Dbg( "serve() exited" );
 
     it = hashmap_iterate( requestMap );
     while ( hashmap_next( &it ) )
-        jsonrpc_request_destroy( (jsonrpc_request_t*)it.p_val );
+        server_Release( (jsonrpc_request_t*)it.p_val );
 
     hashmap_free( requestMap );
     close( epfd );
+    if ( i_sparefd >= 0 )
+        close( i_sparefd );
 
     return 0;
 
@@ -545,14 +2601,132 @@ error:
 
     it = hashmap_iterate( requestMap );
     while ( hashmap_next( &it ) )
-        jsonrpc_request_destroy( (jsonrpc_request_t*)it.p_val );
+        server_Release( (jsonrpc_request_t*)it.p_val );
 
     hashmap_free( requestMap );
     close( epfd );
+    if ( i_sparefd >= 0 )
+        close( i_sparefd );
 
     return -1;
 }
 
+// epoll keeps no output of its own, connections have no p_backend
+const jsonrpc_backend_t jsonrpc_backend_epoll =
+{
+    .psz_name = "epoll",
+    .pf_serve = serve_epoll,
+    .pf_pending = NULL,
+    .pf_mem = NULL,
+    .pf_received = NULL,
+    .b_sendfile = true,
+};
+
+// before the loop allocates anything: the memory a thread touches first
+// comes from its numa node, and glibc gives each thread its own arena
+static void pin_cpu( jsonrpc_server_t *p_this )
+{
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( p_this->i_cpu, &set );
+    int i_err = pthread_setaffinity_np( pthread_self(), sizeof(set), &set );
+    if ( i_err )
+    {
+        log_Err( "pin to cpu %d failed (%s)", p_this->i_cpu, strerror(i_err) );
+        return;
+    }
+
+    // a reuseport group picks its listener by hash, this program picks the
+    // one at the index of the receiving cpu (the group's choice when it is
+    // out of range). Every member installs the same one.
+    struct sock_filter code[] =
+    {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+    for ( int i = 0; i < p_this->i_listeners; i++ )
+    {
+        jsonrpc_listener_t *p_listener = &p_this->p_listeners[i];
+        int i_reuseport = 0;
+        socklen_t i_len = sizeof(int);
+        if ( p_listener->i_family == AF_UNIX ||
+             getsockopt( p_listener->i_fd, SOL_SOCKET, SO_REUSEPORT,
+                         &i_reuseport, &i_len ) < 0 || !i_reuseport )
+            continue;
+        if ( setsockopt( p_listener->i_fd, SOL_SOCKET,
+                         SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog) ) < 0 )
+            log_Warn( "set socket SO_ATTACH_REUSEPORT_CBPF failed (%s)",
+                      strerror( errno ) );
+    }
+}
+
+static int serve( jsonrpc_server_t *p_this )
+{
+    if ( !p_this->b_initialized )
+    {
+        log_Err( "jsonrpc server has not been initialized" );
+        return -1;
+    }
+    assert( p_this->i_listeners > 0 || p_this->i_takeoverfd != -1 );
+
+    if ( p_this->i_cpu >= 0 )
+        pin_cpu( p_this );
+    sg_p_server = p_this;
+    p_this->i_mem_used = 0;
+    p_this->i_connections = 0;
+    p_this->i_paused = 0;
+    p_this->i_listen_conns = -1;
+    sg_p_backend = p_this->i_backend == JSONRPC_BACKEND_URING ?
+                   &jsonrpc_backend_uring : &jsonrpc_backend_epoll;
+    int i_ret = sg_p_backend->pf_serve( p_this );
+    if ( i_ret == BACKEND_FALLBACK )
+    {
+        sg_p_backend = &jsonrpc_backend_epoll;
+        i_ret = sg_p_backend->pf_serve( p_this );
+    }
+    sg_p_backend = NULL;
+    sg_p_server = NULL;
+    return i_ret;
+}
+
+// answer the handshake with the memfd attached, the connection then goes
+// through it. Nothing is queued before the handshake answer.
+static int shm_accept( jsonrpc_request_t *p_request, size_t i_size )
+{
+    shm_t *p_shm = malloc( sizeof(shm_t) );
+    if ( !p_shm )
+    {
+        log_Err( "no memory" );
+        return JSONRPC_ERR_NOMEM;
+    }
+    int i_memfd;
+    if ( shm_Create( p_shm, i_size, &i_memfd ) < 0 )
+    {
+        // the client goes on over the socket
+        log_Warn( "shared memory failed (%s)", strerror( errno ) );
+        free( p_shm );
+        memcpy( p_request->p_res->p_buffer, "handshake OK\r\n", 14 );
+        p_request->p_res->i_buffer = 14;
+        return 0;
+    }
+    STAT_INC( i_syscalls );
+    int i_ret = shm_SendFd( p_request->i_sockfd, "handshake OK\r\n", 14,
+                            i_memfd );
+    close( i_memfd );
+    if ( i_ret < 0 )
+    {
+        log_Err( "handshake send failed (%s)", strerror( errno ) );
+        shm_Release( p_shm );
+        free( p_shm );
+        return -1;
+    }
+    log_Dbg( "shared memory rings of %u bytes (fd:%d)", p_shm->i_size,
+             p_request->i_sockfd );
+    p_request->p_shm = p_shm;
+    return 0;
+}
+
 // handshake request: "{protocol: rpc}" or
 //                    "{protocol: notify, notifyServiceNames: [ xxx, xxx, ... ]}"
 // handshake response: "handshake OK"
@@ -641,26 +2815,89 @@ static int handle_handshake( jsonrpc_server_t *p_server,
             hashmap_put( p_server->notifyServiceMap, key, p_request );
         }
     }
+    // ring size asked for, granted on unix listeners up to their own
+    struct json_object *p_shm = json_object_object_get( p_obj, "shm" );
+    int i_shm = p_shm ? json_object_get_int( p_shm ) : 0;
     json_object_put( p_obj );
+    if ( i_shm > 0 && p_request->i_shm_ring > 0 &&
+         !strcasecmp( p_request->psz_protocol, "rpc" ) )
+        return shm_accept( p_request, i_shm < p_request->i_shm_ring ?
+                           i_shm : p_request->i_shm_ring );
 
     memcpy( p_request->p_res->p_buffer, "handshake OK\r\n", 14 );
     p_request->p_res->i_buffer = 14;
     return 0;
 }
 
-static int handle_request( jsonrpc_server_t *p_server,
-                           block_t *p_reqblock, block_t *p_resblock )
+// a notification (no id) over a limit is dropped without a response
+static int reject_ratelimited( block_t *p_resblock, const char *p_id,
+                               size_t i_id )
+{
+    if ( !p_id )
+        return -1;
+    return reject_with( p_resblock, RATELIMIT_RESPONSE, p_id, i_id );
+}
+
+// the per ip limit, checked before parsing on the members found by a scan
+// of the raw request. A cancellation only saves work, it is let through.
+static int ip_admit( jsonrpc_server_t *p_server, jsonrpc_request_t *p_request,
+                     block_t *p_reqblock, block_t *p_resblock )
+{
+    const char *psz_json = (const char*)p_reqblock->p_buffer;
+    size_t i_json = strnlen( psz_json, p_reqblock->i_buffer );
+    size_t i_method = 0, i_id = 0;
+    const char *p_method = json_request_Member( psz_json, i_json, "method",
+                                                &i_method );
+    if ( p_method && i_method == sizeof(JSONRPC_CANCEL_METHOD) + 1 &&
+         !memcmp( p_method + 1, JSONRPC_CANCEL_METHOD,
+                  sizeof(JSONRPC_CANCEL_METHOD) - 1 ) )
+        return 0;
+    if ( ratelimit_Take( p_server->p_iplimit, p_request->psz_ip,
+                         strlen( p_request->psz_ip ), jsonrpc_mdate() ) )
+        return 0;
+
+    log_Dbg( "client %s is over rate limit", p_request->psz_ip );
+    const char *p_id = json_request_Member( psz_json, i_json, "id", &i_id );
+    return reject_ratelimited( p_resblock, p_id, i_id );
+}
+
+// only calls with an id can be cancelled
+static int reject_cancelled( block_t *p_resblock, const char *psz_id )
+{
+    return reject_with( p_resblock, CANCELLED_RESPONSE, psz_id,
+                        strlen( psz_id ) );
+}
+
+static int handle_call( jsonrpc_server_t *p_server,
+                        block_t *p_reqblock, block_t *p_resblock )
 {
     const char *psz_json = (char*)p_reqblock->p_buffer;
     struct json_object *p_req, *p_response;
     struct json_object *p_params = NULL;
     char psz_err[256] = {0};
     const char *psz_response = NULL;
+    const char *psz_method = NULL;
     pf_rpc_callback_t pf = NULL;
     pf_rpc_member_callback_t pmf = NULL;
+    pf_rpc_stream_callback_t pf_stream = NULL;
     void *p_classobj = NULL;
+    struct json_object *p_id = NULL;
+    const char *psz_id = NULL;
+    method_opt_t *p_opt = NULL;
+    const char *psz_callkey = NULL;
+    const uint8_t *p_body = NULL;
+    size_t i_body = 0;
+    int i_ret;
+    bool b_cancel = false;
+    bool b_cancelled = false;
     assert( p_resblock->i_buffer == 0 );
 
+    jsonrpc_request_t *p_request = sg_p_current_request;
+    if ( p_server->p_iplimit && p_request &&
+         ( i_ret = ip_admit( p_server, p_request, p_reqblock,
+                             p_resblock ) ) < 0 )
+        return i_ret;
+
     p_response = json_object_new_object();
     json_object_object_add( p_response, "jsonrpc",
                             json_object_new_string("2.0"));
@@ -671,11 +2908,18 @@ static int handle_request( jsonrpc_server_t *p_server,
         sprintf( psz_err, "jsonrpc server parsing parameter error" );
         goto error;
     }
+    // before dispatch, every error below echoes it
+    p_id = json_object_object_get( p_req, "id" );
     json_object_object_foreach( p_req, psz_key, val )
     {
         if ( !strcmp( psz_key, "method" ) )
         {
-            const char *psz_method = json_object_get_string( val );
+            psz_method = json_object_get_string( val );
+            if ( !strcmp( psz_method, JSONRPC_CANCEL_METHOD ) )
+            {
+                b_cancel = true;
+                continue;
+            }
             hashmap_key_t key;
             key.type = 'c';
             if ( !strchr( psz_method, '.' ) )
@@ -683,6 +2927,8 @@ static int handle_request( jsonrpc_server_t *p_server,
                 key.u.psz_string = psz_method;
                 pf = hashmap_get( p_server->hashmap, key );
                 if ( !pf )
+                    pf_stream = hashmap_get( p_server->streamMap, key );
+                if ( !pf && !pf_stream )
                 {
                     snprintf( psz_err, sizeof(psz_err) - 1,
                               "jsonrpc_server method %s is unkown", psz_method );
@@ -710,7 +2956,21 @@ static int handle_request( jsonrpc_server_t *p_server,
             p_params = val;
     }
 
-    if ( !pf && !pmf )
+    // reached in order, the call it names has been answered already.
+    // Cancellations read ahead never get here (cancel_scan).
+    if ( b_cancel )
+    {
+        // read ahead, it has done its job
+        char psz_cancel[CANCEL_ID_MAX];
+        if ( p_request && p_request->p_cancel &&
+             cancel_params_id( p_params, psz_cancel ) )
+            cancel_take( p_request, psz_cancel );
+        json_object_put( p_req );
+        json_object_put( p_response );
+        return 0;
+    }
+
+    if ( !pf && !pmf && !pf_stream )
     {
         snprintf( psz_err, sizeof( psz_err ) - 1,
                   "invalid request %s, method is missing", psz_json );
@@ -723,49 +2983,168 @@ static int handle_request( jsonrpc_server_t *p_server,
         goto error;
     }
 
+    if ( p_id )
+        psz_id = json_object_to_json_string( p_id );
+
+    if ( hashmap_get_len( p_server->methodLimitMap ) > 0 )
+    {
+        hashmap_key_t key;
+        key.type = 'c';
+        key.u.psz_string = psz_method;
+        ratelimit_bucket_t *p_bucket =
+            hashmap_get( p_server->methodLimitMap, key );
+        if ( p_bucket && !ratelimit_bucket_Take( p_bucket, jsonrpc_mdate() ) )
+        {
+            log_Dbg( "method %s is over rate limit", psz_method );
+            i_ret = reject_ratelimited( p_resblock, psz_id,
+                                        psz_id ? strlen( psz_id ) : 0 );
+            json_object_put( p_req );
+            json_object_put( p_response );
+            return i_ret;
+        }
+    }
+
+    if ( p_request && p_request->p_cancel && cancel_take( p_request, psz_id ) )
+    {
+        log_Dbg( "call %s of %s cancelled before it ran", psz_id, psz_method );
+        i_ret = reject_cancelled( p_resblock, psz_id );
+        json_object_put( p_req );
+        json_object_put( p_response );
+        return i_ret;
+    }
+
+    // neither cached nor coalesced, the result is never whole in memory
+    if ( pf_stream )
+    {
+        if ( stream_open( pf_stream, p_params, psz_id, p_reqblock, p_resblock,
+                          psz_err, sizeof(psz_err) - 1 ) < 0 )
+            goto error;
+        json_object_put( p_req );
+        json_object_put( p_response );
+        return 0;
+    }
+
+    // the call key would not tell the blobs apart
+    if ( hashmap_get_len( p_server->methodOptMap ) > 0 &&
+         !( p_request && p_request->p_blobs &&
+            p_request->p_blobs->i_blobs > 0 ) )
+    {
+        hashmap_key_t key;
+        key.type = 'c';
+        key.u.psz_string = psz_method;
+        p_opt = hashmap_get( p_server->methodOptMap, key );
+    }
+    if ( p_opt )
+    {
+        // not the cache's own scratch key, the handler may invalidate
+        p_server->p_callkey = json_call_key( p_server->p_callkey, psz_method,
+                                             p_params );
+        if ( p_server->p_callkey )
+            psz_callkey = (const char*)p_server->p_callkey->p_buffer;
+    }
+    if ( psz_callkey && p_opt->i_cache_ttl > 0 )
+    {
+        p_body = rescache_Get( p_server->p_cache, psz_callkey, &i_body,
+                               jsonrpc_mdate() );
+        if ( p_body )
+            goto shared;
+    }
+    if ( psz_callkey && p_opt->b_coalesce )
+    {
+        hashmap_key_t key;
+        key.type = 'c';
+        key.u.psz_string = psz_callkey;
+        flight_t *p_flight = hashmap_get( p_server->flightMap, key );
+        if ( p_flight )
+        {
+            p_body = p_flight->p_body;
+            i_body = p_flight->i_body;
+            goto shared;
+        }
+    }
+
+    // the handler may poll jsonrpc_request_IsCancelled
+    if ( p_request )
+    {
+        p_request->psz_id = psz_id;
+        p_request->b_cancelled = false;
+    }
     if ( pf )
         pf( p_params, p_response );
     else if ( pmf )
         pmf( p_classobj, p_params, p_response );
-
-    json_object_put( p_req );
-    psz_response = json_object_to_json_string( p_response );
-    if ( strlen(psz_response) + 1 >= p_resblock->i_maxlen )
+    if ( p_request )
     {
-        p_resblock = block_Realloc( p_resblock, strlen(psz_response) + 1 );
-        if ( !p_resblock )
-        {
-            log_Err( "no memory" );
-            return JSONRPC_ERR_NOMEM;
-        }
+        b_cancelled = p_request->b_cancelled;
+        p_request->psz_id = NULL;
+        p_request->b_cancelled = false;
+    }
+    // the descriptors can not be cached nor shared
+    if ( p_request && p_request->p_blobs &&
+         p_request->p_blobs->i_attached > 0 )
+        psz_callkey = NULL;
+    if ( b_cancelled )
+    {
+        log_Dbg( "call %s of %s cancelled", psz_id, psz_method );
+        if ( p_request && p_request->p_blobs )
+            fdblob_Detach( p_request->p_blobs );
+        i_ret = reject_cancelled( p_resblock, psz_id );
+        json_object_put( p_req );
+        json_object_put( p_response );
+        return i_ret;
     }
-    memcpy( p_resblock->p_buffer, psz_response, strlen(psz_response) + 1 );
-    p_resblock->i_buffer = strlen(psz_response) + 1;
+
+    psz_response = json_object_to_json_string( p_response );
+    p_body = (const uint8_t*)psz_response;
+    i_body = strlen( psz_response ) + 1;
+    if ( psz_callkey && p_opt->i_cache_ttl > 0 &&
+         !json_object_object_get( p_response, "error" ) )
+        rescache_Put( p_server->p_cache, psz_callkey, p_body, i_body,
+                      jsonrpc_mdate() + (uint64_t)p_opt->i_cache_ttl * 1000 );
+    if ( psz_callkey && p_opt->b_coalesce )
+        flight_add( p_server, psz_callkey, psz_response, i_body );
+
+shared:
+    i_ret = set_response( p_resblock, p_body, i_body, psz_id );
+    json_object_put( p_req );
     json_object_put( p_response );
-    return 0;
+    return i_ret < 0 ? JSONRPC_ERR_NOMEM : 0;
 
 error:
     log_Err( psz_err );
     json_object_object_add( p_response, "error",
                             json_object_new_string( psz_err ) );
+    psz_response = json_object_to_json_string( p_response );
+    if ( p_id )
+        psz_id = json_object_to_json_string( p_id );
+    if ( set_response( p_resblock, (const uint8_t*)psz_response,
+                       strlen(psz_response) + 1, psz_id ) < 0 )
+        abort();
     if ( !is_error(p_req) )
         json_object_put( p_req );
-    psz_response = json_object_to_json_string( p_response );
-    if ( strlen(psz_response) + 1 >= p_resblock->i_maxlen )
-    {
-        p_resblock = block_Realloc( p_resblock, strlen(psz_response) + 1 );
-        if ( !p_resblock )
-        {
-            log_Err( "no memory" );
-            abort();
-        }
-    }
-    memcpy( p_resblock->p_buffer, psz_response, strlen(psz_response) + 1 );
-    p_resblock->i_buffer = strlen(psz_response) + 1;
     json_object_put( p_response );
     return -1;
 }
 
+// the call and what it cost go to the capture when it is sampled
+static int handle_request( jsonrpc_server_t *p_server,
+                           block_t *p_reqblock, block_t *p_resblock )
+{
+    if ( !p_server->p_capture || !capture_Sample( p_server->p_capture ) )
+        return handle_call( p_server, p_reqblock, p_resblock );
+
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    uint64_t i_start = jsonrpc_mdate();
+    int i_ret = handle_call( p_server, p_reqblock, p_resblock );
+    capture_Record( p_server->p_capture, p_reqblock->p_buffer,
+                    strnlen( (const char*)p_reqblock->p_buffer,
+                             p_reqblock->i_buffer ),
+                    (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec,
+                    p_resblock->i_buffer, jsonrpc_mdate() - i_start );
+    return i_ret;
+}
+
 static void remove_request_references( jsonrpc_server_t *p_this,
                                        jsonrpc_request_t *p_request )
 {
@@ -815,6 +3194,13 @@ static int notify_dispatch( jsonrpc_server_t *p_this,
     while ( p_head != NULL )
     {
         assert( p_head->i_state == CONN_HANDSHAKED );
+        if ( output_pending( p_head ) + 5 + i_notify > p_this->i_max_output )
+        {
+            log_Warn( "drop notify to %s, %zu bytes not sent yet",
+                      p_head->psz_ip, output_pending( p_head ) );
+            p_head = p_head->p_next;
+            continue;
+        }
         if ( p_head->p_res->i_buffer + 5 + i_notify >= p_head->p_res->i_maxlen )
         {
             p_head->p_res = block_Realloc( p_head->p_res, i_notify );
@@ -834,7 +3220,7 @@ static int notify_dispatch( jsonrpc_server_t *p_this,
         p_res->i_buffer += i_notify;
         // if process_write return -1, EPOLLOUT or EPOLLHUP will process
         // the unfinished task, depends on errno
-        process_write( p_head->i_sockfd, p_res );
+        process_write( p_head );
 
         p_head = p_head->p_next;
 
@@ -848,61 +3234,212 @@ static int jsonrpc_server_exit( jsonrpc_server_t *p_this )
 {
     log_Dbg( "jsonrpc server exit" );
 
-    if ( p_this->psz_bind_file )
+    for ( int i = 0; i < p_this->i_listeners; i++ )
+    {
+        jsonrpc_listener_t *p_listener = &p_this->p_listeners[i];
+        close( p_listener->i_fd );
+        if ( p_listener->psz_bind_file )
+        {
+            unlink( p_listener->psz_bind_file );
+            free( p_listener->psz_bind_file );
+        }
+    }
+    free( p_this->p_listeners );
+    p_this->p_listeners = NULL;
+    p_this->i_listeners = 0;
+
+    if ( p_this->i_upgradesock != -1 )
+        close( p_this->i_upgradesock );
+    p_this->i_upgradesock = -1;
+    if ( p_this->psz_upgrade_file )
     {
-        unlink( p_this->psz_bind_file );
-        free( p_this->psz_bind_file );
+        unlink( p_this->psz_upgrade_file );
+        free( p_this->psz_upgrade_file );
     }
+    p_this->psz_upgrade_file = NULL;
+    if ( p_this->i_upgradefd != -1 )
+        close( p_this->i_upgradefd );
+    p_this->i_upgradefd = -1;
+    if ( p_this->i_takeoverfd != -1 )
+        close( p_this->i_takeoverfd );
+    p_this->i_takeoverfd = -1;
 
     for ( int i = 0; i < p_this->i_supportedNotifyService; i++ )
         free( p_this->ppsz_supportedNotifyService[i] );
     free( p_this->ppsz_supportedNotifyService );
 
-    if ( p_this->tcpsock != -1 )
-        close( p_this->tcpsock );
-    if ( p_this->unixsock != -1 )
-        close( p_this->unixsock );
-
     hashmap_free( p_this->hashmap );
+    hashmap_free( p_this->streamMap );
     hashmap_free( p_this->classmap );
     hashmap_free( p_this->notifyServiceMap );
 
+    ratelimit_Delete( p_this->p_iplimit );
+    p_this->p_iplimit = NULL;
+    hashmap_iterator it = hashmap_iterate( p_this->methodLimitMap );
+    while ( hashmap_next( &it ) )
+        free( it.p_val );
+    hashmap_free( p_this->methodLimitMap );
+
+    rescache_Delete( p_this->p_cache );
+    p_this->p_cache = NULL;
+    it = hashmap_iterate( p_this->methodOptMap );
+    while ( hashmap_next( &it ) )
+        free( it.p_val );
+    hashmap_free( p_this->methodOptMap );
+    flights_clear( p_this );
+    hashmap_free( p_this->flightMap );
+    if ( p_this->p_callkey )
+        block_Release( p_this->p_callkey );
+    p_this->p_callkey = NULL;
+    capture_Delete( p_this->p_capture );
+    p_this->p_capture = NULL;
+
     p_this->b_initialized = false;
     return 0;
 }
 
-static int open_tcp_socket( jsonrpc_server_t *p_this, const char *psz_name,
-                            int i_port )
+static int add_listener( jsonrpc_server_t *p_this, int i_fd, int i_family,
+                         const char *psz_file,
+                         const jsonrpc_sockopt_t *p_conn )
 {
+    jsonrpc_listener_t *p_listeners = realloc( p_this->p_listeners,
+        (p_this->i_listeners + 1) * sizeof(jsonrpc_listener_t) );
+    if ( !p_listeners )
+    {
+        log_Err( "no memory" );
+        return JSONRPC_ERR_NOMEM;
+    }
+    p_this->p_listeners = p_listeners;
+
+    jsonrpc_listener_t *p_listener = &p_listeners[ p_this->i_listeners ];
+    p_listener->i_fd = i_fd;
+    p_listener->i_family = i_family;
+    p_listener->psz_bind_file = NULL;
+    p_listener->b_paused = false;
+    memset( &p_listener->conn, 0, sizeof(p_listener->conn) );
+    if ( p_conn )
+        p_listener->conn = *p_conn;
+    if ( psz_file )
+    {
+        p_listener->psz_bind_file = strdup( psz_file );
+        if ( !p_listener->psz_bind_file )
+        {
+            log_Err( "no memory" );
+            return JSONRPC_ERR_NOMEM;
+        }
+    }
+    p_this->i_listeners++;
+    return 0;
+}
+
+static int set_listen_opt( int i_fd, const jsonrpc_listen_opt_t *p_opt )
+{
+    if ( p_opt->b_reuseport )
+    {
+        int i_reuseport = 1;
+        if ( setsockopt( i_fd, SOL_SOCKET, SO_REUSEPORT,
+                         &i_reuseport, sizeof(int) ) < 0 )
+        {
+            log_Err( "set socket SO_REUSEPORT failed (%s)", strerror( errno ) );
+            return -1;
+        }
+    }
+    if ( p_opt->i_sndbuf > 0 &&
+         setsockopt( i_fd, SOL_SOCKET, SO_SNDBUF,
+                     &p_opt->i_sndbuf, sizeof(int) ) < 0 )
+    {
+        log_Err( "set socket SO_SNDBUF failed (%s)", strerror( errno ) );
+        return -1;
+    }
+    if ( p_opt->i_rcvbuf > 0 &&
+         setsockopt( i_fd, SOL_SOCKET, SO_RCVBUF,
+                     &p_opt->i_rcvbuf, sizeof(int) ) < 0 )
+    {
+        log_Err( "set socket SO_RCVBUF failed (%s)", strerror( errno ) );
+        return -1;
+    }
+    return 0;
+}
+
+static int open_tcp_socket( jsonrpc_server_t *p_this, int i_family,
+                            const char *psz_name, int i_port,
+                            const jsonrpc_listen_opt_t *p_opt )
+{
+    struct addrinfo hints, *p_res = NULL;
+    memset( &hints, 0, sizeof(hints) );
+    hints.ai_family = i_family;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    char psz_port[16];
+    snprintf( psz_port, sizeof(psz_port), "%d", i_port );
+    int i_err = getaddrinfo( psz_name, psz_port, &hints, &p_res );
+    if ( i_err != 0 )
+    {
+        log_Err( "resolve %s:%d failed (%s)", psz_name, i_port,
+                 gai_strerror( i_err ) );
+        return -1;
+    }
 
-    if ( ( p_this->tcpsock = socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+    int i_fd = socket( i_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                       0 );
+    if ( i_fd < 0 )
     {
         log_Err( "open network socket failed (%s)", strerror( errno ) );
+        freeaddrinfo( p_res );
         return -1;
     }
 
-    int i_reuseaddr = 1;
-    if ( setsockopt( p_this->tcpsock, SOL_SOCKET, SO_REUSEADDR,
-                     &i_reuseaddr, sizeof(int) ) < 0 )
+    int i_on = 1;
+    if ( setsockopt( i_fd, SOL_SOCKET, SO_REUSEADDR, &i_on, sizeof(int) ) < 0 )
     {
         log_Err( "set socket SO_REUSEADDR failed (%s)", strerror( errno ) );
-        return -1;
+        goto error;
+    }
+    if ( i_family == AF_INET6 &&
+         setsockopt( i_fd, IPPROTO_IPV6, IPV6_V6ONLY, &i_on, sizeof(int) ) < 0 )
+    {
+        log_Err( "set socket IPV6_V6ONLY failed (%s)", strerror( errno ) );
+        goto error;
     }
+    if ( set_listen_opt( i_fd, p_opt ) < 0 )
+        goto error;
 
-    if ( socket_listen( p_this->tcpsock, psz_name, i_port ) < 0 )
+    int i_backlog = p_opt->i_backlog > 0 ? p_opt->i_backlog :
+                    p_this->i_listen_backlog;
+    if ( bind( i_fd, p_res->ai_addr, p_res->ai_addrlen ) < 0 ||
+         listen( i_fd, i_backlog ) < 0 )
     {
-        log_Err( "socket_listen on %s:%d failed (%s)", psz_name, i_port,
+        log_Err( "listen on %s:%d failed (%s)", psz_name, i_port,
                  strerror( errno ) );
-        return -1;
+        goto error;
     }
 
+    freeaddrinfo( p_res );
+    if ( add_listener( p_this, i_fd, i_family, NULL, &p_opt->conn ) < 0 )
+    {
+        close( i_fd );
+        return -1;
+    }
     return 0;
+
+error:
+    freeaddrinfo( p_res );
+    close( i_fd );
+    return -1;
 }
 
-static int open_unix_socket( jsonrpc_server_t *p_this, const char *psz_file )
+static int open_unix_socket( jsonrpc_server_t *p_this, const char *psz_file,
+                             const jsonrpc_listen_opt_t *p_opt )
 {
+    struct sockaddr_un addr;
+    if ( strlen( psz_file ) >= sizeof(addr.sun_path) )
+    {
+        log_Err( "open unix socket failed, the file name is too long" );
+        return -1;
+    }
 
-    if ( (p_this->unixsock = socket( AF_UNIX, SOCK_STREAM, 0 )) < 0 )
+    int i_fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if ( i_fd < 0 )
     {
         log_Err( "open unix socket failed (%s)", strerror( errno ) );
         return -1;
@@ -911,21 +3448,31 @@ static int open_unix_socket( jsonrpc_server_t *p_this, const char *psz_file )
     // remove exited file, or else bind will fail
     unlink( psz_file );
 
-    struct sockaddr_un addr;
     addr.sun_family = AF_UNIX;
-    strncpy( addr.sun_path, psz_file, sizeof(addr.sun_path) );
-    if ( bind( p_this->unixsock, &addr, SUN_LEN(&addr) ) < 0 )
+    snprintf( addr.sun_path, sizeof(addr.sun_path), "%s", psz_file );
+    if ( bind( i_fd, &addr, SUN_LEN(&addr) ) < 0 )
     {
         log_Err( "bind unix socket failed (%s)", strerror( errno ) );
+        close( i_fd );
         return -1;
     }
 
-    if ( listen( p_this->unixsock, LISTEN_BACKLOG ) < 0 )
+    int i_backlog = p_opt->i_backlog > 0 ? p_opt->i_backlog :
+                    p_this->i_listen_backlog;
+    if ( set_listen_opt( i_fd, p_opt ) < 0 || listen( i_fd, i_backlog ) < 0 )
     {
         log_Err( "listen unix socket failed (%s)", strerror( errno ) );
+        close( i_fd );
+        unlink( psz_file );
         return -1;
     }
 
+    if ( add_listener( p_this, i_fd, AF_UNIX, psz_file, &p_opt->conn ) < 0 )
+    {
+        close( i_fd );
+        unlink( psz_file );
+        return -1;
+    }
     return 0;
 }
 
@@ -933,22 +3480,58 @@ int jsonrpc_server_init( jsonrpc_server_t *p_this )
 {
     p_this->b_initialized = false;
     p_this->hashmap = NULL;
+    p_this->streamMap = NULL;
     p_this->classmap = NULL;
-    p_this->tcpsock = -1;
-    p_this->unixsock = -1;
-    p_this->psz_bind_file = NULL;
+    p_this->p_listeners = NULL;
+    p_this->i_listeners = 0;
+    p_this->i_upgradesock = -1;
+    p_this->psz_upgrade_file = NULL;
+    p_this->b_handoff_conns = false;
+    p_this->i_upgradefd = -1;
+    p_this->i_drain_deadline = 0;
+    p_this->i_takeoverfd = -1;
+    p_this->i_listen_backlog = LISTEN_BACKLOG;
+    p_this->i_listen_conns = -1;
+    p_this->i_listen_retry = 0;
+    p_this->i_backend = JSONRPC_BACKEND_EPOLL;
+    p_this->i_cpu = -1;
+    p_this->i_max_request = MAX_REQUEST_DEFAULT;
+    p_this->i_max_output = MAX_OUTPUT_DEFAULT;
+    p_this->i_mem_budget = 0;
+    p_this->i_mem_used = 0;
+    p_this->i_connections = 0;
+    p_this->i_paused = 0;
+    p_this->i_pause_deadline = 0;
+    memset( &p_this->stats, 0, sizeof(p_this->stats) );
     p_this->ppsz_supportedNotifyService = NULL;
     p_this->i_supportedNotifyService = 0;
     p_this->notifyServiceMap = NULL;
+    p_this->p_iplimit = NULL;
+    p_this->methodLimitMap = NULL;
+    p_this->p_cache = NULL;
+    p_this->i_cache_bytes = RESCACHE_DEFAULT_BYTES;
+    p_this->p_callkey = NULL;
+    p_this->p_capture = NULL;
 
     p_this->hashmap = hashmap_create(101);
+    p_this->streamMap = hashmap_create(101);
     p_this->classmap = hashmap_create(101);
     p_this->notifyServiceMap = hashmap_create(101);
+    p_this->methodLimitMap = hashmap_create(101);
+    p_this->methodOptMap = hashmap_create(101);
+    p_this->flightMap = hashmap_create(101);
 
     p_this->pf_register_function = register_function;
     p_this->pf_register_member_function = register_member_function;
+    p_this->pf_register_stream = register_stream;
     p_this->pf_register_class_object = register_class_object;
     p_this->pf_register_notify_services = register_notify_services;
+    p_this->pf_set_ip_ratelimit = set_ip_ratelimit;
+    p_this->pf_set_method_ratelimit = set_method_ratelimit;
+    p_this->pf_register_cacheable = register_cacheable;
+    p_this->pf_cache_invalidate = cache_invalidate;
+    p_this->pf_register_coalesced = register_coalesced;
+    p_this->pf_set_capture = set_capture;
     p_this->pf_serve = serve;
     p_this->pf_exit = jsonrpc_server_exit;
     // user specific
@@ -956,6 +3539,8 @@ int jsonrpc_server_init( jsonrpc_server_t *p_this )
     p_this->pf_handle_handshake = handle_handshake;
     p_this->pf_handle_request = handle_request;
     p_this->pf_get_request = NULL;
+    p_this->pf_request_Text = NULL;
+    p_this->pf_select_protocol = NULL;
     p_this->pf_on_client_connected = NULL;
     p_this->pf_on_client_closed = NULL;
     p_this->pf_on_processed = NULL;
@@ -964,13 +3549,21 @@ int jsonrpc_server_init( jsonrpc_server_t *p_this )
     signal( SIGINT, handle_signal );
     signal( SIGTERM, handle_signal );
     signal( SIGPIPE, SIG_IGN );
+    // also takes SIGUSR2 to dump the rings, see trace.h
+    if ( getenv( "JSONRPC_TRACE" ) )
+        trace_Enable( true );
+    const char *psz_backend = getenv( "JSONRPC_BACKEND" );
+    if ( psz_backend && !strcasecmp( psz_backend, "uring" ) )
+        p_this->i_backend = JSONRPC_BACKEND_URING;
 
     // all sockets are set non-block, so there's no need to set timeout.
     p_this->b_initialized = true;
     return 0;
 }
 
-int jsonrpc_server_addListener( jsonrpc_server_t *p_this, int i_sock_flag, ... )
+static int add_listener_va( jsonrpc_server_t *p_this,
+                            const jsonrpc_listen_opt_t *p_opt,
+                            int i_sock_flag, va_list args )
 {
     if ( !p_this->b_initialized )
     {
@@ -978,37 +3571,204 @@ int jsonrpc_server_addListener( jsonrpc_server_t *p_this, int i_sock_flag, ... )
         return -1;
     }
 
-    va_list args;
-    va_start( args, i_sock_flag );
+    jsonrpc_listen_opt_t opt;
+    memset( &opt, 0, sizeof(opt) );
+    if ( p_opt )
+        opt = *p_opt;
 
-    if ( i_sock_flag == AF_INET || i_sock_flag == PF_INET )
+    if ( i_sock_flag == AF_INET || i_sock_flag == PF_INET ||
+         i_sock_flag == AF_INET6 || i_sock_flag == PF_INET6 )
     {
-        if ( p_this->tcpsock != -1 )
-        {
-            log_Err( "jsonrpc server addListener failed: "
-                     "tcp socket already exists" );
-            return -1;
-        }
         const char *psz_name = (const char*)va_arg( args, const char * );
         int i_port = (int)va_arg( args, int );
-        if ( open_tcp_socket( p_this, psz_name, i_port ) < 0 )
-            return -1;
+        int i_family = ( i_sock_flag == PF_INET6 ) ? AF_INET6 : AF_INET;
+        return open_tcp_socket( p_this, i_family, psz_name, i_port, &opt );
     }
     else if ( i_sock_flag == AF_UNIX || i_sock_flag == PF_UNIX )
     {
-        if ( p_this->unixsock != -1 )
-        {
-            log_Err( "jsonrpc server addListener failed: "
-                     "unix socket already exists" );
-            return -1;
-        }
         const char *psz_file = (const char*)va_arg( args, const char * );
-        p_this->psz_bind_file = strdup( psz_file );
-        if ( open_unix_socket( p_this, psz_file ) < 0 )
-            return -1;
+        return open_unix_socket( p_this, psz_file, &opt );
     }
+
+    log_Err( "jsonrpc server addListener failed: unknown socket flag %d",
+             i_sock_flag );
+    return -1;
+}
+
+int jsonrpc_server_addListener( jsonrpc_server_t *p_this, int i_sock_flag, ... )
+{
+    va_list args;
+    va_start( args, i_sock_flag );
+    int i_ret = add_listener_va( p_this, NULL, i_sock_flag, args );
+    va_end( args );
+
+    return i_ret;
+}
+
+int jsonrpc_server_addListenerOpt( jsonrpc_server_t *p_this,
+                                   const jsonrpc_listen_opt_t *p_opt,
+                                   int i_sock_flag, ... )
+{
+    va_list args;
+    va_start( args, i_sock_flag );
+    int i_ret = add_listener_va( p_this, p_opt, i_sock_flag, args );
     va_end( args );
 
+    return i_ret;
+}
+
+int jsonrpc_server_listenUpgrade( jsonrpc_server_t *p_this,
+                                  const char *psz_file, bool b_handoff_conns )
+{
+    if ( !p_this->b_initialized )
+    {
+        log_Err( "jsonrpc server object has not been initialized" );
+        return -1;
+    }
+    if ( p_this->i_upgradesock != -1 )
+    {
+        log_Err( "jsonrpc server is already listening for upgrades" );
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    if ( strlen( psz_file ) >= sizeof(addr.sun_path) )
+    {
+        log_Err( "upgrade socket %s, the file name is too long", psz_file );
+        return -1;
+    }
+
+    int i_fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if ( i_fd < 0 )
+    {
+        log_Err( "open unix socket failed (%s)", strerror( errno ) );
+        return -1;
+    }
+
+    // the previous process may still be bound to it, it already handed off
+    unlink( psz_file );
+
+    addr.sun_family = AF_UNIX;
+    snprintf( addr.sun_path, sizeof(addr.sun_path), "%s", psz_file );
+    // owner only before it listens, see upgrade_peer
+    if ( bind( i_fd, &addr, SUN_LEN(&addr) ) < 0 ||
+         chmod( psz_file, 0600 ) < 0 || listen( i_fd, 1 ) < 0 )
+    {
+        log_Err( "listen upgrade socket %s failed (%s)", psz_file,
+                 strerror( errno ) );
+        close( i_fd );
+        unlink( psz_file );
+        return -1;
+    }
+
+    p_this->psz_upgrade_file = strdup( psz_file );
+    if ( !p_this->psz_upgrade_file )
+    {
+        log_Err( "no memory" );
+        close( i_fd );
+        unlink( psz_file );
+        return JSONRPC_ERR_NOMEM;
+    }
+    p_this->i_upgradesock = i_fd;
+    p_this->b_handoff_conns = b_handoff_conns;
     return 0;
 }
 
+int jsonrpc_server_takeover( jsonrpc_server_t *p_this, const char *psz_file )
+{
+    if ( !p_this->b_initialized )
+    {
+        log_Err( "jsonrpc server object has not been initialized" );
+        return -1;
+    }
+    if ( p_this->i_takeoverfd != -1 )
+    {
+        log_Err( "jsonrpc server is already taking over" );
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    if ( strlen( psz_file ) >= sizeof(addr.sun_path) )
+    {
+        log_Err( "upgrade socket %s, the file name is too long", psz_file );
+        return -1;
+    }
+
+    int i_sock = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    if ( i_sock < 0 )
+    {
+        log_Err( "open unix socket failed (%s)", strerror( errno ) );
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    snprintf( addr.sun_path, sizeof(addr.sun_path), "%s", psz_file );
+    if ( connect( i_sock, &addr, SUN_LEN(&addr) ) < 0 )
+    {
+        int i_err = errno;
+        close( i_sock );
+        if ( i_err == ENOENT || i_err == ECONNREFUSED )
+        {
+            log_Dbg( "no server to take over on %s", psz_file );
+            return 0;
+        }
+        log_Err( "connect %s failed (%s)", psz_file, strerror( i_err ) );
+        return -1;
+    }
+    if ( upgrade_peer( i_sock ) < 0 )
+        goto error;
+
+    int i_listeners = 0;
+    while ( true )
+    {
+        handoff_msg_t msg;
+        int i_fd;
+        uint8_t *p_payload;
+        if ( handoff_Recv( i_sock, &msg, &i_fd, &p_payload ) < 0 )
+            goto error;
+        if ( msg.i_kind == HANDOFF_LISTENERS_END )
+        {
+            free( p_payload );
+            break;
+        }
+        if ( msg.i_kind != HANDOFF_LISTENER || i_fd < 0 )
+        {
+            log_Err( "takeover: unexpected message %u", msg.i_kind );
+            if ( i_fd >= 0 )
+                close( i_fd );
+            free( p_payload );
+            goto error;
+        }
+
+        // the bind file, then the options of its connections
+        const uint8_t *p = p_payload, *p_end = p_payload + msg.i_payload;
+        const char *psz_bind_file = p ? next_string( &p, p_end ) : NULL;
+        const char *psz_conn = psz_bind_file && msg.i_strings >= 2 ?
+                               next_string( &p, p_end ) : NULL;
+        if ( psz_bind_file && psz_bind_file[0] == '\0' )
+            psz_bind_file = NULL;
+        jsonrpc_sockopt_t conn;
+        memset( &conn, 0, sizeof(conn) );
+        if ( psz_conn )
+            sockopt_Parse( &conn, psz_conn );
+        else
+            log_Warn( "takeover: listener %d comes without its options",
+                      i_listeners );
+        int i_ret = add_listener( p_this, i_fd, msg.i_arg, psz_bind_file,
+                                  &conn );
+        free( p_payload );
+        if ( i_ret < 0 )
+        {
+            close( i_fd );
+            goto error;
+        }
+        i_listeners++;
+    }
+
+    p_this->i_takeoverfd = i_sock;
+    log_Warn( "took over %d listeners from %s", i_listeners, psz_file );
+    return i_listeners;
+
+error:
+    close( i_sock );
+    return -1;
+}
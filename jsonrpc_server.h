@@ -10,14 +10,21 @@
 #include <stdbool.h>
 #include <json/json.h>
 #include <pthread.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
 #include "hashmap.h"
 #include "socket.h"
 #include "block.h"
+#include "ratelimit.h"
+#include "rescache.h"
+#include "sockopt.h"
 
 typedef struct jsonrpc_server_t jsonrpc_server_t;
 typedef struct jsonrpc_request_t jsonrpc_request_t;
 typedef struct ws_jsonrpc_server_t ws_jsonrpc_server_t;
 typedef struct JsonrpcPlusWs_server_t JsonrpcPlusWs_server_t;
+typedef struct jsonrpc_stream_t jsonrpc_stream_t;
+typedef struct jsonrpc_protocol_t jsonrpc_protocol_t;
 
 enum conn_state
 {
@@ -29,15 +36,46 @@ enum conn_state
 struct jsonrpc_request_t
 {
     int  i_sockfd;
-    char psz_ip[16];
+    char psz_ip[INET6_ADDRSTRLEN];          // "unix" for unix sockets
     block_t *p_req;
     block_t *p_res;
+    block_t *p_out;                         // responses queued by
+    // process_write, sent once per loop iteration
     // process_write and notify_dispatch
     int     i_state;
     char *psz_protocol;
     char **ppsz_notify_service;
     int  i_notify_service;
     struct jsonrpc_request_t *p_next;       // used for notifyServiceMap
+    bool   b_handed_off;                    // passed to the next process on
+    // upgrade, its client is still connected
+    void *p_backend;                        // loop state (jsonrpc_backend.h),
+    // or NULL
+    size_t i_mem;                           // buffer bytes, see i_mem_used
+    bool   b_paused;                        // not read, over the budget
+    jsonrpc_stream_t *p_stream;             // streamed result being sent,
+    // the next requests wait for it
+    bool   b_queued;                        // in the flush list
+    bool   b_linger;                        // close once p_out is sent
+    bool   b_blocked;                       // socket full (epoll)
+    bool   b_held;                          // requests wait for the output
+    // to drain under i_max_output
+    bool   b_pollout;                       // EPOLLOUT armed
+    struct jsonrpc_request_t *p_next_flush;
+    const char *psz_id;                     // of the call being handled or
+    // streamed, NULL without one
+    bool   b_cancelled;                     // that call was cancelled
+    block_t *p_cancel;                      // ids of queued calls cancelled,
+    // '\0' separated, or NULL
+    size_t i_scanned;                       // p_req bytes looked through for
+    // cancellations while a stream holds them back
+    struct shm_t *p_shm;                    // shared memory transport
+    // (shmring.h) after the handshake, or NULL
+    int    i_shm_ring;                      // granted by its listener
+    struct fdblob_queue_t *p_blobs;         // descriptors received on a
+    // unix listener taking blobs (fdblob.h), or NULL
+    const jsonrpc_protocol_t *p_proto;      // pinned by pf_select_protocol
+    // on the first bytes, NULL for the server's own hooks
 };
 
 
@@ -46,20 +84,119 @@ struct jsonrpc_request_t
 
 
 
+enum jsonrpc_backend
+{
+    JSONRPC_BACKEND_EPOLL,
+    JSONRPC_BACKEND_URING,                  // io_uring, linux 6.0+
+};
+
+// counters of the serve loop
+typedef struct jsonrpc_server_stats_t
+{
+    uint64_t i_requests;                    // requests handled
+    uint64_t i_syscalls;                    // made by the loop for io
+    uint64_t i_loops;                       // event loop iterations
+} jsonrpc_server_stats_t;
+
+// per listener options, 0 keeps the default
+typedef struct jsonrpc_listen_opt_t
+{
+    int  i_backlog;                         // default is i_listen_backlog
+    bool b_reuseport;                       // SO_REUSEPORT, tcp only
+    int  i_sndbuf;                          // SO_SNDBUF and SO_RCVBUF, set
+    int  i_rcvbuf;                          // on the listener and inherited
+    // by accepted connections
+    jsonrpc_sockopt_t conn;                 // applied to each accepted
+    // connection
+} jsonrpc_listen_opt_t;
+
+typedef struct jsonrpc_listener_t
+{
+    int   i_fd;
+    int   i_family;                         // AF_INET, AF_INET6 or AF_UNIX
+    char *psz_bind_file;                    // unix socket path, unlinked on
+    // exit
+    jsonrpc_sockopt_t conn;                 // inherited listeners get
+    // it with the handoff
+    bool  b_paused;                         // out of fds, not accepting
+} jsonrpc_listener_t;
+
 typedef void (*pf_rpc_callback_t) ( struct json_object *p_params,
                                     struct json_object *p_response );
 typedef void (*pf_rpc_member_callback_t) ( void *p_classobj,
         struct json_object *p_params,
         struct json_object *p_response );
 
+/* streamed results, see pf_register_stream.
+ * the stream callback either calls jsonrpc_stream_Begin or
+ * jsonrpc_stream_Error. pf_next is then called each time the connection has
+ * room for more output (below JSONRPC_STREAM_WINDOW unsent bytes), emits
+ * the next part and returns 1, or 0 once the result is complete. A negative
+ * return cuts the response and closes the connection. pf_close releases
+ * p_opaque when the stream ends, also when the client went away.
+ * Connections that can not be written to directly (websocket) get the
+ * result in one piece, pf_next is called until it is complete.
+ */
+#define JSONRPC_STREAM_WINDOW (256 * 1024)
+
+enum jsonrpc_stream_kind
+{
+    JSONRPC_STREAM_ARRAY,                   // "result" is an array, emitted
+    // element by element
+    JSONRPC_STREAM_RAW,                     // "result" is the concatenation
+    // of the emitted bytes, which must form one json value
+};
+
+typedef void (*pf_rpc_stream_callback_t) ( struct json_object *p_params,
+                                           jsonrpc_stream_t *p_stream );
+typedef int  (*pf_rpc_stream_next_t) ( jsonrpc_stream_t *p_stream,
+                                       void *p_opaque );
+
 struct jsonrpc_server_t
 {
     bool      b_initialized;
     hashmap   hashmap;                  // store functions
+    hashmap   streamMap;                // store stream callbacks
     hashmap   classmap;                 // store class object
-    int       tcpsock;
-    int       unixsock;
-    char *psz_bind_file;
+    jsonrpc_listener_t *p_listeners;
+    int       i_listeners;
+    int       i_listen_backlog;         // default SOMAXCONN, set before
+    // jsonrpc_server_addListener
+    int       i_listen_conns;           // connections when out of fds
+    // paused the listeners, -1 while they accept
+    uint64_t  i_listen_retry;
+    int       i_backend;                // JSONRPC_BACKEND_*, set before
+    // pf_serve (or JSONRPC_BACKEND=uring), io_uring falls back to epoll
+    // when the kernel lacks support or an upgrade is configured
+    jsonrpc_server_stats_t stats;
+    int       i_cpu;                    // cpu the serving thread is pinned
+    // to, -1 (default) is not pinned. Set before pf_serve, the loop then
+    // allocates its buffers on that cpu's numa node. With one server per
+    // cpu sharing a port (b_reuseport), listeners added in cpu order, each
+    // takes the connections whose packets the nic queue delivers to its cpu.
+
+    // memory budgets, set before pf_serve
+    size_t    i_max_request;            // bigger messages are rejected as
+    // soon as the framing knows, and the connection closed (16 MB)
+    size_t    i_max_output;             // unsent bytes of a connection,
+    // beyond it the next requests wait for them to drain and notifies are
+    // dropped (4 MB)
+    size_t    i_mem_budget;             // receive and send buffers of all
+    // connections, 0 is unlimited. Over it the connections holding more
+    // than the average stop reading until usage is under 3/4 of it, if
+    // that takes more than a second the biggest one is closed.
+    size_t    i_mem_used;
+    int       i_connections;
+    int       i_paused;
+    uint64_t  i_pause_deadline;
+
+    // zero-downtime upgrade, see jsonrpc_server_listenUpgrade
+    int       i_upgradesock;            // accepts the next process, or -1
+    char     *psz_upgrade_file;
+    bool      b_handoff_conns;          // pass idle connections, or close
+    int       i_upgradefd;              // next process being handed off to
+    uint64_t  i_drain_deadline;
+    int       i_takeoverfd;             // previous process handing off to us
 
     // notify
     char **ppsz_supportedNotifyService;
@@ -67,15 +204,64 @@ struct jsonrpc_server_t
     hashmap   notifyServiceMap;         // key is notify service,
     // value is request list
 
+    // admission control, checked before the handler runs
+    ratelimit_t *p_iplimit;             // per client ip, NULL is unlimited
+    hashmap   methodLimitMap;           // key is method,
+    // value is ratelimit_bucket_t
+
+    // response cache of idempotent methods
+    rescache_t *p_cache;
+    size_t    i_cache_bytes;
+    hashmap   methodOptMap;             // key is method, value is options
+    // (cache ttl, coalescing)
+    hashmap   flightMap;                // coalesced calls executed in the
+    // current loop iteration, key is call key, value is serialized result
+    block_t  *p_callkey;                // scratch for the call key
+
+    struct capture_t *p_capture;        // sampled calls, see pf_set_capture
+
     int (*pf_register_function) ( jsonrpc_server_t *p_this,
                                   const char *psz_method, pf_rpc_callback_t pf );
     int (*pf_register_class_object) ( jsonrpc_server_t *p_this,
                                       const char *psz_class, void *p_obj );
     int (*pf_register_member_function) ( jsonrpc_server_t *p_this,
                                          const char *psz_method, pf_rpc_member_callback_t pmf);
+    // psz_method's result is produced by pf in parts and sent as they come,
+    // see jsonrpc_stream_Begin
+    int (*pf_register_stream) ( jsonrpc_server_t *p_this,
+                                const char *psz_method,
+                                pf_rpc_stream_callback_t pf );
     int (*pf_register_notify_services) ( jsonrpc_server_t *p_this,
                                          const char **ppsz_notify_service,
                                          int i_notify_service );
+    // f_rate requests per second with bursts up to f_burst, calls over
+    // the limit get a "rate limit exceeded" error without running the
+    // handler, notifications over it are dropped. i_sources sizes the ip
+    // table (distinct client ips, up to RATELIMIT_MAX_SOURCES).
+    int (*pf_set_ip_ratelimit) ( jsonrpc_server_t *p_this, int i_sources,
+                                 double f_rate, double f_burst );
+    int (*pf_set_method_ratelimit) ( jsonrpc_server_t *p_this,
+                                     const char *psz_method,
+                                     double f_rate, double f_burst );
+    // successful responses of psz_method are cached for i_ttl ms, a hit
+    // skips both the handler and the serialization. The cache holds at
+    // most i_cache_bytes (default 64 MB, set before registering).
+    int (*pf_register_cacheable) ( jsonrpc_server_t *p_this,
+                                   const char *psz_method, int i_ttl );
+    // p_params NULL drops every cached call of psz_method, handlers use
+    // jsonrpc_cache_Invalidate
+    void (*pf_cache_invalidate) ( jsonrpc_server_t *p_this,
+                                  const char *psz_method,
+                                  struct json_object *p_params );
+    // identical calls (same method and params) of psz_method handled in the
+    // same loop iteration run the handler once and share its result, each
+    // caller gets its own "id" back
+    int (*pf_register_coalesced) ( jsonrpc_server_t *p_this,
+                                   const char *psz_method );
+    // append f_sample (0 to 1) of the calls to psz_file as JSONL, see
+    // capture.h, a previous capture is closed. f_sample 0 stops capturing.
+    int (*pf_set_capture) ( jsonrpc_server_t *p_this, const char *psz_file,
+                            double f_sample );
     int (*pf_serve) ( jsonrpc_server_t *p_this );
     int (*pf_exit)  ( jsonrpc_server_t *p_this );
     // user can overwrite these
@@ -87,6 +273,18 @@ struct jsonrpc_server_t
                                   block_t *p_req, block_t *p_res );
     void (*pf_get_request)      ( jsonrpc_server_t *p_this,
                                   jsonrpc_request_t *p_request );
+    // the '\0' terminated json text of a complete message (as framed by
+    // pf_request_IsComplete), NULL for one without (block_Release it).
+    // Needed by jsonrpc_request_IsCancelled when messages are not json
+    // text already, NULL by default.
+    block_t *(*pf_request_Text) ( jsonrpc_server_t *p_this,
+                                  const block_t *p_req );
+    // a server speaking several protocols tells which one a connection
+    // uses from its first bytes, NULL while they do not tell yet. It is
+    // asked once, the connection then goes straight to that protocol's
+    // hooks instead of the three above.
+    const jsonrpc_protocol_t *(*pf_select_protocol) ( jsonrpc_server_t *p_this,
+                                                      const block_t *p_req );
     void (*pf_on_client_connected) ( jsonrpc_server_t *p_this, int sockfd );
     void (*pf_on_client_closed) ( jsonrpc_server_t *p_this, int sockfd );
     void (*pf_on_processed) ( jsonrpc_server_t *p_this );
@@ -95,6 +293,19 @@ struct jsonrpc_server_t
                                  struct json_object *p_notify );
 };
 
+// the hooks of one wire protocol, see pf_select_protocol
+struct jsonrpc_protocol_t
+{
+    bool (*pf_request_IsComplete) ( jsonrpc_server_t *p_this, block_t *p_req,
+                                    size_t *pi_len );
+    int  (*pf_handle_handshake) ( jsonrpc_server_t *p_this,
+                                  jsonrpc_request_t *p_request );
+    int  (*pf_handle_request)   ( jsonrpc_server_t *p_this,
+                                  block_t *p_req, block_t *p_res );
+    block_t *(*pf_request_Text) ( jsonrpc_server_t *p_this,
+                                  const block_t *p_req );
+};
+
 // websocket jsonrpc server
 struct ws_jsonrpc_server_t
 {
@@ -112,21 +323,103 @@ struct JsonrpcPlusWs_server_t
 
     struct jsonrpc_server_t jsonBase;
     struct ws_jsonrpc_server_t wsBase;
+    jsonrpc_protocol_t json;                // their hooks
+    jsonrpc_protocol_t ws;
 };
 
 
 
 
+/* cancellation, a client gives up on a call with the notification
+ * { "jsonrpc": "2.0", "method": "$/cancelRequest", "params": { "id": <id> } }
+ * (JSONRPC_CANCEL_METHOD), which gets no response. A call still queued
+ * behind a streamed result is answered with a "request cancelled" error
+ * without running, an array stream being sent ends with that error (a raw
+ * one is cut and the connection closed). Handlers and pf_next run on the
+ * loop thread, a long one can poll jsonrpc_request_IsCancelled and return
+ * early, the call is then answered with the same error. The poll looks at
+ * what the client has sent since (what the loop holds, then one recv with
+ * MSG_PEEK), the calls queued behind it that it finds cancelled are
+ * answered like those behind a stream. On protocols whose messages are not
+ * json text (websocket) it decodes them with pf_request_Text.
+ */
+bool jsonrpc_request_IsCancelled( void );
+
+/* blobs, on unix listeners with conn.b_blobs a request starting with
+ * { "blobs": N, ... carries N sealed memfds (SCM_RIGHTS, see fdblob.h and
+ * jsonrpc_client_Blob) and its params refer to them as { "$blob": k }.
+ * A handler gets a read-only view of the one p_ref refers to, valid until
+ * it returns, or NULL. Such calls are neither cached nor coalesced.
+ */
+const uint8_t *jsonrpc_request_Blob( struct json_object *p_ref,
+                                     size_t *pi_size );
+
+/* the other way, i_fd (a sealed memfd, fdblob_Create) goes back with the
+ * response of the call being handled: put the returned { "$blob": k } in
+ * its result, the client maps it with jsonrpc_client_ResultBlob. i_fd is
+ * taken, closed once sent. Same connections as jsonrpc_request_Blob, such
+ * calls are not cached or coalesced either. NULL on error (i_fd closed).
+ */
+struct json_object *jsonrpc_request_ResultBlob( int i_fd );
+
+// pf_cache_invalidate of the server running the calling handler, a no-op
+// outside of handlers and pf_next
+void jsonrpc_cache_Invalidate( const char *psz_method,
+                               struct json_object *p_params );
+
 // notify_dispatch functions can use this to send notify
 int jsonrpc_request_sendResponse( jsonrpc_request_t *p_request,
                                   block_t *p_block );
 
-/* only support TCP and UNIX now,
- * if use TCP, set i_sock_flag as AF_INET or PF_INET, follows ip and port.
+// stream callbacks, i_kind is a jsonrpc_stream_kind. pf_close may be NULL.
+int  jsonrpc_stream_Begin( jsonrpc_stream_t *p_stream, int i_kind,
+                           pf_rpc_stream_next_t pf_next,
+                           void (*pf_close) ( void *p_opaque ),
+                           void *p_opaque );
+// fail the call with an error response instead of a result
+void jsonrpc_stream_Error( jsonrpc_stream_t *p_stream, const char *psz_error );
+// in pf_next. Element appends a copy of p_elem to an array stream, Write
+// and Sendfile append bytes to a raw stream. Sendfile sends i_count bytes
+// of i_fd from i_offset without copying them, it must be the last emit of
+// its pf_next call. They return -1 if the stream kind does not match.
+int  jsonrpc_stream_Element( jsonrpc_stream_t *p_stream,
+                             struct json_object *p_elem );
+int  jsonrpc_stream_Write( jsonrpc_stream_t *p_stream, const void *p_data,
+                           size_t i_data );
+int  jsonrpc_stream_Sendfile( jsonrpc_stream_t *p_stream, int i_fd,
+                              off_t i_offset, size_t i_count );
+
+/* support TCP and UNIX, any number of listeners can be added.
+ * if use TCP, set i_sock_flag as AF_INET or AF_INET6, follows host and port.
+ * AF_INET6 listeners are v6 only, add an AF_INET one on the same port to
+ * accept both.
  * if use UNIX, set i_sock_flag as AF_UNIX or PF_UNIX, follows file name.
  */
 int jsonrpc_server_init( jsonrpc_server_t *p_obj );
 int jsonrpc_server_addListener( jsonrpc_server_t *, int i_sock_flag, ... );
+// same as jsonrpc_server_addListener, p_opt may be NULL
+int jsonrpc_server_addListenerOpt( jsonrpc_server_t *,
+                                   const jsonrpc_listen_opt_t *p_opt,
+                                   int i_sock_flag, ... );
+
+/* zero-downtime upgrade.
+ * a serving server that called jsonrpc_server_listenUpgrade passes its
+ * listeners to the process calling jsonrpc_server_takeover on the same
+ * file, stops accepting, then passes each connection (with its buffered
+ * partial request) once it has no pending output, or closes it if
+ * b_handoff_conns is false. serve returns when every connection is gone
+ * or after UPGRADE_DRAIN_TIMEOUT.
+ * An inherited listener keeps its jsonrpc_listen_opt_t: the socket
+ * options are on it, its conn options come with the handoff.
+ * takeover returns the number of listeners inherited, 0 when no server is
+ * listening on psz_file (add listeners as usual then), -1 on error. The new
+ * process calls it before serve, then listenUpgrade for the next upgrade.
+ * The socket file is owner only and each side rejects a peer running as
+ * another user (SO_PEERCRED).
+ */
+int jsonrpc_server_listenUpgrade( jsonrpc_server_t *, const char *psz_file,
+                                  bool b_handoff_conns );
+int jsonrpc_server_takeover( jsonrpc_server_t *, const char *psz_file );
 
 int ws_jsonrpc_server_init( ws_jsonrpc_server_t *p_this );
 
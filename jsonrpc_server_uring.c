@@ -0,0 +1,760 @@
+// file : jsonrpc_server_uring.c
+// date : 2026-10-19
+// desc : the io_uring loop of jsonrpc_server_t (JSONRPC_BACKEND_URING),
+//        the same as serve_epoll on the shared part of the server, see
+//        jsonrpc_backend.h
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "jsonrpc_backend.h"
+#include "log.h"
+#include "block.h"
+#include "trace.h"
+#include "uring.h"
+#include "shmring.h"
+#include "fdblob.h"
+
+#define URING_ENTRIES 1024
+#define URING_BUFS 1024             // provided recv buffers, power of 2
+#define URING_BUF_SIZE 4096
+#define URING_BGID 0
+#define URING_EXIT_WAIT 100         // 10 ms rounds for in-flight io on exit
+
+enum uring_op
+{
+    UOP_CANCEL,                     // user_data is 0
+    UOP_ACCEPT,                     // user_data is listener index << 2
+    UOP_RECV,                       // user_data is uring_conn_t*
+    UOP_SEND,
+};
+#define UOP_MASK 3
+
+// per connection state of the io_uring loop, in p_request->p_backend
+typedef struct uring_conn_t uring_conn_t;
+typedef struct uring_msg_t
+{
+    struct msghdr msg;
+    struct iovec  iov;
+    union
+    {
+        struct cmsghdr align;
+        char buf[ FDBLOB_CONTROL ];
+    } control;
+    uint8_t p_buf[4096];
+} uring_msg_t;
+
+// sendmsg of a response carrying blobs
+typedef struct uring_smsg_t
+{
+    struct msghdr msg;
+    struct iovec  iov;
+    union
+    {
+        struct cmsghdr align;
+        char buf[ FDBLOB_CONTROL ];
+    } control;
+} uring_smsg_t;
+
+struct uring_conn_t
+{
+    jsonrpc_request_t *p_request;
+    block_t  *p_sending;            // p_out being sent, owned by the kernel
+    // until its cqe
+    size_t    i_sent;
+    int       i_inflight;           // submitted recv and send
+    bool      b_recv;               // multishot recv armed
+    bool      b_closing;
+    uring_msg_t *p_msg;             // recvmsg of a connection taking blobs,
+    // the provided buffers can not carry descriptors
+    uring_smsg_t *p_smsg;           // sendmsg of one giving blobs back
+};
+
+typedef struct uring_loop_t
+{
+    uring_t   ring;
+    jsonrpc_server_t *p_server;
+    hashmap   requestMap;
+    int       i_conns;
+    int       i_sparefd;
+    bool      b_stopping;
+} uring_loop_t;
+
+// loop served by this thread
+static __thread uring_loop_t *sg_p_loop = NULL;
+
+static void uring_close( uring_loop_t *p_loop, uring_conn_t *p_conn );
+
+static size_t uring_conn_mem( jsonrpc_request_t *p_request )
+{
+    uring_conn_t *p_conn = p_request->p_backend;
+    if ( !p_conn )
+        return 0;
+    return p_conn->p_sending->i_maxlen;
+}
+
+static size_t uring_conn_pending( jsonrpc_request_t *p_request )
+{
+    uring_conn_t *p_conn = p_request->p_backend;
+    if ( !p_conn )
+        return 0;
+    return p_conn->p_sending->i_buffer - p_conn->i_sent;
+}
+
+// the recv completions of p_request still in the queue: a handler runs
+// while the loop reaps, the ones after it wait. So do those the kernel
+// posts meanwhile without IORING_SETUP_DEFER_TASKRUN, the bytes are no
+// longer in the socket then.
+static size_t uring_conn_received( jsonrpc_request_t *p_request,
+                                   uint8_t *p_buf, size_t i_size )
+{
+    uring_loop_t *p_loop = sg_p_loop;
+    uring_conn_t *p_conn = p_request->p_backend;
+    if ( !p_loop || !p_conn || p_request->p_shm )
+        return 0;
+    uint64_t i_data = (uint64_t)(uintptr_t)p_conn | UOP_RECV;
+    size_t i_len = 0;
+    struct io_uring_cqe *p_cqe;
+    for ( unsigned i = 0; i_len < i_size &&
+          ( p_cqe = uring_PeekCqeAt( &p_loop->ring, i ) ); i++ )
+    {
+        if ( p_cqe->user_data != i_data || p_cqe->res <= 0 )
+            continue;
+        const uint8_t *p_data;
+        if ( p_cqe->flags & IORING_CQE_F_BUFFER )
+            p_data = uring_GetBuf( &p_loop->ring,
+                                   p_cqe->flags >> IORING_CQE_BUFFER_SHIFT );
+        else if ( p_conn->p_msg )
+            p_data = p_conn->p_msg->p_buf;
+        else
+            continue;
+        size_t i_copy = (size_t)p_cqe->res < i_size - i_len ?
+                        (size_t)p_cqe->res : i_size - i_len;
+        memcpy( p_buf + i_len, p_data, i_copy );
+        i_len += i_copy;
+    }
+    return i_len;
+}
+
+// free a closed connection once the kernel is done with its buffers
+static void uring_release( uring_loop_t *p_loop, uring_conn_t *p_conn )
+{
+    jsonrpc_request_t *p_request = p_conn->p_request;
+    if ( p_conn->i_inflight > 0 || p_request->b_queued )
+        return;
+    server_Release( p_request );
+    block_Release( p_conn->p_sending );
+    free( p_conn->p_msg );
+    free( p_conn->p_smsg );
+    free( p_conn );
+    p_loop->i_conns--;
+}
+
+static void uring_arm_accept( uring_loop_t *p_loop, int i_listener )
+{
+    struct io_uring_sqe *p_sqe = uring_GetSqe( &p_loop->ring );
+    if ( !p_sqe )
+    {
+        log_Err( "io_uring submit failed, listener %d stops accepting",
+                 i_listener );
+        return;
+    }
+    uring_PrepAcceptMultishot( p_sqe,
+                               p_loop->p_server->p_listeners[i_listener].i_fd,
+                               SOCK_NONBLOCK | SOCK_CLOEXEC,
+                               (uint64_t)i_listener << 2 | UOP_ACCEPT );
+}
+
+static void uring_arm_recv( uring_loop_t *p_loop, uring_conn_t *p_conn )
+{
+    struct io_uring_sqe *p_sqe = uring_GetSqe( &p_loop->ring );
+    if ( !p_sqe )
+    {
+        log_Err( "io_uring submit failed, close connection" );
+        uring_close( p_loop, p_conn );
+        return;
+    }
+    if ( p_conn->p_request->p_blobs )
+    {
+        if ( !p_conn->p_msg )
+            p_conn->p_msg = malloc( sizeof(uring_msg_t) );
+        if ( !p_conn->p_msg )
+        {
+            log_Err( "no memory %s %d", __FILE__, __LINE__ );
+            abort();
+        }
+        // one recvmsg at a time, armed again on its completion
+        uring_msg_t *p_msg = p_conn->p_msg;
+        memset( &p_msg->msg, 0, sizeof(p_msg->msg) );
+        p_msg->iov.iov_base = p_msg->p_buf;
+        p_msg->iov.iov_len = sizeof(p_msg->p_buf);
+        p_msg->msg.msg_iov = &p_msg->iov;
+        p_msg->msg.msg_iovlen = 1;
+        p_msg->msg.msg_control = p_msg->control.buf;
+        p_msg->msg.msg_controllen = sizeof(p_msg->control.buf);
+        uring_PrepRecvmsg( p_sqe, p_conn->p_request->i_sockfd, &p_msg->msg,
+                           MSG_CMSG_CLOEXEC,
+                           (uint64_t)(uintptr_t)p_conn | UOP_RECV );
+    }
+    else
+        uring_PrepRecvMultishot( p_sqe, p_conn->p_request->i_sockfd,
+                                 URING_BGID,
+                                 (uint64_t)(uintptr_t)p_conn | UOP_RECV );
+    p_conn->i_inflight++;
+    p_conn->b_recv = true;
+}
+
+// stop reading a paused connection, its recv ends with ECANCELED
+static void uring_cancel_recv( uring_loop_t *p_loop, uring_conn_t *p_conn )
+{
+    struct io_uring_sqe *p_sqe = uring_GetSqe( &p_loop->ring );
+    if ( !p_sqe )
+    {
+        log_Err( "io_uring submit failed, keep reading" );
+        return;
+    }
+    uring_PrepCancel( p_sqe, (uint64_t)(uintptr_t)p_conn | UOP_RECV,
+                      UOP_CANCEL );
+}
+
+static void uring_submit_send( uring_loop_t *p_loop, uring_conn_t *p_conn )
+{
+    struct io_uring_sqe *p_sqe = uring_GetSqe( &p_loop->ring );
+    if ( !p_sqe )
+    {
+        log_Err( "io_uring submit failed, close connection" );
+        uring_close( p_loop, p_conn );
+        return;
+    }
+    block_t *p_sending = p_conn->p_sending;
+    size_t i_chunk = p_sending->i_buffer - p_conn->i_sent;
+    const int *pi_fds;
+    int i_fds = 0;
+    // the blobs of a response go with its first byte, as in epoll_send
+    if ( p_conn->p_request->p_blobs )
+        i_chunk = fdblob_Next( p_conn->p_request->p_blobs, i_chunk,
+                               &pi_fds, &i_fds );
+    if ( i_fds > 0 )
+    {
+        if ( !p_conn->p_smsg )
+            p_conn->p_smsg = malloc( sizeof(uring_smsg_t) );
+        if ( !p_conn->p_smsg )
+        {
+            log_Err( "no memory %s %d", __FILE__, __LINE__ );
+            abort();
+        }
+        uring_smsg_t *p_smsg = p_conn->p_smsg;
+        memset( &p_smsg->msg, 0, sizeof(p_smsg->msg) );
+        p_smsg->iov.iov_base = p_sending->p_buffer + p_conn->i_sent;
+        p_smsg->iov.iov_len = i_chunk;
+        p_smsg->msg.msg_iov = &p_smsg->iov;
+        p_smsg->msg.msg_iovlen = 1;
+        p_smsg->msg.msg_control = p_smsg->control.buf;
+        p_smsg->msg.msg_controllen = CMSG_SPACE( sizeof(int) * i_fds );
+        struct cmsghdr *p_cmsg = CMSG_FIRSTHDR( &p_smsg->msg );
+        p_cmsg->cmsg_level = SOL_SOCKET;
+        p_cmsg->cmsg_type = SCM_RIGHTS;
+        p_cmsg->cmsg_len = CMSG_LEN( sizeof(int) * i_fds );
+        memcpy( CMSG_DATA( p_cmsg ), pi_fds, sizeof(int) * i_fds );
+        uring_PrepSendmsg( p_sqe, p_conn->p_request->i_sockfd, &p_smsg->msg,
+                           (uint64_t)(uintptr_t)p_conn | UOP_SEND );
+    }
+    else
+        uring_PrepSend( p_sqe, p_conn->p_request->i_sockfd,
+                        p_sending->p_buffer + p_conn->i_sent, i_chunk,
+                        (uint64_t)(uintptr_t)p_conn | UOP_SEND );
+    p_conn->i_inflight++;
+}
+
+// same as remove_connection, the socket is closed by uring_release
+static void uring_close( uring_loop_t *p_loop, uring_conn_t *p_conn )
+{
+    if ( p_conn->b_closing )
+        return;
+    p_conn->b_closing = true;
+
+    jsonrpc_request_t *p_request = p_conn->p_request;
+    server_Closing( p_loop->p_server, p_loop->requestMap, p_request );
+    // completes the pending recv and send
+    p_loop->p_server->stats.i_syscalls++;
+    shutdown( p_request->i_sockfd, SHUT_RDWR );
+    uring_release( p_loop, p_conn );
+}
+
+// submit the output queued during this iteration, one send per connection
+static void uring_flush( uring_loop_t *p_loop )
+{
+    // like epoll_flush, what gets queued meanwhile waits for the next
+    // iteration
+    jsonrpc_request_t *p_flush = server_TakeFlush();
+    while ( p_flush )
+    {
+        jsonrpc_request_t *p_request = p_flush;
+        uring_conn_t *p_conn = p_request->p_backend;
+        p_flush = p_request->p_next_flush;
+        p_request->b_queued = false;
+        if ( p_conn->b_closing )
+        {
+            uring_release( p_loop, p_conn );
+            continue;
+        }
+        if ( p_request->p_shm )
+        {
+            server_ShmSend( p_request );
+            if ( p_request->b_blocked )
+                continue;
+            if ( p_request->b_linger )
+                uring_close( p_loop, p_conn );
+            // room for more of a streamed result, or the held requests
+            else if ( p_request->p_stream || p_request->b_held )
+                server_ProcessRequests( p_loop->p_server, p_request );
+            continue;
+        }
+        // a send in flight queues it again on completion
+        if ( p_conn->p_sending->i_buffer != 0 )
+            continue;
+        if ( p_request->p_out->i_buffer == 0 )
+        {
+            if ( p_request->b_linger )
+                uring_close( p_loop, p_conn );
+            continue;
+        }
+
+        block_t *p_tmp = p_conn->p_sending;
+        p_conn->p_sending = p_request->p_out;
+        p_request->p_out = p_tmp;
+        p_conn->i_sent = 0;
+        uring_submit_send( p_loop, p_conn );
+    }
+}
+
+static void uring_on_accept( uring_loop_t *p_loop, int i_listener,
+                             int i_res, unsigned i_flags )
+{
+    jsonrpc_server_t *p_this = p_loop->p_server;
+    jsonrpc_listener_t *p_listener = &p_this->p_listeners[i_listener];
+    int i_lfd = p_listener->i_fd;
+
+    if ( i_res < 0 )
+    {
+        if ( ( i_res == -EMFILE || i_res == -ENFILE ) &&
+             p_loop->i_sparefd >= 0 )
+        {
+            log_Warn( "accept (%s), dropping connection", strerror(-i_res) );
+            close( p_loop->i_sparefd );
+            int connfd = accept( i_lfd, NULL, NULL );
+            if ( connfd >= 0 )
+                close( connfd );
+            p_loop->i_sparefd = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+        }
+        else if ( i_res == -EMFILE || i_res == -ENFILE )
+        {
+            // the error ended the multishot accept, uring_listen arms it
+            // again, see server_ListenPause
+            server_ListenPause( p_this );
+            p_listener->b_paused = true;
+            return;
+        }
+        else if ( i_res != -EINTR && i_res != -ECONNABORTED )
+            log_Err( "accept (%s)", strerror(-i_res) );
+    }
+    else if ( p_loop->b_stopping )
+        close( i_res );
+    else
+    {
+        int connfd = i_res;
+        TRACE_BEGIN( "accept", i_lfd );
+        uring_conn_t *p_conn = calloc( 1, sizeof(uring_conn_t) );
+        if ( p_conn )
+            p_conn->p_sending = block_Alloc( BLOCK_DEFAULT );
+        if ( !p_conn || !p_conn->p_sending )
+        {
+            log_Err( "no memory %s %d", __FILE__, __LINE__ );
+            abort();
+        }
+
+        // multishot accept has no per connection address
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof( addr );
+        memset( &addr, 0, sizeof(addr) );
+        p_this->stats.i_syscalls++;
+        getpeername( connfd, (struct sockaddr*)&addr, &addrlen );
+
+        jsonrpc_request_t *p_request =
+            server_Accepted( p_this, -1, p_loop->requestMap, connfd,
+                             p_listener, &addr );
+        if ( !p_request )
+        {
+            block_Release( p_conn->p_sending );
+            free( p_conn );
+            close( connfd );
+        }
+        else
+        {
+            p_conn->p_request = p_request;
+            p_request->p_backend = p_conn;
+            p_loop->i_conns++;
+            uring_arm_recv( p_loop, p_conn );
+        }
+        TRACE_END( "accept", i_lfd );
+    }
+
+    if ( !( i_flags & IORING_CQE_F_MORE ) && !p_loop->b_stopping )
+        uring_arm_accept( p_loop, i_listener );
+}
+
+static void uring_listen( uring_loop_t *p_loop )
+{
+    jsonrpc_server_t *p_this = p_loop->p_server;
+    if ( !server_ListenResume( p_this, &p_loop->i_sparefd ) )
+        return;
+    for ( int i = 0; i < p_this->i_listeners; i++ )
+    {
+        if ( !p_this->p_listeners[i].b_paused )
+            continue;
+        p_this->p_listeners[i].b_paused = false;
+        uring_arm_accept( p_loop, i );
+    }
+}
+
+static void uring_on_recv( uring_loop_t *p_loop, uring_conn_t *p_conn,
+                           int i_res, unsigned i_flags )
+{
+    jsonrpc_request_t *p_request = p_conn->p_request;
+    int fd = p_request->i_sockfd;
+    if ( !( i_flags & IORING_CQE_F_MORE ) )
+    {
+        p_conn->i_inflight--;
+        p_conn->b_recv = false;
+    }
+
+    if ( i_flags & IORING_CQE_F_BUFFER )
+    {
+        unsigned i_bid = i_flags >> IORING_CQE_BUFFER_SHIFT;
+        // doorbells on a shared memory connection
+        if ( i_res > 0 && !p_conn->b_closing && !p_request->p_shm )
+        {
+            TRACE_BEGIN( "process_read", fd );
+            p_request->p_req = block_Append( p_request->p_req,
+                                             uring_GetBuf( &p_loop->ring,
+                                                           i_bid ),
+                                             i_res );
+            if ( !p_request->p_req )
+            {
+                log_Err( "no memory %s %d", __FILE__, __LINE__ );
+                abort();
+            }
+            TRACE_END( "process_read", fd );
+        }
+        uring_RecycleBuf( &p_loop->ring, i_bid );
+    }
+    else if ( p_conn->p_msg && i_res > 0 && !p_conn->b_closing )
+    {
+        TRACE_BEGIN( "process_read", fd );
+        if ( fdblob_Collect( p_request->p_blobs, &p_conn->p_msg->msg ) < 0 )
+        {
+            uring_close( p_loop, p_conn );
+            return;
+        }
+        if ( !p_request->p_shm )
+            p_request->p_req = block_Append( p_request->p_req,
+                                             p_conn->p_msg->p_buf, i_res );
+        if ( !p_request->p_req )
+        {
+            log_Err( "no memory %s %d", __FILE__, __LINE__ );
+            abort();
+        }
+        TRACE_END( "process_read", fd );
+    }
+
+    if ( p_conn->b_closing )
+    {
+        uring_release( p_loop, p_conn );
+        return;
+    }
+    if ( i_res == 0 )
+    {
+        log_Dbg( "peer closed connection while read" );
+        // the last requests may be in the ring with no doorbell
+        if ( p_request->p_shm && p_request->i_state == CONN_HANDSHAKED )
+            server_ProcessRequests( p_loop->p_server, p_request );
+        uring_close( p_loop, p_conn );
+        return;
+    }
+    if ( i_res < 0 && i_res != -ENOBUFS && i_res != -ECANCELED )
+    {
+        log_Err( "read failed (%s), close connection", strerror(-i_res) );
+        uring_close( p_loop, p_conn );
+        return;
+    }
+
+    if ( i_res > 0 )
+    {
+        // drop notify request except handshake
+        if ( p_request->psz_protocol
+             && !strcasecmp( p_request->psz_protocol, "notify" )
+             && p_request->i_state == CONN_HANDSHAKED )
+        {
+            log_Warn( "drop notify request, notify should not "
+                      "send request" );
+            p_request->p_req->i_buffer = 0;
+        }
+        server_ProcessRequests( p_loop->p_server, p_request );
+        if ( p_conn->b_recv && server_MemPause( p_request ) )
+            uring_cancel_recv( p_loop, p_conn );
+    }
+
+    // ENOBUFS or the kernel ended the multishot recv
+    if ( !p_conn->b_recv && !p_conn->b_closing && !p_request->b_paused )
+        uring_arm_recv( p_loop, p_conn );
+}
+
+static void uring_on_send( uring_loop_t *p_loop, uring_conn_t *p_conn,
+                           int i_res )
+{
+    p_conn->i_inflight--;
+    if ( p_conn->b_closing )
+    {
+        uring_release( p_loop, p_conn );
+        return;
+    }
+    if ( i_res < 0 )
+    {
+        log_Err( "write failed (%s)", strerror(-i_res) );
+        uring_close( p_loop, p_conn );
+        return;
+    }
+
+    p_conn->i_sent += i_res;
+    if ( p_conn->p_request->p_blobs )
+        fdblob_Sent( p_conn->p_request->p_blobs, i_res );
+    if ( p_conn->i_sent < p_conn->p_sending->i_buffer )
+    {
+        uring_submit_send( p_loop, p_conn );
+        return;
+    }
+    p_conn->p_sending->i_buffer = 0;
+    p_conn->i_sent = 0;
+    if ( p_conn->p_sending->i_maxlen > BLOCK_KEEP )
+    {
+        block_Shrink( p_conn->p_sending, BLOCK_DEFAULT );
+        server_MemAccount( p_conn->p_request );
+    }
+    jsonrpc_request_t *p_request = p_conn->p_request;
+    // room for more of a streamed result, or the held requests
+    if ( p_request->p_stream || p_request->b_held )
+        server_ProcessRequests( p_loop->p_server, p_request );
+    if ( p_request->p_out->i_buffer != 0 || p_request->b_linger )
+        server_FlushLater( p_request );
+}
+
+static void uring_reap( uring_loop_t *p_loop )
+{
+    struct io_uring_cqe *p_cqe;
+    while ( (p_cqe = uring_PeekCqe( &p_loop->ring )) )
+    {
+        uint64_t i_data = p_cqe->user_data;
+        int i_res = p_cqe->res;
+        unsigned i_flags = p_cqe->flags;
+        uring_CqeSeen( &p_loop->ring );
+
+        uring_conn_t *p_conn =
+            (uring_conn_t*)(uintptr_t)( i_data & ~(uint64_t)UOP_MASK );
+        switch ( i_data & UOP_MASK )
+        {
+        case UOP_CANCEL:
+            break;
+        case UOP_ACCEPT:
+            uring_on_accept( p_loop, (int)( i_data >> 2 ), i_res, i_flags );
+            break;
+        case UOP_RECV:
+            uring_on_recv( p_loop, p_conn, i_res, i_flags );
+            break;
+        case UOP_SEND:
+            uring_on_send( p_loop, p_conn, i_res );
+            break;
+        }
+    }
+}
+
+static void uring_relieve( uring_loop_t *p_loop )
+{
+    jsonrpc_server_t *p_this = p_loop->p_server;
+    switch ( server_MemRelief( p_this ) )
+    {
+    case MEM_RESUME:
+    {
+        hashmap_iterator it = hashmap_iterate( p_loop->requestMap );
+        while ( hashmap_next( &it ) )
+        {
+            jsonrpc_request_t *p_request = it.p_val;
+            uring_conn_t *p_conn = p_request->p_backend;
+            if ( !p_request->b_paused )
+                continue;
+            p_request->b_paused = false;
+            p_this->i_paused--;
+            // else the cancel has not completed, its cqe re-arms
+            if ( !p_conn->b_recv )
+                uring_arm_recv( p_loop, p_conn );
+        }
+        break;
+    }
+    case MEM_SHED:
+    {
+        jsonrpc_request_t *p_request =
+            server_MemBiggestPaused( p_loop->requestMap );
+        log_Warn( "memory budget exceeded (%zu bytes), close %s (fd:%d, "
+                  "%zu bytes)", p_this->i_mem_used, p_request->psz_ip,
+                  p_request->i_sockfd, p_request->i_mem );
+        uring_close( p_loop, p_request->p_backend );
+        break;
+    }
+    }
+}
+
+static void uring_count_enters( uring_loop_t *p_loop )
+{
+    p_loop->p_server->stats.i_syscalls += p_loop->ring.i_enters;
+    p_loop->ring.i_enters = 0;
+}
+
+static int uring_loop_init( uring_loop_t *p_loop, jsonrpc_server_t *p_this )
+{
+    memset( p_loop, 0, sizeof(uring_loop_t) );
+    p_loop->p_server = p_this;
+    p_loop->i_sparefd = -1;
+
+    // single issuer is 6.0+, as multishot recv
+    int i_err = uring_Init( &p_loop->ring, URING_ENTRIES,
+                            IORING_SETUP_SINGLE_ISSUER |
+                            IORING_SETUP_DEFER_TASKRUN );
+    // without it recvs complete while a handler runs, see
+    // uring_conn_received
+    if ( i_err == -EINVAL )
+        i_err = uring_Init( &p_loop->ring, URING_ENTRIES,
+                            IORING_SETUP_SINGLE_ISSUER );
+    if ( i_err < 0 )
+        return i_err;
+    if ( !( p_loop->ring.i_features & IORING_FEAT_EXT_ARG ) )
+    {
+        uring_Clean( &p_loop->ring );
+        return -ENOSYS;
+    }
+    i_err = uring_SetupBufRing( &p_loop->ring, URING_BGID, URING_BUFS,
+                                URING_BUF_SIZE );
+    if ( i_err < 0 )
+    {
+        uring_Clean( &p_loop->ring );
+        return i_err;
+    }
+
+    p_loop->requestMap = hashmap_create( 101 );
+    p_loop->i_sparefd = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+    return 0;
+}
+
+static void uring_loop_clean( uring_loop_t *p_loop )
+{
+    hashmap_free( p_loop->requestMap );
+    uring_Clean( &p_loop->ring );
+    if ( p_loop->i_sparefd >= 0 )
+        close( p_loop->i_sparefd );
+}
+
+// the same loop as serve_epoll on io_uring: multishot accept and recv into
+// provided buffers, and the responses of an iteration submitted together
+// with the next wait, a busy connection costs no syscall per request
+static int serve_uring( uring_loop_t *p_loop )
+{
+    jsonrpc_server_t *p_this = p_loop->p_server;
+    for ( int i = 0; i < p_this->i_listeners; i++ )
+        uring_arm_accept( p_loop, i );
+
+    int i_ret = 0;
+    while ( !server_Aborted() )
+    {
+        TRACE_BEGIN( "io_uring_enter", 0 );
+        // no waiting with output queued
+        int i_err = uring_SubmitAndWait( &p_loop->ring,
+                                         server_HasFlush() ? 0 :
+                                         LOOP_TIMEOUT );
+        TRACE_END( "io_uring_enter", i_err );
+        if ( i_err < 0 && i_err != -ETIME && i_err != -EINTR &&
+             i_err != -EBUSY )
+        {
+            log_Err( "io_uring_enter failed (%s)", strerror(-i_err) );
+            i_ret = -1;
+            break;
+        }
+
+        uring_reap( p_loop );
+        server_Processed( p_this );
+        uring_relieve( p_loop );
+        uring_flush( p_loop );
+        uring_listen( p_loop );
+        uring_count_enters( p_loop );
+        p_this->stats.i_loops++;
+    }
+
+    log_Dbg( "serve() exited" );
+
+    // the kernel owns the recv and send buffers until their cqe, shut the
+    // connections down and wait for them
+    p_loop->b_stopping = true;
+    hashmap_iterator it = hashmap_iterate( p_loop->requestMap );
+    while ( hashmap_next( &it ) )
+    {
+        jsonrpc_request_t *p_request = it.p_val;
+        uring_conn_t *p_conn = p_request->p_backend;
+        p_conn->b_closing = true;
+        shutdown( p_request->i_sockfd, SHUT_RDWR );
+        server_FlushLater( p_request );
+    }
+    uring_flush( p_loop );
+    for ( int i = 0; i < URING_EXIT_WAIT && p_loop->i_conns > 0; i++ )
+    {
+        uring_SubmitAndWait( &p_loop->ring, 10 );
+        uring_reap( p_loop );
+        uring_flush( p_loop );
+    }
+    uring_count_enters( p_loop );
+    if ( p_loop->i_conns > 0 )
+        log_Warn( "%d connections still busy on exit", p_loop->i_conns );
+
+    return i_ret;
+}
+
+static int uring_serve( jsonrpc_server_t *p_this )
+{
+    if ( p_this->i_upgradesock != -1 || p_this->i_takeoverfd != -1 )
+    {
+        log_Warn( "io_uring backend has no upgrade handoff, use epoll" );
+        return BACKEND_FALLBACK;
+    }
+    uring_loop_t loop;
+    int i_err = uring_loop_init( &loop, p_this );
+    if ( i_err < 0 )
+    {
+        log_Warn( "io_uring unavailable (%s), use epoll", strerror(-i_err) );
+        return BACKEND_FALLBACK;
+    }
+    sg_p_loop = &loop;
+    int i_ret = serve_uring( &loop );
+    sg_p_loop = NULL;
+    uring_loop_clean( &loop );
+    return i_ret;
+}
+
+const jsonrpc_backend_t jsonrpc_backend_uring =
+{
+    .psz_name = "io_uring",
+    .pf_serve = uring_serve,
+    .pf_pending = uring_conn_pending,
+    .pf_mem = uring_conn_mem,
+    .pf_received = uring_conn_received,
+    .b_sendfile = false,
+};
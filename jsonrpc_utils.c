@@ -5,8 +5,11 @@
 //
 
 #include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <time.h>
 #include <json/json.h>
 #include "log.h"
 #include "common.h"
@@ -14,32 +17,275 @@
 
 
 
-bool json_request_IsComplete( block_t *p_req, size_t *pi_len )
+bool json_request_Scan( block_t *p_req, size_t *pi_scanned, int *pi_braces,
+                        size_t *pi_len )
 {
     if ( p_req->i_buffer >= MAX_REQUEST_LEN )
     {
-        log_Warn( "received request more than %d bytes, may be attacked" );
+        log_Warn( "received request more than %d bytes, may be attacked",
+                  MAX_REQUEST_LEN );
+        *pi_len = JSONRPC_OVERSIZE;
         return true;
     }
 
-    int i_braces = 0;
-    for ( int i = 0; i < p_req->i_buffer; i++ )
+    int i_braces = *pi_braces;
+    size_t i = *pi_scanned;
+    for ( ; i < p_req->i_buffer; i++ )
     {
         if ( p_req->p_buffer[i] == '{' )
             i_braces += 1;
         else if ( p_req->p_buffer[i] == '}' )
         {
+            // whether '\0' follows is not known yet, look again
+            if ( i + 1 == p_req->i_buffer )
+                break;
             i_braces -= 1;
             if ( i_braces == 0 && p_req->p_buffer[i + 1] == '\0' )
             {
                 *pi_len = i + 2;
+                *pi_scanned = 0;
+                *pi_braces = 0;
                 return true;
             }
         }
     }
+    *pi_scanned = i;
+    *pi_braces = i_braces;
     return false;
 }
 
+bool json_request_IsComplete( block_t *p_req, size_t *pi_len )
+{
+    size_t i_scanned = 0;
+    int i_braces = 0;
+    return json_request_Scan( p_req, &i_scanned, &i_braces, pi_len );
+}
+
+static const char *skip_space( const char *p, const char *p_end )
+{
+    while ( p < p_end && isspace( (unsigned char)*p ) )
+        p++;
+    return p;
+}
+
+// past the closing quote of the string opening at p, or NULL
+static const char *skip_string( const char *p, const char *p_end )
+{
+    for ( p++; p < p_end; p++ )
+    {
+        if ( *p == '\\' )
+            p++;
+        else if ( *p == '"' )
+            return p + 1;
+    }
+    return NULL;
+}
+
+// past the value starting at p, or NULL
+static const char *skip_value( const char *p, const char *p_end )
+{
+    int i_depth = 0;
+    while ( p < p_end )
+    {
+        if ( *p == '"' )
+        {
+            if ( !( p = skip_string( p, p_end ) ) )
+                return NULL;
+            if ( i_depth == 0 )
+                return p;
+            continue;
+        }
+        if ( *p == '{' || *p == '[' )
+            i_depth++;
+        else if ( *p == '}' || *p == ']' )
+        {
+            // a scalar ends the enclosing object
+            if ( i_depth == 0 )
+                return p;
+            if ( --i_depth == 0 )
+                return p + 1;
+        }
+        else if ( i_depth == 0 && ( *p == ',' || isspace( (unsigned char)*p ) ) )
+            return p;
+        p++;
+    }
+    return NULL;
+}
+
+const char *json_request_Member( const char *p_msg, size_t i_msg,
+                                 const char *psz_key, size_t *pi_val )
+{
+    const char *p = p_msg, *p_end = p_msg + i_msg;
+    size_t i_key = strlen( psz_key );
+    p = skip_space( p, p_end );
+    if ( p == p_end || *p != '{' )
+        return NULL;
+    p++;
+    while ( true )
+    {
+        // keys are compared as written, escapes are not decoded
+        p = skip_space( p, p_end );
+        if ( p == p_end || *p != '"' )
+            return NULL;
+        const char *p_key = p + 1;
+        if ( !( p = skip_string( p, p_end ) ) )
+            return NULL;
+        bool b_match = (size_t)( p - 1 - p_key ) == i_key &&
+                       !memcmp( p_key, psz_key, i_key );
+
+        p = skip_space( p, p_end );
+        if ( p == p_end || *p != ':' )
+            return NULL;
+        const char *p_val = skip_space( p + 1, p_end );
+        p = skip_value( p_val, p_end );
+        if ( !p || p == p_val )
+            return NULL;
+        if ( b_match )
+        {
+            *pi_val = p - p_val;
+            return p_val;
+        }
+
+        p = skip_space( p, p_end );
+        if ( p == p_end || *p != ',' )
+            return NULL;
+        p++;
+    }
+}
+
+typedef struct json_member_t
+{
+    const char *psz_key;
+    struct json_object *p_val;
+} json_member_t;
+
+static block_t *append( block_t *p_block, const char *psz, size_t i )
+{
+    if ( !p_block )
+        return NULL;
+    return block_Append( p_block, (uint8_t*)psz, i );
+}
+
+static block_t *append_json_string( block_t *p_block, const char *psz )
+{
+    p_block = append( p_block, "\"", 1 );
+    for ( const char *p = psz; p_block && *p; p++ )
+    {
+        char psz_esc[8];
+        if ( *p == '"' || *p == '\\' )
+        {
+            psz_esc[0] = '\\';
+            psz_esc[1] = *p;
+            p_block = append( p_block, psz_esc, 2 );
+        }
+        else if ( (unsigned char)*p < 0x20 )
+        {
+            snprintf( psz_esc, sizeof(psz_esc), "\\u%04x", *p );
+            p_block = append( p_block, psz_esc, 6 );
+        }
+        else
+            p_block = append( p_block, p, 1 );
+    }
+    return append( p_block, "\"", 1 );
+}
+
+static int compare_member( const void *p_a, const void *p_b )
+{
+    return strcmp( ((const json_member_t*)p_a)->psz_key,
+                   ((const json_member_t*)p_b)->psz_key );
+}
+
+// same value, same bytes: object members are sorted by key, whitespace
+// is dropped
+static block_t *append_canonical( block_t *p_block, struct json_object *p_obj )
+{
+    if ( !p_obj )
+        return append( p_block, "null", 4 );
+
+    if ( json_object_is_type( p_obj, json_type_array ) )
+    {
+        int i_array = json_object_array_length( p_obj );
+        p_block = append( p_block, "[", 1 );
+        for ( int i = 0; i < i_array; i++ )
+        {
+            if ( i > 0 )
+                p_block = append( p_block, ",", 1 );
+            p_block = append_canonical( p_block,
+                                        json_object_array_get_idx( p_obj, i ) );
+        }
+        return append( p_block, "]", 1 );
+    }
+    else if ( json_object_is_type( p_obj, json_type_object ) )
+    {
+        int i_members = 0;
+        json_object_object_foreach( p_obj, psz_k, p_v )
+        {
+            (void)psz_k; (void)p_v;
+            i_members++;
+        }
+        json_member_t *p_members = malloc( sizeof(json_member_t) *
+                                           (i_members + 1) );
+        if ( !p_members )
+        {
+            log_Err( "no memory" );
+            block_Release( p_block );
+            return NULL;
+        }
+        int i = 0;
+        json_object_object_foreach( p_obj, psz_key, p_val )
+        {
+            p_members[i].psz_key = psz_key;
+            p_members[i].p_val = p_val;
+            i++;
+        }
+        qsort( p_members, i_members, sizeof(json_member_t), compare_member );
+
+        p_block = append( p_block, "{", 1 );
+        for ( i = 0; i < i_members; i++ )
+        {
+            if ( i > 0 )
+                p_block = append( p_block, ",", 1 );
+            p_block = append_json_string( p_block, p_members[i].psz_key );
+            p_block = append( p_block, ":", 1 );
+            p_block = append_canonical( p_block, p_members[i].p_val );
+        }
+        free( p_members );
+        return append( p_block, "}", 1 );
+    }
+    else
+    {
+        const char *psz = json_object_to_json_string( p_obj );
+        return append( p_block, psz, strlen( psz ) );
+    }
+}
+
+block_t *json_call_key( block_t *p_key, const char *psz_method,
+                        struct json_object *p_params )
+{
+    if ( !p_key )
+        p_key = block_Alloc( 4096 );
+    if ( !p_key )
+    {
+        log_Err( "no memory" );
+        return NULL;
+    }
+    p_key->i_buffer = 0;
+    // "method\n" prefix lets a caller match every call of a method
+    p_key = append( p_key, psz_method, strlen( psz_method ) );
+    p_key = append( p_key, "\n", 1 );
+    p_key = append_canonical( p_key, p_params );
+    p_key = append( p_key, "", 1 );
+    if ( !p_key )
+        log_Err( "no memory" );
+    return p_key;
+}
+
+uint64_t jsonrpc_mdate( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
 
 void jsoncpy_bool( bool *p_bool, struct json_object *p_obj )
@@ -9,13 +9,47 @@
 
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <json/json.h>
 #include "block.h"
 
 #define MAX_REQUEST_LEN 100000000   // 100 M
 
 #define JSONRPC_ERR_NOMEM (-100)
 
+// notification cancelling the call whose id is in its params
+#define JSONRPC_CANCEL_METHOD "$/cancelRequest"
+
+// request member counting the memfds sent with it, first in the object,
+// and the params member referring to one of them (fdblob.h)
+#define JSONRPC_BLOBS_KEY "blobs"
+#define JSONRPC_BLOB_KEY "$blob"
+
+// *pi_len of a framing hook (pf_request_IsComplete) returning true for a
+// message over the size limit, as soon as it knows
+#define JSONRPC_OVERSIZE ((size_t)-1)
+
 bool json_request_IsComplete( block_t *p_req, size_t *pi_len );
+// json_request_IsComplete resuming where the last call stopped: the first
+// *pi_scanned bytes (at brace depth *pi_braces) are not looked at again.
+// Both start at 0 and are reset when a message is complete.
+bool json_request_Scan( block_t *p_req, size_t *pi_scanned, int *pi_braces,
+                        size_t *pi_len );
+
+// the value of the top level member psz_key of the json object p_msg (i_msg
+// bytes), found without parsing the rest: *pi_val bytes of json text at the
+// returned pointer, NULL when there is no such member or p_msg is malformed
+const char *json_request_Member( const char *p_msg, size_t i_msg,
+                                 const char *psz_key, size_t *pi_val );
+
+// "method\n" followed by a canonical serialization of params (object
+// members sorted by key, no whitespace), '\0' terminated. p_key is reused
+// (NULL allocates one), returns NULL and releases p_key when out of memory.
+block_t *json_call_key( block_t *p_key, const char *psz_method,
+                        struct json_object *p_params );
+
+// monotonic clock in microseconds
+uint64_t jsonrpc_mdate( void );
 
 void jsoncpy_bool( bool *p_bool, struct json_object *p_obj );
 void jsoncpy_double( double *p_double, struct json_object *p_obj );
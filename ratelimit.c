@@ -0,0 +1,161 @@
+// file : ratelimit.c
+// date : 2026-10-19
+// desc : token bucket rate limiting
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "ratelimit.h"
+#include "log.h"
+#include "common.h"
+
+#define RATELIMIT_PROBE 8           // slots examined per lookup
+
+// 12 bytes per slot so 100k sources fit in a few MB. Keys are not stored,
+// a 64-bit hash picks the slot (low bits) and is verified by its high 32
+// bits, two sources colliding on both just share a bucket.
+typedef struct ratelimit_slot_t
+{
+    uint32_t i_tag;                 // 0 means empty
+    float    f_tokens;
+    uint32_t i_last;                // milliseconds since p_limit->i_epoch
+} ratelimit_slot_t;
+
+struct ratelimit_t
+{
+    float    f_rate;                // tokens per millisecond
+    float    f_burst;
+    uint64_t i_epoch;
+    uint32_t i_mask;
+    ratelimit_slot_t *p_slots;
+};
+
+static uint64_t ratelimit_hash( const char *p_key, size_t i_key )
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for ( size_t i = 0; i < i_key; i++ )
+    {
+        h ^= (uint8_t)p_key[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+ratelimit_t *ratelimit_New( int i_sources, double f_rate, double f_burst )
+{
+    ratelimit_t *p_limit = malloc( sizeof(ratelimit_t) );
+    if ( !p_limit )
+    {
+        log_Err( "no memory" );
+        return NULL;
+    }
+
+    if ( i_sources < 1 )
+        i_sources = 1;
+    else if ( i_sources > RATELIMIT_MAX_SOURCES )
+        i_sources = RATELIMIT_MAX_SOURCES;
+    uint32_t i_slots = 1024;
+    while ( i_slots < (uint32_t)i_sources * 2 )
+        i_slots <<= 1;
+
+    p_limit->p_slots = calloc( i_slots, sizeof(ratelimit_slot_t) );
+    if ( !p_limit->p_slots )
+    {
+        log_Err( "no memory" );
+        free( p_limit );
+        return NULL;
+    }
+    p_limit->i_mask = i_slots - 1;
+    p_limit->f_rate = f_rate / 1000.0;
+    p_limit->f_burst = f_burst;
+    p_limit->i_epoch = 0;
+    return p_limit;
+}
+
+void ratelimit_Delete( ratelimit_t *p_limit )
+{
+    if ( !p_limit )
+        return;
+    free( p_limit->p_slots );
+    free( p_limit );
+}
+
+bool ratelimit_Take( ratelimit_t *p_limit, const char *p_key, size_t i_key,
+                     uint64_t i_now )
+{
+    if ( p_limit->i_epoch == 0 )
+        p_limit->i_epoch = i_now;
+    uint32_t i_ms = (uint32_t)((i_now - p_limit->i_epoch) / 1000);
+
+    uint64_t i_hash = ratelimit_hash( p_key, i_key );
+    uint32_t i_tag = (uint32_t)(i_hash >> 32) | 1;
+    uint32_t i_index = (uint32_t)i_hash & p_limit->i_mask;
+
+    ratelimit_slot_t *p_slot = NULL;
+    ratelimit_slot_t *p_stalest = NULL;
+    for ( int i = 0; i < RATELIMIT_PROBE; i++ )
+    {
+        ratelimit_slot_t *p_tmp =
+            &p_limit->p_slots[ (i_index + i) & p_limit->i_mask ];
+        if ( p_tmp->i_tag == i_tag )
+        {
+            p_slot = p_tmp;
+            break;
+        }
+        if ( p_tmp->i_tag == 0 )
+        {
+            p_stalest = p_tmp;
+            break;
+        }
+        if ( !p_stalest || p_tmp->i_last < p_stalest->i_last )
+            p_stalest = p_tmp;
+    }
+
+    if ( !p_slot )
+    {
+        // new source, or a source that got evicted: start with a full bucket
+        p_slot = p_stalest;
+        p_slot->i_tag = i_tag;
+        p_slot->f_tokens = p_limit->f_burst;
+        p_slot->i_last = i_ms;
+    }
+    else
+    {
+        p_slot->f_tokens += (i_ms - p_slot->i_last) * p_limit->f_rate;
+        if ( p_slot->f_tokens > p_limit->f_burst )
+            p_slot->f_tokens = p_limit->f_burst;
+        p_slot->i_last = i_ms;
+    }
+
+    if ( p_slot->f_tokens < 1.0f )
+        return false;
+    p_slot->f_tokens -= 1.0f;
+    return true;
+}
+
+void ratelimit_bucket_Init( ratelimit_bucket_t *p_bucket, double f_rate,
+                            double f_burst )
+{
+    p_bucket->f_rate = f_rate;
+    p_bucket->f_burst = f_burst;
+    p_bucket->f_tokens = f_burst;
+    p_bucket->i_last = 0;
+}
+
+bool ratelimit_bucket_Take( ratelimit_bucket_t *p_bucket, uint64_t i_now )
+{
+    if ( p_bucket->i_last != 0 )
+    {
+        p_bucket->f_tokens += (i_now - p_bucket->i_last) *
+                              p_bucket->f_rate / 1000000.0;
+        if ( p_bucket->f_tokens > p_bucket->f_burst )
+            p_bucket->f_tokens = p_bucket->f_burst;
+    }
+    p_bucket->i_last = i_now;
+
+    if ( p_bucket->f_tokens < 1.0 )
+        return false;
+    p_bucket->f_tokens -= 1.0;
+    return true;
+}
@@ -0,0 +1,41 @@
+// file : ratelimit.h
+// date : 2026-10-19
+// desc : token bucket rate limiting, a compact open-addressing table of
+//        buckets keyed by an arbitrary byte string (client ip), and single
+//        buckets for per-method limits.
+//
+
+#ifndef JSONRPC_RATELIMIT_H
+#define JSONRPC_RATELIMIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct ratelimit_t ratelimit_t;
+typedef struct ratelimit_bucket_t ratelimit_bucket_t;
+
+struct ratelimit_bucket_t
+{
+    double   f_rate;                // tokens per second
+    double   f_burst;               // bucket capacity
+    double   f_tokens;
+    uint64_t i_last;                // last refill, in microseconds
+};
+
+#define RATELIMIT_MAX_SOURCES (1 << 22)  // a table of 96 MB
+
+// i_sources is the expected number of distinct keys, the table is sized to
+// twice that (12 bytes per slot, at most RATELIMIT_MAX_SOURCES) and recycles
+// the stalest slot when full.
+ratelimit_t *ratelimit_New( int i_sources, double f_rate, double f_burst );
+void         ratelimit_Delete( ratelimit_t *p_limit );
+// take one token for key, return false if the caller is over limit
+bool         ratelimit_Take( ratelimit_t *p_limit, const char *p_key,
+                             size_t i_key, uint64_t i_now );
+
+void ratelimit_bucket_Init( ratelimit_bucket_t *p_bucket, double f_rate,
+                            double f_burst );
+bool ratelimit_bucket_Take( ratelimit_bucket_t *p_bucket, uint64_t i_now );
+
+#endif
@@ -0,0 +1,223 @@
+// file : rescache.c
+// date : 2026-10-19
+// desc : cache of serialized responses
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rescache.h"
+#include "hashmap.h"
+#include "block.h"
+#include "jsonrpc_utils.h"
+#include "log.h"
+#include "common.h"
+
+typedef struct rescache_entry_t rescache_entry_t;
+
+struct rescache_entry_t
+{
+    char     *psz_key;
+    uint8_t  *p_data;
+    size_t    i_data;
+    uint64_t  i_expire;
+    rescache_entry_t *p_prev;       // lru list, head is the most recent
+    rescache_entry_t *p_next;
+};
+
+struct rescache_t
+{
+    hashmap   entryMap;             // key is psz_key, value is entry
+    rescache_entry_t *p_head;
+    rescache_entry_t *p_tail;
+    size_t    i_bytes;
+    size_t    i_max_bytes;
+    block_t  *p_key;                // scratch for rescache_MakeKey
+};
+
+static size_t entry_size( rescache_entry_t *p_entry )
+{
+    return sizeof(rescache_entry_t) + strlen( p_entry->psz_key ) + 1 +
+           p_entry->i_data;
+}
+
+static void lru_unlink( rescache_t *p_cache, rescache_entry_t *p_entry )
+{
+    if ( p_entry->p_prev )
+        p_entry->p_prev->p_next = p_entry->p_next;
+    else
+        p_cache->p_head = p_entry->p_next;
+    if ( p_entry->p_next )
+        p_entry->p_next->p_prev = p_entry->p_prev;
+    else
+        p_cache->p_tail = p_entry->p_prev;
+    p_entry->p_prev = p_entry->p_next = NULL;
+}
+
+static void lru_push_front( rescache_t *p_cache, rescache_entry_t *p_entry )
+{
+    p_entry->p_prev = NULL;
+    p_entry->p_next = p_cache->p_head;
+    if ( p_cache->p_head )
+        p_cache->p_head->p_prev = p_entry;
+    p_cache->p_head = p_entry;
+    if ( !p_cache->p_tail )
+        p_cache->p_tail = p_entry;
+}
+
+static void entry_remove( rescache_t *p_cache, rescache_entry_t *p_entry )
+{
+    hashmap_key_t key;
+    key.type = 'c';
+    key.u.psz_string = p_entry->psz_key;
+    hashmap_pop( p_cache->entryMap, key, NULL );
+    lru_unlink( p_cache, p_entry );
+    p_cache->i_bytes -= entry_size( p_entry );
+    free( p_entry->psz_key );
+    free( p_entry->p_data );
+    free( p_entry );
+}
+
+rescache_t *rescache_New( size_t i_max_bytes )
+{
+    rescache_t *p_cache = malloc( sizeof(rescache_t) );
+    if ( !p_cache )
+    {
+        log_Err( "no memory" );
+        return NULL;
+    }
+    p_cache->entryMap = hashmap_create( 1021 );
+    p_cache->p_key = block_Alloc( 4096 );
+    if ( !p_cache->entryMap || !p_cache->p_key )
+    {
+        log_Err( "no memory" );
+        if ( p_cache->entryMap )
+            hashmap_free( p_cache->entryMap );
+        if ( p_cache->p_key )
+            block_Release( p_cache->p_key );
+        free( p_cache );
+        return NULL;
+    }
+    p_cache->p_head = p_cache->p_tail = NULL;
+    p_cache->i_bytes = 0;
+    p_cache->i_max_bytes = i_max_bytes;
+    return p_cache;
+}
+
+void rescache_Delete( rescache_t *p_cache )
+{
+    if ( !p_cache )
+        return;
+    while ( p_cache->p_head )
+        entry_remove( p_cache, p_cache->p_head );
+    hashmap_free( p_cache->entryMap );
+    block_Release( p_cache->p_key );
+    free( p_cache );
+}
+
+const char *rescache_MakeKey( rescache_t *p_cache, const char *psz_method,
+                              struct json_object *p_params )
+{
+    p_cache->p_key = json_call_key( p_cache->p_key, psz_method, p_params );
+    return p_cache->p_key ? (const char*)p_cache->p_key->p_buffer : NULL;
+}
+
+const uint8_t *rescache_Get( rescache_t *p_cache, const char *psz_key,
+                             size_t *pi_data, uint64_t i_now )
+{
+    hashmap_key_t key;
+    key.type = 'c';
+    key.u.psz_string = psz_key;
+    rescache_entry_t *p_entry = hashmap_get( p_cache->entryMap, key );
+    if ( !p_entry )
+        return NULL;
+    if ( p_entry->i_expire <= i_now )
+    {
+        entry_remove( p_cache, p_entry );
+        return NULL;
+    }
+
+    lru_unlink( p_cache, p_entry );
+    lru_push_front( p_cache, p_entry );
+    *pi_data = p_entry->i_data;
+    return p_entry->p_data;
+}
+
+int rescache_Put( rescache_t *p_cache, const char *psz_key,
+                  const uint8_t *p_data, size_t i_data, uint64_t i_expire )
+{
+    hashmap_key_t key;
+    key.type = 'c';
+    key.u.psz_string = psz_key;
+    rescache_entry_t *p_entry = hashmap_get( p_cache->entryMap, key );
+    if ( p_entry )
+        entry_remove( p_cache, p_entry );
+
+    p_entry = malloc( sizeof(rescache_entry_t) );
+    if ( !p_entry )
+    {
+        log_Err( "no memory" );
+        return JSONRPC_ERR_NOMEM;
+    }
+    p_entry->psz_key = strdup( psz_key );
+    p_entry->p_data = malloc( i_data );
+    if ( !p_entry->psz_key || !p_entry->p_data )
+    {
+        log_Err( "no memory" );
+        free( p_entry->psz_key );
+        free( p_entry->p_data );
+        free( p_entry );
+        return JSONRPC_ERR_NOMEM;
+    }
+    memcpy( p_entry->p_data, p_data, i_data );
+    p_entry->i_data = i_data;
+    p_entry->i_expire = i_expire;
+
+    size_t i_size = entry_size( p_entry );
+    if ( i_size > p_cache->i_max_bytes )
+    {
+        // would evict everything else and still not fit
+        free( p_entry->psz_key );
+        free( p_entry->p_data );
+        free( p_entry );
+        return -1;
+    }
+    while ( p_cache->i_bytes + i_size > p_cache->i_max_bytes )
+        entry_remove( p_cache, p_cache->p_tail );
+
+    key.u.psz_string = p_entry->psz_key;
+    hashmap_put( p_cache->entryMap, key, p_entry );
+    lru_push_front( p_cache, p_entry );
+    p_cache->i_bytes += i_size;
+    return 0;
+}
+
+void rescache_Invalidate( rescache_t *p_cache, const char *psz_method,
+                          struct json_object *p_params )
+{
+    if ( p_params )
+    {
+        const char *psz_key = rescache_MakeKey( p_cache, psz_method,
+                                                p_params );
+        if ( !psz_key )
+            return;
+        hashmap_key_t key;
+        key.type = 'c';
+        key.u.psz_string = psz_key;
+        rescache_entry_t *p_entry = hashmap_get( p_cache->entryMap, key );
+        if ( p_entry )
+            entry_remove( p_cache, p_entry );
+        return;
+    }
+
+    size_t i_method = strlen( psz_method );
+    rescache_entry_t *p_entry = p_cache->p_head;
+    while ( p_entry )
+    {
+        rescache_entry_t *p_next = p_entry->p_next;
+        if ( !strncmp( p_entry->psz_key, psz_method, i_method ) &&
+             p_entry->psz_key[ i_method ] == '\n' )
+            entry_remove( p_cache, p_entry );
+        p_entry = p_next;
+    }
+}
@@ -0,0 +1,35 @@
+// file : rescache.h
+// date : 2026-10-19
+// desc : cache of serialized responses keyed by method + canonicalized
+//        params, with ttl and lru eviction bounded by bytes.
+//
+
+#ifndef JSONRPC_RESCACHE_H
+#define JSONRPC_RESCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <json/json.h>
+
+typedef struct rescache_t rescache_t;
+
+rescache_t *rescache_New( size_t i_max_bytes );
+void        rescache_Delete( rescache_t *p_cache );
+
+// build the key of a call into the cache's scratch buffer, the returned
+// string is valid until the next rescache_MakeKey
+const char *rescache_MakeKey( rescache_t *p_cache, const char *psz_method,
+                              struct json_object *p_params );
+
+// return the cached bytes for psz_key or NULL if absent or expired, the
+// pointer is valid until the next rescache_Put or rescache_Invalidate
+const uint8_t *rescache_Get( rescache_t *p_cache, const char *psz_key,
+                             size_t *pi_data, uint64_t i_now );
+int  rescache_Put( rescache_t *p_cache, const char *psz_key,
+                   const uint8_t *p_data, size_t i_data, uint64_t i_expire );
+
+// drop one call (p_params not NULL) or every cached call of a method
+void rescache_Invalidate( rescache_t *p_cache, const char *psz_method,
+                          struct json_object *p_params );
+
+#endif
@@ -0,0 +1,320 @@
+// file : shmring.c
+// date : 2026-10-19
+// desc : shared memory transport for unix socket connections
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shmring.h"
+#include "log.h"
+#include "common.h"
+
+#define SHM_HEADER 4096             // both ring headers, then the data
+
+// head and tail count bytes modulo 2^32, the sizes are powers of 2. The
+// waiting flags and the positions are a Dekker pair: a side stores its
+// flag then rereads the position, the other side stores the position then
+// reads the flag, both with a full barrier in between, so one of them sees
+// the other.
+struct shmring_t
+{
+    uint32_t i_head;                        // read, written by the consumer
+    uint8_t  pad0[60];
+    uint32_t i_tail;                        // written, by the producer
+    uint8_t  pad1[60];
+    uint32_t b_read_wait;                   // consumer waits for i_tail
+    uint32_t b_write_wait;                  // producer waits for i_head
+    uint32_t i_size;
+    uint8_t  pad2[52];
+};
+
+static int futex( uint32_t *p_word, int i_op, uint32_t i_val,
+                  const struct timespec *p_timeout )
+{
+    return syscall( SYS_futex, p_word, i_op, i_val, p_timeout, NULL, 0 );
+}
+
+static int shm_map( shm_t *p_shm, int i_memfd, size_t i_map, bool b_server )
+{
+    p_shm->p_map = mmap( NULL, i_map, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         i_memfd, 0 );
+    if ( p_shm->p_map == MAP_FAILED )
+    {
+        log_Err( "shm mmap failed (%s)", strerror( errno ) );
+        p_shm->p_map = NULL;
+        return -1;
+    }
+    p_shm->i_map = i_map;
+    // the first ring goes from client to server
+    shmring_t *p_c2s = (shmring_t*)p_shm->p_map;
+    shmring_t *p_s2c = p_c2s + 1;
+    uint8_t *p_c2s_data = p_shm->p_map + SHM_HEADER;
+    uint8_t *p_s2c_data = p_c2s_data + p_shm->i_size;
+    p_shm->p_rx = b_server ? p_c2s : p_s2c;
+    p_shm->p_tx = b_server ? p_s2c : p_c2s;
+    p_shm->p_rx_data = b_server ? p_c2s_data : p_s2c_data;
+    p_shm->p_tx_data = b_server ? p_s2c_data : p_c2s_data;
+    return 0;
+}
+
+int shm_Create( shm_t *p_shm, size_t i_size, int *pi_memfd )
+{
+    memset( p_shm, 0, sizeof(shm_t) );
+    p_shm->i_doorbell = -1;
+    uint32_t i_ring = SHM_RING_MIN;
+    while ( i_ring < i_size && i_ring < SHM_RING_MAX )
+        i_ring *= 2;
+    p_shm->i_size = i_ring;
+
+    int i_memfd = memfd_create( "jsonrpc-shm", MFD_CLOEXEC );
+    if ( i_memfd < 0 )
+    {
+        log_Err( "memfd_create failed (%s)", strerror( errno ) );
+        return -1;
+    }
+    size_t i_map = SHM_HEADER + 2 * (size_t)i_ring;
+    if ( ftruncate( i_memfd, i_map ) < 0 )
+    {
+        log_Err( "shm ftruncate failed (%s)", strerror( errno ) );
+        close( i_memfd );
+        return -1;
+    }
+    if ( shm_map( p_shm, i_memfd, i_map, true ) < 0 )
+    {
+        close( i_memfd );
+        return -1;
+    }
+    // a fresh memfd reads as zeroes
+    p_shm->p_rx->i_size = i_ring;
+    p_shm->p_tx->i_size = i_ring;
+    // armed from the start, the first request rings the doorbell
+    p_shm->p_rx->b_read_wait = 1;
+    *pi_memfd = i_memfd;
+    return 0;
+}
+
+int shm_Attach( shm_t *p_shm, int i_memfd, int i_doorbell )
+{
+    memset( p_shm, 0, sizeof(shm_t) );
+    p_shm->i_doorbell = i_doorbell;
+    struct stat st;
+    if ( fstat( i_memfd, &st ) < 0 || st.st_size < SHM_HEADER )
+    {
+        log_Err( "shm memfd is not usable" );
+        return -1;
+    }
+    shmring_t header;
+    if ( pread( i_memfd, &header, sizeof(header), 0 ) != sizeof(header) ||
+         header.i_size < SHM_RING_MIN || header.i_size > SHM_RING_MAX ||
+         ( header.i_size & ( header.i_size - 1 ) ) ||
+         (size_t)st.st_size != SHM_HEADER + 2 * (size_t)header.i_size )
+    {
+        log_Err( "shm memfd has a bad header" );
+        return -1;
+    }
+    p_shm->i_size = header.i_size;
+    return shm_map( p_shm, i_memfd, st.st_size, false );
+}
+
+void shm_Release( shm_t *p_shm )
+{
+    if ( p_shm->p_map )
+        munmap( p_shm->p_map, p_shm->i_map );
+    p_shm->p_map = NULL;
+}
+
+// the peer armed a wakeup on p_flag, take it and wake it up
+static void shm_wake( shm_t *p_shm, uint32_t *p_flag, uint32_t *p_word )
+{
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if ( !__atomic_load_n( p_flag, __ATOMIC_RELAXED ) ||
+         !__atomic_exchange_n( p_flag, 0, __ATOMIC_SEQ_CST ) )
+        return;
+    if ( p_shm->i_doorbell >= 0 )
+    {
+        char c = 0;
+        send( p_shm->i_doorbell, &c, 1, MSG_NOSIGNAL | MSG_DONTWAIT );
+    }
+    else
+        futex( p_word, FUTEX_WAKE, 1, NULL );
+}
+
+size_t shm_Write( shm_t *p_shm, const uint8_t *p_data, size_t i_data )
+{
+    shmring_t *p_ring = p_shm->p_tx;
+    uint32_t i_mask = p_shm->i_size - 1;
+    uint32_t i_tail = p_ring->i_tail;
+    uint32_t i_head = __atomic_load_n( &p_ring->i_head, __ATOMIC_ACQUIRE );
+    uint32_t i_used = i_tail - i_head;
+    // a peer writing garbage in the positions only hurts itself
+    size_t i_room = i_used > p_shm->i_size ? 0 : p_shm->i_size - i_used;
+    size_t i_copy = i_data < i_room ? i_data : i_room;
+    if ( i_copy == 0 )
+        return 0;
+
+    size_t i_offset = i_tail & i_mask;
+    size_t i_first = p_shm->i_size - i_offset;
+    if ( i_first > i_copy )
+        i_first = i_copy;
+    memcpy( p_shm->p_tx_data + i_offset, p_data, i_first );
+    memcpy( p_shm->p_tx_data, p_data + i_first, i_copy - i_first );
+    __atomic_store_n( &p_ring->i_tail, i_tail + i_copy, __ATOMIC_RELEASE );
+    shm_wake( p_shm, &p_ring->b_read_wait, &p_ring->i_tail );
+    return i_copy;
+}
+
+size_t shm_Readable( shm_t *p_shm )
+{
+    shmring_t *p_ring = p_shm->p_rx;
+    uint32_t i_used = __atomic_load_n( &p_ring->i_tail, __ATOMIC_ACQUIRE ) -
+                      p_ring->i_head;
+    return i_used > p_shm->i_size ? 0 : i_used;
+}
+
+size_t shm_Read( shm_t *p_shm, uint8_t *p_data, size_t i_data )
+{
+    shmring_t *p_ring = p_shm->p_rx;
+    uint32_t i_mask = p_shm->i_size - 1;
+    uint32_t i_head = p_ring->i_head;
+    size_t i_copy = shm_Readable( p_shm );
+    if ( i_copy > i_data )
+        i_copy = i_data;
+    if ( i_copy == 0 )
+        return 0;
+
+    size_t i_offset = i_head & i_mask;
+    size_t i_first = p_shm->i_size - i_offset;
+    if ( i_first > i_copy )
+        i_first = i_copy;
+    memcpy( p_data, p_shm->p_rx_data + i_offset, i_first );
+    memcpy( p_data + i_first, p_shm->p_rx_data, i_copy - i_first );
+    __atomic_store_n( &p_ring->i_head, i_head + i_copy, __ATOMIC_RELEASE );
+    shm_wake( p_shm, &p_ring->b_write_wait, &p_ring->i_head );
+    return i_copy;
+}
+
+// the ring and position a side waits on
+static shmring_t *shm_waited( shm_t *p_shm, bool b_write, uint32_t **pp_flag,
+                              uint32_t **pp_word )
+{
+    shmring_t *p_ring = b_write ? p_shm->p_tx : p_shm->p_rx;
+    *pp_flag = b_write ? &p_ring->b_write_wait : &p_ring->b_read_wait;
+    *pp_word = b_write ? &p_ring->i_head : &p_ring->i_tail;
+    return p_ring;
+}
+
+static bool shm_ready( shm_t *p_shm, bool b_write )
+{
+    if ( !b_write )
+        return shm_Readable( p_shm ) > 0;
+    shmring_t *p_ring = p_shm->p_tx;
+    return p_ring->i_tail -
+           __atomic_load_n( &p_ring->i_head, __ATOMIC_ACQUIRE ) <
+           p_shm->i_size;
+}
+
+bool shm_Arm( shm_t *p_shm, bool b_write )
+{
+    uint32_t *p_flag, *p_word;
+    shm_waited( p_shm, b_write, &p_flag, &p_word );
+    __atomic_store_n( p_flag, 1, __ATOMIC_SEQ_CST );
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if ( !shm_ready( p_shm, b_write ) )
+        return true;
+    // the peer may have taken it already, its wakeup is then spurious
+    __atomic_store_n( p_flag, 0, __ATOMIC_RELAXED );
+    return false;
+}
+
+int shm_Wait( shm_t *p_shm, bool b_write, int i_timeout )
+{
+    uint32_t *p_flag, *p_word;
+    shm_waited( p_shm, b_write, &p_flag, &p_word );
+    uint32_t i_seen = __atomic_load_n( p_word, __ATOMIC_ACQUIRE );
+    if ( !shm_Arm( p_shm, b_write ) )
+        return 0;
+    struct timespec ts;
+    ts.tv_sec = i_timeout / 1000000;
+    ts.tv_nsec = (long)( i_timeout % 1000000 ) * 1000;
+    // returns at once if the word moved since i_seen
+    int i_ret = futex( p_word, FUTEX_WAIT, i_seen, &ts );
+    __atomic_store_n( p_flag, 0, __ATOMIC_RELAXED );
+    if ( shm_ready( p_shm, b_write ) )
+        return 0;
+    return i_ret < 0 && errno == ETIMEDOUT ? -1 : 0;
+}
+
+int shm_SendFd( int i_sock, const void *p_data, size_t i_data, int i_fd )
+{
+    struct iovec iov;
+    iov.iov_base = (void*)p_data;
+    iov.iov_len = i_data;
+
+    union
+    {
+        struct cmsghdr align;
+        char buf[ CMSG_SPACE(sizeof(int)) ];
+    } control;
+
+    struct msghdr msg;
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if ( i_fd >= 0 )
+    {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *p_cmsg = CMSG_FIRSTHDR( &msg );
+        p_cmsg->cmsg_level = SOL_SOCKET;
+        p_cmsg->cmsg_type = SCM_RIGHTS;
+        p_cmsg->cmsg_len = CMSG_LEN( sizeof(int) );
+        memcpy( CMSG_DATA( p_cmsg ), &i_fd, sizeof(int) );
+    }
+    ssize_t i_ret;
+    while ( ( i_ret = sendmsg( i_sock, &msg, MSG_NOSIGNAL ) ) < 0 &&
+            errno == EINTR )
+        ;
+    return i_ret == (ssize_t)i_data ? 0 : -1;
+}
+
+int shm_RecvFd( int i_sock, void *p_data, size_t i_data, int *pi_fd )
+{
+    struct iovec iov;
+    iov.iov_base = p_data;
+    iov.iov_len = i_data;
+
+    union
+    {
+        struct cmsghdr align;
+        char buf[ CMSG_SPACE(sizeof(int)) ];
+    } control;
+
+    struct msghdr msg;
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    *pi_fd = -1;
+    ssize_t i_ret;
+    while ( ( i_ret = recvmsg( i_sock, &msg, MSG_CMSG_CLOEXEC ) ) < 0 &&
+            errno == EINTR )
+        ;
+    if ( i_ret < 0 )
+        return -1;
+    struct cmsghdr *p_cmsg = CMSG_FIRSTHDR( &msg );
+    if ( p_cmsg && p_cmsg->cmsg_level == SOL_SOCKET &&
+         p_cmsg->cmsg_type == SCM_RIGHTS &&
+         p_cmsg->cmsg_len == CMSG_LEN( sizeof(int) ) )
+        memcpy( pi_fd, CMSG_DATA( p_cmsg ), sizeof(int) );
+    return i_ret;
+}
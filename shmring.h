@@ -0,0 +1,62 @@
+// file : shmring.h
+// date : 2026-10-19
+// desc : shared memory transport for unix socket connections. A memfd holds
+//        one single producer single consumer byte ring per direction, the
+//        messages keep their '\0' framing. The socket stays open, it
+//        carries the memfd (SCM_RIGHTS) in the handshake, then the doorbell
+//        bytes of the client waking an idle server, and the close. The
+//        server wakes an idle client with a futex on the ring.
+//
+
+#ifndef JSONRPC_SHMRING_H
+#define JSONRPC_SHMRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SHM_RING_MIN 4096
+#define SHM_RING_MAX (64 * 1024 * 1024)
+
+typedef struct shmring_t shmring_t;         // shared, one per direction
+
+typedef struct shm_t
+{
+    uint8_t   *p_map;
+    size_t     i_map;
+    shmring_t *p_rx;                        // read by this side
+    shmring_t *p_tx;                        // written by this side
+    uint8_t   *p_rx_data;
+    uint8_t   *p_tx_data;
+    uint32_t   i_size;                      // bytes of each ring
+    int        i_doorbell;                  // client: the socket, a byte
+    // on it wakes the server. Server: -1, it wakes the client by futex.
+} shm_t;
+
+// server side, rings of i_size bytes rounded up to a power of 2 within
+// SHM_RING_MIN and SHM_RING_MAX. *pi_memfd is for the client, closed by
+// the caller once sent.
+int    shm_Create( shm_t *p_shm, size_t i_size, int *pi_memfd );
+// client side, maps the memfd received in the handshake
+int    shm_Attach( shm_t *p_shm, int i_memfd, int i_doorbell );
+void   shm_Release( shm_t *p_shm );
+
+// copy what fits or what there is, waking the peer if it waits for it
+size_t shm_Write( shm_t *p_shm, const uint8_t *p_data, size_t i_data );
+size_t shm_Read( shm_t *p_shm, uint8_t *p_data, size_t i_data );
+size_t shm_Readable( shm_t *p_shm );
+
+// going idle, b_write: on a full ring, else on an empty one. The peer
+// wakes this side on its next Read or Write, false when that already
+// happened meanwhile (nothing armed, carry on).
+bool   shm_Arm( shm_t *p_shm, bool b_write );
+// client side, sleep until armed and woken or i_timeout us (0 when woken
+// or the condition already holds, -1 on timeout)
+int    shm_Wait( shm_t *p_shm, bool b_write, int i_timeout );
+
+// sendmsg / recvmsg with one descriptor attached (-1 for none), *pi_fd is
+// -1 when none came
+int    shm_SendFd( int i_sock, const void *p_data, size_t i_data, int i_fd );
+int    shm_RecvFd( int i_sock, void *p_data, size_t i_data, int *pi_fd );
+
+#endif
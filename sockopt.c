@@ -0,0 +1,136 @@
+// file : sockopt.c
+// date : 2026-10-19
+// desc : options of connected sockets
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "sockopt.h"
+#include "log.h"
+#include "common.h"
+
+static int set_int( int i_fd, int i_level, int i_name, int i_val,
+                    const char *psz_name )
+{
+    if ( setsockopt( i_fd, i_level, i_name, &i_val, sizeof(int) ) < 0 )
+    {
+        log_Err( "set socket %s failed (%s)", psz_name, strerror( errno ) );
+        return -1;
+    }
+    return 0;
+}
+
+int sockopt_Apply( int i_fd, int i_family, const jsonrpc_sockopt_t *p_opt )
+{
+    if ( p_opt->i_sndbuf > 0 &&
+         set_int( i_fd, SOL_SOCKET, SO_SNDBUF, p_opt->i_sndbuf,
+                  "SO_SNDBUF" ) < 0 )
+        return -1;
+    if ( p_opt->i_rcvbuf > 0 &&
+         set_int( i_fd, SOL_SOCKET, SO_RCVBUF, p_opt->i_rcvbuf,
+                  "SO_RCVBUF" ) < 0 )
+        return -1;
+
+    if ( i_family != AF_INET && i_family != AF_INET6 )
+        return 0;
+
+    if ( p_opt->b_nodelay &&
+         set_int( i_fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY" ) < 0 )
+        return -1;
+    if ( p_opt->b_quickack &&
+         set_int( i_fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK" ) < 0 )
+        return -1;
+    if ( p_opt->i_user_timeout > 0 &&
+         set_int( i_fd, IPPROTO_TCP, TCP_USER_TIMEOUT, p_opt->i_user_timeout,
+                  "TCP_USER_TIMEOUT" ) < 0 )
+        return -1;
+    if ( p_opt->i_keepalive_idle > 0 )
+    {
+        if ( set_int( i_fd, SOL_SOCKET, SO_KEEPALIVE, 1,
+                      "SO_KEEPALIVE" ) < 0 ||
+             set_int( i_fd, IPPROTO_TCP, TCP_KEEPIDLE,
+                      p_opt->i_keepalive_idle, "TCP_KEEPIDLE" ) < 0 )
+            return -1;
+        if ( p_opt->i_keepalive_interval > 0 &&
+             set_int( i_fd, IPPROTO_TCP, TCP_KEEPINTVL,
+                      p_opt->i_keepalive_interval, "TCP_KEEPINTVL" ) < 0 )
+            return -1;
+        if ( p_opt->i_keepalive_count > 0 &&
+             set_int( i_fd, IPPROTO_TCP, TCP_KEEPCNT,
+                      p_opt->i_keepalive_count, "TCP_KEEPCNT" ) < 0 )
+            return -1;
+    }
+    return 0;
+}
+
+#define SOCKOPT_INT( name, field ) \
+    { name, offsetof(jsonrpc_sockopt_t, field), false }
+#define SOCKOPT_BOOL( name, field ) \
+    { name, offsetof(jsonrpc_sockopt_t, field), true }
+
+static const struct
+{
+    const char *psz_name;
+    size_t      i_offset;
+    bool        b_bool;
+} sg_fields[] =
+{
+    SOCKOPT_BOOL( "nodelay", b_nodelay ),
+    SOCKOPT_BOOL( "quickack", b_quickack ),
+    SOCKOPT_INT( "sndbuf", i_sndbuf ),
+    SOCKOPT_INT( "rcvbuf", i_rcvbuf ),
+    SOCKOPT_INT( "user_timeout", i_user_timeout ),
+    SOCKOPT_INT( "keepalive_idle", i_keepalive_idle ),
+    SOCKOPT_INT( "keepalive_interval", i_keepalive_interval ),
+    SOCKOPT_INT( "keepalive_count", i_keepalive_count ),
+    SOCKOPT_INT( "shm_ring", i_shm_ring ),
+    SOCKOPT_BOOL( "blobs", b_blobs ),
+};
+#define SOCKOPT_FIELDS ( sizeof(sg_fields) / sizeof(sg_fields[0]) )
+
+int sockopt_Format( const jsonrpc_sockopt_t *p_opt, char *psz, size_t i_size )
+{
+    size_t i_len = 0;
+    for ( size_t i = 0; i < SOCKOPT_FIELDS; i++ )
+    {
+        const char *p_field = (const char*)p_opt + sg_fields[i].i_offset;
+        int i_val = sg_fields[i].b_bool ? *(const bool*)p_field :
+                                          *(const int*)p_field;
+        int i_ret = snprintf( psz + i_len, i_size - i_len, "%s%s=%d",
+                              i ? " " : "", sg_fields[i].psz_name, i_val );
+        if ( i_ret < 0 || (size_t)i_ret >= i_size - i_len )
+            return -1;
+        i_len += i_ret;
+    }
+    return i_len;
+}
+
+void sockopt_Parse( jsonrpc_sockopt_t *p_opt, const char *psz )
+{
+    while ( *psz )
+    {
+        size_t i_pair = strcspn( psz, " " );
+        const char *p_eq = memchr( psz, '=', i_pair );
+        for ( size_t i = 0; p_eq && i < SOCKOPT_FIELDS; i++ )
+        {
+            if ( strlen( sg_fields[i].psz_name ) != (size_t)( p_eq - psz ) ||
+                 strncmp( sg_fields[i].psz_name, psz, p_eq - psz ) )
+                continue;
+            char *p_field = (char*)p_opt + sg_fields[i].i_offset;
+            int i_val = atoi( p_eq + 1 );
+            if ( sg_fields[i].b_bool )
+                *(bool*)p_field = i_val != 0;
+            else
+                *(int*)p_field = i_val;
+            break;
+        }
+        psz += i_pair;
+        psz += strspn( psz, " " );
+    }
+}
@@ -0,0 +1,45 @@
+// file : sockopt.h
+// date : 2026-10-19
+// desc : options of connected sockets, applied by the server to accepted
+//        connections and by the client at connect time.
+//
+
+#ifndef JSONRPC_SOCKOPT_H
+#define JSONRPC_SOCKOPT_H
+
+#include <stdbool.h>
+
+// 0 or false keeps the system default, tcp only options are skipped on
+// unix sockets
+typedef struct jsonrpc_sockopt_t
+{
+    bool b_nodelay;                         // TCP_NODELAY, small messages
+    // are sent at once instead of waiting for the previous one's ack
+    bool b_quickack;                        // TCP_QUICKACK, not sticky: the
+    // kernel may go back to delayed acks later
+    int  i_sndbuf;                          // SO_SNDBUF, bytes
+    int  i_rcvbuf;                          // SO_RCVBUF, bytes
+    int  i_user_timeout;                    // TCP_USER_TIMEOUT, ms that
+    // sent data may stay unacked before the connection is dropped
+    int  i_keepalive_idle;                  // SO_KEEPALIVE after this many
+    // idle seconds (TCP_KEEPIDLE)
+    int  i_keepalive_interval;              // TCP_KEEPINTVL, seconds
+    int  i_keepalive_count;                 // TCP_KEEPCNT, unanswered probes
+    int  i_shm_ring;                        // unix only, bytes of each
+    // shared memory ring (shmring.h): the client asks for it in the
+    // handshake, a listener grants up to its own
+    bool b_blobs;                           // unix listeners only, take
+    // requests carrying memfd blobs (fdblob.h)
+} jsonrpc_sockopt_t;
+
+// return -1 on the first option that fails
+int sockopt_Apply( int i_fd, int i_family, const jsonrpc_sockopt_t *p_opt );
+
+// as "name=value" pairs separated by spaces, to pass them to another
+// process (handoff.h). Format returns the length, -1 if i_size is too
+// small. Parse sets the options it knows and keeps the others.
+#define SOCKOPT_FORMAT_MAX 256
+int  sockopt_Format( const jsonrpc_sockopt_t *p_opt, char *psz, size_t i_size );
+void sockopt_Parse( jsonrpc_sockopt_t *p_opt, const char *psz );
+
+#endif
@@ -0,0 +1,228 @@
+// file : trace.c
+// date : 2026-10-19
+// desc : low-overhead event-loop phase tracing
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "trace.h"
+#include "log.h"
+#include "common.h"
+
+typedef struct trace_event_t
+{
+    uint64_t    i_tsc;
+    const char *psz_name;
+    int32_t     i_arg;
+    char        c_phase;            // 'B' or 'E'
+} trace_event_t;
+
+typedef struct trace_ring_t
+{
+    pid_t    i_tid;
+    uint64_t i_head;                // total events ever written
+    struct trace_ring_t *p_next;
+    trace_event_t events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+volatile bool g_b_trace_enabled = false;
+
+static volatile sig_atomic_t sg_b_dump_requested = 0;
+static unsigned sg_i_dumps = 0;
+// SIGUSR2 as it was before tracing took it
+static struct sigaction sg_old_usr2;
+static bool sg_b_usr2 = false;
+static pthread_mutex_t sg_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring_t *sg_p_rings = NULL;
+static __thread trace_ring_t *sg_p_ring = NULL;
+
+// tsc <-> wall clock calibration point, taken when tracing is enabled
+static uint64_t sg_i_tsc0;
+static uint64_t sg_i_ns0;
+
+static inline uint64_t trace_tsc( void )
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    __asm__ __volatile__ ( "rdtsc" : "=a"(lo), "=d"(hi) );
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static uint64_t trace_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static trace_ring_t *trace_ring_get( void )
+{
+    if ( sg_p_ring )
+        return sg_p_ring;
+
+    trace_ring_t *p_ring = calloc( 1, sizeof(trace_ring_t) );
+    if ( !p_ring )
+    {
+        log_Err( "no memory" );
+        return NULL;
+    }
+    p_ring->i_tid = (pid_t)syscall( SYS_gettid );
+
+    pthread_mutex_lock( &sg_lock );
+    p_ring->p_next = sg_p_rings;
+    sg_p_rings = p_ring;
+    pthread_mutex_unlock( &sg_lock );
+
+    sg_p_ring = p_ring;
+    return p_ring;
+}
+
+static inline void trace_record( const char *psz_name, int i_arg, char c_phase )
+{
+    trace_ring_t *p_ring = trace_ring_get();
+    if ( !p_ring )
+        return;
+
+    trace_event_t *p_ev =
+        &p_ring->events[ p_ring->i_head & (TRACE_RING_SIZE - 1) ];
+    p_ev->i_tsc = trace_tsc();
+    p_ev->psz_name = psz_name;
+    p_ev->i_arg = i_arg;
+    p_ev->c_phase = c_phase;
+    p_ring->i_head++;
+}
+
+void trace_Begin( const char *psz_name, int i_arg )
+{
+    trace_record( psz_name, i_arg, 'B' );
+}
+
+void trace_End( const char *psz_name, int i_arg )
+{
+    trace_record( psz_name, i_arg, 'E' );
+}
+
+static void trace_signal( int signum )
+{
+    trace_RequestDump();
+}
+
+void trace_Enable( bool b_enable )
+{
+    if ( b_enable && !g_b_trace_enabled )
+    {
+        sg_i_ns0 = trace_ns();
+        sg_i_tsc0 = trace_tsc();
+    }
+    g_b_trace_enabled = b_enable;
+
+    // SIGUSR2 is ours only while tracing
+    if ( b_enable && !sg_b_usr2 )
+    {
+        struct sigaction sa;
+        memset( &sa, 0, sizeof(sa) );
+        sa.sa_handler = trace_signal;
+        sigemptyset( &sa.sa_mask );
+        sa.sa_flags = SA_RESTART;
+        if ( sigaction( SIGUSR2, &sa, &sg_old_usr2 ) == 0 )
+            sg_b_usr2 = true;
+    }
+    else if ( !b_enable && sg_b_usr2 )
+    {
+        sigaction( SIGUSR2, &sg_old_usr2, NULL );
+        sg_b_usr2 = false;
+    }
+}
+
+int trace_Dump( const char *psz_file )
+{
+    // a new file only, never through a link someone else put there
+    int i_fd = open( psz_file,
+                     O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                     0600 );
+    FILE *p_file = i_fd < 0 ? NULL : fdopen( i_fd, "w" );
+    if ( !p_file )
+    {
+        log_Err( "open trace file %s failed (%s)", psz_file, strerror(errno) );
+        if ( i_fd >= 0 )
+            close( i_fd );
+        return -1;
+    }
+
+    // ticks per nanosecond since tracing was enabled
+    double f_ticks_per_ns = 1.0;
+    uint64_t i_ns = trace_ns() - sg_i_ns0;
+    uint64_t i_tsc = trace_tsc() - sg_i_tsc0;
+    if ( i_ns > 0 && i_tsc > 0 )
+        f_ticks_per_ns = (double)i_tsc / i_ns;
+
+    pid_t i_pid = getpid();
+    bool b_first = true;
+    fprintf( p_file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n" );
+
+    pthread_mutex_lock( &sg_lock );
+    for ( trace_ring_t *p_ring = sg_p_rings; p_ring; p_ring = p_ring->p_next )
+    {
+        uint64_t i_head = p_ring->i_head;
+        uint64_t i_start = i_head > TRACE_RING_SIZE ?
+                           i_head - TRACE_RING_SIZE : 0;
+        for ( uint64_t i = i_start; i < i_head; i++ )
+        {
+            trace_event_t *p_ev = &p_ring->events[ i & (TRACE_RING_SIZE - 1) ];
+            // events recorded before the last calibration point
+            if ( p_ev->i_tsc < sg_i_tsc0 )
+                continue;
+            double f_us = (p_ev->i_tsc - sg_i_tsc0) / f_ticks_per_ns / 1000.0;
+            fprintf( p_file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                     "\"pid\":%d,\"tid\":%d,\"args\":{\"arg\":%d}}",
+                     b_first ? "" : ",\n", p_ev->psz_name, p_ev->c_phase,
+                     f_us, (int)i_pid, (int)p_ring->i_tid, p_ev->i_arg );
+            b_first = false;
+        }
+    }
+    pthread_mutex_unlock( &sg_lock );
+
+    fprintf( p_file, "\n]}\n" );
+    fclose( p_file );
+    return 0;
+}
+
+void trace_RequestDump( void )
+{
+    sg_b_dump_requested = 1;
+}
+
+void trace_DumpIfRequested( void )
+{
+    if ( !sg_b_dump_requested )
+        return;
+    sg_b_dump_requested = 0;
+
+    const char *psz_dir = getenv( "TMPDIR" );
+    if ( !psz_dir || !*psz_dir )
+        psz_dir = "/tmp";
+    char psz_file[PATH_MAX];
+    if ( snprintf( psz_file, sizeof(psz_file), "%s/jsonrpc_trace.%d.%u.json",
+                   psz_dir, (int)getpid(), sg_i_dumps++ ) >=
+         (int)sizeof(psz_file) )
+    {
+        log_Err( "trace directory %s is too long", psz_dir );
+        return;
+    }
+    if ( trace_Dump( psz_file ) == 0 )
+        log_Warn( "trace dumped to %s", psz_file );
+}
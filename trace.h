@@ -0,0 +1,44 @@
+// file : trace.h
+// date : 2026-10-19
+// desc : low-overhead event-loop phase tracing, each thread records
+//        timestamped begin/end events into its own ring buffer, the rings
+//        can be dumped as Chrome trace-event JSON (chrome://tracing or
+//        ui.perfetto.dev).
+//
+
+#ifndef JSONRPC_TRACE_H
+#define JSONRPC_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_RING_SIZE 65536       // events per thread, must be power of 2
+
+extern volatile bool g_b_trace_enabled;
+
+// psz_name must be a string literal (or live as long as the process), only
+// the pointer is recorded.
+void trace_Begin( const char *psz_name, int i_arg );
+void trace_End( const char *psz_name, int i_arg );
+
+// while enabled, SIGUSR2 requests a dump (trace_RequestDump). Disabling
+// gives SIGUSR2 back its previous handler.
+void trace_Enable( bool b_enable );
+
+// write all rings to psz_file in Chrome trace-event format, psz_file is
+// created (0600) and must not exist yet
+int  trace_Dump( const char *psz_file );
+
+// async-signal-safe, ask the event loop to dump at the end of its iteration
+void trace_RequestDump( void );
+// called by the event loop, dump to $TMPDIR (or /tmp)
+// /jsonrpc_trace.<pid>.<n>.json if a dump was requested, n counts the dumps
+void trace_DumpIfRequested( void );
+
+// disabled tracing costs one predictable branch
+#define TRACE_BEGIN( name, arg ) \
+    do { if ( g_b_trace_enabled ) trace_Begin( name, arg ); } while ( 0 )
+#define TRACE_END( name, arg ) \
+    do { if ( g_b_trace_enabled ) trace_End( name, arg ); } while ( 0 )
+
+#endif
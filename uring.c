@@ -0,0 +1,316 @@
+// file : uring.c
+// date : 2026-10-19
+// desc : minimal io_uring wrapper on the raw syscalls
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "uring.h"
+#include "log.h"
+#include "common.h"
+
+static int sys_setup( unsigned i_entries, struct io_uring_params *p_params )
+{
+    return (int)syscall( __NR_io_uring_setup, i_entries, p_params );
+}
+
+static int sys_enter( int i_fd, unsigned i_submit, unsigned i_wait,
+                      unsigned i_flags, void *p_arg, size_t i_arg )
+{
+    return (int)syscall( __NR_io_uring_enter, i_fd, i_submit, i_wait, i_flags,
+                         p_arg, i_arg );
+}
+
+static int sys_register( int i_fd, unsigned i_opcode, void *p_arg,
+                         unsigned i_args )
+{
+    return (int)syscall( __NR_io_uring_register, i_fd, i_opcode, p_arg,
+                         i_args );
+}
+
+int uring_Init( uring_t *p_ring, unsigned i_entries, unsigned i_flags )
+{
+    memset( p_ring, 0, sizeof(uring_t) );
+    p_ring->i_fd = -1;
+
+    struct io_uring_params params;
+    memset( &params, 0, sizeof(params) );
+    params.flags = i_flags | IORING_SETUP_CQSIZE;
+    params.cq_entries = i_entries * 4;
+    int i_fd = sys_setup( i_entries, &params );
+    if ( i_fd < 0 )
+        return -errno;
+    p_ring->i_fd = i_fd;
+    p_ring->i_features = params.features;
+
+    p_ring->i_sq_ring_size = params.sq_off.array +
+                             params.sq_entries * sizeof(unsigned);
+    p_ring->i_cq_ring_size = params.cq_off.cqes +
+                             params.cq_entries * sizeof(struct io_uring_cqe);
+    if ( params.features & IORING_FEAT_SINGLE_MMAP )
+    {
+        if ( p_ring->i_cq_ring_size > p_ring->i_sq_ring_size )
+            p_ring->i_sq_ring_size = p_ring->i_cq_ring_size;
+        p_ring->i_cq_ring_size = p_ring->i_sq_ring_size;
+    }
+
+    p_ring->p_sq_ring = mmap( NULL, p_ring->i_sq_ring_size,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, i_fd,
+                              IORING_OFF_SQ_RING );
+    if ( p_ring->p_sq_ring == MAP_FAILED )
+        goto error;
+    if ( params.features & IORING_FEAT_SINGLE_MMAP )
+        p_ring->p_cq_ring = p_ring->p_sq_ring;
+    else
+    {
+        p_ring->p_cq_ring = mmap( NULL, p_ring->i_cq_ring_size,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, i_fd,
+                                  IORING_OFF_CQ_RING );
+        if ( p_ring->p_cq_ring == MAP_FAILED )
+            goto error;
+    }
+    p_ring->i_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    p_ring->p_sqes = mmap( NULL, p_ring->i_sqes_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, i_fd, IORING_OFF_SQES );
+    if ( p_ring->p_sqes == MAP_FAILED )
+        goto error;
+
+    uint8_t *p_sq = p_ring->p_sq_ring;
+    p_ring->p_sq_head = (unsigned*)(p_sq + params.sq_off.head);
+    p_ring->p_sq_tail = (unsigned*)(p_sq + params.sq_off.tail);
+    p_ring->i_sq_mask = *(unsigned*)(p_sq + params.sq_off.ring_mask);
+    p_ring->i_sq_tail = *p_ring->p_sq_tail;
+    unsigned *p_array = (unsigned*)(p_sq + params.sq_off.array);
+    for ( unsigned i = 0; i < params.sq_entries; i++ )
+        p_array[i] = i;
+
+    uint8_t *p_cq = p_ring->p_cq_ring;
+    p_ring->p_cq_head = (unsigned*)(p_cq + params.cq_off.head);
+    p_ring->p_cq_tail = (unsigned*)(p_cq + params.cq_off.tail);
+    p_ring->i_cq_mask = *(unsigned*)(p_cq + params.cq_off.ring_mask);
+    p_ring->p_cqes = (struct io_uring_cqe*)(p_cq + params.cq_off.cqes);
+    return 0;
+
+error:
+    {
+        int i_err = -errno;
+        uring_Clean( p_ring );
+        return i_err;
+    }
+}
+
+void uring_Clean( uring_t *p_ring )
+{
+    if ( p_ring->p_br )
+    {
+        struct io_uring_buf_reg reg;
+        memset( &reg, 0, sizeof(reg) );
+        reg.bgid = p_ring->i_bgid;
+        sys_register( p_ring->i_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1 );
+        munmap( p_ring->p_br, p_ring->i_br_size );
+        free( p_ring->p_bufs );
+    }
+    if ( p_ring->p_sqes && p_ring->p_sqes != MAP_FAILED )
+        munmap( p_ring->p_sqes, p_ring->i_sqes_size );
+    if ( p_ring->p_cq_ring && p_ring->p_cq_ring != MAP_FAILED &&
+         p_ring->p_cq_ring != p_ring->p_sq_ring )
+        munmap( p_ring->p_cq_ring, p_ring->i_cq_ring_size );
+    if ( p_ring->p_sq_ring && p_ring->p_sq_ring != MAP_FAILED )
+        munmap( p_ring->p_sq_ring, p_ring->i_sq_ring_size );
+    if ( p_ring->i_fd >= 0 )
+        close( p_ring->i_fd );
+    memset( p_ring, 0, sizeof(uring_t) );
+    p_ring->i_fd = -1;
+}
+
+static int uring_Submit( uring_t *p_ring, unsigned i_wait, unsigned i_flags,
+                         void *p_arg, size_t i_arg )
+{
+    unsigned i_submit = p_ring->i_sq_tail - *p_ring->p_sq_head;
+    __atomic_store_n( p_ring->p_sq_tail, p_ring->i_sq_tail, __ATOMIC_RELEASE );
+    p_ring->i_enters++;
+    int i_ret = sys_enter( p_ring->i_fd, i_submit, i_wait, i_flags,
+                           p_arg, i_arg );
+    return i_ret < 0 ? -errno : i_ret;
+}
+
+struct io_uring_sqe *uring_GetSqe( uring_t *p_ring )
+{
+    unsigned i_head = __atomic_load_n( p_ring->p_sq_head, __ATOMIC_ACQUIRE );
+    if ( p_ring->i_sq_tail - i_head > p_ring->i_sq_mask )
+    {
+        // full, the kernel consumes sqes synchronously on submit
+        if ( uring_Submit( p_ring, 0, 0, NULL, 0 ) < 0 )
+            return NULL;
+    }
+    struct io_uring_sqe *p_sqe =
+        &p_ring->p_sqes[ p_ring->i_sq_tail & p_ring->i_sq_mask ];
+    memset( p_sqe, 0, sizeof(*p_sqe) );
+    p_ring->i_sq_tail++;
+    return p_sqe;
+}
+
+int uring_SubmitAndWait( uring_t *p_ring, int i_timeout_ms )
+{
+    struct __kernel_timespec ts;
+    ts.tv_sec = i_timeout_ms / 1000;
+    ts.tv_nsec = (long long)( i_timeout_ms % 1000 ) * 1000000;
+    struct io_uring_getevents_arg arg;
+    memset( &arg, 0, sizeof(arg) );
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    return uring_Submit( p_ring, 1,
+                         IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                         &arg, sizeof(arg) );
+}
+
+struct io_uring_cqe *uring_PeekCqe( uring_t *p_ring )
+{
+    unsigned i_head = *p_ring->p_cq_head;
+    if ( i_head == __atomic_load_n( p_ring->p_cq_tail, __ATOMIC_ACQUIRE ) )
+        return NULL;
+    return &p_ring->p_cqes[ i_head & p_ring->i_cq_mask ];
+}
+
+struct io_uring_cqe *uring_PeekCqeAt( uring_t *p_ring, unsigned i )
+{
+    unsigned i_head = *p_ring->p_cq_head;
+    unsigned i_tail = __atomic_load_n( p_ring->p_cq_tail, __ATOMIC_ACQUIRE );
+    if ( i >= i_tail - i_head )
+        return NULL;
+    return &p_ring->p_cqes[ ( i_head + i ) & p_ring->i_cq_mask ];
+}
+
+void uring_CqeSeen( uring_t *p_ring )
+{
+    __atomic_store_n( p_ring->p_cq_head, *p_ring->p_cq_head + 1,
+                      __ATOMIC_RELEASE );
+}
+
+int uring_SetupBufRing( uring_t *p_ring, uint16_t i_bgid, unsigned i_bufs,
+                        unsigned i_size )
+{
+    size_t i_br_size = i_bufs * sizeof(struct io_uring_buf);
+    void *p_br = mmap( NULL, i_br_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( p_br == MAP_FAILED )
+        return -errno;
+    uint8_t *p_bufs = malloc( (size_t)i_bufs * i_size );
+    if ( !p_bufs )
+    {
+        log_Err( "no memory" );
+        munmap( p_br, i_br_size );
+        return -ENOMEM;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset( &reg, 0, sizeof(reg) );
+    reg.ring_addr = (uint64_t)(uintptr_t)p_br;
+    reg.ring_entries = i_bufs;
+    reg.bgid = i_bgid;
+    if ( sys_register( p_ring->i_fd, IORING_REGISTER_PBUF_RING, &reg, 1 ) < 0 )
+    {
+        int i_err = -errno;
+        free( p_bufs );
+        munmap( p_br, i_br_size );
+        return i_err;
+    }
+
+    p_ring->p_br = p_br;
+    p_ring->i_br_size = i_br_size;
+    p_ring->i_bgid = i_bgid;
+    p_ring->i_br_tail = 0;
+    p_ring->i_br_mask = i_bufs - 1;
+    p_ring->p_bufs = p_bufs;
+    p_ring->i_buf_size = i_size;
+    for ( unsigned i = 0; i < i_bufs; i++ )
+        uring_RecycleBuf( p_ring, i );
+    return 0;
+}
+
+uint8_t *uring_GetBuf( uring_t *p_ring, unsigned i_bid )
+{
+    return p_ring->p_bufs + (size_t)i_bid * p_ring->i_buf_size;
+}
+
+void uring_RecycleBuf( uring_t *p_ring, unsigned i_bid )
+{
+    struct io_uring_buf *p_buf =
+        &p_ring->p_br->bufs[ p_ring->i_br_tail & p_ring->i_br_mask ];
+    p_buf->addr = (uint64_t)(uintptr_t)uring_GetBuf( p_ring, i_bid );
+    p_buf->len = p_ring->i_buf_size;
+    p_buf->bid = i_bid;
+    p_ring->i_br_tail++;
+    __atomic_store_n( &p_ring->p_br->tail, p_ring->i_br_tail,
+                      __ATOMIC_RELEASE );
+}
+
+void uring_PrepAcceptMultishot( struct io_uring_sqe *p_sqe, int i_fd,
+                                int i_flags, uint64_t i_data )
+{
+    p_sqe->opcode = IORING_OP_ACCEPT;
+    p_sqe->fd = i_fd;
+    p_sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    p_sqe->accept_flags = i_flags;
+    p_sqe->user_data = i_data;
+}
+
+void uring_PrepRecvMultishot( struct io_uring_sqe *p_sqe, int i_fd,
+                              uint16_t i_bgid, uint64_t i_data )
+{
+    p_sqe->opcode = IORING_OP_RECV;
+    p_sqe->fd = i_fd;
+    p_sqe->ioprio = IORING_RECV_MULTISHOT;
+    p_sqe->flags = IOSQE_BUFFER_SELECT;
+    p_sqe->buf_group = i_bgid;
+    p_sqe->user_data = i_data;
+}
+
+void uring_PrepRecvmsg( struct io_uring_sqe *p_sqe, int i_fd,
+                        struct msghdr *p_msg, int i_flags, uint64_t i_data )
+{
+    p_sqe->opcode = IORING_OP_RECVMSG;
+    p_sqe->fd = i_fd;
+    p_sqe->addr = (uint64_t)(uintptr_t)p_msg;
+    p_sqe->len = 1;
+    p_sqe->msg_flags = i_flags;
+    p_sqe->user_data = i_data;
+}
+
+void uring_PrepSendmsg( struct io_uring_sqe *p_sqe, int i_fd,
+                        const struct msghdr *p_msg, uint64_t i_data )
+{
+    p_sqe->opcode = IORING_OP_SENDMSG;
+    p_sqe->fd = i_fd;
+    p_sqe->addr = (uint64_t)(uintptr_t)p_msg;
+    p_sqe->len = 1;
+    p_sqe->msg_flags = MSG_NOSIGNAL;
+    p_sqe->user_data = i_data;
+}
+
+void uring_PrepSend( struct io_uring_sqe *p_sqe, int i_fd, const void *p_buf,
+                     size_t i_len, uint64_t i_data )
+{
+    p_sqe->opcode = IORING_OP_SEND;
+    p_sqe->fd = i_fd;
+    p_sqe->addr = (uint64_t)(uintptr_t)p_buf;
+    p_sqe->len = i_len;
+    p_sqe->msg_flags = MSG_NOSIGNAL;
+    p_sqe->user_data = i_data;
+}
+
+void uring_PrepCancel( struct io_uring_sqe *p_sqe, uint64_t i_target,
+                       uint64_t i_data )
+{
+    p_sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    p_sqe->fd = -1;
+    p_sqe->addr = i_target;
+    p_sqe->user_data = i_data;
+}
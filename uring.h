@@ -0,0 +1,92 @@
+// file : uring.h
+// date : 2026-10-19
+// desc : minimal io_uring wrapper on the raw syscalls (no liburing), with a
+//        provided buffer ring for multishot recv.
+//
+
+#ifndef JSONRPC_URING_H
+#define JSONRPC_URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+typedef struct uring_t uring_t;
+
+struct uring_t
+{
+    int       i_fd;
+    unsigned  i_features;
+
+    // submission queue, sqes are used in order so sq_array is the identity
+    unsigned *p_sq_head;
+    unsigned *p_sq_tail;
+    unsigned  i_sq_mask;
+    unsigned  i_sq_tail;                    // local tail, published on enter
+    struct io_uring_sqe *p_sqes;
+
+    // completion queue
+    unsigned *p_cq_head;
+    unsigned *p_cq_tail;
+    unsigned  i_cq_mask;
+    struct io_uring_cqe *p_cqes;
+
+    void     *p_sq_ring;
+    size_t    i_sq_ring_size;
+    void     *p_cq_ring;
+    size_t    i_cq_ring_size;
+    size_t    i_sqes_size;
+
+    // provided buffers of group i_bgid
+    struct io_uring_buf_ring *p_br;
+    size_t    i_br_size;
+    uint16_t  i_bgid;
+    uint16_t  i_br_tail;
+    unsigned  i_br_mask;
+    uint8_t  *p_bufs;
+    unsigned  i_buf_size;
+
+    uint64_t  i_enters;                     // io_uring_enter calls
+};
+
+// return 0 or -errno, i_flags are IORING_SETUP_* flags
+int  uring_Init( uring_t *p_ring, unsigned i_entries, unsigned i_flags );
+void uring_Clean( uring_t *p_ring );
+
+// next free sqe, submitting the pending ones when the queue is full
+struct io_uring_sqe *uring_GetSqe( uring_t *p_ring );
+// submit pending sqes and wait up to i_timeout_ms for at least one cqe,
+// return the number submitted or -errno (-ETIME on timeout, -EINTR)
+int  uring_SubmitAndWait( uring_t *p_ring, int i_timeout_ms );
+
+// NULL when the completion queue is empty, call uring_CqeSeen after use
+struct io_uring_cqe *uring_PeekCqe( uring_t *p_ring );
+void uring_CqeSeen( uring_t *p_ring );
+// the i-th cqe waiting in the queue, NULL past the last. It stays there.
+struct io_uring_cqe *uring_PeekCqeAt( uring_t *p_ring, unsigned i );
+
+// i_bufs (power of 2) buffers of i_size bytes
+int      uring_SetupBufRing( uring_t *p_ring, uint16_t i_bgid,
+                             unsigned i_bufs, unsigned i_size );
+uint8_t *uring_GetBuf( uring_t *p_ring, unsigned i_bid );
+// give a consumed buffer back to the kernel
+void     uring_RecycleBuf( uring_t *p_ring, unsigned i_bid );
+
+void uring_PrepAcceptMultishot( struct io_uring_sqe *p_sqe, int i_fd,
+                                int i_flags, uint64_t i_data );
+void uring_PrepRecvMultishot( struct io_uring_sqe *p_sqe, int i_fd,
+                              uint16_t i_bgid, uint64_t i_data );
+// cancel the request submitted with user_data i_target
+void uring_PrepCancel( struct io_uring_sqe *p_sqe, uint64_t i_target,
+                       uint64_t i_data );
+// single shot, p_msg stays valid until the cqe
+void uring_PrepRecvmsg( struct io_uring_sqe *p_sqe, int i_fd,
+                        struct msghdr *p_msg, int i_flags, uint64_t i_data );
+// same, p_msg stays valid until the cqe
+void uring_PrepSendmsg( struct io_uring_sqe *p_sqe, int i_fd,
+                        const struct msghdr *p_msg, uint64_t i_data );
+void uring_PrepSend( struct io_uring_sqe *p_sqe, int i_fd, const void *p_buf,
+                     size_t i_len, uint64_t i_data );
+
+#endif
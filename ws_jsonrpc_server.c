@@ -31,6 +31,8 @@ static bool ws_request_IsComplete( jsonrpc_server_t *p_server, block_t *p_req,
                                    size_t *pi_len );
 static int ws_handle_request( jsonrpc_server_t *p_server, block_t *p_req,
                               block_t *p_res );
+static block_t *ws_request_Text( jsonrpc_server_t *p_server,
+                                 const block_t *p_req );
 static int ws_handle_handshake( jsonrpc_server_t *p_server,
                                 jsonrpc_request_t *p_request );
 static int ws_jsonrpc_server_exit( jsonrpc_server_t *p_server );
@@ -45,6 +47,7 @@ int ws_jsonrpc_server_init( ws_jsonrpc_server_t *p_server )
 
     p_this->pf_request_IsComplete = ws_request_IsComplete;
     p_this->pf_handle_request = ws_handle_request;
+    p_this->pf_request_Text = ws_request_Text;
     p_this->pf_handle_handshake = ws_handle_handshake;
     p_this->pf_notify_dispatch  = ws_notify_dispatch;
     p_this->pf_exit = ws_jsonrpc_server_exit;
@@ -110,6 +113,7 @@ static bool ws_request_IsComplete( jsonrpc_server_t *p_server, block_t *p_req,
     if ( p_req->i_buffer >= MAX_REQUEST_LEN )
     {
         log_Err( "ws request is big than %d", MAX_REQUEST_LEN );
+        *pi_len = JSONRPC_OVERSIZE;
         return true;
     }
 
@@ -143,6 +147,13 @@ static bool ws_request_IsComplete( jsonrpc_server_t *p_server, block_t *p_req,
                     return false;
                 if ( get_ws_payload_len( p_ptr, i_ptr, &i_payload ) < 0 )
                     return false;
+                // known from the header, before the payload is buffered
+                if ( p_req->i_buffer - i_ptr + i_payload >
+                     p_server->i_max_request )
+                {
+                    *pi_len = JSONRPC_OVERSIZE;
+                    return true;
+                }
                 if ( i_header + 4 + i_payload > i_ptr )
                     return false;
                 p_ptr += i_header + 4 + i_payload;
@@ -159,6 +170,11 @@ static bool ws_request_IsComplete( jsonrpc_server_t *p_server, block_t *p_req,
                 return false;
             if ( get_ws_payload_len( p_ptr, i_ptr, &i_payload ) < 0 )
                 return false;
+            if ( i_payload > p_server->i_max_request )
+            {
+                *pi_len = JSONRPC_OVERSIZE;
+                return true;
+            }
             if ( i_header + 4 + i_payload > i_ptr )
                 return false;
             *pi_len = i_header + 4 + i_payload;
@@ -536,10 +552,9 @@ static void close_ws_conn( block_t *p_res )
     log_Dbg( "close ws connection on normal, send return close msg" );
 }
 
-static int handle_ws_payload( jsonrpc_server_t *p_this, block_t *p_req,
-                              block_t *p_res )
+// the unmasked payload of a single fin frame, '\0' terminated
+static block_t *unmask_payload( const block_t *p_req )
 {
-    ws_jsonrpc_server_t *p_server = (ws_jsonrpc_server_t *)p_this;
     uint64_t i_payload;
     int i_header = get_ws_header_len( p_req->p_buffer, p_req->i_buffer );
     int i_ret = get_ws_payload_len( p_req->p_buffer, p_req->i_buffer,
@@ -549,18 +564,44 @@ static int handle_ws_payload( jsonrpc_server_t *p_this, block_t *p_req,
 
     uint8_t p_mark_key[4];
     for ( int i = 0; i < 4; i++ )
-        p_mark_key[i] = p_req->p_buffer[ 2 + i ];
+        p_mark_key[i] = p_req->p_buffer[ i_header + i ];
 
-    block_t *p_json_req = block_Alloc( i_payload );
+    block_t *p_json_req = block_Alloc( i_payload + 1 );
     if ( !p_json_req )
     {
         log_Err( "no memory" );
-        return JSONRPC_ERR_NOMEM;
+        return NULL;
     }
-    uint8_t *p_payload = p_req->p_buffer + i_header + 4;
+    const uint8_t *p_payload = p_req->p_buffer + i_header + 4;
     for ( int i = 0; i < i_payload; i++ )
         p_json_req->p_buffer[i] = p_payload[i] ^ p_mark_key[ i % 4 ];
+    p_json_req->p_buffer[i_payload] = '\0';
     p_json_req->i_buffer = i_payload;
+    return p_json_req;
+}
+
+// the json text of a complete text message, for the cancellations looked
+// for ahead (jsonrpc_request_IsCancelled)
+static block_t *ws_request_Text( jsonrpc_server_t *p_server,
+                                 const block_t *p_req )
+{
+    if ( p_req->i_buffer < 2 || !( p_req->p_buffer[1] & 0x80 ) )
+        return NULL;
+    if ( !( p_req->p_buffer[0] & 0x80 ) )
+        return concatenate_fragments( (block_t*)p_req, NULL );
+    if ( ( p_req->p_buffer[0] & 0x0f ) != 0x1 )
+        return NULL;
+    return unmask_payload( p_req );
+}
+
+static int handle_ws_payload( jsonrpc_server_t *p_this, block_t *p_req,
+                              block_t *p_res )
+{
+    ws_jsonrpc_server_t *p_server = (ws_jsonrpc_server_t *)p_this;
+    // the base handler parses a '\0' terminated string
+    block_t *p_json_req = unmask_payload( p_req );
+    if ( !p_json_req )
+        return JSONRPC_ERR_NOMEM;
 
     // call base handle_request
     int ret = p_server->base.pf_handle_request( p_this, p_json_req, p_res );
@@ -590,16 +631,17 @@ static block_t *concatenate_fragments( block_t *p_req, block_t *p_res )
     while ( !(p_ptr[0] & 0x80) && i_ptr > 0 )
     {
         // fragments
+        // p_res is NULL when only looking at the text
         if ( i_opcode == -1 )
         {
             i_opcode = p_ptr[0] & 0x0f;
-            if ( i_opcode == 0x0 )
+            if ( i_opcode == 0x0 && p_res )
                 fail_ws_conn( p_res, WS_UNCONSISTANT_DATATYPE,
                               "first fragment opcode is 0x0" );
         }
         else
         {
-            if ( (p_ptr[0] & 0x0f) != 0x0 )
+            if ( (p_ptr[0] & 0x0f) != 0x0 && p_res )
                 fail_ws_conn( p_res, WS_UNCONSISTANT_DATATYPE,
                               "following fragment opcode is not 0x0" );
         }
@@ -618,12 +660,17 @@ static block_t *concatenate_fragments( block_t *p_req, block_t *p_res )
         p_ptr += i_header + 4 + i_payload;
         i_ptr -= i_header + 4 + i_payload;
     }
+    // the masks left room for it
+    p_block->p_buffer[ p_block->i_buffer ] = '\0';
 
     return p_block;
 }
 
 static void add_ws_response_header( block_t *p_res )
 {
+    // nothing to answer (cancel notification)
+    if ( p_res->i_buffer == 0 )
+        return;
     int i_header;
     if ( p_res->i_buffer <= 125 )
         i_header = 2;